@@ -0,0 +1,270 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "AsyncWriter.hxx"
+#include "Log.hxx"
+
+#include <cassert>
+#include <set>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+AsyncWriter::AsyncWriter(EventLoop &event_loop)
+	:inject_event(event_loop, BIND_THIS_METHOD(OnInject)),
+	 thread(&AsyncWriter::Run, this)
+{
+}
+
+AsyncWriter::~AsyncWriter() noexcept
+{
+	{
+		const std::scoped_lock lock{mutex};
+		quit = true;
+	}
+
+	cond.notify_one();
+	thread.join();
+}
+
+void
+AsyncWriter::Push(const void *owner, Work work,
+		  Completion completion) noexcept
+{
+	/* allocate the list node before locking the mutex */
+	JobList tmp;
+	tmp.emplace_back(owner, std::move(work), std::move(completion));
+
+	{
+		const std::scoped_lock lock{mutex};
+		pending.splice(pending.end(), tmp);
+	}
+
+	cond.notify_one();
+}
+
+void
+AsyncWriter::Cancel(const void *owner) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	/* the writer thread doesn't touch the "completion"
+	   attribute, so it's safe to clear it even while the job
+	   is running */
+	for (auto *list : {&pending, &running, &finished})
+		for (auto &job : *list)
+			if (job.owner == owner)
+				job.completion = {};
+}
+
+void
+AsyncWriter::Flush() noexcept
+{
+	std::unique_lock lock{mutex};
+	idle_cond.wait(lock, [this]{
+		return pending.empty() && running.empty();
+	});
+}
+
+#ifndef _WIN32
+
+/**
+ * Wait until the given file (or directory) has been written to the
+ * disk.
+ */
+static bool
+SyncPath(const char *path) noexcept
+{
+	const int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	const bool success = fsync(fd) == 0;
+	close(fd);
+	return success;
+}
+
+#endif
+
+[[gnu::pure]]
+static std::string_view
+GetParentDirectory(std::string_view path) noexcept
+{
+	const auto slash = path.rfind('/');
+	if (slash == path.npos)
+		return ".";
+
+	if (slash == 0)
+		return "/";
+
+	return path.substr(0, slash);
+}
+
+void
+AsyncWriter::CommitFile(std::string_view tmp_path, std::string_view path,
+			CommitCallback callback) noexcept
+{
+	assert(current != nullptr);
+
+	auto i = commits.find(path);
+	if (i == commits.end()) {
+		i = commits.emplace(std::string{path},
+				    PendingCommit{}).first;
+		i->second.tmp_path = tmp_path;
+	}
+
+	i->second.waiters.emplace_back(current, std::move(callback));
+}
+
+void
+AsyncWriter::CommitFiles() noexcept
+{
+	if (commits.empty())
+		return;
+
+#ifndef _WIN32
+	/* sync all files before renaming the first one, so the
+	   disk is waited for once instead of once per file */
+	for (auto &[path, commit] : commits) {
+		if (!SyncPath(commit.tmp_path.c_str())) {
+			FormatError("Failed to sync %s: %s",
+				    commit.tmp_path.c_str(), strerror(errno));
+			commit.success = false;
+		}
+	}
+#endif
+
+	std::set<std::string_view> directories;
+
+	for (auto &[path, commit] : commits) {
+		if (commit.success &&
+		    rename(commit.tmp_path.c_str(), path.c_str()) != 0) {
+			FormatError("Failed to save %s: %s",
+				    path.c_str(), strerror(errno));
+			commit.success = false;
+		}
+
+		if (commit.success)
+			directories.emplace(GetParentDirectory(path));
+		else
+			remove(commit.tmp_path.c_str());
+	}
+
+#ifndef _WIN32
+	/* make the renames durable */
+	for (const auto directory : directories) {
+		const std::string d{directory};
+		if (!SyncPath(d.c_str()))
+			FormatError("Failed to sync %s: %s",
+				    d.c_str(), strerror(errno));
+	}
+#endif
+
+	for (auto &[path, commit] : commits) {
+		for (auto &[job, callback] : commit.waiters) {
+			if (!commit.success)
+				job->success = false;
+
+			if (callback)
+				callback(commit.success);
+		}
+	}
+
+	commits.clear();
+}
+
+void
+AsyncWriter::Run() noexcept
+{
+#ifndef _WIN32
+	/* signals are handled by the SignalMonitor in the
+	   EventLoop thread */
+	sigset_t mask;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+#endif
+
+	std::unique_lock lock{mutex};
+
+	while (true) {
+		if (pending.empty()) {
+			if (quit)
+				break;
+
+			cond.wait(lock);
+			continue;
+		}
+
+		/* take all pending jobs at once, and hand back their
+		   completions with one wakeup */
+		running.splice(running.end(), pending);
+
+		lock.unlock();
+
+		/* Push() only modifies #pending, and Cancel() only
+		   modifies the completions, so #running can be
+		   walked without holding the mutex */
+		for (auto &job : running) {
+			current = &job;
+			job.success = job.work();
+		}
+
+		current = nullptr;
+		CommitFiles();
+
+		lock.lock();
+
+		finished.splice(finished.end(), running);
+		inject_event.Schedule();
+		idle_cond.notify_all();
+	}
+}
+
+void
+AsyncWriter::OnInject() noexcept
+{
+	while (true) {
+		/* move one job at a time out of the list, so a
+		   completion may call Cancel() for the following
+		   ones */
+		JobList job;
+
+		{
+			const std::scoped_lock lock{mutex};
+			if (finished.empty())
+				break;
+
+			job.splice(job.end(), finished, finished.begin());
+		}
+
+		if (job.front().completion)
+			job.front().completion(job.front().success);
+
+		/* the job (and whatever its closures own) is
+		   destroyed here, in the EventLoop thread */
+	}
+}
@@ -0,0 +1,195 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef ASYNC_WRITER_HXX
+#define ASYNC_WRITER_HXX
+
+#include "event/InjectEvent.hxx"
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Performs blocking file I/O (journal snapshots, appending to the
+ * journal and to log files) in a dedicated thread, so the
+ * #EventLoop never waits for the disk.
+ *
+ * Jobs are executed in the order they were pushed.  Their
+ * completion callbacks are invoked in the #EventLoop thread.
+ *
+ * All jobs which are pending when the thread wakes up are executed
+ * as one batch; files which were registered with CommitFile() are
+ * synced and renamed together at the end of the batch.
+ */
+class AsyncWriter final {
+public:
+	/**
+	 * The I/O operation; it runs in the writer thread and must
+	 * not access objects which are owned by the #EventLoop
+	 * thread.  Returns true on success.
+	 */
+	using Work = std::function<bool()>;
+
+	using Completion = std::function<void(bool success)>;
+
+	/**
+	 * Invoked in the writer thread after CommitFile() has
+	 * finished (or failed).
+	 */
+	using CommitCallback = std::function<void(bool success)>;
+
+private:
+	struct Job {
+		/**
+		 * An opaque pointer which allows Cancel() to find
+		 * the completions of an object which is about to be
+		 * destroyed.
+		 */
+		const void *owner;
+
+		Work work;
+		Completion completion;
+
+		bool success = false;
+
+		Job(const void *_owner, Work &&_work,
+		    Completion &&_completion) noexcept
+			:owner(_owner), work(std::move(_work)),
+			 completion(std::move(_completion)) {}
+	};
+
+	using JobList = std::list<Job>;
+
+	struct PendingCommit {
+		std::string tmp_path;
+
+		/**
+		 * The jobs which have written this file in the
+		 * current batch (a later one overwrote the temporary
+		 * file of the earlier ones).
+		 */
+		std::vector<std::pair<Job *, CommitCallback>> waiters;
+
+		bool success = true;
+	};
+
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	/**
+	 * Signalled by the writer thread each time it has finished
+	 * the #running jobs; see Flush().
+	 */
+	std::condition_variable idle_cond;
+
+	/**
+	 * Protected by #mutex.
+	 */
+	JobList pending, running, finished;
+
+	/**
+	 * Protected by #mutex.
+	 */
+	bool quit = false;
+
+	/**
+	 * The files registered by CommitFile(), keyed by their final
+	 * path.  Only accessed by the writer thread.
+	 */
+	std::map<std::string, PendingCommit, std::less<>> commits;
+
+	/**
+	 * The job whose #Work function is running.  Only accessed by
+	 * the writer thread.
+	 */
+	Job *current = nullptr;
+
+	InjectEvent inject_event;
+
+	std::thread thread;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	explicit AsyncWriter(EventLoop &event_loop);
+
+	/**
+	 * Executes all pending jobs and then stops the thread.
+	 * Completions which have not been invoked yet are discarded.
+	 */
+	~AsyncWriter() noexcept;
+
+	AsyncWriter(const AsyncWriter &) = delete;
+	AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+	void Push(const void *owner, Work work,
+		  Completion completion={}) noexcept;
+
+	/**
+	 * Discard the completions of all jobs pushed with the given
+	 * owner.  The jobs themselves are still executed.
+	 */
+	void Cancel(const void *owner) noexcept;
+
+	/**
+	 * Wait until all jobs pushed so far have been executed.
+	 * This blocks the calling thread; it is meant for rare
+	 * occasions where a file which has just been written is
+	 * going to be read.  The completions are invoked later, as
+	 * usual.
+	 */
+	void Flush() noexcept;
+
+	/**
+	 * May only be called by a #Work function: at the end of the
+	 * current batch, sync the file at @tmp_path and rename it to
+	 * @path.  The files of all jobs in the batch are synced
+	 * before the first one is renamed, and each directory is
+	 * synced only once, so saving many small files costs one
+	 * wait for the disk instead of one per file.
+	 *
+	 * If this fails, the job is reported as failed, even if its
+	 * #Work function has returned true.
+	 *
+	 * @param callback invoked in the writer thread after the
+	 * rename (or failure)
+	 */
+	void CommitFile(std::string_view tmp_path, std::string_view path,
+			CommitCallback callback={}) noexcept;
+
+private:
+	void Run() noexcept;
+
+	/**
+	 * Perform the renames registered by CommitFile().
+	 */
+	void CommitFiles() noexcept;
+
+	void OnInject() noexcept;
+};
+
+#endif
@@ -0,0 +1,251 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "AudioScrobblerBackend.hxx"
+#include "ScrobblerConfig.hxx"
+#include "SessionCache.hxx"
+#include "Protocol.hxx"
+#include "Record.hxx"
+#include "Form.hxx"
+#include "Log.hxx"
+#include "util/SpanCast.hxx"
+
+
+/**
+ * The status keywords which may appear in the first line of a
+ * server response.
+ */
+enum class ResponseKeyword {
+	OK,
+	BADSESSION,
+	FAILED,
+	BANNED,
+	BADAUTH,
+	BADTIME,
+	UNKNOWN,
+};
+
+static constexpr struct {
+	std::string_view name;
+	ResponseKeyword keyword;
+} response_keywords[] = {
+	{ "OK", ResponseKeyword::OK },
+	{ "BADSESSION", ResponseKeyword::BADSESSION },
+	{ "FAILED", ResponseKeyword::FAILED },
+	{ "BANNED", ResponseKeyword::BANNED },
+	{ "BADAUTH", ResponseKeyword::BADAUTH },
+	{ "BADTIME", ResponseKeyword::BADTIME },
+};
+
+/**
+ * Parse the keyword at the beginning of a response line.
+ *
+ * @param rest_r on return, the rest of the line after the keyword
+ * (e.g. the reason for "FAILED"), with leading whitespace removed
+ */
+static constexpr ResponseKeyword
+ParseResponseKeyword(std::string_view line, std::string_view &rest_r) noexcept
+{
+	for (const auto &i : response_keywords) {
+		if (!line.starts_with(i.name))
+			continue;
+
+		auto rest = line.substr(i.name.size());
+		if (!rest.empty() && rest.front() != ' ')
+			/* a longer word which happens to begin with
+			   this keyword */
+			continue;
+
+		while (!rest.empty() && rest.front() == ' ')
+			rest.remove_prefix(1);
+
+		rest_r = rest;
+		return i.keyword;
+	}
+
+	rest_r = line;
+	return ResponseKeyword::UNKNOWN;
+}
+
+/**
+ * Return the first line of the given response body.
+ */
+static constexpr std::string_view
+FirstLine(std::string_view body) noexcept
+{
+	return body.substr(0, body.find('\n'));
+}
+
+std::string
+AudioScrobblerBackend::MakeHandshakeURL() const
+{
+	const auto timestr = as_timestamp();
+	const auto md5 = as_md5(config.password, timestr);
+
+	/* construct the handshake url. */
+	FormDataBuilder url(config.url);
+	url.Append("hs", "true");
+	url.Append("p", "1.2");
+	url.Append("c", AS_CLIENT_ID);
+	url.Append("v", AS_CLIENT_VERSION);
+	url.Append("u", config.username);
+	url.Append("t", timestr);
+	url.Append("a", ToStringView(md5));
+
+	return url;
+}
+
+/**
+ * Parse the first line of the handshake response.
+ */
+static bool
+ParseHandshakeStatus(const char *name, std::string_view line) noexcept
+{
+	const int length = line.size();
+	const char *const data = line.data();
+
+	std::string_view rest;
+
+	switch (ParseResponseKeyword(line, rest)) {
+	case ResponseKeyword::OK:
+		FormatInfo("[%s] handshake successful", name);
+		return true;
+
+	case ResponseKeyword::BANNED:
+		FormatError("[%s] handshake failed, we're banned (%.*s)",
+			    name, length, data);
+		break;
+
+	case ResponseKeyword::BADAUTH:
+		FormatError("[%s] handshake failed, "
+			    "username or password incorrect (%.*s)",
+			    name, length, data);
+		break;
+
+	case ResponseKeyword::BADTIME:
+		FormatError("[%s] handshake failed, clock not synchronized (%.*s)",
+			    name, length, data);
+		break;
+
+	case ResponseKeyword::FAILED:
+		FormatError("[%s] handshake failed (%.*s)",
+			    name, length, data);
+		break;
+
+	default:
+		FormatError("[%s] error parsing handshake response (%.*s)",
+			    name, length, data);
+		break;
+	}
+
+	return false;
+}
+
+bool
+AudioScrobblerBackend::ParseHandshakeResponse(std::string_view body,
+					      ScrobblerSession &session) const noexcept
+{
+	const char *const name = config.name.c_str();
+
+	if (!ParseHandshakeStatus(name, next_line(body)))
+		return false;
+
+	session.id = next_line(body);
+	FormatDebug("[%s] session: %s", name, session.id.c_str());
+
+	session.nowplay_url = next_line(body);
+	FormatDebug("[%s] now playing url: %s",
+		    name, session.nowplay_url.c_str());
+
+	session.submit_url = next_line(body);
+	FormatDebug("[%s] submit url: %s",
+		    name, session.submit_url.c_str());
+
+	if (!session.IsDefined()) {
+		session.Clear();
+		return false;
+	}
+
+	return true;
+}
+
+std::string
+AudioScrobblerBackend::MakeNowPlaying(const ScrobblerSession &session,
+				      const Record &song) const
+{
+	FormDataBuilder post_data;
+	post_data.Append("s", session.id);
+	post_data.Append("a", song.artist);
+	post_data.Append("t", song.track);
+	post_data.Append("b", song.album);
+	post_data.Append("l",
+			 std::chrono::duration_cast<std::chrono::seconds>(song.length).count());
+	post_data.Append("n", song.number);
+	post_data.Append("m", song.mbid.Format().c_str());
+	return post_data;
+}
+
+std::string
+AudioScrobblerBackend::MakeSubmit(const ScrobblerSession &session,
+				  const RecordQueue &queue,
+				  std::size_t offset, std::size_t count) const
+{
+	FormDataBuilder post_data;
+	post_data.Reserve(EstimateSubmitSize(queue, offset, count) +
+			  session.id.size());
+	post_data.Append("s", session.id);
+	AppendSubmitRecords(post_data, queue, offset, count);
+	return post_data;
+}
+
+SubmitResponseType
+AudioScrobblerBackend::ParseResponse(std::string_view body) const noexcept
+{
+	const char *const scrobbler_name = config.name.c_str();
+	const auto line = FirstLine(body);
+	std::string_view rest;
+
+	switch (ParseResponseKeyword(line, rest)) {
+	case ResponseKeyword::OK:
+		FormatInfo("[%s] OK", scrobbler_name);
+		return SubmitResponseType::OK;
+
+	case ResponseKeyword::BADSESSION:
+		FormatWarning("[%s] invalid session", scrobbler_name);
+		return SubmitResponseType::HANDSHAKE;
+
+	case ResponseKeyword::FAILED:
+		if (!rest.empty())
+			FormatError("[%s] submission rejected: %.*s",
+				    scrobbler_name,
+				    (int)rest.size(), rest.data());
+		else
+			FormatError("[%s] submission rejected",
+				    scrobbler_name);
+		break;
+
+	default:
+		FormatError("[%s] unknown response: %.*s",
+			    scrobbler_name, (int)line.size(), line.data());
+		break;
+	}
+
+	return SubmitResponseType::FAILED;
+}
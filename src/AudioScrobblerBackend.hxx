@@ -0,0 +1,55 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef AUDIO_SCROBBLER_BACKEND_HXX
+#define AUDIO_SCROBBLER_BACKEND_HXX
+
+#include "ScrobblerBackend.hxx"
+
+/**
+ * The AudioScrobbler 1.2 protocol: the handshake returns a session
+ * id and the URLs for submissions and "now playing" notifications,
+ * which are sent as form posts.
+ */
+class AudioScrobblerBackend final : public ScrobblerBackend {
+	const ScrobblerConfig &config;
+
+public:
+	explicit AudioScrobblerBackend(const ScrobblerConfig &_config) noexcept
+		:config(_config) {}
+
+	/* virtual methods from class ScrobblerBackend */
+	bool HasHandshake() const noexcept override {
+		return true;
+	}
+
+	std::string MakeHandshakeURL() const override;
+	bool ParseHandshakeResponse(std::string_view body,
+				    ScrobblerSession &session) const noexcept override;
+	std::string MakeNowPlaying(const ScrobblerSession &session,
+				   const Record &song) const override;
+	std::string MakeSubmit(const ScrobblerSession &session,
+			       const RecordQueue &queue,
+			       std::size_t offset,
+			       std::size_t count) const override;
+	SubmitResponseType ParseResponse(std::string_view body) const noexcept override;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BATCH_SIZER_HXX
+#define BATCH_SIZER_HXX
+
+#include "event/Chrono.hxx"
+
+#include <algorithm>
+
+/**
+ * Determines how many songs are submitted in one request.  The
+ * batch size doubles after each full batch which was accepted
+ * quickly, and is halved after each failure.
+ */
+class BatchSizer {
+	/**
+	 * The batch size used before the first response.
+	 */
+	static constexpr unsigned INITIAL_SIZE = 10;
+
+	/**
+	 * A response which arrives within this duration counts as
+	 * "fast", i.e. the server can handle larger batches.
+	 */
+	static constexpr Event::Duration FAST_RESPONSE = std::chrono::seconds{2};
+
+	const unsigned maximum;
+
+	unsigned size;
+
+	/**
+	 * Has the batch size stopped changing?
+	 */
+	bool settled = false;
+
+public:
+	explicit constexpr BatchSizer(unsigned _maximum) noexcept
+		:maximum(_maximum),
+		 size(std::min(INITIAL_SIZE, maximum)) {}
+
+	constexpr unsigned Get() const noexcept {
+		return size;
+	}
+
+	/**
+	 * A batch was accepted by the server.
+	 *
+	 * @param count the number of songs in the batch
+	 * @param duration the time between sending the request and
+	 * receiving the response
+	 * @return true if the batch size has just settled, i.e. it
+	 * was not changed after a change
+	 */
+	constexpr bool OnSuccess(unsigned count,
+				 Event::Duration duration) noexcept {
+		if (count < size)
+			/* the queue was not long enough to fill the
+			   batch; this doesn't tell us anything */
+			return false;
+
+		if (duration < FAST_RESPONSE && size < maximum) {
+			size = std::min(size * 2, maximum);
+			settled = false;
+			return false;
+		}
+
+		if (settled)
+			return false;
+
+		settled = true;
+		return true;
+	}
+
+	/**
+	 * The server has rejected a batch or the request has failed.
+	 *
+	 * @return true if the batch size was modified
+	 */
+	constexpr bool OnFailure() noexcept {
+		if (size <= 1)
+			return false;
+
+		size /= 2;
+		settled = false;
+		return true;
+	}
+};
+
+#endif
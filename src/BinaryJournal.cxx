@@ -0,0 +1,223 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2019 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "BinaryJournal.hxx"
+#include "Record.hxx"
+#include "Timestamp.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+
+#include <string.h>
+
+static constexpr char BINARY_JOURNAL_MAGIC[8] = {
+	'M', 'P', 'D', 'S', 'J', 'N', 'L', 0,
+};
+
+static constexpr unsigned BINARY_JOURNAL_VERSION = 1;
+
+static constexpr std::byte ENTRY_RECORD{'R'};
+static constexpr std::byte ENTRY_ACK{'A'};
+
+static constexpr unsigned FLAG_LOVE = 0x1;
+static constexpr unsigned FLAG_RADIO = 0x2;
+
+bool
+binary_journal_check_magic(std::span<const std::byte> data) noexcept
+{
+	return data.size() >= sizeof(BINARY_JOURNAL_MAGIC) &&
+		memcmp(data.data(), BINARY_JOURNAL_MAGIC,
+		       sizeof(BINARY_JOURNAL_MAGIC)) == 0;
+}
+
+static void
+AppendU8(std::string &dest, unsigned value) noexcept
+{
+	dest.push_back(char(value));
+}
+
+static void
+AppendU16(std::string &dest, unsigned value) noexcept
+{
+	dest.push_back(char(value));
+	dest.push_back(char(value >> 8));
+}
+
+static void
+AppendU32(std::string &dest, uint_least32_t value) noexcept
+{
+	dest.push_back(char(value));
+	dest.push_back(char(value >> 8));
+	dest.push_back(char(value >> 16));
+	dest.push_back(char(value >> 24));
+}
+
+static void
+AppendString(std::string &dest, std::string_view value) noexcept
+{
+	/* longer strings are truncated; no real tag is that long */
+	value = value.substr(0, 0xffff);
+
+	AppendU16(dest, value.size());
+	dest.append(value);
+}
+
+void
+binary_journal_write_header(FILE *file, unsigned n_records) noexcept
+{
+	std::string buffer(BINARY_JOURNAL_MAGIC, sizeof(BINARY_JOURNAL_MAGIC));
+	AppendU32(buffer, BINARY_JOURNAL_VERSION);
+	AppendU32(buffer, n_records);
+	fwrite(buffer.data(), 1, buffer.size(), file);
+}
+
+void
+binary_journal_write_record(FILE *file, const Record &record) noexcept
+{
+	unsigned flags = 0;
+	if (record.love)
+		flags |= FLAG_LOVE;
+	if (record.source[0] == 'R')
+		flags |= FLAG_RADIO;
+
+	const auto length_s =
+		std::chrono::duration_cast<std::chrono::seconds>(record.length);
+
+	std::string buffer;
+	buffer.reserve(48 + record.artist.size() + record.track.size() +
+		       record.album.size() + record.number.size() +
+		       record.mbid.size());
+	buffer.push_back(char(ENTRY_RECORD));
+	AppendU8(buffer, flags);
+	AppendU32(buffer, std::max<long>(length_s.count(), 0));
+	AppendString(buffer, record.artist);
+	AppendString(buffer, record.track);
+	AppendString(buffer, record.album);
+	AppendString(buffer, record.number);
+	AppendString(buffer, record.mbid.Format().c_str());
+	AppendString(buffer, record.time != 0
+		     ? record.FormatTime().c_str()
+		     : "");
+
+	fwrite(buffer.data(), 1, buffer.size(), file);
+}
+
+void
+binary_journal_write_ack(FILE *file, unsigned n_acked) noexcept
+{
+	std::string buffer;
+	buffer.push_back(char(ENTRY_ACK));
+	AppendU32(buffer, n_acked);
+	fwrite(buffer.data(), 1, buffer.size(), file);
+}
+
+BinaryJournalReader::BinaryJournalReader(std::span<const std::byte> data)
+	:begin(data.data()), p(begin), end(data.data() + data.size())
+{
+	if (!binary_journal_check_magic(data))
+		throw std::runtime_error("Not a binary journal");
+
+	Read(sizeof(BINARY_JOURNAL_MAGIC));
+
+	const unsigned version = ReadU32();
+	if (version != BINARY_JOURNAL_VERSION)
+		throw FormatRuntimeError("Unsupported journal version %u",
+					 version);
+
+	n_records = ReadU32();
+}
+
+void
+BinaryJournalReader::Seek(std::size_t position)
+{
+	if (position < BINARY_JOURNAL_HEADER_SIZE ||
+	    position > std::size_t(end - begin))
+		throw std::runtime_error("Journal offset out of range");
+
+	p = begin + position;
+}
+
+inline const std::byte *
+BinaryJournalReader::Read(std::size_t size)
+{
+	if (std::size_t(end - p) < size)
+		throw std::runtime_error("Truncated journal");
+
+	const auto *result = p;
+	p += size;
+	return result;
+}
+
+inline unsigned
+BinaryJournalReader::ReadU8()
+{
+	return unsigned(*Read(1));
+}
+
+inline unsigned
+BinaryJournalReader::ReadU16()
+{
+	const auto *s = Read(2);
+	return unsigned(s[0]) | (unsigned(s[1]) << 8);
+}
+
+inline unsigned
+BinaryJournalReader::ReadU32()
+{
+	const auto *s = Read(4);
+	return uint_least32_t(s[0]) | (uint_least32_t(s[1]) << 8) |
+		(uint_least32_t(s[2]) << 16) | (uint_least32_t(s[3]) << 24);
+}
+
+inline std::string_view
+BinaryJournalReader::ReadString()
+{
+	const std::size_t length = ReadU16();
+	const auto *s = Read(length);
+	return {(const char *)s, length};
+}
+
+BinaryJournalReader::EntryType
+BinaryJournalReader::Next(Record &record, unsigned &n_acked)
+{
+	if (p == end)
+		return EntryType::END;
+
+	const std::byte type = *Read(1);
+	if (type == ENTRY_RECORD) {
+		const unsigned flags = ReadU8();
+		record.love = (flags & FLAG_LOVE) != 0;
+		record.source = (flags & FLAG_RADIO) != 0 ? "R" : "P";
+		record.length = std::chrono::seconds(ReadU32());
+		record.artist = ReadString();
+		record.track = ReadString();
+		record.album = ReadString();
+		record.number = TrackNumber{ReadString()};
+		record.mbid = Mbid{ReadString()};
+		record.time = ParseTimestamp(ReadString());
+		return EntryType::RECORD;
+	} else if (type == ENTRY_ACK) {
+		n_acked = ReadU32();
+		return EntryType::ACK;
+	} else
+		throw FormatRuntimeError("Unknown journal entry type 0x%02x",
+					 unsigned(type));
+}
@@ -0,0 +1,131 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2019 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BINARY_JOURNAL_HXX
+#define BINARY_JOURNAL_HXX
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <stdio.h>
+
+struct Record;
+
+/*
+ * The binary journal format (all integers are little-endian):
+ *
+ * - header: 8 bytes magic "MPDSJNL\0", uint32 version, uint32
+ *   number of records in the snapshot
+ *
+ * - a sequence of entries, each starting with a one-byte type
+ *
+ *   - 'R' (record): uint8 flags (1=love, 2=radio), uint32 length in
+ *     seconds, followed by artist, track, album, number, mbid and
+ *     time, each as uint16 length plus the raw bytes
+ *
+ *   - 'A' (acknowledgement): uint32 number of records at the
+ *     beginning of the file which have been submitted
+ *
+ * In "append" mode, more entries are added after the snapshot, so
+ * the header's record count is only a hint.
+ */
+
+/**
+ * The size of the header in bytes.
+ */
+static constexpr std::size_t BINARY_JOURNAL_HEADER_SIZE = 16;
+
+/**
+ * Does the given buffer (the beginning of a file) look like a binary
+ * journal?
+ */
+[[gnu::pure]]
+bool
+binary_journal_check_magic(std::span<const std::byte> data) noexcept;
+
+void
+binary_journal_write_header(FILE *file, unsigned n_records) noexcept;
+
+void
+binary_journal_write_record(FILE *file, const Record &record) noexcept;
+
+void
+binary_journal_write_ack(FILE *file, unsigned n_acked) noexcept;
+
+/**
+ * Parser for a (memory-mapped) binary journal.
+ */
+class BinaryJournalReader {
+	const std::byte *const begin, *p, *const end;
+
+	unsigned n_records;
+
+public:
+	/**
+	 * Throws on error (unsupported version, malformed header).
+	 */
+	explicit BinaryJournalReader(std::span<const std::byte> data);
+
+	/**
+	 * The number of records according to the header.
+	 */
+	unsigned GetRecordCount() const noexcept {
+		return n_records;
+	}
+
+	/**
+	 * The offset of the next entry from the beginning of the
+	 * file.
+	 */
+	std::size_t GetPosition() const noexcept {
+		return p - begin;
+	}
+
+	/**
+	 * Continue parsing at the given offset, which was obtained
+	 * by GetPosition().  Throws if it is out of range.
+	 */
+	void Seek(std::size_t position);
+
+	enum class EntryType {
+		END,
+		RECORD,
+		ACK,
+	};
+
+	/**
+	 * Parse the next entry.  Throws on error (malformed or
+	 * truncated entry).
+	 *
+	 * @param record the destination for #EntryType::RECORD
+	 * @param n_acked the destination for #EntryType::ACK
+	 */
+	EntryType Next(Record &record, unsigned &n_acked);
+
+private:
+	const std::byte *Read(std::size_t size);
+	unsigned ReadU8();
+	unsigned ReadU16();
+	unsigned ReadU32();
+	std::string_view ReadString();
+};
+
+#endif
@@ -25,6 +25,7 @@
 #include "Config.hxx"
 #include "config.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -66,6 +67,11 @@ enum Option {
 	OPTION_HOST,
 	OPTION_PORT,
 	OPTION_PROXY,
+	OPTION_IMPORT,
+	OPTION_IMPORT_OUTPUT,
+	OPTION_SIMULATE,
+	OPTION_SIMULATE_RATE,
+	OPTION_SIMULATE_DURATION,
 	OPTION_HELP,
 };
 
@@ -80,6 +86,11 @@ static constexpr OptionDef option_defs[] = {
 	{"host", 0, true, "MPD host name to connect to, or Unix domain socket path"},
 	{"port", 0, true, "MPD port to connect to"},
 	{"proxy", 0, true, "HTTP proxy URI"},
+	{"import", 0, true, "submit a listening history file and exit"},
+	{"import-output", 0, true, "merge the imported history into this journal instead"},
+	{"simulate", 0, true, "play songs on this number of synthetic tenants and report the throughput"},
+	{"simulate-rate", 0, true, "songs per second over all simulated tenants (default 10)"},
+	{"simulate-duration", 0, true, "seconds to play simulated songs (default 60)"},
 	{"help", 'h', "show help options"},
 };
 
@@ -97,6 +108,30 @@ PrintOption(const OptionDef &opt) noexcept
 		       opt.GetDescription());
 }
 
+static unsigned
+ParseUnsigned(const char *option, const char *value)
+{
+	char *endptr;
+	const unsigned long result = strtoul(value, &endptr, 10);
+	if (endptr == value || *endptr != 0 || result > UINT_MAX)
+		throw FormatRuntimeError("Not a number: %s %s",
+					 option, value);
+
+	return result;
+}
+
+static double
+ParsePositiveDouble(const char *option, const char *value)
+{
+	char *endptr;
+	const double result = strtod(value, &endptr);
+	if (endptr == value || *endptr != 0 || !(result > 0))
+		throw FormatRuntimeError("Not a positive number: %s %s",
+					 option, value);
+
+	return result;
+}
+
 [[noreturn]]
 static void
 help() noexcept
@@ -119,6 +154,8 @@ help() noexcept
 void
 parse_cmdline(Config &config, int argc, char **argv)
 {
+	bool simulate_options = false;
+
 	// First pass: handle command line options
 	OptionParser parser(option_defs, argc, argv);
 	while (auto o = parser.Next()) {
@@ -162,6 +199,40 @@ parse_cmdline(Config &config, int argc, char **argv)
 			config.proxy = o.value;
 			break;
 
+		case OPTION_IMPORT:
+			config.import_path = o.value;
+
+			/* the import is a one-shot operation in the
+			   foreground */
+			config.no_daemon = true;
+			break;
+
+		case OPTION_IMPORT_OUTPUT:
+			config.import_output = o.value;
+			break;
+
+		case OPTION_SIMULATE:
+			config.simulate_tenants = ParseUnsigned("--simulate",
+								o.value);
+			if (config.simulate_tenants == 0)
+				throw std::runtime_error("--simulate requires at least one tenant");
+
+			/* the simulation reports on stdout */
+			config.no_daemon = true;
+			break;
+
+		case OPTION_SIMULATE_RATE:
+			config.simulate_rate = ParsePositiveDouble("--simulate-rate",
+								   o.value);
+			simulate_options = true;
+			break;
+
+		case OPTION_SIMULATE_DURATION:
+			config.simulate_duration =
+				ParseUnsigned("--simulate-duration", o.value);
+			simulate_options = true;
+			break;
+
 		case OPTION_HELP:
 			help();
 		}
@@ -170,4 +241,13 @@ parse_cmdline(Config &config, int argc, char **argv)
 	const auto remaining = parser.GetRemaining();
 	if (!remaining.empty())
 		throw FormatRuntimeError("Unknown option: %s", remaining.front());
+
+	if (!config.import_output.empty() && config.import_path.empty())
+		throw std::runtime_error("--import-output requires --import");
+
+	if (simulate_options && config.simulate_tenants == 0)
+		throw std::runtime_error("--simulate-rate and --simulate-duration require --simulate");
+
+	if (config.simulate_tenants > 0 && !config.import_path.empty())
+		throw std::runtime_error("--simulate and --import are mutually exclusive");
 }
@@ -22,6 +22,7 @@
 #define CONFIG_HXX
 
 #include "ScrobblerConfig.hxx"
+#include "MpdConfig.hxx"
 
 #include <forward_list>
 #include <string>
@@ -59,6 +60,100 @@ struct Config {
 	enum file_location loc = file_unknown;
 
 	std::forward_list<ScrobblerConfig> scrobblers;
+
+	/**
+	 * The MPD servers to be observed.  If there are no
+	 * "[mpd:NAME]" sections, this contains one server configured
+	 * by #host and #port.
+	 */
+	std::forward_list<MpdConfig> mpd;
+
+	/**
+	 * A directory containing one configuration file per tenant
+	 * ("NAME.conf").  Each file contains scrobbler and
+	 * "[mpd:NAME]" sections, and the tenant name is prepended to
+	 * all section names.
+	 */
+	std::string tenant_dir;
+
+	/**
+	 * The directory for tenant journals which don't have a
+	 * "journal" setting.
+	 */
+	std::string tenant_journal_dir;
+
+	/**
+	 * The default "max_queue" setting for tenant scrobblers.
+	 */
+	unsigned tenant_max_queue = 0;
+
+	/**
+	 * The address of the metrics endpoint: a local socket path
+	 * or "HOST:PORT".  Empty disables it.
+	 */
+	std::string metrics_listen;
+
+	/**
+	 * The path of a journal shared by all scrobblers which don't
+	 * have their own "journal" setting.  Empty disables it.
+	 */
+	std::string shared_journal;
+
+	/**
+	 * Measure the duration of all event loop callbacks, and log
+	 * those which take longer than this number of milliseconds.
+	 * 0 disables the measurement.
+	 */
+	unsigned loop_slow_threshold = 0;
+
+	/**
+	 * Send no more than this number of concurrent requests to
+	 * one host.  0 means unlimited.
+	 */
+	unsigned host_max_in_flight = 0;
+
+	/**
+	 * Send no more than this number of requests per second to
+	 * one host.  0 means unlimited.
+	 */
+	unsigned host_rate_limit = 0;
+
+	/**
+	 * Run the scrobblers in this number of worker threads, each
+	 * with its own event loop and HTTP client.  0 runs them in
+	 * the main thread.
+	 */
+	unsigned worker_threads = 0;
+
+	/**
+	 * The listening history file passed to "--import".  Empty
+	 * means normal operation.
+	 */
+	std::string import_path;
+
+	/**
+	 * If set, then "--import" merges the history into this
+	 * journal file and exits instead of submitting it.
+	 */
+	std::string import_output;
+
+	/**
+	 * The number of synthetic tenants played by "--simulate"; 0
+	 * means normal operation.
+	 */
+	unsigned simulate_tenants = 0;
+
+	/**
+	 * The number of songs per second "--simulate" plays, summed
+	 * over all tenants.
+	 */
+	double simulate_rate = 10;
+
+	/**
+	 * For how many seconds "--simulate" plays songs before it
+	 * waits for the queues to drain.
+	 */
+	unsigned simulate_duration = 60;
 };
 
 #endif
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
 
 #include <pwd.h>
 #endif
@@ -162,6 +163,28 @@ daemonize_write_pidfile()
 #endif
 }
 
+void
+daemonize_check_pidfile(const char *path)
+{
+#ifndef _WIN32
+	FILE *file = fopen(path, "r");
+	if (file == nullptr)
+		return;
+
+	long pid;
+	const bool valid = fscanf(file, "%ld", &pid) == 1 && pid > 0;
+	fclose(file);
+
+	/* EPERM means that the process exists, but belongs to
+	   another user */
+	if (valid && (kill(pid_t(pid), 0) == 0 || errno == EPERM))
+		throw FormatRuntimeError("mpdscribble is running (pid %ld, see %s)",
+					 pid, path);
+#else
+	(void)path;
+#endif
+}
+
 void
 daemonize_init(const char *user, const char *_pidfile)
 {
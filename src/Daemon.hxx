@@ -65,4 +65,11 @@ daemonize_detach();
 void
 daemonize_write_pidfile();
 
+/**
+ * Throws if the given pidfile refers to a process which is still
+ * running.  A missing or stale pidfile is ignored.
+ */
+void
+daemonize_check_pidfile(const char *path);
+
 #endif
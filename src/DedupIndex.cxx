@@ -0,0 +1,97 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "DedupIndex.hxx"
+#include "Record.hxx"
+
+#include <string_view>
+
+static constexpr uint_least64_t FNV1A_OFFSET_BASIS = 14695981039346656037ULL;
+static constexpr uint_least64_t FNV1A_PRIME = 1099511628211ULL;
+
+static constexpr uint_least64_t
+FNV1aHash(uint_least64_t hash, std::string_view s) noexcept
+{
+	for (const unsigned char ch : s) {
+		hash ^= ch;
+		hash *= FNV1A_PRIME;
+	}
+
+	/* a separator, so "ab"+"c" differs from "a"+"bc" */
+	hash ^= 0xff;
+	hash *= FNV1A_PRIME;
+	return hash;
+}
+
+static constexpr uint_least64_t
+FNV1aHash(uint_least64_t hash, uint_least64_t value) noexcept
+{
+	for (unsigned i = 0; i < 8; ++i) {
+		hash ^= (value >> (i * 8)) & 0xff;
+		hash *= FNV1A_PRIME;
+	}
+
+	return hash;
+}
+
+uint_least64_t
+record_dedup_key(const Record &record) noexcept
+{
+	uint_least64_t hash = FNV1A_OFFSET_BASIS;
+	hash = FNV1aHash(hash, uint_least64_t(record.time));
+	hash = FNV1aHash(hash, record.artist);
+	hash = FNV1aHash(hash, record.track);
+	return hash;
+}
+
+bool
+DedupIndex::Add(uint_least64_t key) noexcept
+{
+	if (recent_set.contains(key))
+		return false;
+
+	return queued.insert(key).second;
+}
+
+void
+DedupIndex::Acknowledge(uint_least64_t key) noexcept
+{
+	if (queued.erase(key) == 0 || !recent_set.insert(key).second)
+		return;
+
+	recent.push_back(key);
+
+	if (recent.size() > MAX_RECENT) {
+		recent_set.erase(recent.front());
+		recent.pop_front();
+	}
+}
+
+std::size_t
+DedupIndex::GetMemoryUsage() const noexcept
+{
+	/* a node with the key and the "next" pointer, plus one
+	   bucket pointer */
+	static constexpr std::size_t PER_KEY = sizeof(uint_least64_t) +
+		2 * sizeof(void *);
+
+	return (queued.size() + recent_set.size()) * PER_KEY +
+		recent.size() * sizeof(uint_least64_t);
+}
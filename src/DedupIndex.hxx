@@ -0,0 +1,85 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef DEDUP_INDEX_HXX
+#define DEDUP_INDEX_HXX
+
+#include "util/RingQueue.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+
+struct Record;
+
+/**
+ * Calculate a hash of the fields which identify one play: the
+ * timestamp, the artist and the track.
+ */
+[[gnu::pure]]
+uint_least64_t
+record_dedup_key(const Record &record) noexcept;
+
+/**
+ * An index of the records in a scrobbler's queue and of the most
+ * recently acknowledged ones, to detect duplicates.  It stores only
+ * the 64 bit hashes calculated by record_dedup_key().
+ */
+class DedupIndex {
+	/**
+	 * Remember this number of acknowledged records.
+	 */
+	static constexpr std::size_t MAX_RECENT = 1024;
+
+	std::unordered_set<uint_least64_t> queued;
+
+	/**
+	 * The keys of acknowledged records, oldest first.  Each of
+	 * them is also in #recent_set.
+	 */
+	RingQueue<uint_least64_t> recent;
+
+	std::unordered_set<uint_least64_t> recent_set;
+
+public:
+	[[gnu::pure]]
+	bool Contains(uint_least64_t key) const noexcept {
+		return queued.contains(key) || recent_set.contains(key);
+	}
+
+	/**
+	 * Add the key of a new record in the queue.
+	 *
+	 * @return false if this is a duplicate (and nothing was
+	 * added)
+	 */
+	bool Add(uint_least64_t key) noexcept;
+
+	/**
+	 * The record has been submitted successfully and removed
+	 * from the queue.
+	 */
+	void Acknowledge(uint_least64_t key) noexcept;
+
+	[[gnu::pure]]
+	std::size_t GetMemoryUsage() const noexcept;
+};
+
+#endif
@@ -0,0 +1,209 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "FileSink.hxx"
+#include "AsyncWriter.hxx"
+#include "JsonWriter.hxx"
+#include "Record.hxx"
+#include "ScrobblerConfig.hxx"
+#include "Log.hxx"
+#include "system/Error.hxx"
+
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+FileSink::FileSink(const ScrobblerConfig &_config,
+		   EventLoop &event_loop, AsyncWriter &_writer)
+	:config(_config), writer(_writer),
+	 file(fopen(config.file.c_str(), "a")),
+	 flush_timer(event_loop, BIND_THIS_METHOD(OnFlushTimer))
+{
+	if (file == nullptr)
+		throw FormatErrno("Failed to open file '%s' of scrobbler '%s'",
+				  config.file.c_str(),
+				  config.name.c_str());
+}
+
+FileSink::~FileSink() noexcept
+{
+	Flush();
+
+	writer.Push(nullptr, [f = file](){
+		return fclose(f) == 0;
+	});
+}
+
+/**
+ * Append a TSV field; tabs, newlines and backslashes are escaped.
+ */
+static void
+AppendTsv(std::string &dest, std::string_view src) noexcept
+{
+	for (const char ch : src) {
+		switch (ch) {
+		case '\t':
+			dest += "\\t";
+			break;
+
+		case '\n':
+			dest += "\\n";
+			break;
+
+		case '\r':
+			dest += "\\r";
+			break;
+
+		case '\\':
+			dest += "\\\\";
+			break;
+
+		default:
+			dest += ch;
+		}
+	}
+}
+
+static void
+FormatLine(std::string &dest, FileFormat format, const Record &record) noexcept
+{
+	const unsigned length =
+		std::chrono::duration_cast<std::chrono::seconds>(record.length).count();
+
+	switch (format) {
+	case FileFormat::TEXT:
+		dest += log_date();
+		dest += ' ';
+		dest += record.artist;
+		dest += " - ";
+		dest += record.track;
+		break;
+
+	case FileFormat::TSV:
+		/* time, artist, track, album, number, mbid, length,
+		   love, source */
+		if (record.time != 0)
+			dest += record.FormatTime().c_str();
+		dest += '\t';
+		AppendTsv(dest, record.artist);
+		dest += '\t';
+		AppendTsv(dest, record.track);
+		dest += '\t';
+		AppendTsv(dest, record.album);
+		dest += '\t';
+		AppendTsv(dest, record.number);
+		dest += '\t';
+		dest += record.mbid.Format().c_str();
+		dest += '\t';
+		dest += std::to_string(length);
+		dest += '\t';
+		dest += record.love ? '1' : '0';
+		dest += '\t';
+		dest += record.source;
+		break;
+
+	case FileFormat::JSONL:
+		dest += "{\"time\":";
+		if (record.time != 0)
+			dest += record.FormatTime().c_str();
+		else
+			dest += "null";
+		dest += ",\"artist\":";
+		AppendJsonString(dest, record.artist);
+		dest += ",\"track\":";
+		AppendJsonString(dest, record.track);
+		dest += ",\"album\":";
+		AppendJsonString(dest, record.album);
+		dest += ",\"number\":";
+		AppendJsonString(dest, record.number);
+		dest += ",\"mbid\":";
+		AppendJsonString(dest, record.mbid.Format().c_str());
+		dest += ",\"length\":";
+		dest += std::to_string(length);
+		dest += ",\"love\":";
+		dest += record.love ? "true" : "false";
+		dest += ",\"source\":";
+		AppendJsonString(dest, record.source);
+		dest += '}';
+		break;
+	}
+
+	dest += '\n';
+}
+
+void
+FileSink::Push(const Record &record) noexcept
+{
+	FormatLine(buffer, config.file_format, record);
+	++n_buffered;
+
+	if (config.file_flush_count > 0 &&
+	    n_buffered >= config.file_flush_count)
+		Flush();
+	else if (config.file_flush_interval.count() > 0 &&
+		 !flush_timer.IsPending())
+		flush_timer.Schedule(config.file_flush_interval);
+}
+
+void
+FileSink::Flush() noexcept
+{
+	flush_timer.Cancel();
+
+	if (buffer.empty())
+		return;
+
+	writer.Push(nullptr, [f = file, data = std::move(buffer),
+			      sync = config.file_sync,
+			      path = config.file](){
+		/* one write for the whole group of lines */
+		if (fwrite(data.data(), 1, data.size(), f) != data.size() ||
+		    fflush(f) != 0) {
+			FormatError("Failed to write %s: %s",
+				    path.c_str(), strerror(errno));
+			clearerr(f);
+			return false;
+		}
+
+#ifdef __APPLE__
+		if (sync && fsync(fileno(f)) < 0) {
+			FormatError("Failed to sync %s: %s",
+				    path.c_str(), strerror(errno));
+			return false;
+		}
+#elif !defined(_WIN32)
+		if (sync && fdatasync(fileno(f)) < 0) {
+			FormatError("Failed to sync %s: %s",
+				    path.c_str(), strerror(errno));
+			return false;
+		}
+#else
+		(void)sync;
+#endif
+
+		return true;
+	});
+
+	buffer.clear();
+	n_buffered = 0;
+}
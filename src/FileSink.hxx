@@ -0,0 +1,92 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef FILE_SINK_HXX
+#define FILE_SINK_HXX
+
+#include "event/CoarseTimerEvent.hxx"
+
+#include <string>
+
+#include <stdio.h>
+
+struct Record;
+struct ScrobblerConfig;
+class AsyncWriter;
+
+/**
+ * Writes the played songs to the file of a scrobbler which has the
+ * "file" setting.  Lines are collected in a buffer and handed to
+ * the #AsyncWriter in groups, according to the configured flush
+ * policy ("file_flush_count", "file_flush_interval").
+ */
+class FileSink final {
+	const ScrobblerConfig &config;
+
+	AsyncWriter &writer;
+
+	/**
+	 * The file is only accessed by the #AsyncWriter thread; it
+	 * gets closed by the last job.
+	 */
+	FILE *const file;
+
+	/**
+	 * Formatted lines which have not been passed to #writer yet.
+	 */
+	std::string buffer;
+
+	/**
+	 * The number of lines in #buffer.
+	 */
+	unsigned n_buffered = 0;
+
+	CoarseTimerEvent flush_timer;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	FileSink(const ScrobblerConfig &_config,
+		 EventLoop &event_loop, AsyncWriter &_writer);
+
+	/**
+	 * Flushes the buffer and closes the file after all pending
+	 * writes.
+	 */
+	~FileSink() noexcept;
+
+	FileSink(const FileSink &) = delete;
+	FileSink &operator=(const FileSink &) = delete;
+
+	void Push(const Record &record) noexcept;
+
+	/**
+	 * Pass all buffered lines to the #AsyncWriter now.
+	 */
+	void Flush() noexcept;
+
+private:
+	void OnFlushTimer() noexcept {
+		Flush();
+	}
+};
+
+#endif
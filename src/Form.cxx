@@ -19,21 +19,77 @@
  */
 
 #include "Form.hxx"
-#include "lib/curl/Escape.hxx"
 
-#include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <charconv>
 
 void
 FormDataBuilder::AppendVerbatim(unsigned value) noexcept
 {
 	char buffer[16];
-	snprintf(buffer, sizeof(buffer), "%u", value);
-	AppendVerbatim(buffer);
+	const auto result = std::to_chars(buffer, buffer + sizeof(buffer),
+					  value);
+	s.append(buffer, result.ptr);
+}
+
+/**
+ * A lookup table for the "unreserved" characters of RFC 3986, which
+ * need no percent-encoding.
+ */
+static constexpr auto unreserved_table = []{
+	std::array<bool, 256> table{};
+
+	for (unsigned ch = '0'; ch <= '9'; ++ch)
+		table[ch] = true;
+
+	for (unsigned ch = 'a'; ch <= 'z'; ++ch)
+		table[ch] = table[ch - 'a' + 'A'] = true;
+
+	table['-'] = table['.'] = table['_'] = table['~'] = true;
+	return table;
+}();
+
+static constexpr bool
+IsUnreserved(char ch) noexcept
+{
+	return unreserved_table[(unsigned char)ch];
 }
 
 void
 FormDataBuilder::AppendEscape(std::string_view value) noexcept
 {
-	if (auto e = CurlEscape(value))
-		s.append(e);
+	static constexpr char hex_digits[] = "0123456789ABCDEF";
+
+	const char *src = value.data();
+	const char *const end = src + value.size();
+
+	/* calculate the exact size, then write directly into the
+	   buffer */
+	const std::size_t n_escape = std::count_if(src, end, [](char ch){
+		return !IsUnreserved(ch);
+	});
+
+	const std::size_t old_size = s.size();
+	s.resize(old_size + value.size() + n_escape * 2);
+
+	char *p = s.data() + old_size;
+
+	while (src != end) {
+		/* copy a run of unreserved characters at once */
+		const char *run_end = std::find_if_not(src, end, IsUnreserved);
+		p = std::copy(src, run_end, p);
+		src = run_end;
+
+		if (src == end)
+			break;
+
+		const auto ch = (unsigned char)*src++;
+		*p++ = '%';
+		*p++ = hex_digits[ch >> 4];
+		*p++ = hex_digits[ch & 0xf];
+	}
+
+	assert(p == s.data() + s.size());
 }
@@ -21,7 +21,9 @@
 #ifndef FORM_HXX
 #define FORM_HXX
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 
 class FormDataBuilder {
 	std::string s;
@@ -44,6 +46,15 @@ public:
 				: Separator::AMPERSAND;
 	}
 
+	/**
+	 * Allocate memory for (at least) this number of additional
+	 * bytes, so the following Append() calls don't need to
+	 * reallocate the buffer.
+	 */
+	void Reserve(std::size_t n) noexcept {
+		s.reserve(s.size() + n);
+	}
+
 	const char *c_str() const noexcept {
 		return s.c_str();
 	}
@@ -98,6 +109,10 @@ private:
 
 	void AppendVerbatim(unsigned value) noexcept;
 
+	/**
+	 * Append the value with percent-encoding (RFC 3986).  Runs
+	 * of unreserved characters are copied in one piece.
+	 */
 	void AppendEscape(std::string_view value) noexcept;
 
 	void AppendEscape(unsigned value) noexcept {
@@ -0,0 +1,82 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "HttpRequestSlot.hxx"
+#include "lib/curl/Global.hxx"
+
+void
+HttpRequestSlot::CreateRequest(const char *url, std::string &&body,
+			       struct curl_slist *headers)
+{
+	HttpResponseHandler &handler = *this;
+	request = std::make_unique<CurlRequest>(curl_global, url,
+						std::move(body),
+						handler, headers);
+}
+
+void
+HttpRequestSlot::Start(const char *url, std::string &&body,
+		       struct curl_slist *headers)
+{
+	assert(!IsBusy());
+
+	auto &throttle = curl_global.GetThrottle();
+	if (!throttle.Enqueue(throttle_client, url)) {
+		pending_url = url;
+		pending_body = std::move(body);
+		pending_headers = headers;
+		return;
+	}
+
+	try {
+		CreateRequest(url, std::move(body), headers);
+	} catch (...) {
+		throttle.Remove(throttle_client);
+		throw;
+	}
+}
+
+void
+HttpRequestSlot::Cancel() noexcept
+{
+	request.reset();
+	curl_global.GetThrottle().Remove(throttle_client);
+	pending_body = {};
+}
+
+std::unique_ptr<CurlRequest>
+HttpRequestSlot::Finish() noexcept
+{
+	auto r = std::move(request);
+	curl_global.GetThrottle().Remove(throttle_client);
+	return r;
+}
+
+void
+HttpRequestSlot::OnThrottleAdmitted() noexcept
+{
+	try {
+		CreateRequest(pending_url.c_str(), std::move(pending_body),
+			      pending_headers);
+	} catch (...) {
+		Finish();
+		error_callback(std::current_exception());
+	}
+}
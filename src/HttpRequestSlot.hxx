@@ -0,0 +1,144 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef HTTP_REQUEST_SLOT_HXX
+#define HTTP_REQUEST_SLOT_HXX
+
+#include "lib/curl/Handler.hxx"
+#include "lib/curl/Request.hxx"
+#include "lib/curl/Throttle.hxx"
+#include "util/BindMethod.hxx"
+
+#include <cassert>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class CurlGlobal;
+
+/**
+ * A slot for (at most) one in-flight HTTP request.  The response is
+ * forwarded to bound callbacks.  All slots share one #CurlGlobal, so
+ * requests in different slots run concurrently, within the limits
+ * of its #CurlThrottle.
+ */
+class HttpRequestSlot final : HttpResponseHandler {
+public:
+	using ResponseCallback = BoundMethod<void(std::string_view body) noexcept>;
+	using ErrorCallback = BoundMethod<void(std::exception_ptr e) noexcept>;
+
+private:
+	CurlGlobal &curl_global;
+
+	const ResponseCallback response_callback;
+	const ErrorCallback error_callback;
+
+	std::unique_ptr<CurlRequest> request;
+
+	CurlThrottleClient throttle_client;
+
+	/**
+	 * The parameters of the request which waits for the
+	 * #CurlThrottle; the #CurlRequest (with its easy handle and
+	 * response buffer) is only created when it is admitted.
+	 */
+	std::string pending_url, pending_body;
+	struct curl_slist *pending_headers = nullptr;
+
+public:
+	/**
+	 * @param _owner identifies the object which owns this slot;
+	 * the #CurlThrottle admits the requests of different owners
+	 * in turn
+	 * @param _urgent shall this slot's requests overtake the
+	 * non-urgent ones waiting for the #CurlThrottle?
+	 */
+	HttpRequestSlot(CurlGlobal &_curl_global,
+			ResponseCallback _response_callback,
+			ErrorCallback _error_callback,
+			const void *_owner, bool _urgent=false) noexcept
+		:curl_global(_curl_global),
+		 response_callback(_response_callback),
+		 error_callback(_error_callback),
+		 throttle_client(BIND_THIS_METHOD(OnThrottleAdmitted),
+				 _owner, _urgent) {}
+
+	~HttpRequestSlot() noexcept {
+		Cancel();
+	}
+
+	HttpRequestSlot(const HttpRequestSlot &) = delete;
+	HttpRequestSlot &operator=(const HttpRequestSlot &) = delete;
+
+	/**
+	 * Is a request currently in flight or waiting to be sent?
+	 */
+	bool IsBusy() const noexcept {
+		return request != nullptr || throttle_client.IsWaiting();
+	}
+
+	/**
+	 * Start a new request.  The slot must not be busy.  If the
+	 * #CurlThrottle doesn't admit it right away, it is sent
+	 * later.
+	 *
+	 * @param body the POST request body; if empty, then a GET
+	 * request is sent
+	 * @param headers additional request headers (or nullptr);
+	 * the list must outlive the request
+	 */
+	void Start(const char *url, std::string &&body,
+		   struct curl_slist *headers=nullptr);
+
+	/**
+	 * Abort the request (if any).  No callback will be invoked.
+	 */
+	void Cancel() noexcept;
+
+private:
+	void CreateRequest(const char *url, std::string &&body,
+			   struct curl_slist *headers);
+
+	/**
+	 * The request is finished: free it and let the
+	 * #CurlThrottle admit the next one.
+	 */
+	std::unique_ptr<CurlRequest> Finish() noexcept;
+
+	/* virtual methods from class HttpResponseHandler */
+	void OnHttpResponse(std::string_view body) noexcept override {
+		/* the slot is idle during the callback, but the
+		   request (which owns the body buffer) lives until
+		   it returns; the callback may even destroy this
+		   slot */
+		const auto r = Finish();
+		response_callback(body);
+	}
+
+	void OnHttpError(std::exception_ptr e) noexcept override {
+		const auto r = Finish();
+		error_callback(std::move(e));
+	}
+
+	/* callback for #throttle_client */
+	void OnThrottleAdmitted() noexcept;
+};
+
+#endif
@@ -0,0 +1,384 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "Import.hxx"
+#include "Journal.hxx"
+#include "BinaryJournal.hxx"
+#include "DedupIndex.hxx"
+#include "Record.hxx"
+#include "Timestamp.hxx"
+#include "system/Error.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/SpanCast.hxx"
+#include "util/StringSplit.hxx"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+/**
+ * The result of parsing one chunk of a tab-separated file.
+ */
+struct ImportChunk {
+	/**
+	 * The records are allocated by the worker thread, leaving
+	 * only the deduplication to the merge.
+	 */
+	std::vector<SharedRecord> records;
+
+	/**
+	 * The record_dedup_key() of each record, calculated by the
+	 * worker thread.
+	 */
+	std::vector<uint_least64_t> keys;
+
+	std::size_t n_invalid = 0;
+};
+
+/**
+ * The contents of a file, mapped into memory if possible.
+ */
+class FileContents {
+	std::string_view data;
+
+#ifdef _WIN32
+	std::string buffer;
+#endif
+
+public:
+	explicit FileContents(const char *path);
+	~FileContents() noexcept;
+
+	FileContents(const FileContents &) = delete;
+	FileContents &operator=(const FileContents &) = delete;
+
+	std::string_view get() const noexcept {
+		return data;
+	}
+};
+
+}
+
+#ifndef _WIN32
+
+FileContents::FileContents(const char *path)
+{
+	const int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		throw FormatErrno("Failed to open %s", path);
+
+	AtScopeExit(fd) { close(fd); };
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		throw FormatErrno("Failed to stat %s", path);
+
+	if (st.st_size == 0)
+		return;
+
+	void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		throw FormatErrno("Failed to map %s", path);
+
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	data = {(const char *)p, std::size_t(st.st_size)};
+}
+
+FileContents::~FileContents() noexcept
+{
+	if (!data.empty())
+		munmap(const_cast<char *>(data.data()), data.size());
+}
+
+#else
+
+FileContents::FileContents(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr)
+		throw FormatErrno("Failed to open %s", path);
+
+	AtScopeExit(file) { fclose(file); };
+
+	char chunk[65536];
+	std::size_t nbytes;
+	while ((nbytes = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		buffer.append(chunk, nbytes);
+
+	data = buffer;
+}
+
+FileContents::~FileContents() noexcept = default;
+
+#endif
+
+/**
+ * Undo the escaping done by AppendTsv() in FileSink.cxx.
+ */
+static std::string
+UnescapeTsv(std::string_view src) noexcept
+{
+	std::string dest;
+	dest.reserve(src.size());
+
+	for (std::size_t i = 0; i < src.size(); ++i) {
+		char ch = src[i];
+		if (ch == '\\' && i + 1 < src.size()) {
+			switch (src[++i]) {
+			case 't':
+				ch = '\t';
+				break;
+
+			case 'n':
+				ch = '\n';
+				break;
+
+			case 'r':
+				ch = '\r';
+				break;
+
+			default:
+				ch = src[i];
+			}
+		}
+
+		dest.push_back(ch);
+	}
+
+	return dest;
+}
+
+/**
+ * Parse one line of a tab-separated file.
+ *
+ * @return false if the line is invalid
+ */
+static bool
+ParseTsvLine(std::string_view line, Record &record) noexcept
+{
+	std::string_view columns[9];
+	std::size_t n = 0;
+
+	while (n < std::size(columns)) {
+		const auto [column, rest] = Split(line, '\t');
+		columns[n++] = column;
+		if (rest.data() == nullptr)
+			break;
+		line = rest;
+	}
+
+	if (n < 3)
+		return false;
+
+	record.time = ParseTimestamp(columns[0]);
+	record.artist = UnescapeTsv(columns[1]);
+	record.track = UnescapeTsv(columns[2]);
+	if (record.time == 0 || !record_is_defined(&record))
+		return false;
+
+	if (n > 3)
+		record.album = UnescapeTsv(columns[3]);
+	if (n > 4)
+		record.number = TrackNumber{UnescapeTsv(columns[4])};
+	if (n > 5)
+		record.mbid = Mbid{UnescapeTsv(columns[5])};
+	if (n > 6)
+		record.length = std::chrono::seconds(strtoul(std::string{columns[6]}.c_str(),
+							     nullptr, 10));
+	if (n > 7)
+		record.love = columns[7] == "1";
+	if (n > 8 && columns[8] == "R")
+		record.source = "R";
+
+	return true;
+}
+
+static void
+ParseTsvChunk(std::string_view data, ImportChunk &chunk) noexcept
+{
+	/* a rough estimate to avoid reallocations */
+	chunk.records.reserve(data.size() / 64);
+
+	while (!data.empty()) {
+		auto [line, rest] = Split(data, '\n');
+		data = rest;
+
+		if (line.ends_with('\r'))
+			line.remove_suffix(1);
+
+		if (line.empty() || line.front() == '#')
+			continue;
+
+		Record record;
+		if (!ParseTsvLine(line, record)) {
+			++chunk.n_invalid;
+			continue;
+		}
+
+		chunk.keys.push_back(record_dedup_key(record));
+		chunk.records.emplace_back(std::make_shared<const Record>(std::move(record)));
+	}
+}
+
+/**
+ * Split the data into (at most) the given number of chunks at line
+ * boundaries.
+ */
+static std::vector<std::string_view>
+SplitChunks(std::string_view data, unsigned n) noexcept
+{
+	std::vector<std::string_view> chunks;
+
+	while (!data.empty()) {
+		std::size_t size = data.size() / n;
+		if (n > 1 && size > 0) {
+			const auto eol = data.find('\n', size);
+			size = eol == data.npos ? data.size() : eol + 1;
+		} else
+			size = data.size();
+
+		chunks.push_back(data.substr(0, size));
+		data.remove_prefix(size);
+
+		if (n > 1)
+			--n;
+	}
+
+	return chunks;
+}
+
+static ImportResult
+import_tsv(std::string_view data, unsigned n_threads)
+{
+	/* skip a header line */
+	if (data.starts_with("time\t"))
+		data = Split(data, '\n').second;
+
+	/* small files are not worth starting threads */
+	static constexpr std::size_t MIN_CHUNK_SIZE = 1024 * 1024;
+	n_threads = std::clamp<std::size_t>(data.size() / MIN_CHUNK_SIZE,
+					    1, std::max(n_threads, 1U));
+
+	const auto slices = SplitChunks(data, n_threads);
+	std::vector<ImportChunk> chunks(slices.size());
+
+	{
+		std::vector<std::thread> threads;
+		threads.reserve(slices.size());
+
+		for (std::size_t i = 1; i < slices.size(); ++i)
+			threads.emplace_back(ParseTsvChunk, slices[i],
+					     std::ref(chunks[i]));
+
+		/* the first chunk is parsed in this thread */
+		if (!slices.empty())
+			ParseTsvChunk(slices.front(), chunks.front());
+
+		for (auto &i : threads)
+			i.join();
+	}
+
+	std::size_t n_total = 0;
+	for (const auto &i : chunks)
+		n_total += i.records.size();
+
+	ImportResult result;
+	result.records.reserve(n_total);
+
+	std::unordered_set<uint_least64_t> keys;
+	keys.reserve(n_total);
+
+	for (auto &chunk : chunks) {
+		result.n_invalid += chunk.n_invalid;
+
+		for (std::size_t i = 0; i < chunk.records.size(); ++i) {
+			if (!keys.insert(chunk.keys[i]).second) {
+				++result.n_duplicates;
+				continue;
+			}
+
+			result.records.push_back(std::move(chunk.records[i]));
+		}
+
+		/* free the memory early */
+		chunk = {};
+	}
+
+	return result;
+}
+
+/**
+ * Does this look like a text journal, i.e. does the first line
+ * which is not a comment begin with "KEY ="?
+ */
+[[gnu::pure]]
+static bool
+IsTextJournal(std::string_view data) noexcept
+{
+	while (!data.empty()) {
+		const auto [line, rest] = Split(data, '\n');
+		data = rest;
+
+		const auto i = line.find_first_not_of(" \t\r");
+		if (i == line.npos || line[i] == '#')
+			continue;
+
+		const auto eq = line.find('=');
+		return eq != line.npos && line.find('\t') == line.npos;
+	}
+
+	return false;
+}
+
+ImportResult
+import_history(const char *path, unsigned n_threads)
+{
+	const FileContents contents(path);
+	const auto data = contents.get();
+
+	if (binary_journal_check_magic(AsBytes(data)) || IsTextJournal(data)) {
+		/* journals are small compared to listening
+		   histories, and "ack" markers count the records
+		   from the beginning of the file; parse them with
+		   the existing (serial) journal parser */
+		JournalReadInfo info;
+		ImportResult result;
+		result.records = journal_read(path, &info);
+		result.n_duplicates = info.n_duplicates;
+		return result;
+	}
+
+	return import_tsv(data, n_threads);
+}
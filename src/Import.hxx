@@ -0,0 +1,63 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef IMPORT_HXX
+#define IMPORT_HXX
+
+#include "RecordQueue.hxx"
+
+#include <cstddef>
+
+struct ImportResult {
+	/**
+	 * The plays in file order, without duplicates.
+	 */
+	RecordQueue records;
+
+	/**
+	 * The number of lines which could not be parsed (or which
+	 * lack the artist or the track).
+	 */
+	std::size_t n_invalid = 0;
+
+	/**
+	 * The number of plays which were dropped because they have
+	 * the same timestamp, artist and track as an earlier one.
+	 */
+	std::size_t n_duplicates = 0;
+};
+
+/**
+ * Load a listening history file for "--import".  It may be a
+ * journal (in either format), or a file with tab-separated values
+ * in the format written by a "file" scrobbler with "file_format =
+ * tsv": time (UNIX or ISO 8601 UTC), artist, track, and optionally
+ * album, number, MusicBrainz id, length in seconds, love (0/1) and
+ * source ("P"/"R").
+ *
+ * Tab-separated files are split into chunks which are parsed by
+ * this number of threads.
+ *
+ * Throws on error.
+ */
+ImportResult
+import_history(const char *path, unsigned n_threads);
+
+#endif
@@ -0,0 +1,94 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "ImportFeeder.hxx"
+#include "Journal.hxx"
+#include "Log.hxx"
+#include "event/Loop.hxx"
+
+#include <algorithm>
+
+ImportFeeder::ImportFeeder(EventLoop &event_loop, MultiScrobbler &_scrobblers,
+			   RecordQueue &&_records)
+	:scrobblers(_scrobblers),
+	 records(std::move(_records)),
+	 timer(event_loop, BIND_THIS_METHOD(OnTimer)),
+	 n_total(records.size())
+{
+}
+
+void
+ImportFeeder::SaveRemaining(const char *path) noexcept
+{
+	FormatInfo("import: interrupted after queueing %zu of %zu songs",
+		   n_total - records.size(), n_total);
+
+	if (records.empty())
+		return;
+
+	/* the binary format is much faster to load */
+	if (journal_write(path, records, JournalFormat::BINARY))
+		FormatInfo("import: saved the remaining %zu songs to %s; "
+			   "resume with \"--import %s\"",
+			   records.size(), path, path);
+	else
+		FormatError("import: failed to save the remaining %zu songs",
+			    records.size());
+
+	records.clear();
+}
+
+inline void
+ImportFeeder::Feed() noexcept
+{
+	const std::size_t queued = scrobblers.GetMaxQueueLength();
+	if (queued >= HIGH_WATER)
+		return;
+
+	/* select all scrobblers each time, because a configuration
+	   reload may have replaced some of them */
+	const auto targets = scrobblers.Select({});
+
+	const std::size_t n = std::min(HIGH_WATER - queued, records.size());
+	for (std::size_t i = 0; i < n; ++i)
+		scrobblers.Push(targets, records[i]);
+
+	records.pop_front(n);
+
+	if (n > 0)
+		FormatDebug("import: queued %zu of %zu songs",
+			    n_total - records.size(), n_total);
+}
+
+void
+ImportFeeder::OnTimer() noexcept
+{
+	Feed();
+
+	if (records.empty() && scrobblers.GetMaxQueueLength() == 0) {
+		FormatInfo("import: all %zu songs have been submitted",
+			   n_total);
+		done = true;
+		timer.GetEventLoop().Break();
+		return;
+	}
+
+	timer.Schedule(std::chrono::milliseconds{100});
+}
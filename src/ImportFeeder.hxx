@@ -0,0 +1,82 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef IMPORT_FEEDER_HXX
+#define IMPORT_FEEDER_HXX
+
+#include "RecordQueue.hxx"
+#include "MultiScrobbler.hxx"
+#include "event/CoarseTimerEvent.hxx"
+
+#include <cstddef>
+
+/**
+ * Moves the records loaded by "--import" into the scrobbler queues,
+ * but only as fast as the scrobblers submit them, to keep the
+ * memory usage bounded.  When all records have been submitted, the
+ * #EventLoop is stopped.
+ */
+class ImportFeeder {
+	/**
+	 * Push more records while the longest queue is shorter than
+	 * this.  Large enough for several full batches.
+	 */
+	static constexpr std::size_t HIGH_WATER = 2000;
+
+	MultiScrobbler &scrobblers;
+
+	RecordQueue records;
+
+	CoarseTimerEvent timer;
+
+	const std::size_t n_total;
+
+	/**
+	 * Have all records been submitted?
+	 */
+	bool done = false;
+
+public:
+	ImportFeeder(EventLoop &event_loop, MultiScrobbler &_scrobblers,
+		     RecordQueue &&_records);
+
+	void Start() noexcept {
+		timer.Schedule({});
+	}
+
+	bool IsDone() const noexcept {
+		return done;
+	}
+
+	/**
+	 * The import was interrupted: save the records which have not
+	 * been queued yet in a journal file, which may be passed to
+	 * "--import" later.  They are not moved to the queues,
+	 * because that would defeat the memory limit.
+	 */
+	void SaveRemaining(const char *path) noexcept;
+
+private:
+	void Feed() noexcept;
+
+	void OnTimer() noexcept;
+};
+
+#endif
@@ -32,7 +32,8 @@
 static constexpr bool
 IsValidSectionNameChar(char ch) noexcept
 {
-	return IsAlphaNumericASCII(ch) || ch == '_' || ch == '-' || ch == '.';
+	return IsAlphaNumericASCII(ch) || ch == '_' || ch == '-' || ch == '.' ||
+		ch == ':';
 }
 
 [[gnu::pure]]
@@ -20,22 +20,75 @@
 
 #include "Instance.hxx"
 #include "Config.hxx"
+#include "ReadConfig.hxx"
 #include "SdDaemon.hxx"
+#include "Log.hxx"
 #include "event/SignalMonitor.hxx"
+#include "util/Exception.hxx"
+#include "util/RuntimeError.hxx"
 
-Instance::Instance(const Config &config)
-	:curl_global(event_loop, NullableString(config.proxy)),
-	 mpd_observer(event_loop, *this,
-		      NullableString(config.host), config.port),
-	 scrobblers(config.scrobblers, event_loop, curl_global),
+#include <algorithm>
+
+static std::vector<std::unique_ptr<ScrobblerWorker>>
+StartWorkers(const Config &config,
+	     const std::shared_ptr<CurlThrottleBudget> &throttle_budget)
+{
+	std::vector<std::unique_ptr<ScrobblerWorker>> workers;
+	workers.reserve(config.worker_threads);
+
+	for (unsigned i = 0; i < config.worker_threads; ++i)
+		workers.emplace_back(std::make_unique<ScrobblerWorker>(NullableString(config.proxy),
+								       throttle_budget));
+
+	return workers;
+}
+
+static std::vector<ScrobblerWorker *>
+ToPointers(const std::vector<std::unique_ptr<ScrobblerWorker>> &workers) noexcept
+{
+	std::vector<ScrobblerWorker *> result;
+	result.reserve(workers.size());
+	for (const auto &i : workers)
+		result.push_back(i.get());
+	return result;
+}
+
+Instance::Instance(const Config &config, const Config &_command_line)
+	:curl_global(event_loop, NullableString(config.proxy),
+		     {config.host_max_in_flight, config.host_rate_limit}),
+	 writer(event_loop),
+	 /* the per-host limits apply to all threads together */
+	 workers(StartWorkers(config, curl_global.GetThrottle().GetBudget())),
+	 scrobblers(config.scrobblers, event_loop, curl_global, writer,
+		    NullableString(config.shared_journal),
+		    ToPointers(workers)),
 	 save_journal_interval(std::chrono::seconds{config.journal_interval}),
-	 save_journal_timer(event_loop, BIND_THIS_METHOD(OnSaveJournalTimer))
+	 save_journal_timer(event_loop, BIND_THIS_METHOD(OnSaveJournalTimer)),
+	 command_line(std::make_unique<const Config>(_command_line))
 {
+#ifdef ENABLE_LOOP_STATS
+	if (config.loop_slow_threshold > 0)
+		loop_monitor = std::make_unique<LoopMonitor>(event_loop,
+							     std::chrono::milliseconds{config.loop_slow_threshold});
+#endif
+
+	for (const auto &i : config.mpd)
+		sources.emplace_front(event_loop, i, scrobblers);
+
+#ifndef _WIN32
+	if (!config.metrics_listen.empty())
+		metrics_server = std::make_unique<MetricsServer>(event_loop,
+								 config.metrics_listen.c_str(),
+								 *this);
+#endif
+
 #ifndef _WIN32
 	SignalMonitorInit(event_loop);
 	SignalMonitorRegister(SIGTERM, BIND_THIS_METHOD(Stop));
 	SignalMonitorRegister(SIGINT, BIND_THIS_METHOD(Stop));
+	SignalMonitorRegister(SIGHUP, BIND_THIS_METHOD(Reload));
 	SignalMonitorRegister(SIGUSR1, BIND_THIS_METHOD(OnSubmitSignal));
+	SignalMonitorRegister(SIGUSR2, BIND_THIS_METHOD(OnStatisticsSignal));
 #endif
 
 	ScheduleSaveJournalTimer();
@@ -54,6 +107,53 @@ Instance::Stop() noexcept
 	event_loop.Break();
 }
 
+/**
+ * Throws if one of the (running) MPD sources refers to a scrobbler
+ * which is not in the new configuration.
+ */
+static void
+CheckScrobblerNames(const std::forward_list<MpdSource> &sources,
+		    const std::forward_list<ScrobblerConfig> &configs)
+{
+	for (const auto &source : sources) {
+		for (const auto &name : source.GetScrobblerNames()) {
+			if (std::none_of(configs.begin(), configs.end(),
+					 [&name](const ScrobblerConfig &c){
+						 return c.name == name;
+					 }))
+				throw FormatRuntimeError("Scrobbler '%s' is still used by MPD '%s'",
+							 name.c_str(),
+							 source.GetName().c_str());
+		}
+	}
+}
+
+void
+Instance::Reload() noexcept
+try {
+	if (command_line->simulate_tenants > 0) {
+		/* the simulated tenants are not in the
+		   configuration file */
+		LogInfo("reloading is not supported with --simulate");
+		return;
+	}
+
+	LogInfo("reloading the configuration");
+
+	Config config = *command_line;
+	file_read_config(config);
+
+	CheckScrobblerNames(sources, config.scrobblers);
+
+	scrobblers.Reload(config.scrobblers);
+
+	for (auto &i : sources)
+		i.SelectScrobblers();
+} catch (...) {
+	FormatError("Failed to reload the configuration: %s",
+		    GetFullMessage(std::current_exception()).c_str());
+}
+
 #ifndef _WIN32
 
 void
@@ -62,6 +162,12 @@ Instance::OnSubmitSignal() noexcept
 	scrobblers.SubmitNow();
 }
 
+void
+Instance::OnStatisticsSignal() noexcept
+{
+	scrobblers.LogStatistics();
+}
+
 #endif
 
 void
@@ -76,3 +182,28 @@ Instance::ScheduleSaveJournalTimer() noexcept
 {
 	save_journal_timer.Schedule(save_journal_interval);
 }
+
+void
+Instance::WriteMetrics(MetricsWriter &w)
+{
+	scrobblers.WriteMetrics(w);
+
+	w.Describe("mpdscribble_mpd_connected", "gauge",
+		   "Is the connection to MPD established?");
+	for (const auto &i : sources)
+		w.Write("mpdscribble_mpd_connected",
+			MetricsWriter::MakeLabel("mpd", i.GetName()),
+			uint_least64_t(i.GetObserver().IsConnected()));
+
+	w.Describe("mpdscribble_mpd_updates_total", "counter",
+		   "Player state updates received from MPD.");
+	for (const auto &i : sources)
+		w.Write("mpdscribble_mpd_updates_total",
+			MetricsWriter::MakeLabel("mpd", i.GetName()),
+			uint_least64_t(i.GetObserver().GetUpdateCount()));
+
+#ifdef ENABLE_LOOP_STATS
+	if (loop_monitor)
+		loop_monitor->WriteMetrics(w);
+#endif
+}
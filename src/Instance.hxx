@@ -24,27 +24,83 @@
 #include "event/Loop.hxx"
 #include "event/CoarseTimerEvent.hxx"
 #include "lib/curl/Global.hxx"
-#include "time/Stopwatch.hxx"
-#include "MpdObserver.hxx"
+#include "AsyncWriter.hxx"
+#include "ScrobblerWorker.hxx"
+#include "MpdSource.hxx"
 #include "MultiScrobbler.hxx"
+#include "Metrics.hxx"
+
+#ifndef _WIN32
+#include "MetricsServer.hxx"
+#endif
+
+#ifdef ENABLE_LOOP_STATS
+#include "LoopMonitor.hxx"
+#endif
+
+#include <forward_list>
+#include <memory>
+#include <vector>
 
 struct Config;
 
-struct Instance final : MpdObserverListener {
+struct Instance final : MetricsHandler {
 	EventLoop event_loop;
 
-	Stopwatch stopwatch;
+#ifdef ENABLE_LOOP_STATS
+	/**
+	 * Measures the #event_loop callbacks; nullptr if
+	 * "loop_slow_threshold" was not configured.
+	 */
+	std::unique_ptr<LoopMonitor> loop_monitor;
+#endif
 
 	CurlGlobal curl_global;
 
-	MpdObserver mpd_observer;
+	/**
+	 * Writes the journals and log files.  It is declared before
+	 * #scrobblers, so it gets destroyed after them and finishes
+	 * their last jobs.
+	 */
+	AsyncWriter writer;
+
+	/**
+	 * The threads which run the scrobblers if "worker_threads"
+	 * is configured.  They are declared before #scrobblers, so
+	 * they are stopped after them.
+	 */
+	std::vector<std::unique_ptr<ScrobblerWorker>> workers;
 
 	MultiScrobbler scrobblers;
 
+	/**
+	 * The observed MPD servers.  They share #event_loop,
+	 * #curl_global and #scrobblers.
+	 */
+	std::forward_list<MpdSource> sources;
+
+#ifndef _WIN32
+	/**
+	 * The metrics endpoint; nullptr if it was not configured.
+	 */
+	std::unique_ptr<MetricsServer> metrics_server;
+#endif
+
 	const Event::Duration save_journal_interval;
 	CoarseTimerEvent save_journal_timer;
 
-	Instance(const Config &config);
+	/**
+	 * The settings from the command line, before the
+	 * configuration file was loaded; a reload starts over with
+	 * a copy of them.
+	 */
+	const std::unique_ptr<const Config> command_line;
+
+	/**
+	 * @param _command_line the settings from the command line
+	 * (see #command_line)
+	 */
+	Instance(const Config &config, const Config &_command_line);
 	~Instance() noexcept;
 
 	void Run() noexcept {
@@ -53,24 +109,24 @@ struct Instance final : MpdObserverListener {
 
 	void Stop() noexcept;
 
-	void OnMpdSongChanged(const struct mpd_song *song) noexcept;
-
-	/* virtual methods from MpdObserverListener */
-	void OnMpdStarted(const struct mpd_song *song) noexcept override;
-	void OnMpdPlaying(const struct mpd_song *song,
-			  std::chrono::steady_clock::duration elapsed) noexcept override;
-	void OnMpdEnded(const struct mpd_song *song,
-			bool love) noexcept override;
-	void OnMpdPaused() noexcept override;
-	void OnMpdResumed() noexcept override;
+	/**
+	 * Load the configuration file again and apply the changed
+	 * scrobbler sections.  Other settings require a restart.
+	 * On error, the old settings remain in effect.
+	 */
+	void Reload() noexcept;
 
 private:
 #ifndef _WIN32
 	void OnSubmitSignal() noexcept;
+	void OnStatisticsSignal() noexcept;
 #endif
 
 	void OnSaveJournalTimer() noexcept;
 	void ScheduleSaveJournalTimer() noexcept;
+
+	/* virtual methods from MetricsHandler */
+	void WriteMetrics(MetricsWriter &w) override;
 };
 
 #endif
@@ -19,18 +19,35 @@
 */
 
 #include "Journal.hxx"
+#include "BinaryJournal.hxx"
 #include "Record.hxx"
+#include "DedupIndex.hxx"
+#include "Timestamp.hxx"
+#include "util/Exception.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/SpanCast.hxx"
 #include "util/StringStrip.hxx"
 #include "Log.hxx"
+#include "Probe.hxx"
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 
-static int journal_file_empty;
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 static void
 journal_write_string(FILE *file, char field, const char *value)
@@ -40,10 +57,11 @@ journal_write_string(FILE *file, char field, const char *value)
 }
 
 static void
-journal_write_string(FILE *file, char field, const std::string &value)
+journal_write_string(FILE *file, char field, std::string_view value)
 {
 	if (!value.empty())
-		fprintf(file, "%c = %s\n", field, value.c_str());
+		fprintf(file, "%c = %.*s\n", field,
+			int(value.size()), value.data());
 }
 
 static void
@@ -55,10 +73,12 @@ journal_write_record(FILE *file, const Record *record)
 	journal_write_string(file, 't', record->track);
 	journal_write_string(file, 'b', record->album);
 	journal_write_string(file, 'n', record->number);
-	journal_write_string(file, 'm', record->mbid);
+	if (!record->mbid.empty())
+		journal_write_string(file, 'm', record->mbid.Format().c_str());
 	if (record->love)
 		journal_write_string(file, 'r', "L");
-	journal_write_string(file, 'i', record->time);
+	if (record->time != 0)
+		journal_write_string(file, 'i', record->FormatTime().c_str());
 
 	const auto length_s =
 		std::chrono::duration_cast<std::chrono::seconds>(record->length);
@@ -69,50 +89,600 @@ journal_write_record(FILE *file, const Record *record)
 		record->source);
 }
 
-bool
-journal_write(const char *path, const std::list<Record> &queue)
+static void
+journal_write_record(FILE *file, JournalFormat format,
+		     const Record &record) noexcept
 {
-	FILE *handle;
+	switch (format) {
+	case JournalFormat::TEXT:
+		journal_write_record(file, &record);
+		break;
+
+	case JournalFormat::BINARY:
+		binary_journal_write_record(file, record);
+		break;
+	}
+}
 
-	if (queue.empty() && journal_file_empty)
-		return false;
+static void
+journal_write_ack(FILE *file, JournalFormat format, unsigned n_acked) noexcept
+{
+	switch (format) {
+	case JournalFormat::TEXT:
+		fprintf(file, "ack = %u\n\n", n_acked);
+		break;
+
+	case JournalFormat::BINARY:
+		binary_journal_write_ack(file, n_acked);
+		break;
+	}
+}
+
+/**
+ * Write the queue to a temporary file and rename it, so a crash
+ * never leaves a truncated journal behind.
+ *
+ * @param batch if not nullptr, then the file is synced and renamed
+ * by AsyncWriter::CommitFile() at the end of the batch; else it is
+ * synced and renamed before returning
+ */
+static bool
+journal_write_file(const char *path, const RecordQueue &queue,
+		   JournalFormat format, JournalWriteInfo *info_r=nullptr,
+		   AsyncWriter *batch=nullptr,
+		   AsyncWriter::CommitCallback committed={})
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	const std::string tmp_path = std::string{path} + ".tmp";
 
-	handle = fopen(path, "wb");
+	FILE *handle = fopen(tmp_path.c_str(), "wb");
 	if (!handle) {
 		FormatError("Failed to save %s: %s", path, strerror(errno));
 		return false;
 	}
 
+	if (format == JournalFormat::BINARY)
+		binary_journal_write_header(handle, queue.size());
+
 	for (const auto &i : queue)
-		journal_write_record(handle, &i);
+		journal_write_record(handle, format, *i);
 
-	fclose(handle);
+	const long size = ftell(handle);
+
+	bool success = fflush(handle) == 0 && !ferror(handle);
+#ifndef _WIN32
+	if (success && batch == nullptr)
+		success = fsync(fileno(handle)) == 0;
+#endif
+
+	if (fclose(handle) != 0)
+		success = false;
+
+	if (success && batch == nullptr &&
+	    rename(tmp_path.c_str(), path) != 0)
+		success = false;
+
+	if (!success) {
+		FormatError("Failed to save %s: %s", path, strerror(errno));
+		remove(tmp_path.c_str());
+		return false;
+	}
+
+	if (batch != nullptr)
+		batch->CommitFile(tmp_path, path, std::move(committed));
+
+	const auto duration = std::chrono::steady_clock::now() - start;
+	MPDSCRIBBLE_PROBE4(journal_write, path, queue.size(), size,
+			   std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+
+	if (info_r != nullptr) {
+		info_r->duration = duration;
+		info_r->size = size > 0 ? size : 0;
+	}
 
 	return true;
 }
 
-static void
-journal_commit_record(std::list<Record> &queue, Record &&record)
+bool
+journal_write(const char *path, const RecordQueue &queue,
+	      JournalFormat format, JournalWriteInfo *info_r,
+	      AsyncWriter *batch, AsyncWriter::CommitCallback committed)
 {
-	if (!record.artist.empty() && !record.track.empty()) {
+	return journal_write_file(path, queue, format, info_r,
+				  batch, std::move(committed));
+}
+
+namespace {
+
+/**
+ * Collects the records parsed from a journal file and applies
+ * acknowledgement markers.
+ */
+class JournalLoader {
+	RecordQueue queue;
+
+	/**
+	 * Stop loading after this number of records.  0 means
+	 * unlimited.
+	 */
+	const std::size_t max_records;
+
+	/**
+	 * The number of records in the file and how many of them
+	 * have been removed from the queue because they were
+	 * acknowledged.
+	 */
+	unsigned n_records = 0, n_acked = 0;
+
+	/**
+	 * See JournalReadInfo::tail_offset.
+	 */
+	std::size_t tail_offset = 0;
+
+	bool damaged = false;
+
+public:
+	explicit JournalLoader(std::size_t _max_records) noexcept
+		:max_records(_max_records) {}
+
+	void Commit(Record &&record) noexcept {
+		if (!record_is_defined(&record))
+			return;
+
 		/* append record to the queue */
+		queue.emplace_back(std::make_shared<const Record>(std::move(record)));
+		++n_records;
+	}
+
+	void Acknowledge(unsigned n) noexcept {
+		if (n > n_records)
+			n = n_records;
+
+		if (n > n_acked) {
+			queue.pop_front(n - n_acked);
+			n_acked = n;
+		}
+	}
+
+	void SetDamaged() noexcept {
+		damaged = true;
+	}
+
+	void Reserve(std::size_t n) {
+		if (max_records > 0 && n > max_records)
+			n = max_records;
 
-		queue.emplace_back(std::move(record));
+		queue.reserve(n);
+	}
+
+	/**
+	 * Has the limit been reached?  Then the parser calls
+	 * SetTail() and stops.
+	 */
+	bool IsFull() const noexcept {
+		return max_records > 0 && queue.size() >= max_records;
+	}
 
-		journal_file_empty = false;
+	void SetTail(std::size_t offset) noexcept {
+		tail_offset = offset;
 	}
+
+private:
+	/**
+	 * Remove records with the same timestamp, artist and track
+	 * as an earlier one.
+	 *
+	 * @return the number of removed records
+	 */
+	unsigned RemoveDuplicates() noexcept {
+		std::unordered_set<uint_least64_t> keys;
+		keys.reserve(queue.size());
+
+		RecordQueue result;
+		result.reserve(queue.size());
+		for (auto &i : queue)
+			if (keys.insert(record_dedup_key(*i)).second)
+				result.push_back(std::move(i));
+
+		const unsigned n_duplicates = queue.size() - result.size();
+		queue = std::move(result);
+		return n_duplicates;
+	}
+
+public:
+	RecordQueue Finish(JournalReadInfo *info_r,
+				 JournalFormat format) noexcept {
+		/* this is done after the "ack" markers have been
+		   applied, because they count all records in the
+		   file, including duplicates */
+		const unsigned n_duplicates = RemoveDuplicates();
+
+		if (info_r != nullptr) {
+			info_r->n_acked = n_acked;
+			info_r->n_duplicates = n_duplicates;
+			info_r->format = format;
+			info_r->damaged = damaged;
+			info_r->tail_offset = tail_offset;
+			info_r->n_head_records = n_records;
+		}
+
+		return std::move(queue);
+	}
+};
+
+/**
+ * Passes the records and "ack" markers of journal_read_tail() to
+ * its callbacks.
+ */
+class JournalTailLoader {
+	const std::function<void(Record &&)> &record_callback;
+	const std::function<void(unsigned)> &ack_callback;
+
+public:
+	JournalTailLoader(const std::function<void(Record &&)> &_record_callback,
+			  const std::function<void(unsigned)> &_ack_callback) noexcept
+		:record_callback(_record_callback),
+		 ack_callback(_ack_callback) {}
+
+	void Commit(Record &&record) noexcept {
+		if (record_is_defined(&record))
+			record_callback(std::move(record));
+	}
+
+	void Acknowledge(unsigned n) noexcept {
+		ack_callback(n);
+	}
+
+	void SetDamaged() noexcept {}
+	void Reserve(std::size_t) noexcept {}
+
+	bool IsFull() const noexcept {
+		return false;
+	}
+
+	void SetTail(std::size_t) noexcept {}
+};
+
+}
+
+namespace {
+
+/**
+ * Splits a file into lines.  It reads large chunks and searches
+ * them with memchr() (which is vectorized by the C library), and
+ * lines may have any length.
+ */
+class LineScanner {
+	static constexpr std::size_t INITIAL_CAPACITY = 65536;
+
+	FILE *const file;
+
+	std::size_t capacity = INITIAL_CAPACITY;
+	std::unique_ptr<char[]> buffer;
+
+	/**
+	 * The unconsumed data in #buffer.
+	 */
+	std::size_t start = 0, end = 0;
+
+	/**
+	 * The range from #start to this position is known to
+	 * contain no newline.
+	 */
+	std::size_t scanned = 0;
+
+	/**
+	 * The file offset of #start.
+	 */
+	std::size_t offset;
+
+	bool eof = false;
+
+public:
+	LineScanner(FILE *_file, std::size_t _offset)
+		:file(_file), buffer(std::make_unique<char[]>(capacity)),
+		 offset(_offset) {}
+
+	/**
+	 * Returns the file offset of the line which will be
+	 * returned by the next Next() call.
+	 */
+	std::size_t GetOffset() const noexcept {
+		return offset;
+	}
+
+	/**
+	 * Obtain the next line (without the newline character).
+	 * The returned string is valid until the next call.
+	 *
+	 * @return false at the end of the file
+	 */
+	bool Next(std::string_view &line) {
+		while (true) {
+			const char *p = buffer.get() + start;
+			const auto *newline = (const char *)
+				memchr(buffer.get() + scanned, '\n',
+				       end - scanned);
+			if (newline != nullptr) {
+				line = {p, std::size_t(newline - p)};
+				Consume(line.size() + 1);
+				return true;
+			}
+
+			scanned = end;
+
+			if (eof) {
+				if (start == end)
+					return false;
+
+				/* the last line has no newline */
+				line = {p, end - start};
+				Consume(line.size());
+				return true;
+			}
+
+			Fill();
+		}
+	}
+
+private:
+	void Consume(std::size_t n) noexcept {
+		start += n;
+		offset += n;
+
+		if (scanned < start)
+			scanned = start;
+	}
+
+	void Fill() {
+		if (start > 0) {
+			/* move the partial line to the beginning */
+			memmove(buffer.get(), buffer.get() + start,
+				end - start);
+			end -= start;
+			scanned -= start;
+			start = 0;
+		}
+
+		if (end == capacity) {
+			/* the line doesn't fit: grow the buffer */
+			auto new_buffer = std::make_unique<char[]>(capacity * 2);
+			std::copy_n(buffer.get(), end, new_buffer.get());
+			buffer = std::move(new_buffer);
+			capacity *= 2;
+		}
+
+		const std::size_t nbytes =
+			fread(buffer.get() + end, 1, capacity - end, file);
+		if (nbytes == 0)
+			eof = true;
+
+		end += nbytes;
+	}
+};
+
 }
 
-std::list<Record>
-journal_read(const char *path)
+template<typename T>
+static T
+ParseNumber(std::string_view s) noexcept
 {
-	FILE *file;
-	char line[1024];
+	T value = 0;
+	std::from_chars(s.data(), s.data() + s.size(), value);
+	return value;
+}
+
+/**
+ * @param offset the file offset of the current position (for
+ * JournalLoader::SetTail())
+ */
+template<typename L>
+static void
+journal_read_text(FILE *file, L &loader, std::size_t offset=0)
+{
+	LineScanner scanner(file, offset);
 	Record record;
 
-	journal_file_empty = true;
+	std::string_view line;
+	while (true) {
+		const std::size_t line_offset = scanner.GetOffset();
+		if (!scanner.Next(line))
+			break;
+
+		line = StripLeft(line);
+		if (line.empty() || line.front() == '#')
+			continue;
+
+		const auto eq = line.find('=');
+		if (eq == line.npos || eq == 0)
+			continue;
+
+		const auto key = StripRight(line.substr(0, eq));
+		const auto value = Strip(line.substr(eq + 1));
+
+		if (key == "ack") {
+			loader.Commit(std::move(record));
+			record = {};
+			loader.Acknowledge(ParseNumber<unsigned>(value));
+			continue;
+		}
+
+		if (key.size() != 1)
+			/* unknown key */
+			continue;
+
+		switch (key.front()) {
+		case 'a':
+			loader.Commit(std::move(record));
+			record = {};
+
+			if (loader.IsFull()) {
+				/* the rest of the file begins with
+				   this line */
+				loader.SetTail(line_offset);
+				return;
+			}
+
+			record.artist = value;
+			break;
+
+		case 't':
+			record.track = value;
+			break;
+
+		case 'b':
+			record.album = value;
+			break;
+
+		case 'n':
+			record.number = TrackNumber{value};
+			break;
+
+		case 'm':
+			record.mbid = Mbid{value};
+			break;
+
+		case 'i':
+			record.time = ParseTimestamp(value);
+			break;
+
+		case 'l':
+			record.length = std::chrono::seconds(ParseNumber<int>(value));
+			break;
+
+		case 'o':
+			if (value.starts_with('R'))
+				record.source = "R";
+			break;
+
+		case 'r':
+			if (value.starts_with('L'))
+				record.love = true;
+			break;
+		}
+	}
+
+	loader.Commit(std::move(record));
+}
+
+/**
+ * @param offset start parsing at this offset instead of right after
+ * the header
+ */
+template<typename L>
+static void
+journal_read_binary(const char *path, std::span<const std::byte> data,
+		    L &loader, std::size_t offset) noexcept
+try {
+	BinaryJournalReader reader(data);
+
+	if (offset > 0)
+		reader.Seek(offset);
+	else
+		/* the header tells us how many records to expect
+		   (probably a few more because they were appended
+		   later) */
+		loader.Reserve(reader.GetRecordCount());
+
+	while (true) {
+		if (loader.IsFull()) {
+			if (reader.GetPosition() < data.size())
+				loader.SetTail(reader.GetPosition());
+			return;
+		}
+
+		Record record;
+		unsigned n_acked;
+
+		switch (reader.Next(record, n_acked)) {
+		case BinaryJournalReader::EntryType::END:
+			return;
+
+		case BinaryJournalReader::EntryType::RECORD:
+			loader.Commit(std::move(record));
+			break;
+
+		case BinaryJournalReader::EntryType::ACK:
+			loader.Acknowledge(n_acked);
+			break;
+		}
+	}
+} catch (...) {
+	/* keep the records which were parsed successfully; the
+	   rest may have been truncated by a crash while
+	   appending */
+	FormatWarning("Failed to load %s: %s",
+		      path, GetFullMessage(std::current_exception()).c_str());
+	loader.SetDamaged();
+}
+
+#ifndef _WIN32
+
+/**
+ * Map the whole file into memory and parse it as a binary journal.
+ */
+template<typename L>
+static void
+journal_read_binary(const char *path, FILE *file, L &loader,
+		    std::size_t offset)
+{
+	struct stat st;
+	if (fstat(fileno(file), &st) < 0) {
+		FormatWarning("Failed to load %s: %s", path, strerror(errno));
+		return;
+	}
+
+	const std::size_t size = st.st_size;
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fileno(file), 0);
+	if (p == MAP_FAILED) {
+		FormatWarning("Failed to map %s: %s", path, strerror(errno));
+		return;
+	}
+
+	madvise(p, size, MADV_SEQUENTIAL);
+
+	journal_read_binary(path, {(const std::byte *)p, size}, loader,
+			    offset);
+
+	munmap(p, size);
+}
+
+#else
+
+template<typename L>
+static void
+journal_read_binary(const char *path, FILE *file, L &loader,
+		    std::size_t offset)
+{
+	std::string buffer;
+	char chunk[16384];
+	std::size_t nbytes;
+	while ((nbytes = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		buffer.append(chunk, nbytes);
+
+	journal_read_binary(path, AsBytes(buffer), loader, offset);
+}
+
+#endif
+
+/**
+ * Determine the size of the file (for tracepoints).
+ */
+[[maybe_unused]]
+static long
+GetFileSize(FILE *file) noexcept
+{
+	return fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+}
+
+RecordQueue
+journal_read(const char *path, JournalReadInfo *info_r,
+	     std::size_t max_records)
+{
+	[[maybe_unused]] const auto start = std::chrono::steady_clock::now();
 
-	file = fopen(path, "r");
+	FILE *file = fopen(path, "rb");
 	if (file == nullptr) {
 		if (errno != ENOENT)
 			/* ENOENT is ignored silently, because the
@@ -123,48 +693,210 @@ journal_read(const char *path)
 		return {};
 	}
 
-	std::list<Record> queue;
-	while (fgets(line, sizeof(line), file) != nullptr) {
-		char *key, *value;
+	AtScopeExit(file) { fclose(file); };
 
-		key = StripLeft(line);
-		if (*key == 0 || *key == '#')
-			continue;
+	/* peek at the beginning of the file to determine its
+	   format */
+	std::byte magic[8];
+	const std::size_t magic_size = fread(magic, 1, sizeof(magic), file);
+	rewind(file);
 
-		value = strchr(key, '=');
-		if (value == nullptr || value == key)
-			continue;
+	JournalLoader loader(max_records);
+	JournalFormat format;
 
-		*value++ = 0;
+	if (binary_journal_check_magic({magic, magic_size})) {
+		format = JournalFormat::BINARY;
+		journal_read_binary(path, file, loader, 0);
+	} else {
+		format = JournalFormat::TEXT;
+		journal_read_text(file, loader);
+	}
 
-		StripRight(key);
-		value = Strip(value);
+	auto queue = loader.Finish(info_r, format);
 
-		if (!strcmp("a", key)) {
-			journal_commit_record(queue, std::move(record));
-			record = {};
-			record.artist = value;
-		} else if (!strcmp("t", key))
-			record.track = value;
-		else if (!strcmp("b", key))
-			record.album = value;
-		else if (!strcmp("n", key))
-			record.number = value;
-		else if (!strcmp("m", key))
-			record.mbid = value;
-		else if (!strcmp("i", key))
-			record.time = value;
-		else if (!strcmp("l", key))
-			record.length = std::chrono::seconds(atoi(value));
-		else if (strcmp("o", key) == 0 && value[0] == 'R')
-			record.source = "R";
-		else if (strcmp("r", key) == 0 && value[0] == 'L')
-			record.love = true;
+	MPDSCRIBBLE_PROBE4(journal_read, path, queue.size(), GetFileSize(file),
+			   std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
+	return queue;
+}
+
+void
+journal_read_tail(const char *path, JournalFormat format, std::size_t offset,
+		  const std::function<void(Record &&)> &record_callback,
+		  const std::function<void(unsigned)> &ack_callback) noexcept
+{
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr) {
+		FormatWarning("Failed to load %s: %s", path, strerror(errno));
+		return;
 	}
 
-	fclose(file);
+	AtScopeExit(file) { fclose(file); };
 
-	journal_commit_record(queue, std::move(record));
+	JournalTailLoader loader(record_callback, ack_callback);
 
-	return queue;
+	switch (format) {
+	case JournalFormat::TEXT:
+		if (fseek(file, offset, SEEK_SET) < 0) {
+			FormatWarning("Failed to seek %s: %s",
+				      path, strerror(errno));
+			return;
+		}
+
+		journal_read_text(file, loader, offset);
+		break;
+
+	case JournalFormat::BINARY:
+		journal_read_binary(path, file, loader, offset);
+		break;
+	}
+}
+
+/**
+ * Compact the journal file when at least this fraction of its
+ * records has been acknowledged.
+ */
+static constexpr unsigned COMPACT_DEAD_PERCENT = 50;
+
+JournalAppender::~JournalAppender() noexcept
+{
+	writer.Cancel(this);
+
+	/* close the file in the writer thread, after all pending
+	   jobs */
+	writer.Push(nullptr, [f = file](){
+		f->Close();
+		return true;
+	});
+}
+
+bool
+JournalAppender::File::Open() noexcept
+{
+	if (file != nullptr)
+		return true;
+
+	if (must_rewrite)
+		/* don't append to a file which may be corrupt or in
+		   a different format; wait for the next Compact()
+		   call */
+		return false;
+
+	file = fopen(path.c_str(), "ab");
+	if (file == nullptr) {
+		FormatError("Failed to open %s: %s",
+			    path.c_str(), strerror(errno));
+		must_rewrite = true;
+		return false;
+	}
+
+	return true;
+}
+
+void
+JournalAppender::File::Close() noexcept
+{
+	if (file != nullptr) {
+		fclose(file);
+		file = nullptr;
+	}
+}
+
+bool
+JournalAppender::File::Flush() noexcept
+{
+	if (fflush(file) != 0 || ferror(file)) {
+		FormatError("Failed to write %s: %s",
+			    path.c_str(), strerror(errno));
+		Close();
+		must_rewrite = true;
+		return false;
+	}
+
+	return true;
+}
+
+bool
+JournalAppender::File::Append(const Record &record) noexcept
+{
+	if (!Open())
+		return false;
+
+	journal_write_record(file, format, record);
+	return Flush();
+}
+
+bool
+JournalAppender::File::Acknowledge(unsigned _n_acked) noexcept
+{
+	if (!Open())
+		return false;
+
+	journal_write_ack(file, format, _n_acked);
+	return Flush();
+}
+
+bool
+JournalAppender::File::Rewrite(const RecordQueue &queue,
+			       JournalWriteInfo &info) noexcept
+{
+	Close();
+
+	if (!journal_write_file(path.c_str(), queue, format, &info)) {
+		must_rewrite = true;
+		return false;
+	}
+
+	must_rewrite = false;
+	return true;
+}
+
+void
+JournalAppender::Append(const SharedRecord &record) noexcept
+{
+	++n_records;
+
+	writer.Push(this, [f = file, record](){
+		return f->Append(*record);
+	});
+}
+
+void
+JournalAppender::Acknowledge(unsigned n) noexcept
+{
+	assert(n_acked + n <= n_records);
+
+	n_acked += n;
+
+	writer.Push(this, [f = file, a = n_acked](){
+		return f->Acknowledge(a);
+	});
+}
+
+bool
+JournalAppender::NeedsCompaction() const noexcept
+{
+	return file->must_rewrite ||
+		(n_acked > 0 &&
+		 n_acked * 100 >= n_records * COMPACT_DEAD_PERCENT);
+}
+
+void
+JournalAppender::Compact(const RecordQueue &queue,
+			 CompactCompletion completion) noexcept
+{
+	/* if rewriting fails, the writer thread sets
+	   "must_rewrite", and the next call will try again */
+	n_records = queue.size();
+	n_acked = 0;
+
+	/* filled by the writer thread, read by the completion */
+	auto info = std::make_shared<JournalWriteInfo>();
+
+	writer.Push(this, [f = file, snapshot = queue, info](){
+		return f->Rewrite(snapshot, *info);
+	}, [info, completion = std::move(completion)](bool success){
+		if (completion)
+			completion(success, *info);
+	});
 }
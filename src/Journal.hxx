@@ -21,14 +21,236 @@
 #ifndef JOURNAL_HXX
 #define JOURNAL_HXX
 
-#include <list>
+#include "JournalFormat.hxx"
+#include "RecordQueue.hxx"
+#include "AsyncWriter.hxx"
 
-struct Record;
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
 
+#include <stdio.h>
+
+/**
+ * Statistics about writing a journal file from scratch.
+ */
+struct JournalWriteInfo {
+	std::chrono::steady_clock::duration duration{};
+
+	/**
+	 * The size of the new file in bytes.
+	 */
+	std::size_t size = 0;
+};
+
+/**
+ * Write the queue to a journal file, replacing the old one
+ * atomically.
+ *
+ * @param batch if not nullptr, then this function must be called by
+ * a job of this #AsyncWriter, and the new file is synced and moved
+ * to @path at the end of the batch (see AsyncWriter::CommitFile());
+ * else this happens before returning
+ * @param committed invoked when the file has been (or could not
+ * be) moved to @path; only used with @batch
+ * @return false on error
+ */
 bool
-journal_write(const char *path, const std::list<Record> &queue);
+journal_write(const char *path, const RecordQueue &queue,
+	      JournalFormat format=JournalFormat::TEXT,
+	      JournalWriteInfo *info_r=nullptr,
+	      AsyncWriter *batch=nullptr,
+	      AsyncWriter::CommitCallback committed={});
+
+struct JournalReadInfo {
+	/**
+	 * The number of records which were dropped because an "ack"
+	 * marker said they have already been submitted.
+	 */
+	unsigned n_acked = 0;
+
+	/**
+	 * The number of records which were dropped because another
+	 * record with the same timestamp, artist and track was
+	 * loaded already.
+	 */
+	unsigned n_duplicates = 0;
+
+	/**
+	 * The format of the file which was read.
+	 */
+	JournalFormat format = JournalFormat::TEXT;
+
+	/**
+	 * Was the file malformed or truncated?  Only the records
+	 * before the damaged part have been loaded.
+	 */
+	bool damaged = false;
+
+	/**
+	 * If the file contains more records than the "max_records"
+	 * parameter of journal_read() allowed: the offset where
+	 * parsing stopped, to be passed to journal_read_tail().
+	 * Zero if the whole file was loaded.
+	 */
+	std::size_t tail_offset = 0;
+
+	/**
+	 * The number of records before #tail_offset, including the
+	 * acknowledged ones.  The "ack" markers after #tail_offset
+	 * count from the beginning of the file.
+	 */
+	unsigned n_head_records = 0;
+};
+
+/**
+ * Load a journal file.  Both formats are supported and detected
+ * automatically.
+ *
+ * @param info_r if not nullptr, then additional information about
+ * the file is returned here
+ * @param max_records stop after this number of records (0 means
+ * unlimited); see JournalReadInfo::tail_offset
+ */
+RecordQueue
+journal_read(const char *path, JournalReadInfo *info_r=nullptr,
+	     std::size_t max_records=0);
+
+/**
+ * Parse the part of a journal file which was not loaded by
+ * journal_read() because of its "max_records" parameter.
+ *
+ * @param offset the JournalReadInfo::tail_offset value
+ * @param record_callback invoked for each record
+ * @param ack_callback invoked for each "ack" marker with its value,
+ * i.e. a number of records counted from the beginning of the file
+ */
+void
+journal_read_tail(const char *path, JournalFormat format, std::size_t offset,
+		  const std::function<void(Record &&)> &record_callback,
+		  const std::function<void(unsigned)> &ack_callback) noexcept;
+
+/**
+ * Appends new records and acknowledgement markers to a journal file
+ * instead of rewriting it completely.  The file is only rewritten
+ * ("compacted") when most of its records have been acknowledged.
+ *
+ * All file operations are performed by the #AsyncWriter.
+ */
+class JournalAppender {
+	AsyncWriter &writer;
+
+	/**
+	 * The state which is only accessed by the #AsyncWriter
+	 * thread (except for #must_rewrite).  It is shared with the
+	 * pending jobs, because they may outlive this object.
+	 */
+	struct File {
+		const std::string path;
+
+		const JournalFormat format;
+
+		FILE *file = nullptr;
+
+		/**
+		 * Set when writing to the file has failed or when the
+		 * existing file is in a different format; the next
+		 * Compact() call will rewrite it from scratch.
+		 */
+		std::atomic_bool must_rewrite;
+
+		File(const char *_path, JournalFormat _format,
+		     bool _must_rewrite) noexcept
+			:path(_path), format(_format),
+			 must_rewrite(_must_rewrite) {}
+
+		~File() noexcept {
+			Close();
+		}
+
+		File(const File &) = delete;
+		File &operator=(const File &) = delete;
+
+		bool Open() noexcept;
+		void Close() noexcept;
+		bool Flush() noexcept;
+
+		bool Append(const Record &record) noexcept;
+		bool Acknowledge(unsigned n_acked) noexcept;
+		bool Rewrite(const RecordQueue &queue,
+			     JournalWriteInfo &info) noexcept;
+	};
+
+	const std::shared_ptr<File> file;
+
+	/**
+	 * The number of records in the file (including the
+	 * acknowledged ones).
+	 */
+	unsigned n_records;
+
+	/**
+	 * The number of records at the beginning of the file which
+	 * have been acknowledged.
+	 */
+	unsigned n_acked;
+
+public:
+	/**
+	 * @param n_live the number of records loaded by
+	 * journal_read()
+	 * @param info the information returned by journal_read()
+	 */
+	JournalAppender(AsyncWriter &_writer,
+			const char *path, JournalFormat format,
+			unsigned n_live, const JournalReadInfo &info) noexcept
+		:writer(_writer),
+		 /* an existing file in the wrong format must be
+		    converted before anything can be appended, and
+		    nothing must be appended to a damaged file; if
+		    duplicates were dropped, the "ack" markers don't
+		    match the queue anymore */
+		 file(std::make_shared<File>(path, format,
+					     (n_live + info.n_acked > 0 &&
+					      info.format != format) ||
+					     info.damaged ||
+					     info.n_duplicates > 0)),
+		 n_records(n_live + info.n_acked + info.n_duplicates),
+		 n_acked(info.n_acked) {}
+
+	/**
+	 * Closes the file after all pending jobs are done.
+	 */
+	~JournalAppender() noexcept;
+
+	JournalAppender(const JournalAppender &) = delete;
+	JournalAppender &operator=(const JournalAppender &) = delete;
+
+	void Append(const SharedRecord &record) noexcept;
+
+	/**
+	 * The given number of records at the beginning of the queue
+	 * have been submitted successfully.
+	 */
+	void Acknowledge(unsigned n) noexcept;
+
+	[[gnu::pure]]
+	bool NeedsCompaction() const noexcept;
+
+	using CompactCompletion =
+		std::function<void(bool success, const JournalWriteInfo &info)>;
 
-std::list<Record>
-journal_read(const char *path);
+	/**
+	 * Rewrite the file from scratch (with a copy of the given
+	 * queue), omitting all acknowledged records.
+	 *
+	 * @param completion invoked in the #EventLoop thread when
+	 * done
+	 */
+	void Compact(const RecordQueue &queue,
+		     CompactCompletion completion={}) noexcept;
+};
 
 #endif
@@ -0,0 +1,82 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "JsonWriter.hxx"
+
+#include <cmath>
+
+#include <stdio.h>
+
+void
+AppendJsonString(std::string &dest, std::string_view src) noexcept
+{
+	dest += '"';
+
+	for (const char ch : src) {
+		switch (ch) {
+		case '"':
+			dest += "\\\"";
+			break;
+
+		case '\\':
+			dest += "\\\\";
+			break;
+
+		case '\n':
+			dest += "\\n";
+			break;
+
+		case '\r':
+			dest += "\\r";
+			break;
+
+		case '\t':
+			dest += "\\t";
+			break;
+
+		default:
+			if ((unsigned char)ch < 0x20) {
+				char buffer[8];
+				snprintf(buffer, sizeof(buffer), "\\u%04x",
+					 (unsigned char)ch);
+				dest += buffer;
+			} else
+				dest += ch;
+		}
+	}
+
+	dest += '"';
+}
+
+void
+JsonWriter::Number(double value) noexcept
+{
+	if (!std::isfinite(value)) {
+		Null();
+		return;
+	}
+
+	Separator();
+
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.6g", value);
+	dest += buffer;
+	need_comma = true;
+}
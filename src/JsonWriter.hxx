@@ -0,0 +1,135 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef JSON_WRITER_HXX
+#define JSON_WRITER_HXX
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Append a quoted JSON string.
+ */
+void
+AppendJsonString(std::string &dest, std::string_view src) noexcept;
+
+/**
+ * Generates JSON directly into a string buffer, without building a
+ * document tree first.  The caller is responsible for calling the
+ * methods in a valid order; this class only inserts the commas.
+ */
+class JsonWriter {
+	std::string &dest;
+
+	/**
+	 * Does the next value (or key) need a comma before it?
+	 */
+	bool need_comma = false;
+
+public:
+	explicit JsonWriter(std::string &_dest) noexcept
+		:dest(_dest) {}
+
+	void BeginObject() noexcept {
+		Separator();
+		dest += '{';
+		need_comma = false;
+	}
+
+	void EndObject() noexcept {
+		dest += '}';
+		need_comma = true;
+	}
+
+	void BeginArray() noexcept {
+		Separator();
+		dest += '[';
+		need_comma = false;
+	}
+
+	void EndArray() noexcept {
+		dest += ']';
+		need_comma = true;
+	}
+
+	/**
+	 * Begin an object member.  It must be followed by exactly
+	 * one value.
+	 */
+	void Key(std::string_view key) noexcept {
+		Separator();
+		AppendJsonString(dest, key);
+		dest += ':';
+		need_comma = false;
+	}
+
+	void String(std::string_view value) noexcept {
+		Separator();
+		AppendJsonString(dest, value);
+		need_comma = true;
+	}
+
+	void Unsigned(uint_least64_t value) noexcept {
+		Separator();
+		dest += std::to_string(value);
+		need_comma = true;
+	}
+
+	/**
+	 * Append a floating point number; "null" if it is not
+	 * finite, because JSON has no representation for it.
+	 */
+	void Number(double value) noexcept;
+
+	void Null() noexcept {
+		Separator();
+		dest += "null";
+		need_comma = true;
+	}
+
+	void Boolean(bool value) noexcept {
+		Separator();
+		dest += value ? "true" : "false";
+		need_comma = true;
+	}
+
+	void Member(std::string_view key, std::string_view value) noexcept {
+		Key(key);
+		String(value);
+	}
+
+	/**
+	 * Like Member(), but omit the member if the value is empty.
+	 */
+	void OptionalMember(std::string_view key,
+			    std::string_view value) noexcept {
+		if (!value.empty())
+			Member(key, value);
+	}
+
+private:
+	void Separator() noexcept {
+		if (need_comma)
+			dest += ',';
+	}
+};
+
+#endif
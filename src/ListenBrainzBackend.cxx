@@ -0,0 +1,174 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "ListenBrainzBackend.hxx"
+#include "ScrobblerConfig.hxx"
+#include "SessionCache.hxx"
+#include "JsonWriter.hxx"
+#include "Record.hxx"
+#include "Log.hxx"
+#include "config.h"
+
+#include <algorithm>
+
+ListenBrainzBackend::ListenBrainzBackend(const ScrobblerConfig &_config)
+	:config(_config)
+{
+	headers.Append(("Authorization: Token " + config.token).c_str());
+	headers.Append("Content-Type: application/json");
+}
+
+void
+ListenBrainzBackend::InitSession(ScrobblerSession &session) const
+{
+	std::string url = config.url;
+	if (!url.ends_with('/'))
+		url.push_back('/');
+	url.append("1/submit-listens");
+
+	session.nowplay_url = url;
+	session.submit_url = std::move(url);
+}
+
+/**
+ * Write the "track_metadata" object of a listen.
+ */
+static void
+WriteTrackMetadata(JsonWriter &w, const Record &song) noexcept
+{
+	w.Key("track_metadata");
+	w.BeginObject();
+	w.Member("artist_name", song.artist);
+	w.Member("track_name", song.track);
+	w.OptionalMember("release_name", song.album);
+
+	w.Key("additional_info");
+	w.BeginObject();
+	w.OptionalMember("tracknumber", song.number);
+	w.OptionalMember("recording_mbid", song.mbid.Format().c_str());
+
+	if (song.length.count() > 0) {
+		w.Key("duration_ms");
+		w.Unsigned(std::chrono::duration_cast<std::chrono::milliseconds>(song.length).count());
+	}
+
+	w.Member("media_player", "MPD");
+	w.Member("submission_client", PACKAGE);
+	w.Member("submission_client_version", VERSION);
+	w.EndObject();
+
+	w.EndObject();
+}
+
+/**
+ * Estimate the size of the JSON document for the given range of the
+ * queue, to reserve the buffer.
+ */
+[[gnu::pure]]
+static std::size_t
+EstimateSubmitSize(const RecordQueue &queue, std::size_t offset,
+		   std::size_t count) noexcept
+{
+	/* the keys and the constant values of one listen */
+	static constexpr std::size_t PER_SONG = 256;
+
+	std::size_t size = 64;
+	for (std::size_t i = offset; i < offset + count; ++i) {
+		const Record &song = *queue[i];
+		/* allow a few escaped characters */
+		size += PER_SONG +
+			(song.artist.size() + song.track.size() +
+			 song.album.size() + song.number.size() +
+			 song.mbid.size()) * 9 / 8;
+	}
+
+	return size;
+}
+
+std::string
+ListenBrainzBackend::MakeNowPlaying(const ScrobblerSession &,
+				    const Record &song) const
+{
+	std::string body;
+	JsonWriter w(body);
+	w.BeginObject();
+	w.Member("listen_type", "playing_now");
+	w.Key("payload");
+	w.BeginArray();
+	w.BeginObject();
+	WriteTrackMetadata(w, song);
+	w.EndObject();
+	w.EndArray();
+	w.EndObject();
+	return body;
+}
+
+std::string
+ListenBrainzBackend::MakeSubmit(const ScrobblerSession &,
+				const RecordQueue &queue,
+				std::size_t offset, std::size_t count) const
+{
+	std::string body;
+	body.reserve(EstimateSubmitSize(queue, offset, count));
+
+	JsonWriter w(body);
+	w.BeginObject();
+
+	/* "single" is meant for a song which has just been
+	   played; everything else is a backlog */
+	w.Member("listen_type", count == 1 ? "single" : "import");
+
+	w.Key("payload");
+	w.BeginArray();
+
+	for (std::size_t i = offset; i < offset + count; ++i) {
+		const Record &song = *queue[i];
+
+		w.BeginObject();
+		w.Key("listened_at");
+		w.Unsigned(std::max<int_least64_t>(song.time, 0));
+		WriteTrackMetadata(w, song);
+		w.EndObject();
+	}
+
+	w.EndArray();
+	w.EndObject();
+	return body;
+}
+
+SubmitResponseType
+ListenBrainzBackend::ParseResponse(std::string_view body) const noexcept
+{
+	/* error responses have a HTTP status which makes the
+	   request fail; a successful one is {"status": "ok"} */
+	auto i = body.find("\"status\"");
+	if (i != body.npos) {
+		auto rest = body.substr(i + 8);
+		const auto j = rest.find_first_not_of(" \t\r\n:");
+		if (j != rest.npos && rest.substr(j).starts_with("\"ok\"")) {
+			FormatInfo("[%s] OK", config.name.c_str());
+			return SubmitResponseType::OK;
+		}
+	}
+
+	FormatError("[%s] unknown response: %.*s",
+		    config.name.c_str(), (int)body.size(), body.data());
+	return SubmitResponseType::FAILED;
+}
@@ -0,0 +1,61 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef LISTENBRAINZ_BACKEND_HXX
+#define LISTENBRAINZ_BACKEND_HXX
+
+#include "ScrobblerBackend.hxx"
+#include "lib/curl/Slist.hxx"
+
+/**
+ * The ListenBrainz API (https://listenbrainz.readthedocs.io/): all
+ * requests go to the "submit-listens" endpoint with the user token
+ * in the "Authorization" header; there is no handshake.  Many songs
+ * can be submitted in one "import" request.
+ */
+class ListenBrainzBackend final : public ScrobblerBackend {
+	const ScrobblerConfig &config;
+
+	CurlSlist headers;
+
+public:
+	explicit ListenBrainzBackend(const ScrobblerConfig &_config);
+
+	/* virtual methods from class ScrobblerBackend */
+	bool HasHandshake() const noexcept override {
+		return false;
+	}
+
+	void InitSession(ScrobblerSession &session) const override;
+
+	struct curl_slist *GetRequestHeaders() const noexcept override {
+		return headers.Get();
+	}
+
+	std::string MakeNowPlaying(const ScrobblerSession &session,
+				   const Record &song) const override;
+	std::string MakeSubmit(const ScrobblerSession &session,
+			       const RecordQueue &queue,
+			       std::size_t offset,
+			       std::size_t count) const override;
+	SubmitResponseType ParseResponse(std::string_view body) const noexcept override;
+};
+
+#endif
@@ -23,7 +23,12 @@
 #include "util/StringStrip.hxx"
 #include "config.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <thread>
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -35,31 +40,172 @@
 #include <syslog.h>
 #endif
 
-static LogLevel log_threshold = LogLevel::INFO;
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+LogLevel log_threshold = LogLevel::INFO;
 
 static FILE *log_file;
 
-const char *
-log_date() noexcept
+namespace {
+
+/**
+ * A bounded lock-free multi-producer/single-consumer queue of log
+ * messages (the algorithm by Dmitry Vyukov).  Producers never block;
+ * if the queue is full, the message is written synchronously.
+ */
+class LogQueue {
+	static constexpr std::size_t SIZE = 128;
+	static_assert((SIZE & (SIZE - 1)) == 0, "Must be a power of two");
+
+public:
+	struct Slot {
+		/**
+		 * Equals the position of the producer which may
+		 * fill this slot; the position plus one after it has
+		 * been filled.
+		 */
+		std::atomic<std::size_t> sequence;
+
+		LogLevel level;
+		time_t time;
+		std::size_t length;
+		char text[1024];
+	};
+
+private:
+	std::array<Slot, SIZE> slots;
+
+	alignas(64) std::atomic<std::size_t> enqueue_position{0};
+
+	/**
+	 * Only accessed by the consumer.
+	 */
+	alignas(64) std::size_t dequeue_position = 0;
+
+public:
+	LogQueue() noexcept {
+		for (std::size_t i = 0; i < SIZE; ++i)
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Reserve a slot.  After filling it, call Commit().
+	 *
+	 * @return nullptr if the queue is full
+	 */
+	Slot *Reserve(std::size_t &position_r) noexcept {
+		std::size_t position =
+			enqueue_position.load(std::memory_order_relaxed);
+
+		while (true) {
+			Slot &slot = slots[position & (SIZE - 1)];
+			const std::size_t sequence =
+				slot.sequence.load(std::memory_order_acquire);
+			const auto diff = std::intptr_t(sequence) -
+				std::intptr_t(position);
+
+			if (diff == 0) {
+				if (enqueue_position.compare_exchange_weak(position,
+									   position + 1,
+									   std::memory_order_relaxed)) {
+					position_r = position;
+					return &slot;
+				}
+			} else if (diff < 0)
+				return nullptr;
+			else
+				position = enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+
+	void Commit(Slot &slot, std::size_t position) noexcept {
+		slot.sequence.store(position + 1, std::memory_order_release);
+	}
+
+	/**
+	 * Obtain the oldest message.  After handling it, call
+	 * Pop().
+	 *
+	 * @return nullptr if the queue is empty
+	 */
+	const Slot *Front() const noexcept {
+		const Slot &slot = slots[dequeue_position & (SIZE - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) !=
+		    dequeue_position + 1)
+			return nullptr;
+
+		return &slot;
+	}
+
+	void Pop() noexcept {
+		Slot &slot = slots[dequeue_position & (SIZE - 1)];
+		slot.sequence.store(dequeue_position + SIZE,
+				    std::memory_order_release);
+		++dequeue_position;
+	}
+};
+
+}
+
+static LogQueue log_queue;
+
+/**
+ * The thread which writes the messages from #log_queue; not
+ * joinable before log_start_thread() and after log_deinit().
+ */
+static std::thread log_thread;
+
+/**
+ * Is #log_thread running?  Checked by the producers instead of
+ * #log_thread itself, which may be modified concurrently.
+ */
+static std::atomic_bool log_thread_running{false};
+
+/**
+ * Set by the log thread before it goes to sleep; producers which
+ * see it wake it up via #log_wakeup.
+ */
+static std::atomic_bool log_thread_sleeping{false};
+static std::atomic<unsigned> log_wakeup{0};
+static std::atomic_bool log_thread_quit{false};
+
+/**
+ * Format the given time.  The result is cached, so strftime() is
+ * called at most once per second (and thread).
+ */
+static const char *
+FormatLogDate(time_t t) noexcept
 {
-	static char buf[32];
-	time_t t;
-	struct tm *tmp;
+	static thread_local char buf[32];
+	static thread_local time_t cached_time = -1;
 
-	t = time(nullptr);
-	tmp = localtime(&t);
-	if (tmp == nullptr) {
-		buf[0] = 0;
+	if (t == cached_time)
 		return buf;
-	}
 
-	if (!strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S%z", tmp)) {
+	cached_time = t;
+	buf[0] = 0;
+
+#ifdef _WIN32
+	const struct tm *tmp = localtime(&t);
+#else
+	struct tm tm;
+	const struct tm *tmp = localtime_r(&t, &tm);
+#endif
+	if (tmp != nullptr &&
+	    !strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S%z", tmp))
 		buf[0] = 0;
-		return buf;
-	}
+
 	return buf;
 }
 
+const char *
+log_date() noexcept
+{
+	return FormatLogDate(time(nullptr));
+}
+
 static void
 log_init_file(const char *path)
 {
@@ -74,7 +220,9 @@ log_init_file(const char *path)
 			throw FormatErrno("cannot open %s", path);
 	}
 
-	setvbuf(log_file, nullptr, _IONBF, 0);
+	/* each message (or each batch written by the log thread)
+	   is flushed explicitly */
+	setvbuf(log_file, nullptr, _IOFBF, 16384);
 }
 
 #ifdef HAVE_SYSLOG
@@ -133,9 +281,135 @@ log_init(const char *path, int verbose)
 		log_init_file(path);
 }
 
+/**
+ * Write one message, without flushing #log_file.
+ */
+static void
+WriteMessage([[maybe_unused]] LogLevel level, time_t t,
+	     const char *msg, std::size_t length) noexcept
+{
+#ifdef HAVE_SYSLOG
+	if (log_file == nullptr) {
+		syslog(ToSyslog(level), "%.*s", int(length), msg);
+		return;
+	}
+#endif
+
+	fprintf(log_file, "%s %.*s\n", FormatLogDate(t), int(length), msg);
+}
+
+static void
+WriteMessageNow(LogLevel level, const char *msg, std::size_t length) noexcept
+{
+	WriteMessage(level, time(nullptr), msg, length);
+
+	if (log_file != nullptr)
+		fflush(log_file);
+}
+
+/**
+ * Write all queued messages.
+ *
+ * @return true if at least one message was written
+ */
+static bool
+FlushQueue() noexcept
+{
+	bool any = false;
+
+	while (const auto *slot = log_queue.Front()) {
+		WriteMessage(slot->level, slot->time,
+			     slot->text, slot->length);
+		log_queue.Pop();
+		any = true;
+	}
+
+	if (any && log_file != nullptr)
+		fflush(log_file);
+
+	return any;
+}
+
+static void
+LogThread() noexcept
+{
+#ifndef _WIN32
+	/* signals are handled by the SignalMonitor in the
+	   EventLoop thread */
+	sigset_t mask;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+#endif
+
+	while (true) {
+		FlushQueue();
+
+		if (log_thread_quit.load()) {
+			FlushQueue();
+			break;
+		}
+
+		const unsigned wakeup = log_wakeup.load();
+		log_thread_sleeping.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (log_queue.Front() == nullptr && !log_thread_quit.load())
+			log_wakeup.wait(wakeup);
+
+		log_thread_sleeping.store(false);
+	}
+}
+
+static void
+WakeLogThread() noexcept
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (log_thread_sleeping.load()) {
+		log_wakeup.fetch_add(1);
+		log_wakeup.notify_one();
+	}
+}
+
+void
+log_start_thread()
+{
+	assert(!log_thread.joinable());
+
+	log_thread_quit.store(false);
+	log_thread = std::thread(LogThread);
+	log_thread_running.store(true);
+}
+
+static void
+StopLogThread() noexcept
+{
+	if (!log_thread.joinable())
+		return;
+
+	log_thread_running.store(false);
+	log_thread_quit.store(true);
+	log_wakeup.fetch_add(1);
+	log_wakeup.notify_one();
+	log_thread.join();
+}
+
+/**
+ * Stops the thread at exit if log_deinit() has not been called
+ * (e.g. after an exception); a joinable std::thread must not be
+ * destroyed.
+ */
+static struct LogThreadGuard {
+	~LogThreadGuard() noexcept {
+		StopLogThread();
+	}
+} log_thread_guard;
+
 void
 log_deinit() noexcept
 {
+	StopLogThread();
+
 #ifndef HAVE_SYSLOG
 	assert(log_file != nullptr);
 
@@ -147,45 +421,84 @@ log_deinit() noexcept
 		fclose(log_file);
 }
 
+/**
+ * Reserve a slot in #log_queue if the log thread is running.
+ */
+static LogQueue::Slot *
+ReserveSlot(LogLevel level, std::size_t &position_r) noexcept
+{
+	if (!log_thread_running.load(std::memory_order_relaxed))
+		return nullptr;
+
+	auto *slot = log_queue.Reserve(position_r);
+	for (unsigned i = 0; slot == nullptr && i < 64; ++i) {
+		/* full: give the log thread a chance before falling
+		   back to a synchronous write (which may reorder
+		   messages) */
+		std::this_thread::yield();
+		slot = log_queue.Reserve(position_r);
+	}
+
+	if (slot != nullptr) {
+		slot->level = level;
+		slot->time = time(nullptr);
+	}
+
+	return slot;
+}
+
+static void
+CommitSlot(LogQueue::Slot &slot, std::size_t position) noexcept
+{
+	log_queue.Commit(slot, position);
+	WakeLogThread();
+}
+
 void
 Log(LogLevel level, const char *msg) noexcept
 {
-	if (level > log_threshold)
+	if (!LogLevelEnabled(level))
 		return;
 
-#ifdef HAVE_SYSLOG
-	if (log_file == nullptr)
-		syslog(ToSyslog(level), "%s", msg);
-	else
-#endif
-		fprintf(log_file, "%s %s\n", log_date(), msg);
+	const std::size_t length = strlen(msg);
+
+	std::size_t position;
+	auto *slot = ReserveSlot(level, position);
+	if (slot == nullptr) {
+		WriteMessageNow(level, msg, length);
+		return;
+	}
+
+	slot->length = std::min(length, sizeof(slot->text));
+	memcpy(slot->text, msg, slot->length);
+	CommitSlot(*slot, position);
 }
 
 void
 LogFormat(LogLevel level, const char *fmt, ...) noexcept
 {
-	if (level > log_threshold)
+	if (!LogLevelEnabled(level))
 		return;
 
-#ifdef HAVE_SYSLOG
-	if (log_file == nullptr) {
-		va_list ap;
-		va_start(ap, fmt);
-		vsyslog(ToSyslog(level), fmt, ap);
-		va_end(ap);
-	} else {
-#endif
-		char msg[1024];
+	std::size_t position;
+	auto *slot = ReserveSlot(level, position);
 
-		{
-			va_list ap;
-			va_start(ap, fmt);
-			vsnprintf(msg, sizeof(msg), fmt, ap);
-			va_end(ap);
-		}
+	char buffer[1024];
+	char *const msg = slot != nullptr ? slot->text : buffer;
+	static_assert(sizeof(buffer) == sizeof(slot->text));
 
-		fprintf(log_file, "%s %s\n", log_date(), msg);
-#ifdef HAVE_SYSLOG
+	va_list ap;
+	va_start(ap, fmt);
+	const int length = vsnprintf(msg, sizeof(buffer), fmt, ap);
+	va_end(ap);
+
+	const std::size_t n = std::clamp<int>(length, 0, sizeof(buffer) - 1);
+
+	if (slot == nullptr) {
+		WriteMessageNow(level, msg, n);
+		return;
 	}
-#endif
+
+	slot->length = n;
+	CommitSlot(*slot, position);
 }
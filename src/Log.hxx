@@ -32,15 +32,41 @@ enum class LogLevel {
 	ERROR,
 };
 
+/**
+ * Messages with a lower level are discarded.  Don't modify;
+ * log_init() sets it.
+ */
+extern LogLevel log_threshold;
+
 /**
  * Throws on error.
  */
 void
 log_init(const char *path, int verbose);
 
+/**
+ * Start the thread which writes the log messages in the background.
+ * Until then, they are written synchronously.  Call this after
+ * daemonize_detach(), because threads don't survive fork().
+ *
+ * Throws on error.
+ */
+void
+log_start_thread();
+
+/**
+ * Writes all pending messages, stops the thread and closes the log.
+ */
 void
 log_deinit() noexcept;
 
+[[gnu::pure]]
+inline bool
+LogLevelEnabled(LogLevel level) noexcept
+{
+	return level >= log_threshold;
+}
+
 const char *
 log_date() noexcept;
 
@@ -63,32 +89,39 @@ gcc_printf(2, 3)
 void
 LogFormat(LogLevel level, const char *fmt, ...) noexcept;
 
+/* the FormatX() functions check the level inline, so filtered
+   messages cost neither a call nor any formatting */
+
 template<typename... Args>
 inline void
 FormatDebug(const char *fmt, Args&&... args) noexcept
 {
-	LogFormat(LogLevel::DEBUG, fmt, std::forward<Args>(args)...);
+	if (LogLevelEnabled(LogLevel::DEBUG))
+		LogFormat(LogLevel::DEBUG, fmt, std::forward<Args>(args)...);
 }
 
 template<typename... Args>
 inline void
 FormatInfo(const char *fmt, Args&&... args) noexcept
 {
-	LogFormat(LogLevel::INFO, fmt, std::forward<Args>(args)...);
+	if (LogLevelEnabled(LogLevel::INFO))
+		LogFormat(LogLevel::INFO, fmt, std::forward<Args>(args)...);
 }
 
 template<typename... Args>
 inline void
 FormatWarning(const char *fmt, Args&&... args) noexcept
 {
-	LogFormat(LogLevel::WARNING, fmt, std::forward<Args>(args)...);
+	if (LogLevelEnabled(LogLevel::WARNING))
+		LogFormat(LogLevel::WARNING, fmt, std::forward<Args>(args)...);
 }
 
 template<typename... Args>
 inline void
 FormatError(const char *fmt, Args&&... args) noexcept
 {
-	LogFormat(LogLevel::ERROR, fmt, std::forward<Args>(args)...);
+	if (LogLevelEnabled(LogLevel::ERROR))
+		LogFormat(LogLevel::ERROR, fmt, std::forward<Args>(args)...);
 }
 
 #endif
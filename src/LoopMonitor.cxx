@@ -0,0 +1,133 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "LoopMonitor.hxx"
+#include "event/Loop.hxx"
+#include "Log.hxx"
+
+#include <string_view>
+
+static constexpr const char *callback_type_names[] = {
+	"socket",
+	"coarse_timer",
+	"fine_timer",
+	"defer",
+	"idle",
+	"inject",
+};
+
+static_assert(std::size(callback_type_names) ==
+	      EventLoopObserver::N_CALLBACK_TYPES);
+
+LoopMonitor::LoopMonitor(EventLoop &_loop,
+			 Event::Duration _slow_threshold) noexcept
+	:loop(_loop), slow_threshold(_slow_threshold),
+	 durations{
+		 Histogram{WRITE_DURATION_BUCKETS},
+		 Histogram{WRITE_DURATION_BUCKETS},
+		 Histogram{WRITE_DURATION_BUCKETS},
+		 Histogram{WRITE_DURATION_BUCKETS},
+		 Histogram{WRITE_DURATION_BUCKETS},
+		 Histogram{WRITE_DURATION_BUCKETS},
+	 }
+{
+	loop.SetObserver(this);
+}
+
+LoopMonitor::~LoopMonitor() noexcept
+{
+	loop.SetObserver(nullptr);
+}
+
+/**
+ * Extract the method name from a string generated by
+ * BindMethodDetail::MethodName(), e.g. "&Foo::Bar" from
+ * "... [with auto method = &Foo::Bar]".
+ */
+static constexpr std::string_view
+ExtractMethodName(std::string_view s) noexcept
+{
+	auto i = s.rfind('[');
+	if (i == s.npos)
+		return s;
+
+	i = s.find(" = ", i);
+	if (i == s.npos)
+		return s;
+
+	s = s.substr(i + 3);
+	if (s.starts_with('&'))
+		s.remove_prefix(1);
+
+	return s.substr(0, s.find_first_of("];"));
+}
+
+void
+LoopMonitor::OnCallback(CallbackType type, Event::Duration duration,
+			const char *name) noexcept
+{
+	durations[unsigned(type)].Observe(duration);
+
+	if (duration >= slow_threshold) {
+		++n_slow;
+
+		const auto method = name != nullptr
+			? ExtractMethodName(name)
+			: std::string_view{"?"};
+
+		FormatWarning("slow %s callback %.*s: %.1f ms",
+			      callback_type_names[unsigned(type)],
+			      int(method.size()), method.data(),
+			      std::chrono::duration<double, std::milli>(duration).count());
+	}
+}
+
+void
+LoopMonitor::OnTimerLateness(CallbackType type,
+			     Event::Duration lateness) noexcept
+{
+	(type == CallbackType::FINE_TIMER ? fine_lateness : coarse_lateness)
+		.Observe(lateness);
+}
+
+void
+LoopMonitor::WriteMetrics(MetricsWriter &w) const
+{
+	w.Describe("mpdscribble_loop_callback_duration_seconds", "histogram",
+		   "How long event loop callbacks took.");
+	for (unsigned i = 0; i < N_CALLBACK_TYPES; ++i)
+		w.Write("mpdscribble_loop_callback_duration_seconds",
+			MetricsWriter::MakeLabel("type",
+						 callback_type_names[i]),
+			durations[i]);
+
+	w.Describe("mpdscribble_loop_timer_lateness_seconds", "histogram",
+		   "How long after their due time timers were invoked.");
+	w.Write("mpdscribble_loop_timer_lateness_seconds",
+		MetricsWriter::MakeLabel("timer", "coarse"),
+		coarse_lateness);
+	w.Write("mpdscribble_loop_timer_lateness_seconds",
+		MetricsWriter::MakeLabel("timer", "fine"),
+		fine_lateness);
+
+	w.Describe("mpdscribble_loop_slow_callbacks_total", "counter",
+		   "Event loop callbacks which took longer than loop_slow_threshold.");
+	w.Write("mpdscribble_loop_slow_callbacks_total", {}, n_slow);
+}
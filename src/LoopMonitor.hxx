@@ -0,0 +1,72 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef LOOP_MONITOR_HXX
+#define LOOP_MONITOR_HXX
+
+#include "event/LoopObserver.hxx"
+#include "Metrics.hxx"
+
+#include <array>
+#include <cstdint>
+
+class EventLoop;
+
+/**
+ * Collects the callback durations and the timer lateness of an
+ * #EventLoop for the metrics endpoint, and logs callbacks which
+ * block the loop for too long.
+ */
+class LoopMonitor final : public EventLoopObserver {
+	EventLoop &loop;
+
+	const Event::Duration slow_threshold;
+
+	std::array<Histogram, N_CALLBACK_TYPES> durations;
+
+	Histogram coarse_lateness{LATENESS_BUCKETS};
+	Histogram fine_lateness{LATENESS_BUCKETS};
+
+	uint_least64_t n_slow = 0;
+
+public:
+	/**
+	 * Registers itself as the loop's #EventLoopObserver.
+	 */
+	LoopMonitor(EventLoop &_loop, Event::Duration _slow_threshold) noexcept;
+	~LoopMonitor() noexcept;
+
+	LoopMonitor(const LoopMonitor &) = delete;
+	LoopMonitor &operator=(const LoopMonitor &) = delete;
+
+	/**
+	 * Throws std::bad_alloc.
+	 */
+	void WriteMetrics(MetricsWriter &w) const;
+
+private:
+	/* virtual methods from EventLoopObserver */
+	void OnCallback(CallbackType type, Event::Duration duration,
+			const char *name) noexcept override;
+	void OnTimerLateness(CallbackType type,
+			     Event::Duration lateness) noexcept override;
+};
+
+#endif
@@ -23,150 +23,75 @@
 #include "CommandLine.hxx"
 #include "ReadConfig.hxx"
 #include "Config.hxx"
+#include "Import.hxx"
+#include "ImportFeeder.hxx"
+#include "Simulator.hxx"
+#include "Journal.hxx"
+#include "DedupIndex.hxx"
 #include "Log.hxx"
 #include "lib/gcrypt/Init.hxx"
 #include "util/PrintException.hxx"
+#include "util/RuntimeError.hxx"
 #include "SdDaemon.hxx"
 
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
 #include <stdlib.h>
 #include <unistd.h>
 
-static std::chrono::steady_clock::duration
-GetSongDuration(const struct mpd_song *song) noexcept
+static ImportResult
+LoadImport(const Config &config)
 {
-#if LIBMPDCLIENT_CHECK_VERSION(2,10,0)
-	return std::chrono::milliseconds(mpd_song_get_duration_ms(song));
-#else
-	return std::chrono::seconds(mpd_song_get_duration(song));
-#endif
-}
+	const auto start = std::chrono::steady_clock::now();
 
-static constexpr bool
-played_long_enough(std::chrono::steady_clock::duration elapsed,
-		   std::chrono::steady_clock::duration length) noexcept
-{
-	/* http://www.lastfm.de/api/submissions "The track must have been
-	   played for a duration of at least 240 seconds or half the track's
-	   total length, whichever comes first. Skipping or pausing the
-	   track is irrelevant as long as the appropriate amount has been
-	   played."
-	 */
-	return elapsed > std::chrono::minutes(4) ||
-		(length >= std::chrono::seconds(30) && elapsed > length / 2);
-}
+	auto result = import_history(config.import_path.c_str(),
+				     std::thread::hardware_concurrency());
 
-/**
- * This function determines if a song is played repeatedly: according
- * to MPD, the current song hasn't changed, and now we're comparing
- * the "elapsed" value with the previous one.
- */
-static bool
-song_repeated(const struct mpd_song *song,
-	      std::chrono::steady_clock::duration elapsed,
-	      std::chrono::steady_clock::duration prev_elapsed) noexcept
-{
-	return elapsed < std::chrono::minutes(1) && prev_elapsed > elapsed &&
-		played_long_enough(prev_elapsed - elapsed,
-				   GetSongDuration(song));
-}
+	const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	FormatInfo("import: loaded %zu songs from %s in %u ms "
+		   "(%zu invalid, %zu duplicates)",
+		   result.records.size(), config.import_path.c_str(),
+		   (unsigned)duration.count(),
+		   result.n_invalid, result.n_duplicates);
 
-static const char *
-artist(const struct mpd_song *song) noexcept
-{
-	if (mpd_song_get_tag(song, MPD_TAG_ARTIST, 0) != nullptr) {
-		return mpd_song_get_tag(song, MPD_TAG_ARTIST, 0);
-	} else {
-		return mpd_song_get_tag(song, MPD_TAG_ALBUM_ARTIST, 0);
-	}
-}
-
-void
-Instance::OnMpdSongChanged(const struct mpd_song *song) noexcept
-{
-	FormatInfo("new song detected (%s - %s), id: %u, pos: %u\n",
-		   artist(song),
-		   mpd_song_get_tag(song, MPD_TAG_TITLE, 0),
-		   mpd_song_get_id(song), mpd_song_get_pos(song));
-
-	stopwatch.Start();
-
-	scrobblers.NowPlaying(artist(song),
-			      mpd_song_get_tag(song, MPD_TAG_TITLE, 0),
-			      mpd_song_get_tag(song, MPD_TAG_ALBUM, 0),
-			      mpd_song_get_tag(song, MPD_TAG_TRACK, 0),
-			      mpd_song_get_tag(song, MPD_TAG_MUSICBRAINZ_TRACKID, 0),
-			      GetSongDuration(song));
+	return result;
 }
 
 /**
- * Pause mode on the current song was activated.
+ * Merge the imported records into the journal file specified with
+ * "--import-output".
  */
-void
-Instance::OnMpdPaused() noexcept
+static void
+ImportToJournal(const char *path, RecordQueue &&records)
 {
-	stopwatch.Stop();
-}
+	JournalReadInfo info;
+	auto queue = journal_read(path, &info);
 
-/**
- * The current song continues to play (after pause).
- */
-void
-Instance::OnMpdResumed() noexcept
-{
-	stopwatch.Resume();
-}
+	std::unordered_set<uint_least64_t> keys;
+	keys.reserve(queue.size() + records.size());
+	for (const auto &i : queue)
+		keys.insert(record_dedup_key(*i));
 
-/**
- * MPD started playing this song.
- */
-void
-Instance::OnMpdStarted(const struct mpd_song *song) noexcept
-{
-	OnMpdSongChanged(song);
-}
+	const std::size_t n_old = queue.size();
+	queue.reserve(n_old + records.size());
 
-/**
- * MPD is still playing the song.
- */
-void
-Instance::OnMpdPlaying(const struct mpd_song *song,
-		       std::chrono::steady_clock::duration elapsed) noexcept
-{
-	const auto prev_elapsed = stopwatch.GetDuration();
+	for (auto &i : records)
+		if (keys.insert(record_dedup_key(*i)).second)
+			queue.push_back(std::move(i));
 
-	if (song_repeated(song, elapsed, prev_elapsed)) {
-		/* the song is playing repeatedly: make it virtually
-		   stop and re-start */
-		LogDebug("repeated song detected");
+	records.clear();
 
-		OnMpdEnded(song, false);
-		OnMpdStarted(song);
-	}
-}
+	/* the binary format is much faster to load; mpdscribble
+	   converts it if the scrobbler is configured with
+	   "journal_format = text" */
+	if (!journal_write(path, queue, JournalFormat::BINARY) &&
+	    !queue.empty())
+		throw FormatRuntimeError("Failed to write %s", path);
 
-/**
- * MPD stopped playing this song.
- */
-void
-Instance::OnMpdEnded(const struct mpd_song *song, bool love) noexcept
-{
-	const auto elapsed = stopwatch.GetDuration();
-	const auto length = GetSongDuration(song);
-
-	if (!played_long_enough(elapsed, length))
-		return;
-
-	/* FIXME:
-	   libmpdclient doesn't have any way to fetch the musicbrainz id. */
-	scrobblers.SongChange(mpd_song_get_uri(song),
-			      artist(song),
-			      mpd_song_get_tag(song, MPD_TAG_TITLE, 0),
-			      mpd_song_get_tag(song, MPD_TAG_ALBUM, 0),
-			      mpd_song_get_tag(song, MPD_TAG_TRACK, 0),
-			      mpd_song_get_tag(song, MPD_TAG_MUSICBRAINZ_TRACKID, 0),
-			      length.count() > 0 ? length : elapsed,
-			      love,
-			      nullptr);
+	FormatInfo("import: added %zu songs to %s",
+		   queue.size() - n_old, path);
 }
 
 int
@@ -176,8 +101,27 @@ try {
 
 	Config config;
 	parse_cmdline(config, argc, argv);
+
+	/* SIGHUP loads the configuration file on top of this */
+	const Config command_line = config;
+
 	file_read_config(config);
 
+	if (!config.import_path.empty()) {
+		/* both processes would rewrite the same journals,
+		   and one would lose the other's songs */
+		if (config.import_output.empty() && !config.pidfile.empty())
+			daemonize_check_pidfile(config.pidfile.c_str());
+
+		/* don't observe MPD while importing, and don't
+		   overwrite the pid file of a running daemon */
+		config.mpd.clear();
+		config.pidfile.clear();
+	}
+
+	if (config.simulate_tenants > 0)
+		PrepareSimulation(config);
+
 	log_init(NullableString(config.log), config.verbose);
 
 	daemonize_init(NullableString(config.daemon_user),
@@ -194,21 +138,54 @@ try {
 #endif
 		daemonize_close_stdout_stderr();
 
+	log_start_thread();
+
 	Gcrypt::Init();
 
-	Instance instance(config);
+	std::optional<ImportResult> import;
+	if (!config.import_path.empty())
+		import.emplace(LoadImport(config));
+
+	if (import && !config.import_output.empty()) {
+		ImportToJournal(config.import_output.c_str(),
+				std::move(import->records));
+	} else {
+		Instance instance(config, command_line);
 
-	/* run the main loop */
+		std::optional<ImportFeeder> import_feeder;
+		if (import) {
+			import_feeder.emplace(instance.event_loop,
+					      instance.scrobblers,
+					      std::move(import->records));
+			import_feeder->Start();
+		}
 
-	sd_notify(0, "READY=1");
+		std::optional<Simulator> simulator;
+		if (config.simulate_tenants > 0) {
+			simulator.emplace(instance, config);
+			simulator->Start();
+		}
 
-	instance.Run();
+		/* run the main loop */
 
-	/* cleanup */
+		sd_notify(0, "READY=1");
 
-	LogInfo("shutting down");
+		instance.Run();
 
-	instance.scrobblers.WriteJournal();
+		/* cleanup */
+
+		LogInfo("shutting down");
+
+		if (import_feeder && !import_feeder->IsDone())
+			/* interrupted: the queued songs are saved in
+			   the journals, the rest in a separate file */
+			import_feeder->SaveRemaining((config.import_path + ".rest").c_str());
+
+		instance.scrobblers.WriteJournal();
+
+		/* the Instance destructor waits for the
+		   AsyncWriter, which may still log */
+	}
 
 	log_deinit();
 
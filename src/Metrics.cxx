@@ -0,0 +1,160 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "Metrics.hxx"
+
+#include <cmath>
+
+#include <stdio.h>
+
+double
+Histogram::GetQuantile(double q) const noexcept
+{
+	if (count == 0)
+		return NAN;
+
+	const double rank = q * count;
+
+	uint_least64_t below = 0;
+	for (std::size_t i = 0; i < bounds.size(); ++i) {
+		if (below + counts[i] >= rank && counts[i] > 0) {
+			const double lower = i > 0 ? bounds[i - 1] : 0;
+			return lower + (bounds[i] - lower) *
+				(rank - below) / counts[i];
+		}
+
+		below += counts[i];
+	}
+
+	return bounds.empty() ? NAN : bounds.back();
+}
+
+void
+MetricsWriter::Describe(const char *name, const char *type,
+			const char *help)
+{
+	out.append("# HELP ").append(name).append(" ").append(help);
+	out.append("\n# TYPE ").append(name).append(" ").append(type);
+	out.push_back('\n');
+}
+
+void
+MetricsWriter::WriteName(const char *name, const char *suffix,
+			 std::string_view labels,
+			 std::string_view extra_label)
+{
+	out.append(name).append(suffix);
+
+	if (!labels.empty() || !extra_label.empty()) {
+		out.push_back('{');
+		out.append(labels);
+		if (!labels.empty() && !extra_label.empty())
+			out.push_back(',');
+		out.append(extra_label);
+		out.push_back('}');
+	}
+
+	out.push_back(' ');
+}
+
+void
+MetricsWriter::Write(const char *name, std::string_view labels,
+		     uint_least64_t value)
+{
+	WriteName(name, "", labels);
+	out.append(std::to_string(value));
+	out.push_back('\n');
+}
+
+static void
+AppendDouble(std::string &out, double value)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.9g", value);
+	out.append(buffer);
+}
+
+void
+MetricsWriter::Write(const char *name, std::string_view labels,
+		     double value)
+{
+	WriteName(name, "", labels);
+	AppendDouble(out, value);
+	out.push_back('\n');
+}
+
+void
+MetricsWriter::Write(const char *name, std::string_view labels,
+		     const Histogram &histogram)
+{
+	uint_least64_t cumulative = 0;
+
+	for (std::size_t i = 0; i <= histogram.bounds.size(); ++i) {
+		cumulative += histogram.counts[i];
+
+		std::string le = "le=\"";
+		if (i < histogram.bounds.size())
+			AppendDouble(le, histogram.bounds[i]);
+		else
+			le.append("+Inf");
+		le.push_back('"');
+
+		WriteName(name, "_bucket", labels, le);
+		out.append(std::to_string(cumulative));
+		out.push_back('\n');
+	}
+
+	WriteName(name, "_sum", labels);
+	AppendDouble(out, histogram.sum);
+	out.push_back('\n');
+
+	WriteName(name, "_count", labels);
+	out.append(std::to_string(histogram.count));
+	out.push_back('\n');
+}
+
+std::string
+MetricsWriter::MakeLabel(const char *name, std::string_view value)
+{
+	std::string result = name;
+	result.append("=\"");
+
+	for (const char ch : value) {
+		switch (ch) {
+		case '\\':
+			result.append("\\\\");
+			break;
+
+		case '"':
+			result.append("\\\"");
+			break;
+
+		case '\n':
+			result.append("\\n");
+			break;
+
+		default:
+			result.push_back(ch);
+		}
+	}
+
+	result.push_back('"');
+	return result;
+}
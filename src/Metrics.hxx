@@ -0,0 +1,176 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef METRICS_HXX
+#define METRICS_HXX
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+/**
+ * Upper bounds (in seconds) of the histogram buckets for HTTP
+ * round trips.
+ */
+inline constexpr double LATENCY_BUCKETS[] = {
+	0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60,
+};
+
+/**
+ * Upper bounds (in seconds) of the histogram buckets for file
+ * writes.
+ */
+inline constexpr double WRITE_DURATION_BUCKETS[] = {
+	0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5,
+};
+
+/**
+ * Upper bounds (in seconds) of the histogram buckets for timer
+ * lateness.  Coarse timers have a granularity of about one second.
+ */
+inline constexpr double LATENESS_BUCKETS[] = {
+	0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 2, 5, 10,
+};
+
+/**
+ * A histogram with fixed bucket boundaries.  Each observation
+ * increments exactly one bucket; the cumulative counts are only
+ * calculated by MetricsWriter.
+ *
+ * This class is not thread-safe; it is only updated and read in
+ * the main thread, so updating it costs a few integer operations.
+ */
+class Histogram {
+	static constexpr std::size_t MAX_BUCKETS = 16;
+
+	std::span<const double> bounds;
+
+	/**
+	 * One counter per bucket; the last one is the implicit
+	 * "+Inf" bucket.
+	 */
+	std::array<uint_least64_t, MAX_BUCKETS + 1> counts{};
+
+	double sum = 0;
+
+	uint_least64_t count = 0;
+
+public:
+	explicit constexpr Histogram(std::span<const double> _bounds) noexcept
+		:bounds(_bounds) {
+		static_assert(std::size(LATENCY_BUCKETS) <= MAX_BUCKETS);
+		static_assert(std::size(WRITE_DURATION_BUCKETS) <= MAX_BUCKETS);
+		static_assert(std::size(LATENESS_BUCKETS) <= MAX_BUCKETS);
+	}
+
+	constexpr void Observe(double value) noexcept {
+		std::size_t i = 0;
+		while (i < bounds.size() && value > bounds[i])
+			++i;
+
+		++counts[i];
+		sum += value;
+		++count;
+	}
+
+	void Observe(std::chrono::steady_clock::duration value) noexcept {
+		Observe(std::chrono::duration<double>(value).count());
+	}
+
+	uint_least64_t GetCount() const noexcept {
+		return count;
+	}
+
+	/**
+	 * Add the observations of another histogram with the same
+	 * bounds.
+	 */
+	void Add(const Histogram &other) noexcept {
+		for (std::size_t i = 0; i <= bounds.size(); ++i)
+			counts[i] += other.counts[i];
+		sum += other.sum;
+		count += other.count;
+	}
+
+	/**
+	 * Estimate a quantile (0 to 1) by linear interpolation within
+	 * its bucket, like Prometheus' histogram_quantile().  Returns
+	 * the highest bound if it falls into the "+Inf" bucket, and
+	 * NaN if there are no observations.
+	 */
+	[[gnu::pure]]
+	double GetQuantile(double q) const noexcept;
+
+	friend class MetricsWriter;
+};
+
+/**
+ * Generates the Prometheus text exposition format.  All series of
+ * one metric must be written right after its Describe() call.
+ */
+class MetricsWriter {
+	std::string &out;
+
+public:
+	explicit MetricsWriter(std::string &_out) noexcept
+		:out(_out) {}
+
+	void Describe(const char *name, const char *type,
+		      const char *help);
+
+	/**
+	 * @param labels a label list generated by MakeLabel() (or
+	 * several of them, separated by commas); may be empty
+	 */
+	void Write(const char *name, std::string_view labels,
+		   uint_least64_t value);
+
+	void Write(const char *name, std::string_view labels,
+		   double value);
+
+	void Write(const char *name, std::string_view labels,
+		   const Histogram &histogram);
+
+	/**
+	 * Format one label with proper escaping, e.g.
+	 * `scrobbler="last.fm"`.
+	 */
+	static std::string MakeLabel(const char *name,
+				     std::string_view value);
+
+private:
+	void WriteName(const char *name, const char *suffix,
+		       std::string_view labels,
+		       std::string_view extra_label={});
+};
+
+class MetricsHandler {
+public:
+	/**
+	 * Write all metrics.  May throw std::bad_alloc.
+	 */
+	virtual void WriteMetrics(MetricsWriter &w) = 0;
+};
+
+#endif
@@ -0,0 +1,375 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "MetricsServer.hxx"
+#include "Metrics.hxx"
+#include "Log.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "system/Error.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <string_view>
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/**
+ * Requests larger than this are rejected.
+ */
+static constexpr std::size_t MAX_REQUEST_SIZE = 8192;
+
+/**
+ * Close connections which have not finished after this duration.
+ */
+static constexpr Event::Duration CONNECTION_TIMEOUT = std::chrono::seconds{10};
+
+/**
+ * After accept() has run out of file descriptors, stop accepting
+ * connections for this duration; the listener is level-triggered
+ * and would otherwise spin.
+ */
+static constexpr Event::Duration ACCEPT_RETRY_DELAY = std::chrono::seconds{1};
+
+class MetricsServer::Connection final : public AutoUnlinkIntrusiveListHook {
+	MetricsHandler &handler;
+
+	SocketEvent socket;
+
+	CoarseTimerEvent timeout_timer;
+
+	std::string request, response;
+
+	/**
+	 * The number of bytes of #response which have been sent
+	 * already.
+	 */
+	std::size_t sent = 0;
+
+public:
+	Connection(EventLoop &event_loop, SocketDescriptor fd,
+		   MetricsHandler &_handler) noexcept
+		:handler(_handler),
+		 socket(event_loop, BIND_THIS_METHOD(OnSocketReady), fd),
+		 timeout_timer(event_loop, BIND_THIS_METHOD(Destroy))
+	{
+		socket.ScheduleRead();
+		timeout_timer.Schedule(CONNECTION_TIMEOUT);
+	}
+
+	~Connection() noexcept {
+		socket.Close();
+	}
+
+	void Destroy() noexcept {
+		delete this;
+	}
+
+private:
+	void Respond(const char *status, std::string_view body) noexcept;
+	void OnRequest() noexcept;
+	bool TryWrite() noexcept;
+	void OnSocketReady(unsigned events) noexcept;
+};
+
+void
+MetricsServer::Connection::Respond(const char *status,
+				   std::string_view body) noexcept
+try {
+	response = "HTTP/1.0 ";
+	response.append(status);
+	response.append("\r\n"
+			"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: ");
+	response.append(std::to_string(body.size()));
+	response.append("\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+	response.append(body);
+
+	request = {};
+	socket.ScheduleWrite();
+} catch (...) {
+	Destroy();
+}
+
+inline void
+MetricsServer::Connection::OnRequest() noexcept
+{
+	if (!request.starts_with("GET ")) {
+		Respond("405 Method Not Allowed", "Method Not Allowed\n");
+		return;
+	}
+
+	std::string body;
+
+	try {
+		MetricsWriter w(body);
+		handler.WriteMetrics(w);
+	} catch (...) {
+		Respond("500 Internal Server Error", "Out of memory\n");
+		return;
+	}
+
+	Respond("200 OK", body);
+}
+
+inline bool
+MetricsServer::Connection::TryWrite() noexcept
+{
+	const std::string_view rest = std::string_view{response}.substr(sent);
+	ssize_t nbytes = send(socket.GetSocket().Get(), rest.data(),
+			      rest.size(), MSG_DONTWAIT|MSG_NOSIGNAL);
+	if (nbytes < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	sent += nbytes;
+	if (sent < response.size())
+		return true;
+
+	/* done; this is HTTP/1.0 without keep-alive */
+	shutdown(socket.GetSocket().Get(), SHUT_WR);
+	return false;
+}
+
+void
+MetricsServer::Connection::OnSocketReady(unsigned events) noexcept
+{
+	if (!response.empty()) {
+		if (!TryWrite())
+			Destroy();
+		return;
+	}
+
+	if (events & (SocketEvent::ERROR|SocketEvent::HANGUP)) {
+		Destroy();
+		return;
+	}
+
+	char buffer[1024];
+	ssize_t nbytes = recv(socket.GetSocket().Get(), buffer,
+			      sizeof(buffer), MSG_DONTWAIT);
+	if (nbytes < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			Destroy();
+		return;
+	}
+
+	if (nbytes == 0) {
+		Destroy();
+		return;
+	}
+
+	if (request.size() + nbytes > MAX_REQUEST_SIZE) {
+		Destroy();
+		return;
+	}
+
+	request.append(buffer, nbytes);
+
+	/* we don't care about the request headers; wait until they
+	   are complete, or else the client may get a connection
+	   reset */
+	if (request.find("\r\n\r\n") != request.npos ||
+	    request.find("\n\n") != request.npos) {
+		socket.CancelRead();
+		OnRequest();
+	}
+}
+
+static int
+BindLocal(const char *path)
+{
+	struct sockaddr_un sun{};
+	sun.sun_family = AF_UNIX;
+
+	const size_t length = strlen(path);
+	if (length >= sizeof(sun.sun_path))
+		throw FormatRuntimeError("Socket path is too long: %s", path);
+
+	memcpy(sun.sun_path, path, length);
+	if (path[0] == '@')
+		/* abstract socket */
+		sun.sun_path[0] = 0;
+	else {
+		/* delete the stale socket from a previous run, but
+		   nothing else (e.g. after a typo in the path) */
+		struct stat st;
+		if (lstat(path, &st) == 0) {
+			if (!S_ISSOCK(st.st_mode))
+				throw FormatRuntimeError("Not a socket: %s",
+							 path);
+
+			unlink(path);
+		}
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		throw MakeErrno("Failed to create socket");
+
+	if (bind(fd, (const struct sockaddr *)&sun,
+		 offsetof(struct sockaddr_un, sun_path) + length) < 0) {
+		const int e = errno;
+		close(fd);
+		throw FormatErrno(e, "Failed to bind to %s", path);
+	}
+
+	return fd;
+}
+
+static int
+BindTCP(const char *address)
+{
+	std::string_view host = address, port;
+
+	if (const auto colon = host.rfind(':'); colon != host.npos) {
+		port = host.substr(colon + 1);
+		host = host.substr(0, colon);
+	} else {
+		/* only a port number was specified */
+		port = host;
+		host = {};
+	}
+
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+		/* IPv6 address in square brackets */
+		host = host.substr(1, host.size() - 2);
+
+	if (port.empty())
+		throw FormatRuntimeError("No port in metrics address: %s",
+					 address);
+
+	const std::string host_string{host}, port_string{port};
+
+	struct addrinfo hints{};
+	hints.ai_flags = AI_PASSIVE|AI_ADDRCONFIG;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *ai;
+	int result = getaddrinfo(host_string.empty()
+				 ? nullptr : host_string.c_str(),
+				 port_string.c_str(), &hints, &ai);
+	if (result != 0)
+		throw FormatRuntimeError("Failed to resolve %s: %s",
+					 address, gai_strerror(result));
+
+	int fd = -1, e = 0;
+	for (const struct addrinfo *i = ai; i != nullptr && fd < 0;
+	     i = i->ai_next) {
+		fd = socket(i->ai_family,
+			    SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			e = errno;
+			continue;
+		}
+
+		const int reuse = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+			   &reuse, sizeof(reuse));
+
+		if (bind(fd, i->ai_addr, i->ai_addrlen) < 0) {
+			e = errno;
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	freeaddrinfo(ai);
+
+	if (fd < 0)
+		throw FormatErrno(e, "Failed to bind to %s", address);
+
+	return fd;
+}
+
+MetricsServer::MetricsServer(EventLoop &event_loop, const char *address,
+			     MetricsHandler &_handler)
+	:handler(_handler),
+	 listener(event_loop, BIND_THIS_METHOD(OnListenerReady)),
+	 accept_retry_timer(event_loop, BIND_THIS_METHOD(OnAcceptRetryTimer))
+{
+	const bool local = address[0] == '/' || address[0] == '@';
+
+	int fd = local ? BindLocal(address) : BindTCP(address);
+
+	if (listen(fd, 16) < 0) {
+		const int e = errno;
+		close(fd);
+		throw FormatErrno(e, "Failed to listen on %s", address);
+	}
+
+	if (address[0] == '/')
+		unlink_path = address;
+
+	listener.Open(SocketDescriptor{fd});
+	listener.ScheduleRead();
+}
+
+MetricsServer::~MetricsServer() noexcept
+{
+	connections.clear_and_dispose([](Connection *c){
+		c->Destroy();
+	});
+
+	listener.Close();
+
+	if (!unlink_path.empty())
+		unlink(unlink_path.c_str());
+}
+
+void
+MetricsServer::OnListenerReady(unsigned) noexcept
+{
+	const int fd = accept4(listener.GetSocket().Get(), nullptr, nullptr,
+			       SOCK_NONBLOCK|SOCK_CLOEXEC);
+	if (fd < 0) {
+		const int e = errno;
+		if (e == EAGAIN || e == EINTR)
+			return;
+
+		FormatError("Failed to accept metrics connection: %s",
+			    strerror(e));
+
+		if (e == EMFILE || e == ENFILE || e == ENOBUFS ||
+		    e == ENOMEM) {
+			/* the pending connection remains, so the
+			   listener would be ready again immediately */
+			listener.Cancel();
+			accept_retry_timer.Schedule(ACCEPT_RETRY_DELAY);
+		}
+
+		return;
+	}
+
+	auto *c = new Connection(listener.GetEventLoop(),
+				 SocketDescriptor{fd}, handler);
+	connections.push_back(*c);
+}
+
+void
+MetricsServer::OnAcceptRetryTimer() noexcept
+{
+	listener.ScheduleRead();
+}
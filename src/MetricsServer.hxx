@@ -0,0 +1,76 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef METRICS_SERVER_HXX
+#define METRICS_SERVER_HXX
+
+#include "event/SocketEvent.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <string>
+
+class MetricsHandler;
+
+/**
+ * A tiny HTTP server which responds to every "GET" request with
+ * the metrics in the Prometheus text exposition format.  It listens
+ * on a local socket (absolute path or "@abstract") or on a TCP
+ * address ("HOST:PORT").
+ */
+class MetricsServer final {
+	class Connection;
+
+	MetricsHandler &handler;
+
+	SocketEvent listener;
+
+	/**
+	 * Re-enables #listener after accept() has failed because
+	 * the process has run out of file descriptors.
+	 */
+	CoarseTimerEvent accept_retry_timer;
+
+	/**
+	 * The path of the local socket which will be deleted by the
+	 * destructor; empty if this is not a (non-abstract) local
+	 * socket.
+	 */
+	std::string unlink_path;
+
+	IntrusiveList<Connection> connections;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	MetricsServer(EventLoop &event_loop, const char *address,
+		      MetricsHandler &_handler);
+	~MetricsServer() noexcept;
+
+	MetricsServer(const MetricsServer &) = delete;
+	MetricsServer &operator=(const MetricsServer &) = delete;
+
+private:
+	void OnListenerReady(unsigned events) noexcept;
+	void OnAcceptRetryTimer() noexcept;
+};
+
+#endif
@@ -0,0 +1,56 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MPD_CONFIG_HXX
+#define MPD_CONFIG_HXX
+
+#include <forward_list>
+#include <string>
+
+/**
+ * Configuration of one MPD server to be observed.
+ */
+struct MpdConfig {
+	/**
+	 * The name of the "[mpd:NAME]" section; empty for the
+	 * default server configured in the global section.  It is
+	 * used in log messages.
+	 */
+	std::string name;
+
+	/**
+	 * The name of the tenant this server belongs to; empty if it
+	 * was configured in the main configuration file.
+	 */
+	std::string tenant;
+
+	std::string host;
+
+	unsigned port = 0;
+
+	/**
+	 * The names of the scrobbler sections which receive the
+	 * songs played by this server.  An empty list means all
+	 * scrobblers.
+	 */
+	std::forward_list<std::string> scrobblers;
+};
+
+#endif
@@ -20,25 +20,23 @@
 
 #include "MpdObserver.hxx"
 #include "Log.hxx"
+#include "Probe.hxx"
+#include "util/Exception.hxx"
 
 #include <cassert>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 
 #include <string.h>
 #include <stdio.h>
-
-void
-MpdObserver::HandleError() noexcept
-{
-	FormatWarning("mpd error (%u): %s",
-		      mpd_connection_get_error(connection),
-		      mpd_connection_get_error_message(connection));
-
-	mpd_connection_free(connection);
-	connection = nullptr;
-
-	socket.Abandon();
-}
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 static std::string
 settings_name(const struct mpd_settings *settings) noexcept
@@ -59,71 +57,347 @@ settings_name(const struct mpd_settings *settings) noexcept
 	return buffer;
 }
 
-static std::string
-connection_settings_name(const struct mpd_connection *connection) noexcept
+/**
+ * The state of a getaddrinfo() call in a helper thread.  It is
+ * shared by the thread and the #MpdObserver, which may give up
+ * waiting at any time.
+ */
+struct MpdObserver::Resolver {
+	std::mutex mutex;
+
+	/**
+	 * The observer's event which is scheduled when the call
+	 * finishes; nullptr after the observer has given up.
+	 */
+	InjectEvent *event;
+
+	struct addrinfo *result = nullptr;
+
+	/**
+	 * The getaddrinfo() return value.
+	 */
+	int error = 0;
+
+	explicit Resolver(InjectEvent &_event) noexcept
+		:event(&_event) {}
+
+	~Resolver() noexcept {
+		if (result != nullptr)
+			freeaddrinfo(result);
+	}
+
+	Resolver(const Resolver &) = delete;
+	Resolver &operator=(const Resolver &) = delete;
+
+	/**
+	 * The helper thread's function.
+	 */
+	static void Run(std::shared_ptr<Resolver> r,
+			std::string host, std::string port) noexcept {
+		/* signals are handled by the SignalMonitor in the
+		   EventLoop thread */
+		sigset_t mask;
+		sigfillset(&mask);
+		pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+		struct addrinfo hints{};
+		hints.ai_flags = AI_ADDRCONFIG;
+		hints.ai_socktype = SOCK_STREAM;
+
+		struct addrinfo *result;
+		const int error = getaddrinfo(host.c_str(), port.c_str(),
+					      &hints, &result);
+
+		const std::scoped_lock lock{r->mutex};
+		r->error = error;
+		if (error == 0)
+			r->result = result;
+
+		if (r->event != nullptr)
+			r->event->Schedule();
+	}
+};
+
+void
+MpdObserver::Disconnect() noexcept
 {
-	const struct mpd_settings *settings =
-		mpd_connection_get_settings(connection);
-	if (settings == nullptr)
-		return "unknown";
+	timeout_timer.Cancel();
+	CancelResolve();
+
+	if (async != nullptr) {
+		/* mpd_async_free() closes the socket */
+		mpd_async_free(async);
+		async = nullptr;
+		socket.Abandon();
+	} else if (socket.IsDefined())
+		socket.Close();
+
+	if (parser != nullptr) {
+		mpd_parser_free(parser);
+		parser = nullptr;
+	}
+
+	if (status != nullptr) {
+		mpd_status_free(status);
+		status = nullptr;
+	}
 
-	return settings_name(settings);
+	if (received_song != nullptr) {
+		mpd_song_free(received_song);
+		received_song = nullptr;
+	}
+
+	if (message != nullptr) {
+		mpd_message_free(message);
+		message = nullptr;
+	}
+
+	FreeAddresses();
+
+	command = Command::NONE;
+	pending_idle = 0;
+	subscribed = false;
+}
+
+void
+MpdObserver::HandleError(const char *msg) noexcept
+{
+	FormatWarning("mpd error: %s", msg);
+
+	Disconnect();
+	ScheduleConnect();
+}
+
+void
+MpdObserver::HandleAsyncError() noexcept
+{
+	assert(async != nullptr);
+
+	if (mpd_async_get_error(async) == MPD_ERROR_CLOSED)
+		HandleError("connection closed");
+	else
+		HandleError(mpd_async_get_error_message(async));
+}
+
+/**
+ * Create a non-blocking socket and start connecting it to the
+ * given address.
+ *
+ * @return the socket or -1 on error (with errno set)
+ */
+static int
+ConnectNonBlock(int family, const struct sockaddr *address,
+		socklen_t address_length) noexcept
+{
+	int fd = socket(family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, address, address_length) < 0 && errno != EINPROGRESS) {
+		const int e = errno;
+		close(fd);
+		errno = e;
+		return -1;
+	}
+
+	return fd;
+}
+
+static int
+ConnectLocal(const char *path) noexcept
+{
+	struct sockaddr_un sun{};
+	sun.sun_family = AF_UNIX;
+
+	const size_t length = strlen(path);
+	if (length >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memcpy(sun.sun_path, path, length);
+	if (path[0] == '@')
+		/* abstract socket */
+		sun.sun_path[0] = 0;
+
+	return ConnectNonBlock(AF_UNIX, (const struct sockaddr *)&sun,
+			       offsetof(struct sockaddr_un, sun_path) + length);
 }
 
 bool
 MpdObserver::Connect() noexcept
 {
-	assert(connection == nullptr);
+	assert(async == nullptr);
+	assert(command == Command::NONE);
 
-	connection = mpd_connection_new(host, port, 0);
-	if (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS) {
-		HandleError();
+	if (settings == nullptr) {
+		FormatError("Out of memory");
 		return false;
 	}
 
-	const unsigned *version = mpd_connection_get_server_version(connection);
+	const char *host = mpd_settings_get_host(settings);
+	if (host == nullptr)
+		host = "localhost";
+
+	if (host[0] == '/' || host[0] == '@') {
+		const int fd = ConnectLocal(host);
+		if (fd < 0) {
+			FormatWarning("Failed to connect to %s: %s",
+				      host, strerror(errno));
+			return false;
+		}
 
-	if (mpd_connection_cmp_server_version(connection, 0, 16, 0) < 0) {
-		FormatWarning("Error: MPD version %d.%d.%d is too old (%s needed)",
-			      version[0], version[1], version[2],
-			      "0.16.0");
-		mpd_connection_free(connection);
-		connection = nullptr;
+		StartConnect(fd);
+		return true;
+	}
+
+	char port[16];
+	snprintf(port, sizeof(port), "%u", mpd_settings_get_port(settings));
+
+	/* getaddrinfo() may block for a long time, and it would
+	   stall all MPD sources and scrobblers in this thread */
+	try {
+		auto r = std::make_shared<Resolver>(resolve_event);
+		std::thread(Resolver::Run, r,
+			    std::string{host}, std::string{port}).detach();
+		resolver = std::move(r);
+	} catch (...) {
+		FormatWarning("Failed to resolve %s: %s", host,
+			      GetFullMessage(std::current_exception()).c_str());
 		return false;
 	}
 
-	const auto name = connection_settings_name(connection);
-	FormatInfo("connected to mpd %i.%i.%i at %s",
-		   version[0], version[1], version[2],
-		   name.c_str());
+	command = Command::RESOLVE;
+	timeout_timer.Schedule(RESPONSE_TIMEOUT);
+	return true;
+}
 
-	socket.Open(SocketDescriptor{mpd_connection_get_fd(connection)});
-	socket.ScheduleRead();
+void
+MpdObserver::CancelResolve() noexcept
+{
+	if (!resolver)
+		return;
 
-	subscribed = mpd_run_subscribe(connection, "mpdscribble");
-	if (!subscribed && !mpd_connection_clear_error(connection)) {
-		HandleError();
-		return false;
+	{
+		/* the thread runs on, but it will not touch this
+		   object */
+		const std::scoped_lock lock{resolver->mutex};
+		resolver->event = nullptr;
 	}
 
-	return true;
+	resolver.reset();
+	resolve_event.Cancel();
 }
 
 void
-MpdObserver::OnConnectTimer() noexcept
+MpdObserver::OnResolved() noexcept
 {
-	if (!Connect()) {
+	assert(command == Command::RESOLVE);
+	assert(resolver);
+
+	timeout_timer.Cancel();
+	command = Command::NONE;
+
+	int error;
+
+	{
+		const std::scoped_lock lock{resolver->mutex};
+		error = resolver->error;
+		addresses = std::exchange(resolver->result, nullptr);
+	}
+
+	resolver.reset();
+
+	if (error != 0) {
+		FormatWarning("Failed to resolve %s: %s",
+			      settings_name(settings).c_str(),
+			      gai_strerror(error));
 		ScheduleConnect();
 		return;
 	}
 
-	ScheduleUpdate();
+	next_address = addresses;
+	if (!ConnectNextAddress())
+		ScheduleConnect();
+}
+
+bool
+MpdObserver::ConnectNextAddress() noexcept
+{
+	int error = 0;
+
+	while (next_address != nullptr) {
+		const auto &i = *next_address;
+		next_address = i.ai_next;
+
+		const int fd = ConnectNonBlock(i.ai_family, i.ai_addr,
+					       i.ai_addrlen);
+		if (fd >= 0) {
+			StartConnect(fd);
+			return true;
+		}
+
+		error = errno;
+	}
+
+	FreeAddresses();
+
+	if (error != 0)
+		FormatWarning("Failed to connect to %s: %s",
+			      settings_name(settings).c_str(),
+			      strerror(error));
+	return false;
+}
+
+void
+MpdObserver::FreeAddresses() noexcept
+{
+	if (addresses != nullptr) {
+		freeaddrinfo(addresses);
+		addresses = nullptr;
+	}
+
+	next_address = nullptr;
+}
+
+void
+MpdObserver::StartConnect(int fd) noexcept
+{
+	socket.Open(SocketDescriptor{fd});
+	socket.ScheduleWrite();
+	command = Command::CONNECT;
+	timeout_timer.Schedule(RESPONSE_TIMEOUT);
+}
+
+void
+MpdObserver::OnConnected() noexcept
+{
+	assert(command == Command::CONNECT);
+
+	FreeAddresses();
+
+	async = mpd_async_new(socket.GetSocket().Get());
+	parser = mpd_parser_new();
+	if (async == nullptr || parser == nullptr) {
+		HandleError("Out of memory");
+		return;
+	}
+
+	command = Command::GREETING;
+	UpdateSocket();
+}
+
+void
+MpdObserver::OnConnectTimer() noexcept
+{
+	if (!Connect())
+		ScheduleConnect();
 }
 
 void
 MpdObserver::ScheduleConnect() noexcept
 {
-	assert(connection == nullptr);
+	assert(async == nullptr);
 
 	LogInfo("waiting 15 seconds before reconnecting");
 
@@ -132,245 +406,486 @@ MpdObserver::ScheduleConnect() noexcept
 
 MpdObserver::MpdObserver(EventLoop &event_loop,
 			 MpdObserverListener &_listener,
-			 const char *_host, int _port) noexcept
+			 const char *_host, int _port)
 	:listener(_listener),
-	 host(_host), port(_port),
+	 settings(mpd_settings_new(_host, _port, 0, nullptr, nullptr)),
 	 connect_timer(event_loop, BIND_THIS_METHOD(OnConnectTimer)),
-	 update_timer(event_loop, BIND_THIS_METHOD(OnUpdateTimer)),
-	 socket(event_loop, BIND_THIS_METHOD(OnSocketReady))
+	 timeout_timer(event_loop, BIND_THIS_METHOD(OnTimeout)),
+	 socket(event_loop, BIND_THIS_METHOD(OnSocketReady)),
+	 resolve_event(event_loop, BIND_THIS_METHOD(OnResolved))
 {
 	connect_timer.Schedule(std::chrono::seconds{0});
 }
 
 MpdObserver::~MpdObserver() noexcept
 {
-	if (connection != nullptr)
-		mpd_connection_free(connection);
+	Disconnect();
 
-	if (current_song != nullptr)
-		mpd_song_free(current_song);
+	if (settings != nullptr)
+		mpd_settings_free(settings);
 }
 
-enum mpd_state
-MpdObserver::QueryState(struct mpd_song **song_r,
-			std::chrono::steady_clock::duration &elapsed_r) noexcept
+bool
+MpdObserver::SendCommand(Command _command, const char *cmd,
+			 const char *arg1, const char *arg2) noexcept
 {
-	struct mpd_status *status;
-	enum mpd_state state;
-	struct mpd_song *song;
+	assert(async != nullptr);
+
+	if (!mpd_async_send_command(async, cmd, arg1, arg2, nullptr)) {
+		HandleAsyncError();
+		return false;
+	}
 
-	assert(connection != nullptr);
+	command = _command;
 
-	mpd_command_list_begin(connection, true);
-	mpd_send_status(connection);
-	mpd_send_current_song(connection);
-	mpd_command_list_end(connection);
+	if (command == Command::IDLE)
+		/* "idle" may legitimately take forever */
+		timeout_timer.Cancel();
+	else
+		timeout_timer.Schedule(RESPONSE_TIMEOUT);
 
-	status = mpd_recv_status(connection);
-	if (!status) {
-		HandleError();
-		return MPD_STATE_UNKNOWN;
+	UpdateSocket();
+	return true;
+}
+
+void
+MpdObserver::UpdateSocket() noexcept
+{
+	assert(async != nullptr);
+
+	const unsigned events = mpd_async_events(async);
+
+	unsigned flags = 0;
+	if (events & MPD_ASYNC_EVENT_READ)
+		flags |= SocketEvent::READ;
+	if (events & MPD_ASYNC_EVENT_WRITE)
+		flags |= SocketEvent::WRITE;
+
+	socket.Schedule(flags);
+}
+
+void
+MpdObserver::OnGreeting(const char *line) noexcept
+{
+	unsigned version[3];
+	if (sscanf(line, "OK MPD %u.%u.%u",
+		   &version[0], &version[1], &version[2]) != 3) {
+		HandleError("Malformed MPD greeting");
+		return;
 	}
 
-	state = mpd_status_get_state(status);
-	elapsed_r = std::chrono::milliseconds(mpd_status_get_elapsed_ms(status));
+	if (version[0] == 0 && version[1] < 16) {
+		FormatWarning("Error: MPD version %u.%u.%u is too old (%s needed)",
+			      version[0], version[1], version[2],
+			      "0.16.0");
+		Disconnect();
+		ScheduleConnect();
+		return;
+	}
 
-	mpd_status_free(status);
+	const auto name = settings_name(settings);
+	FormatInfo("connected to mpd %u.%u.%u at %s",
+		   version[0], version[1], version[2],
+		   name.c_str());
 
-	if (state != MPD_STATE_PLAY) {
-		if (!mpd_response_finish(connection)) {
-			HandleError();
-			return MPD_STATE_UNKNOWN;
+	const char *password = mpd_settings_get_password(settings);
+	if (password != nullptr)
+		SendCommand(Command::PASSWORD, "password", password);
+	else
+		SendCommand(Command::SUBSCRIBE, "subscribe", "mpdscribble");
+}
+
+void
+MpdObserver::OnLine(char *line) noexcept
+{
+	if (command == Command::GREETING) {
+		OnGreeting(line);
+		return;
+	}
+
+	switch (mpd_parser_feed(parser, line)) {
+	case MPD_PARSER_MALFORMED:
+		HandleError("Malformed MPD response");
+		break;
+
+	case MPD_PARSER_SUCCESS:
+		OnResponse();
+		break;
+
+	case MPD_PARSER_ERROR:
+		OnServerError(mpd_parser_get_message(parser));
+		break;
+
+	case MPD_PARSER_PAIR:
+		OnPair({mpd_parser_get_name(parser),
+			mpd_parser_get_value(parser)});
+		break;
+	}
+}
+
+void
+MpdObserver::ReceiveLines() noexcept
+{
+	while (async != nullptr) {
+		char *line = mpd_async_recv_line(async);
+		if (line == nullptr) {
+			if (mpd_async_get_error(async) != MPD_ERROR_SUCCESS)
+				HandleAsyncError();
+			return;
+		}
+
+		if (command == Command::NONE || command == Command::CONNECT) {
+			HandleError("Unexpected MPD response");
+			return;
 		}
 
-		return state;
+		OnLine(line);
 	}
+}
 
-	if (!mpd_response_next(connection)) {
-		HandleError();
-		return MPD_STATE_UNKNOWN;
+void
+MpdObserver::OnPair(const struct mpd_pair &pair) noexcept
+{
+	switch (command) {
+	case Command::NONE:
+	case Command::RESOLVE:
+	case Command::CONNECT:
+	case Command::GREETING:
+	case Command::PASSWORD:
+	case Command::SUBSCRIBE:
+		break;
+
+	case Command::IDLE:
+		if (strcmp(pair.name, "changed") == 0)
+			pending_idle |= mpd_idle_name_parse(pair.value);
+		break;
+
+	case Command::READ_MESSAGES:
+		if (strcmp(pair.name, "channel") == 0) {
+			FinishMessage();
+			message = mpd_message_begin(&pair);
+		} else if (message != nullptr)
+			mpd_message_feed(message, &pair);
+		break;
+
+	case Command::STATUS:
+		mpd_status_feed(status, &pair);
+		break;
+
+	case Command::CURRENT_SONG:
+		if (received_song == nullptr) {
+			if (strcmp(pair.name, "file") == 0)
+				received_song = mpd_song_begin(&pair);
+		} else
+			mpd_song_feed(received_song, &pair);
+		break;
 	}
+}
 
-	song = mpd_recv_song(connection);
-	if (song == nullptr) {
-		if (!mpd_response_finish(connection)) {
-			HandleError();
-			return MPD_STATE_UNKNOWN;
+void
+MpdObserver::OnResponse() noexcept
+{
+	switch (command) {
+	case Command::NONE:
+	case Command::RESOLVE:
+	case Command::CONNECT:
+	case Command::GREETING:
+		assert(false);
+		break;
+
+	case Command::PASSWORD:
+		SendCommand(Command::SUBSCRIBE, "subscribe", "mpdscribble");
+		break;
+
+	case Command::SUBSCRIBE:
+		subscribed = true;
+		QueryState();
+		break;
+
+	case Command::IDLE:
+		OnIdleResponse();
+		break;
+
+	case Command::READ_MESSAGES:
+		FinishMessage();
+		OnIdleResponse();
+		break;
+
+	case Command::STATUS:
+		OnStatusResponse();
+		break;
+
+	case Command::CURRENT_SONG:
+		{
+			std::optional<SongInfo> song;
+			if (received_song != nullptr) {
+				song.emplace(*received_song);
+				mpd_song_free(received_song);
+				received_song = nullptr;
+			}
+
+			Update(song ? player_state : MPD_STATE_UNKNOWN,
+			       std::move(song));
 		}
+		break;
+	}
+}
 
-		return MPD_STATE_UNKNOWN;
+void
+MpdObserver::OnServerError(const char *msg) noexcept
+{
+	if (command == Command::SUBSCRIBE) {
+		/* MPD doesn't support client-to-client messages;
+		   that's not fatal */
+		subscribed = false;
+		QueryState();
+		return;
 	}
 
-	if (!mpd_response_finish(connection)) {
-		mpd_song_free(song);
-		HandleError();
-		return MPD_STATE_UNKNOWN;
+	HandleError(msg != nullptr ? msg : "unknown");
+}
+
+void
+MpdObserver::QueryState() noexcept
+{
+	assert(status == nullptr);
+
+	status = mpd_status_begin();
+	if (status == nullptr) {
+		HandleError("Out of memory");
+		return;
 	}
 
-	*song_r = song;
-	return MPD_STATE_PLAY;
+	SendCommand(Command::STATUS, "status");
 }
 
 void
-MpdObserver::Update() noexcept
+MpdObserver::OnStatusResponse() noexcept
 {
-	struct mpd_song *prev;
-	enum mpd_state state;
-	std::chrono::steady_clock::duration elapsed{};
+	assert(status != nullptr);
+
+	player_state = mpd_status_get_state(status);
+	elapsed = std::chrono::milliseconds(mpd_status_get_elapsed_ms(status));
+	const int song_id = mpd_status_get_song_id(status);
+
+	mpd_status_free(status);
+	status = nullptr;
+
+	if (player_state != MPD_STATE_PLAY) {
+		Update(player_state, std::nullopt);
+		return;
+	}
+
+	if (current_song && song_id >= 0 &&
+	    (unsigned)song_id == current_song->id) {
+		/* still the same song (e.g. after seeking): no need
+		   to send "currentsong" */
+		Update(MPD_STATE_PLAY, std::nullopt);
+		return;
+	}
+
+	SendCommand(Command::CURRENT_SONG, "currentsong");
+}
 
-	prev = current_song;
-	state = QueryState(&current_song, elapsed);
+void
+MpdObserver::Update(enum mpd_state state,
+		    std::optional<SongInfo> &&song) noexcept
+{
+	++n_updates;
 
 	if (state == MPD_STATE_PAUSE) {
+		assert(!song);
+
+		MPDSCRIBBLE_PROBE2(mpd_update, int(state), -1);
+
 		if (!was_paused)
 			listener.OnMpdPaused();
 		was_paused = true;
 
-		ScheduleIdle();
+		SendIdle();
 		return;
-	} else if (state != MPD_STATE_PLAY) {
-		current_song = nullptr;
+	}
+
+	/* the song which was played before, unless it continues */
+	std::optional<SongInfo> prev;
+	if (state != MPD_STATE_PLAY || song)
+		prev = std::exchange(current_song, std::move(song));
+
+	MPDSCRIBBLE_PROBE2(mpd_update, int(state),
+			   current_song ? int(current_song->id) : -1);
+
+	if (state != MPD_STATE_PLAY) {
+		assert(!current_song);
+
 		last_id = -1;
 		was_paused = false;
-	} else if ((mpd_song_get_tag(current_song, MPD_TAG_ARTIST, 0) == nullptr &&
-		   mpd_song_get_tag(current_song, MPD_TAG_ALBUM_ARTIST, 0) == nullptr) ||
-		   mpd_song_get_tag(current_song, MPD_TAG_TITLE, 0) == nullptr) {
-		if (mpd_song_get_id(current_song) != last_id) {
+	} else if (current_song && !current_song->IsComplete()) {
+		if (current_song->id != last_id) {
 			FormatInfo("new song detected with tags missing (%s)",
-				   mpd_song_get_uri(current_song));
-			last_id = mpd_song_get_id(current_song);
+				   current_song->uri.c_str());
+			last_id = current_song->id;
 		}
 
-		mpd_song_free(current_song);
-		current_song = nullptr;
+		current_song.reset();
 	}
 
 	if (was_paused) {
-		if (current_song != nullptr &&
-		    mpd_song_get_id(current_song) == last_id)
+		if (current_song && current_song->id == last_id)
 			listener.OnMpdResumed();
 		was_paused = false;
 	}
 
 	/* submit the previous song */
-	if (prev != nullptr &&
-	    (current_song == nullptr ||
-	     mpd_song_get_id(prev) != mpd_song_get_id(current_song))) {
-		listener.OnMpdEnded(prev, love);
+	if (prev && (!current_song || prev->id != current_song->id)) {
+		listener.OnMpdEnded(*prev, love);
 		love = false;
 	}
 
-	if (current_song != nullptr) {
-		if (mpd_song_get_id(current_song) != last_id) {
+	if (current_song) {
+		if (current_song->id != last_id) {
 			/* new song. */
 
-			listener.OnMpdStarted(current_song);
-			last_id = mpd_song_get_id(current_song);
+			listener.OnMpdStarted(*current_song);
+			last_id = current_song->id;
 		} else {
 			/* still playing the previous song */
 
-			listener.OnMpdPlaying(current_song, elapsed);
+			listener.OnMpdPlaying(*current_song, elapsed);
 		}
 	}
 
-	if (prev != nullptr)
-		mpd_song_free(prev);
-
-	if (connection == nullptr) {
-		ScheduleConnect();
-		return;
-	}
-
-	ScheduleIdle();
-	return;
+	SendIdle();
 }
 
 void
-MpdObserver::OnUpdateTimer() noexcept
+MpdObserver::FinishMessage() noexcept
 {
-	Update();
-}
+	if (message == nullptr)
+		return;
 
-inline void
-MpdObserver::ScheduleUpdate() noexcept
-{
-	update_timer.Schedule();
+	const char *text = mpd_message_get_text(message);
+	if (text == nullptr)
+		;
+	else if (strcmp(text, "love") == 0)
+		love = true;
+	else
+		FormatInfo("Unrecognized client-to-client message: '%s'",
+			   text);
+
+	mpd_message_free(message);
+	message = nullptr;
 }
 
-bool
-MpdObserver::ReadMessages() noexcept
+void
+MpdObserver::OnIdleResponse() noexcept
 {
-	assert(subscribed);
-
-	if (!mpd_send_read_messages(connection))
-		return mpd_connection_clear_error(connection);
-
-	struct mpd_message *msg;
-	while ((msg = mpd_recv_message(connection)) != nullptr) {
-		const char *text = mpd_message_get_text(msg);
-		if (strcmp(text, "love") == 0)
-			love = true;
-		else
-			FormatInfo("Unrecognized client-to-client message: '%s'",
-				   text);
-
-		mpd_message_free(msg);
+	if (subscribed && (pending_idle & MPD_IDLE_MESSAGE) != 0) {
+		pending_idle &= ~MPD_IDLE_MESSAGE;
+		SendCommand(Command::READ_MESSAGES, "readmessages");
+		return;
 	}
 
-	return mpd_response_finish(connection);
+	if (pending_idle & MPD_IDLE_PLAYER) {
+		/* there was a change: query MPD */
+		pending_idle = 0;
+		QueryState();
+	} else {
+		/* nothing interesting: re-enter idle */
+		pending_idle = 0;
+		SendIdle();
+	}
 }
 
 void
-MpdObserver::OnIdleResponse() noexcept
+MpdObserver::SendIdle() noexcept
 {
-	bool success;
-	enum mpd_idle idle;
+	assert(async != nullptr);
 
-	assert(connection != nullptr);
-	assert(mpd_connection_get_error(connection) == MPD_ERROR_SUCCESS);
+	SendCommand(Command::IDLE, "idle", "player",
+		    subscribed ? "message" : nullptr);
+}
 
-	idle = mpd_recv_idle(connection, false);
-	success = mpd_response_finish(connection);
+void
+MpdObserver::OnSocketReady(unsigned events) noexcept
+{
+	if (command == Command::CONNECT) {
+		int error;
+		socklen_t error_length = sizeof(error);
+		if (getsockopt(socket.GetSocket().Get(), SOL_SOCKET, SO_ERROR,
+			       &error, &error_length) < 0)
+			error = errno;
+
+		if (error != 0) {
+			FormatWarning("Failed to connect to MPD: %s",
+				      strerror(error));
+
+			/* try the next address before falling back
+			   to the reconnect timer */
+			socket.Close();
+			timeout_timer.Cancel();
+			command = Command::NONE;
+			if (ConnectNextAddress())
+				return;
+
+			Disconnect();
+			ScheduleConnect();
+			return;
+		}
 
-	if (!success) {
-		HandleError();
-		ScheduleConnect();
+		OnConnected();
 		return;
 	}
 
-	if (subscribed && (idle & MPD_IDLE_MESSAGE) != 0 &&
-	    !ReadMessages()) {
-		HandleError();
-		ScheduleConnect();
+	assert(async != nullptr);
+
+	unsigned async_events = 0;
+	if (events & SocketEvent::READ)
+		async_events |= MPD_ASYNC_EVENT_READ;
+	if (events & SocketEvent::WRITE)
+		async_events |= MPD_ASYNC_EVENT_WRITE;
+	if (events & SocketEvent::HANGUP)
+		async_events |= MPD_ASYNC_EVENT_HUP;
+	if (events & SocketEvent::ERROR)
+		async_events |= MPD_ASYNC_EVENT_ERROR;
+
+	if (!mpd_async_io(async, (enum mpd_async_event)async_events)) {
+		HandleAsyncError();
 		return;
 	}
 
-	if (idle & MPD_IDLE_PLAYER)
-		/* there was a change: query MPD */
-		ScheduleUpdate();
-	else
-		/* nothing interesting: re-enter idle */
-		ScheduleIdle();
-}
+	ReceiveLines();
 
-void
-MpdObserver::OnSocketReady(unsigned) noexcept
-{
-	OnIdleResponse();
+	if (async != nullptr)
+		UpdateSocket();
 }
 
 void
-MpdObserver::ScheduleIdle() noexcept
+MpdObserver::OnTimeout() noexcept
 {
-	assert(connection != nullptr);
+	if (command == Command::RESOLVE) {
+		FormatWarning("Failed to resolve %s: %s",
+			      settings_name(settings).c_str(),
+			      strerror(ETIMEDOUT));
+		Disconnect();
+		ScheduleConnect();
+		return;
+	}
 
-	idle_notified = false;
+	if (command == Command::CONNECT) {
+		FormatWarning("Failed to connect to MPD: %s",
+			      strerror(ETIMEDOUT));
 
-	constexpr enum mpd_idle mask = (enum mpd_idle)(MPD_IDLE_PLAYER|MPD_IDLE_MESSAGE);
+		/* this address may be unreachable; try the next
+		   one */
+		socket.Close();
+		command = Command::NONE;
+		if (ConnectNextAddress())
+			return;
 
-	if (!mpd_send_idle_mask(connection, mask)) {
-		HandleError();
+		Disconnect();
 		ScheduleConnect();
 		return;
 	}
+
+	HandleError("MPD did not respond in time");
 }
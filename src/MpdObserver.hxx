@@ -21,20 +21,25 @@
 #ifndef MPD_OBSERVER_HXX
 #define MPD_OBSERVER_HXX
 
+#include "SongInfo.hxx"
 #include "event/CoarseTimerEvent.hxx"
-#include "event/DeferEvent.hxx"
 #include "event/SocketEvent.hxx"
+#include "event/InjectEvent.hxx"
 
 #include <mpd/client.h>
 
+struct addrinfo;
+
 #include <chrono>
+#include <memory>
+#include <optional>
 
 class MpdObserverListener {
 public:
-	virtual void OnMpdStarted(const struct mpd_song *song) noexcept = 0;
-	virtual void OnMpdPlaying(const struct mpd_song *song,
+	virtual void OnMpdStarted(const SongInfo &song) noexcept = 0;
+	virtual void OnMpdPlaying(const SongInfo &song,
 				  std::chrono::steady_clock::duration elapsed) noexcept = 0;
-	virtual void OnMpdEnded(const struct mpd_song *song,
+	virtual void OnMpdEnded(const SongInfo &song,
 				bool love) noexcept = 0;
 	virtual void OnMpdPaused() noexcept = 0;
 	virtual void OnMpdResumed() noexcept = 0;
@@ -43,14 +48,114 @@ public:
 class MpdObserver {
 	MpdObserverListener &listener;
 
-	const char *const host;
-	const int port;
+	/**
+	 * Host, port and password of the MPD server, with defaults
+	 * from $MPD_HOST and $MPD_PORT.
+	 */
+	struct mpd_settings *const settings;
+
+	/**
+	 * Give up if MPD doesn't respond to a command (other than
+	 * "idle") within this duration, so a hung server can
+	 * neither stall this observer nor go unnoticed.
+	 */
+	static constexpr Event::Duration RESPONSE_TIMEOUT = std::chrono::seconds{30};
+
+	/**
+	 * The protocol state of the connection; nullptr while not
+	 * connected.  It owns the socket of #socket.
+	 */
+	struct mpd_async *async = nullptr;
+
+	struct mpd_parser *parser = nullptr;
+
+	/**
+	 * The getaddrinfo() call running in a helper thread, so a
+	 * slow DNS server doesn't block the #EventLoop; nullptr if
+	 * there is none.
+	 */
+	struct Resolver;
+	std::shared_ptr<Resolver> resolver;
+
+	/**
+	 * The resolved addresses of the MPD server while
+	 * connecting; each one is tried until a connect() succeeds.
+	 */
+	struct addrinfo *addresses = nullptr;
+
+	/**
+	 * The next entry of #addresses to be tried.
+	 */
+	const struct addrinfo *next_address = nullptr;
+
+	/**
+	 * The command whose response is expected next.
+	 */
+	enum class Command {
+		/**
+		 * Not connected.
+		 */
+		NONE,
+
+		/**
+		 * Waiting for #resolver.
+		 */
+		RESOLVE,
+
+		/**
+		 * The non-blocking connect() is in progress.
+		 */
+		CONNECT,
+
+		/**
+		 * Waiting for the "OK MPD x.y.z" greeting.
+		 */
+		GREETING,
+
+		PASSWORD,
+		SUBSCRIBE,
+		IDLE,
+		READ_MESSAGES,
+		STATUS,
+		CURRENT_SONG,
+	} command = Command::NONE;
+
+	/**
+	 * The "idle" events which have not yet been handled.
+	 */
+	unsigned pending_idle = 0;
+
+	/**
+	 * The "status" response being received.
+	 */
+	struct mpd_status *status = nullptr;
+
+	/**
+	 * The "currentsong" response being received.
+	 */
+	struct mpd_song *received_song = nullptr;
 
-	struct mpd_connection *connection = nullptr;
+	/**
+	 * The message of the "readmessages" response being received.
+	 */
+	struct mpd_message *message = nullptr;
+
+	/**
+	 * Values from the last "status" response, used after
+	 * "currentsong" has been received.
+	 */
+	enum mpd_state player_state = MPD_STATE_UNKNOWN;
+	std::chrono::steady_clock::duration elapsed{};
 
-	bool idle_notified = false;
 	unsigned last_id = -1;
-	struct mpd_song *current_song = nullptr;
+
+	/**
+	 * The song which is being played; empty if MPD is not
+	 * playing or if the song lacks tags needed for submitting
+	 * it.
+	 */
+	std::optional<SongInfo> current_song;
+
 	bool was_paused = false;
 
 	/**
@@ -61,37 +166,129 @@ class MpdObserver {
 
 	bool subscribed = false;
 
-	CoarseTimerEvent connect_timer;
-	DeferEvent update_timer;
+	/**
+	 * The number of player state updates received from MPD (for
+	 * the metrics endpoint).
+	 */
+	unsigned long n_updates = 0;
+
+	CoarseTimerEvent connect_timer, timeout_timer;
 	SocketEvent socket;
 
+	/**
+	 * Invoked by the #resolver thread when it is done.
+	 */
+	InjectEvent resolve_event;
+
 public:
+	/**
+	 * Throws on error.
+	 */
 	MpdObserver(EventLoop &event_loop,
 		    MpdObserverListener &_listener,
-		    const char *_host, int _port) noexcept;
+		    const char *_host, int _port);
 	~MpdObserver() noexcept;
 
+	bool IsConnected() const noexcept {
+		return async != nullptr;
+	}
+
+	unsigned long GetUpdateCount() const noexcept {
+		return n_updates;
+	}
+
 private:
-	void HandleError() noexcept;
+	/**
+	 * Close the connection and discard all partial responses.
+	 */
+	void Disconnect() noexcept;
+
+	/**
+	 * Log the error, close the connection and schedule a
+	 * reconnect.
+	 */
+	void HandleError(const char *msg) noexcept;
+	void HandleAsyncError() noexcept;
 
 	void ScheduleConnect() noexcept;
 	void OnConnectTimer() noexcept;
+
+	/**
+	 * Start a non-blocking connect() to MPD (after resolving
+	 * its host name in a helper thread).
+	 *
+	 * @return false on error
+	 */
 	bool Connect() noexcept;
 
-	void ScheduleUpdate() noexcept;
-	void OnUpdateTimer() noexcept;
-	enum mpd_state QueryState(struct mpd_song **song_r,
-				  std::chrono::steady_clock::duration &elapsed_r) noexcept;
 	/**
-	 * Update: determine MPD's current song and enqueue submissions.
+	 * Abandon the getaddrinfo() call of #resolver.
 	 */
-	void Update() noexcept;
+	void CancelResolve() noexcept;
 
-	bool ReadMessages() noexcept;
+	void OnResolved() noexcept;
 
-	void OnSocketReady(unsigned events) noexcept;
-	void ScheduleIdle() noexcept;
+	/**
+	 * Start a non-blocking connect() to the next entry of
+	 * #addresses.
+	 *
+	 * @return false if there is none left
+	 */
+	bool ConnectNextAddress() noexcept;
+
+	void FreeAddresses() noexcept;
+
+	/**
+	 * The non-blocking connect() on this socket has been
+	 * started.
+	 */
+	void StartConnect(int fd) noexcept;
+
+	void OnConnected() noexcept;
+
+	bool SendCommand(Command _command, const char *cmd,
+			 const char *arg1=nullptr,
+			 const char *arg2=nullptr) noexcept;
+
+	/**
+	 * Register the events #async is waiting for at #socket.
+	 */
+	void UpdateSocket() noexcept;
+
+	/**
+	 * Handle all complete response lines received so far.
+	 */
+	void ReceiveLines() noexcept;
+	void OnGreeting(const char *line) noexcept;
+	void OnLine(char *line) noexcept;
+	void OnPair(const struct mpd_pair &pair) noexcept;
+	void OnResponse() noexcept;
+	void OnServerError(const char *msg) noexcept;
+
+	void SendIdle() noexcept;
 	void OnIdleResponse() noexcept;
+
+	/**
+	 * Query MPD's player state.  "currentsong" is only sent if
+	 * the song id differs from #current_song.
+	 */
+	void QueryState() noexcept;
+	void OnStatusResponse() noexcept;
+
+	void FinishMessage() noexcept;
+
+	/**
+	 * Update: handle MPD's current song and enqueue submissions.
+	 *
+	 * @param song the new current song if MPD is playing; if
+	 * empty with #MPD_STATE_PLAY, then #current_song is still
+	 * being played
+	 */
+	void Update(enum mpd_state state,
+		    std::optional<SongInfo> &&song) noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+	void OnTimeout() noexcept;
 };
 
 #endif
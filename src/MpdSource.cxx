@@ -0,0 +1,163 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2019 The Music Player Daemon Project
+ * Copyright (C) 2005-2008 Kuno Woudt <kuno@frob.nl>
+ * Project homepage: http://musicpd.org
+ 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "MpdSource.hxx"
+#include "MpdConfig.hxx"
+#include "Config.hxx"
+#include "Log.hxx"
+
+static constexpr bool
+played_long_enough(std::chrono::steady_clock::duration elapsed,
+		   std::chrono::steady_clock::duration length) noexcept
+{
+	/* http://www.lastfm.de/api/submissions "The track must have been
+	   played for a duration of at least 240 seconds or half the track's
+	   total length, whichever comes first. Skipping or pausing the
+	   track is irrelevant as long as the appropriate amount has been
+	   played."
+	 */
+	return elapsed > std::chrono::minutes(4) ||
+		(length >= std::chrono::seconds(30) && elapsed > length / 2);
+}
+
+/**
+ * This function determines if a song is played repeatedly: according
+ * to MPD, the current song hasn't changed, and now we're comparing
+ * the "elapsed" value with the previous one.
+ */
+static bool
+song_repeated(const SongInfo &song,
+	      std::chrono::steady_clock::duration elapsed,
+	      std::chrono::steady_clock::duration prev_elapsed) noexcept
+{
+	return elapsed < std::chrono::minutes(1) && prev_elapsed > elapsed &&
+		played_long_enough(prev_elapsed - elapsed, song.duration);
+}
+
+MpdSource::MpdSource(EventLoop &event_loop, const MpdConfig &config,
+		     MultiScrobbler &_scrobblers)
+	:name(config.name),
+	 log_prefix(config.name.empty()
+		    ? std::string{}
+		    : "[mpd:" + config.name + "] "),
+	 scrobblers(_scrobblers),
+	 scrobbler_names(config.scrobblers),
+	 targets(scrobblers.Select(scrobbler_names)),
+	 observer(event_loop, *this,
+		  NullableString(config.host), config.port)
+{
+}
+
+void
+MpdSource::SelectScrobblers() noexcept
+{
+	if (scrobbler_names.empty()) {
+		targets = scrobblers.Select(scrobbler_names);
+		return;
+	}
+
+	targets.clear();
+	for (const auto &i : scrobbler_names) {
+		auto *s = scrobblers.Find(i);
+		if (s != nullptr)
+			targets.push_back(s);
+		else
+			FormatWarning("%sscrobbler '%s' is not available",
+				      log_prefix.c_str(), i.c_str());
+	}
+}
+
+void
+MpdSource::OnMpdSongChanged(const SongInfo &song) noexcept
+{
+	FormatInfo("%snew song detected (%s - %s), id: %u, pos: %u\n",
+		   log_prefix.c_str(),
+		   song.artist.c_str(), song.title.c_str(),
+		   song.id, song.pos);
+
+	stopwatch.Start();
+
+	scrobblers.NowPlaying(targets, song.ToRecord());
+}
+
+/**
+ * Pause mode on the current song was activated.
+ */
+void
+MpdSource::OnMpdPaused() noexcept
+{
+	stopwatch.Stop();
+}
+
+/**
+ * The current song continues to play (after pause).
+ */
+void
+MpdSource::OnMpdResumed() noexcept
+{
+	stopwatch.Resume();
+}
+
+/**
+ * MPD started playing this song.
+ */
+void
+MpdSource::OnMpdStarted(const SongInfo &song) noexcept
+{
+	OnMpdSongChanged(song);
+}
+
+/**
+ * MPD is still playing the song.
+ */
+void
+MpdSource::OnMpdPlaying(const SongInfo &song,
+		       std::chrono::steady_clock::duration elapsed) noexcept
+{
+	const auto prev_elapsed = stopwatch.GetDuration();
+
+	if (song_repeated(song, elapsed, prev_elapsed)) {
+		/* the song is playing repeatedly: make it virtually
+		   stop and re-start */
+		LogDebug("repeated song detected");
+
+		OnMpdEnded(song, false);
+		OnMpdStarted(song);
+	}
+}
+
+/**
+ * MPD stopped playing this song.
+ */
+void
+MpdSource::OnMpdEnded(const SongInfo &song, bool love) noexcept
+{
+	const auto elapsed = stopwatch.GetDuration();
+
+	if (!played_long_enough(elapsed, song.duration))
+		return;
+
+	auto record = song.ToRecord();
+	if (record.length.count() <= 0)
+		record.length = elapsed;
+	record.love = love;
+
+	scrobblers.SongChange(targets, song.uri.c_str(), std::move(record));
+}
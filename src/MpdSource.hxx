@@ -0,0 +1,108 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2019 The Music Player Daemon Project
+ * Copyright (C) 2005-2008 Kuno Woudt <kuno@frob.nl>
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_SOURCE_HXX
+#define MPD_SOURCE_HXX
+
+#include "MpdObserver.hxx"
+#include "MultiScrobbler.hxx"
+#include "time/Stopwatch.hxx"
+
+#include <forward_list>
+#include <string>
+
+struct MpdConfig;
+
+/**
+ * One observed MPD server.  It measures how long each song was
+ * played and passes the songs to its scrobblers.
+ */
+class MpdSource final : MpdObserverListener {
+	/**
+	 * The name of the "[mpd:NAME]" section; empty for the
+	 * default server.
+	 */
+	const std::string name;
+
+	/**
+	 * The prefix for log messages, e.g. "[mpd:kitchen] "; empty
+	 * for the default server.
+	 */
+	const std::string log_prefix;
+
+	MultiScrobbler &scrobblers;
+
+	/**
+	 * The "scrobblers" setting; empty selects all scrobblers.
+	 */
+	const std::forward_list<std::string> scrobbler_names;
+
+	/**
+	 * The scrobblers which receive songs from this server.
+	 */
+	ScrobblerList targets;
+
+	Stopwatch stopwatch;
+
+	MpdObserver observer;
+
+public:
+	/**
+	 * Throws if the configuration refers to an unknown
+	 * scrobbler.
+	 */
+	MpdSource(EventLoop &event_loop, const MpdConfig &config,
+		  MultiScrobbler &_scrobblers);
+
+	MpdSource(const MpdSource &) = delete;
+	MpdSource &operator=(const MpdSource &) = delete;
+
+	const std::string &GetName() const noexcept {
+		return name;
+	}
+
+	const MpdObserver &GetObserver() const noexcept {
+		return observer;
+	}
+
+	const std::forward_list<std::string> &GetScrobblerNames() const noexcept {
+		return scrobbler_names;
+	}
+
+	/**
+	 * Look up the scrobblers again after MultiScrobbler::Reload().
+	 * Those which do not exist anymore are skipped.
+	 */
+	void SelectScrobblers() noexcept;
+
+private:
+	void OnMpdSongChanged(const SongInfo &song) noexcept;
+
+	/* virtual methods from MpdObserverListener */
+	void OnMpdStarted(const SongInfo &song) noexcept override;
+	void OnMpdPlaying(const SongInfo &song,
+			  std::chrono::steady_clock::duration elapsed) noexcept override;
+	void OnMpdEnded(const SongInfo &song,
+			bool love) noexcept override;
+	void OnMpdPaused() noexcept override;
+	void OnMpdResumed() noexcept override;
+};
+
+#endif
@@ -21,70 +21,302 @@
 #include "MultiScrobbler.hxx"
 #include "Scrobbler.hxx"
 #include "ScrobblerConfig.hxx"
+#include "SharedJournal.hxx"
+#include "AsyncWriter.hxx"
+#include "ScrobblerWorker.hxx"
 #include "Protocol.hxx"
 #include "Record.hxx"
+#include "Metrics.hxx"
 #include "Log.hxx"
+#include "util/Exception.hxx"
+#include "util/RuntimeError.hxx"
 
-#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string_view>
+#include <utility>
+
+#include <time.h>
 
 MultiScrobbler::MultiScrobbler(const std::forward_list<ScrobblerConfig> &configs,
-			       EventLoop &event_loop,
-			       CurlGlobal &curl_global)
+			       EventLoop &_event_loop,
+			       CurlGlobal &_curl_global,
+			       AsyncWriter &_writer,
+			       const char *shared_journal_path,
+			       std::vector<ScrobblerWorker *> _workers)
+	:event_loop(_event_loop), curl_global(_curl_global), writer(_writer),
+	 workers(std::move(_workers))
 {
 	LogInfo("starting mpdscribble (" AS_CLIENT_ID " " AS_CLIENT_VERSION ")");
 
+	const ScopePauseWorkers pause{workers};
+
 	for (const auto &i : configs)
-		scrobblers.emplace_front(i, event_loop, curl_global);
+		Emplace(i);
+
+	if (shared_journal_path != nullptr) {
+		shared_journal = std::make_unique<SharedJournal>(writer,
+								 shared_journal_path);
+		LoadSharedJournal();
+	}
+}
+
+MultiScrobbler::~MultiScrobbler() noexcept
+{
+	const ScopePauseWorkers pause{workers};
+	scrobblers.clear();
 }
 
-MultiScrobbler::~MultiScrobbler() noexcept = default;
+/**
+ * Does this scrobbler keep its queue in the shared journal?
+ */
+[[gnu::pure]]
+static bool
+UsesSharedJournal(const Scrobbler &s) noexcept
+{
+	return !s.GetConfig().shared_journal.empty();
+}
+
+Scrobbler &
+MultiScrobbler::Emplace(const ScrobblerConfig &config)
+{
+	if (workers.empty() || !config.shared_journal.empty())
+		return scrobblers.emplace_front(config, event_loop,
+						curl_global, writer);
+
+	auto &worker = *workers[next_worker++ % workers.size()];
+	return scrobblers.emplace_front(config, worker.GetEventLoop(),
+					worker.GetCurl(),
+					worker.GetWriter());
+}
+
+ScrobblerWorker *
+MultiScrobbler::GetWorker(const Scrobbler &s) const noexcept
+{
+	for (auto *i : workers)
+		if (&i->GetEventLoop() == &s.GetEventLoop())
+			return i;
+
+	return nullptr;
+}
+
+void
+MultiScrobbler::LoadSharedJournal() noexcept
+{
+	auto result = shared_journal->Load();
+	if (result.records.empty())
+		return;
+
+	const std::size_t n = result.records.size();
+	FormatInfo("loaded %zu song%s from %s",
+		   n, n == 1 ? "" : "s",
+		   shared_journal->GetPath().c_str());
+
+	for (auto &s : scrobblers) {
+		if (!UsesSharedJournal(s))
+			continue;
+
+		if (!result.consistent) {
+			/* we don't know what this scrobbler has
+			   submitted already; submitting a song twice
+			   is better than losing it */
+			for (const auto &i : result.records)
+				s.Restore(i);
+			continue;
+		}
+
+		const auto i = result.pending.find(s.GetConfig().name);
+		if (i == result.pending.end()) {
+			/* either a new scrobbler or a damaged
+			   cursors file; we can't tell, so err on the
+			   side of submitting twice */
+			FormatWarning("[%s] not found in %s.cursors, "
+				      "submitting all %zu songs",
+				      s.GetConfig().name.c_str(),
+				      shared_journal->GetPath().c_str(), n);
+			for (const auto &j : result.records)
+				s.Restore(j);
+			continue;
+		}
+
+		for (const std::size_t j : i->second)
+			s.Restore(result.records[j]);
+	}
+}
 
 void
 MultiScrobbler::WriteJournal() noexcept
 {
-	for (auto &i : scrobblers)
-		i.WriteJournal();
+	const ScopePauseWorkers pause{workers};
+
+	std::vector<SharedJournal::Participant> participants;
+	bool shared_dirty = std::exchange(shared_journal_dirty, false);
+
+	for (auto &i : scrobblers) {
+		if (shared_journal && UsesSharedJournal(i)) {
+			participants.push_back({i.GetConfig().name,
+						i.GetQueue()});
+			shared_dirty |= i.IsJournalDirty();
+		} else
+			i.WriteJournal();
+	}
+
+	/* the shared journal is rewritten only if one of the
+	   queues has changed */
+	if (shared_dirty) {
+		shared_journal->Write(participants, [this](bool success){
+			if (!success)
+				/* try again at the next
+				   journal_interval */
+				shared_journal_dirty = true;
+		});
+
+		for (auto &i : scrobblers)
+			if (UsesSharedJournal(i))
+				i.SetJournalSaved();
+	}
 }
 
 void
-MultiScrobbler::NowPlaying(const char *artist, const char *track,
-			   const char *album, const char *number,
-			   const char *mbid,
-			   std::chrono::steady_clock::duration length) noexcept
+MultiScrobbler::Reload(const std::forward_list<ScrobblerConfig> &configs)
 {
-	Record record;
+	for (const auto &i : configs)
+		if (!i.shared_journal.empty() &&
+		    (!shared_journal || shared_journal->GetPath() != i.shared_journal))
+			throw std::runtime_error("Changing 'shared_journal' requires a restart");
+
+	const ScopePauseWorkers pause{workers};
 
-	if (artist != nullptr)
-		record.artist = artist;
+	/* move the scrobblers with unchanged settings to the new
+	   list; splicing doesn't move the objects, so the pending
+	   requests and timers are not disturbed */
+	std::forward_list<Scrobbler> old;
+	old.swap(scrobblers);
 
-	if (track != nullptr)
-		record.track = track;
+	unsigned n_kept = 0;
+	for (const auto &config : configs) {
+		for (auto prev = old.before_begin(), i = std::next(prev);
+		     i != old.end(); prev = i++) {
+			if (i->GetConfig() == config) {
+				scrobblers.splice_after(scrobblers.before_begin(),
+							old, prev);
+				++n_kept;
+				break;
+			}
+		}
+	}
 
-	if (album != nullptr)
-		record.album = album;
+	/* save the queues of the others; the records in memory are
+	   handed to the replacement directly, because it may not
+	   have a journal of its own */
+	std::map<std::string, std::vector<SharedRecord>> carried;
+	unsigned n_removed = 0;
+	for (auto &i : old) {
+		if (UsesSharedJournal(i))
+			shared_journal_dirty = true;
+		else
+			i.WriteJournal();
 
-	if (number != nullptr)
-		record.number = number;
+		const auto &queue = i.GetQueue();
+		carried.emplace(i.GetConfig().name,
+				std::vector<SharedRecord>(queue.begin(),
+							  queue.end()));
+		++n_removed;
+	}
 
-	if (mbid != nullptr)
-		record.mbid = mbid;
+	old.clear();
 
-	record.length = length;
+	/* the new scrobblers are going to read the journals which
+	   were just written */
+	writer.Flush();
+	for (auto *i : workers)
+		i->GetWriter().Flush();
 
-	for (auto &i : scrobblers)
-		i.ScheduleNowPlaying(record);
+	unsigned n_created = 0;
+	for (const auto &config : configs) {
+		if (Find(config.name) != nullptr)
+			continue;
+
+		try {
+			Emplace(config);
+		} catch (...) {
+			FormatError("[%s] failed to start: %s",
+				    config.name.c_str(),
+				    GetFullMessage(std::current_exception()).c_str());
+			continue;
+		}
+
+		auto &s = scrobblers.front();
+		++n_created;
+
+		/* submitting a song twice is better than losing it;
+		   those which were loaded from the journal are
+		   dropped by the dedup index */
+		if (const auto i = carried.find(config.name);
+		    i != carried.end())
+			for (const auto &record : i->second)
+				s.Restore(record);
+	}
+
+	FormatInfo("configuration reloaded: %u scrobbler%s unchanged, "
+		   "%u stopped, %u started",
+		   n_kept, n_kept == 1 ? "" : "s",
+		   n_removed, n_created);
+}
+
+Scrobbler *
+MultiScrobbler::Find(std::string_view name) noexcept
+{
+	auto i = std::find_if(scrobblers.begin(), scrobblers.end(),
+			      [name](const Scrobbler &s){
+				      return s.GetConfig().name == name;
+			      });
+	return i != scrobblers.end() ? &*i : nullptr;
+}
+
+ScrobblerList
+MultiScrobbler::Select(const std::forward_list<std::string> &names)
+{
+	ScrobblerList result;
+
+	if (names.empty()) {
+		for (auto &i : scrobblers)
+			result.push_back(&i);
+		return result;
+	}
+
+	for (const auto &name : names) {
+		auto *s = Find(name);
+		if (s == nullptr)
+			throw FormatRuntimeError("No such scrobbler: '%s'",
+						 name.c_str());
+
+		result.push_back(s);
+	}
+
+	return result;
 }
 
 void
-MultiScrobbler::SongChange(const char *file, const char *artist, const char *track,
-			   const char *album, const char *number,
-			   const char *mbid,
-			   std::chrono::steady_clock::duration length,
-			   bool love,
-			   const char *time2) noexcept
+MultiScrobbler::NowPlaying(const ScrobblerList &targets,
+			   Record &&record) noexcept
 {
-	Record record;
+	/* all scrobblers share one immutable copy */
+	const auto shared = std::make_shared<const Record>(std::move(record));
+
+	for (auto *i : targets) {
+		if (auto *w = GetWorker(*i))
+			w->Inject([i, shared]{ i->ScheduleNowPlaying(shared); });
+		else
+			i->ScheduleNowPlaying(shared);
+	}
+}
 
+void
+MultiScrobbler::SongChange(const ScrobblerList &targets, const char *uri,
+			   Record &&record) noexcept
+{
 	/* from the 1.2 protocol draft:
 
 	   You may still submit if there is no album title (variable b)
@@ -92,47 +324,201 @@ MultiScrobbler::SongChange(const char *file, const char *artist, const char *tra
 
 	   everything else is mandatory.
 	 */
-	if (!(artist && strlen(artist))) {
+	if (record.artist.empty()) {
 		FormatWarning("empty artist, not submitting; "
-			      "please check the tags on %s\n", file);
+			      "please check the tags on %s\n", uri);
 		return;
 	}
 
-	if (!(track && strlen(track))) {
+	if (record.track.empty()) {
 		FormatWarning("empty title, not submitting; "
-			      "please check the tags on %s", file);
+			      "please check the tags on %s", uri);
 		return;
 	}
 
-	record.artist = artist;
-	record.track = track;
+	if (record.time == 0)
+		record.time = time(nullptr);
 
-	if (album != nullptr)
-		record.album = album;
+	FormatInfo("%s, songchange: %s - %s (%i)\n",
+		   record.FormatTime().c_str(), record.artist.c_str(),
+		   record.track.c_str(),
+		   (int)std::chrono::duration_cast<std::chrono::seconds>(record.length).count());
 
-	if (number != nullptr)
-		record.number = number;
+	/* all scrobblers share one immutable copy */
+	Push(targets, std::make_shared<const Record>(std::move(record)));
+}
 
-	if (mbid != nullptr)
-		record.mbid = mbid;
+void
+MultiScrobbler::Push(const ScrobblerList &targets,
+		     const SharedRecord &record) noexcept
+{
+	bool shared_push = false;
+	for (auto *i : targets) {
+		if (auto *w = GetWorker(*i))
+			/* it doesn't use the shared journal (see
+			   Emplace()), so the result is not needed */
+			w->Inject([i, record]{ i->Push(record); });
+		else if (i->Push(record) && UsesSharedJournal(*i))
+			shared_push = true;
+	}
 
-	record.length = length;
-	record.time = time2 ? time2 : as_timestamp();
-	record.love = love;
-	record.source = strstr(file, "://") == nullptr ? "P" : "R";
+	if (shared_push)
+		shared_journal->Add(record);
+}
 
-	FormatInfo("%s, songchange: %s - %s (%i)\n",
-		   record.time.c_str(), record.artist.c_str(),
-		   record.track.c_str(),
-		   (int)std::chrono::duration_cast<std::chrono::seconds>(record.length).count());
+std::size_t
+MultiScrobbler::GetMaxQueueLength() const noexcept
+{
+	const ScopePauseWorkers pause{workers};
 
-	for (auto &i : scrobblers)
-		i.Push(record);
+	std::size_t result = 0;
+	for (const auto &i : scrobblers)
+		result = std::max(result, i.GetQueueLength());
+	return result;
 }
 
 void
 MultiScrobbler::SubmitNow() noexcept
 {
+	const ScopePauseWorkers pause{workers};
+
 	for (auto &i : scrobblers)
 		i.SubmitNow();
 }
+
+void
+MultiScrobbler::LogStatistics() const noexcept
+{
+	struct TenantStatistics {
+		unsigned n_scrobblers = 0;
+		std::size_t queue_length = 0, memory = 0;
+		unsigned long n_requests = 0;
+	};
+
+	std::map<std::string_view, TenantStatistics> tenants;
+
+	const ScopePauseWorkers pause{workers};
+	for (const auto &i : scrobblers) {
+		auto &t = tenants[i.GetConfig().tenant];
+		++t.n_scrobblers;
+		t.queue_length += i.GetQueueLength();
+		t.memory += i.GetMemoryUsage();
+		t.n_requests += i.GetRequestCount();
+	}
+
+	for (const auto &[name, t] : tenants)
+		FormatInfo("[%.*s] %u scrobbler%s, %zu queued song%s, "
+			   "%zu kB, %lu requests",
+			   name.empty() ? 4 : (int)name.size(),
+			   name.empty() ? "main" : name.data(),
+			   t.n_scrobblers, t.n_scrobblers == 1 ? "" : "s",
+			   t.queue_length, t.queue_length == 1 ? "" : "s",
+			   t.memory / 1024, t.n_requests);
+}
+
+MultiScrobbler::Statistics
+MultiScrobbler::GetStatistics() const noexcept
+{
+	Statistics result;
+	std::set<std::string_view> tenants;
+
+	const ScopePauseWorkers pause{workers};
+	for (const auto &i : scrobblers) {
+		tenants.emplace(i.GetConfig().tenant);
+		++result.n_scrobblers;
+		result.max_queue_length = std::max(result.max_queue_length,
+						   i.GetQueueLength());
+		result.memory += i.GetMemoryUsage();
+		result.songs_submitted += i.GetMetrics().songs_submitted;
+		result.submit_latency.Add(i.GetMetrics().submit_latency);
+	}
+
+	result.n_tenants = tenants.size();
+	return result;
+}
+
+static std::string
+MakeLabels(const Scrobbler &s)
+{
+	const auto &config = s.GetConfig();
+	auto labels = MetricsWriter::MakeLabel("scrobbler", config.name);
+	if (!config.tenant.empty()) {
+		labels.push_back(',');
+		labels.append(MetricsWriter::MakeLabel("tenant", config.tenant));
+	}
+
+	return labels;
+}
+
+static double
+ToSeconds(std::chrono::steady_clock::duration d) noexcept
+{
+	return std::chrono::duration<double>(d).count();
+}
+
+void
+MultiScrobbler::WriteMetrics(MetricsWriter &w) const
+{
+	const ScopePauseWorkers pause{workers};
+
+	std::vector<std::pair<const Scrobbler *, std::string>> list;
+	for (const auto &i : scrobblers)
+		list.emplace_back(&i, MakeLabels(i));
+
+	const auto write = [&w, &list](const char *name, const char *type,
+				       const char *help, auto &&get){
+		w.Describe(name, type, help);
+		for (const auto &[s, labels] : list)
+			w.Write(name, labels, get(*s));
+	};
+
+	write("mpdscribble_queue_length", "gauge",
+	      "Songs waiting to be submitted.",
+	      [](const Scrobbler &s){ return uint_least64_t(s.GetQueueLength()); });
+	write("mpdscribble_queue_spilled", "gauge",
+	      "Queued songs which were spilled to disk.",
+	      [](const Scrobbler &s){ return uint_least64_t(s.GetSpilledCount()); });
+	write("mpdscribble_pending", "gauge",
+	      "Songs in submit requests which are in flight.",
+	      [](const Scrobbler &s){ return uint_least64_t(s.GetPendingCount()); });
+	write("mpdscribble_submit_interval_seconds", "gauge",
+	      "The current submit retry interval.",
+	      [](const Scrobbler &s){ return ToSeconds(s.GetSubmitInterval()); });
+	write("mpdscribble_handshake_interval_seconds", "gauge",
+	      "The current handshake retry interval.",
+	      [](const Scrobbler &s){ return ToSeconds(s.GetHandshakeInterval()); });
+	write("mpdscribble_handshake_success_total", "counter",
+	      "Successful handshakes.",
+	      [](const Scrobbler &s){ return s.GetMetrics().handshake_success; });
+	write("mpdscribble_handshake_failure_total", "counter",
+	      "Failed handshakes.",
+	      [](const Scrobbler &s){ return s.GetMetrics().handshake_failure; });
+	write("mpdscribble_submit_success_total", "counter",
+	      "Submit requests accepted by the server.",
+	      [](const Scrobbler &s){ return s.GetMetrics().submit_success; });
+	write("mpdscribble_submit_failure_total", "counter",
+	      "Failed submit requests.",
+	      [](const Scrobbler &s){ return s.GetMetrics().submit_failure; });
+	write("mpdscribble_songs_submitted_total", "counter",
+	      "Songs accepted by the server or written to the file.",
+	      [](const Scrobbler &s){ return s.GetMetrics().songs_submitted; });
+	write("mpdscribble_duplicates_total", "counter",
+	      "Songs which were dropped because they were queued or submitted already.",
+	      [](const Scrobbler &s){ return s.GetMetrics().duplicates; });
+	write("mpdscribble_now_playing_expired_total", "counter",
+	      "'Now playing' notifications which were discarded because the song had ended.",
+	      [](const Scrobbler &s){ return s.GetMetrics().now_playing_expired; });
+	write("mpdscribble_submit_latency_seconds", "histogram",
+	      "Round trip time of submit requests.",
+	      [](const Scrobbler &s) -> const Histogram & {
+		      return s.GetMetrics().submit_latency;
+	      });
+	write("mpdscribble_journal_write_seconds", "histogram",
+	      "Time spent rewriting the journal file.",
+	      [](const Scrobbler &s) -> const Histogram & {
+		      return s.GetMetrics().journal_write_duration;
+	      });
+	write("mpdscribble_journal_write_bytes_total", "counter",
+	      "Bytes written while rewriting the journal file.",
+	      [](const Scrobbler &s){ return s.GetMetrics().journal_write_bytes; });
+}
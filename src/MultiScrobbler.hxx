@@ -21,38 +21,211 @@
 #ifndef MULTI_SCROBBLER_HXX
 #define MULTI_SCROBBLER_HXX
 
+#include "Record.hxx"
+#include "Metrics.hxx"
+
 #include <chrono>
+#include <cstdint>
 #include <forward_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
 struct ScrobblerConfig;
 class CurlGlobal;
+class AsyncWriter;
 class Scrobbler;
 class EventLoop;
+class SharedJournal;
+class ScrobblerWorker;
+
+/**
+ * A selection of scrobblers which receive the songs of one MPD
+ * server.
+ */
+using ScrobblerList = std::vector<Scrobbler *>;
 
 class MultiScrobbler {
+	EventLoop &event_loop;
+	CurlGlobal &curl_global;
+	AsyncWriter &writer;
+
+	/**
+	 * The worker threads the scrobblers are distributed to;
+	 * empty if all scrobblers run in the main thread.
+	 */
+	const std::vector<ScrobblerWorker *> workers;
+
+	/**
+	 * The index of the worker which gets the next scrobbler.
+	 */
+	std::size_t next_worker = 0;
+
+	/**
+	 * All scrobblers.  Those which run in a worker thread may
+	 * only be accessed while the workers are paused, or by a
+	 * function injected into their worker.
+	 */
 	std::forward_list<Scrobbler> scrobblers;
 
+	/**
+	 * The journal of all scrobblers which don't have their own
+	 * one; null if "shared_journal" is not configured.
+	 */
+	std::unique_ptr<SharedJournal> shared_journal;
+
+	/**
+	 * Must #shared_journal be rewritten even if no participant's
+	 * queue has changed?  Set when a participant was removed and
+	 * when saving it has failed.
+	 */
+	bool shared_journal_dirty = false;
+
 public:
+	/**
+	 * @param shared_journal_path the path of the shared journal
+	 * or nullptr
+	 * @param workers worker threads which shall run the
+	 * scrobblers; scrobblers using the shared journal always
+	 * run in the main thread, because the shared journal needs
+	 * direct access to their queues
+	 */
 	explicit MultiScrobbler(const std::forward_list<ScrobblerConfig> &configs,
 				EventLoop &event_loop,
-				CurlGlobal &curl_global);
+				CurlGlobal &curl_global,
+				AsyncWriter &writer,
+				const char *shared_journal_path=nullptr,
+				std::vector<ScrobblerWorker *> workers={});
 	~MultiScrobbler() noexcept;
 
+private:
+	/**
+	 * Create a new scrobbler, in the main thread or in the next
+	 * worker.  The workers must be paused.
+	 *
+	 * Throws on error.
+	 */
+	Scrobbler &Emplace(const ScrobblerConfig &config);
+
+	/**
+	 * Returns the worker which runs the given scrobbler, or
+	 * nullptr if it runs in the main thread.
+	 */
+	[[gnu::pure]]
+	ScrobblerWorker *GetWorker(const Scrobbler &s) const noexcept;
+
+	/**
+	 * Load the shared journal and give each scrobbler the records
+	 * it has not submitted yet.
+	 */
+	void LoadSharedJournal() noexcept;
+
+public:
+
 	void WriteJournal() noexcept;
 
-	void NowPlaying(const char *artist, const char *track,
-			const char *album, const char *number,
-			const char *mbid,
-			std::chrono::steady_clock::duration length) noexcept;
+	/**
+	 * Apply a new list of scrobbler settings.  Scrobblers whose
+	 * settings have not changed are kept, together with their
+	 * queue, session and connections.  All others are destroyed
+	 * after saving their journal, and scrobblers for new or
+	 * changed sections are created.
+	 *
+	 * This invalidates all #ScrobblerList instances returned by
+	 * Select().
+	 *
+	 * Throws if the new settings cannot be applied at runtime;
+	 * nothing has been changed then.
+	 */
+	void Reload(const std::forward_list<ScrobblerConfig> &configs);
+
+	/**
+	 * Look up a scrobbler by its section name.  Returns nullptr
+	 * if there is none.
+	 */
+	[[gnu::pure]]
+	Scrobbler *Find(std::string_view name) noexcept;
 
-	void SongChange(const char *file, const char *artist, const char *track,
-			const char *album, const char *number,
-			const char *mbid,
-			std::chrono::steady_clock::duration length,
-			bool love,
-			const char *time) noexcept;
+	/**
+	 * Look up scrobblers by their section names.  An empty list
+	 * selects all scrobblers.
+	 *
+	 * Throws if a name is unknown.
+	 */
+	ScrobblerList Select(const std::forward_list<std::string> &names);
+
+	/**
+	 * Send a "now playing" notification to the given
+	 * scrobblers.  The "time" and "love" attributes of the
+	 * record are ignored.
+	 */
+	void NowPlaying(const ScrobblerList &targets,
+			Record &&record) noexcept;
+
+	/**
+	 * A song has been played: queue it for submission, unless
+	 * it lacks the artist or the title.  If its "time" is zero,
+	 * the current time is used.
+	 *
+	 * @param uri the URI of the song, for log messages
+	 */
+	void SongChange(const ScrobblerList &targets, const char *uri,
+			Record &&record) noexcept;
+
+	/**
+	 * Queue a record which was prepared by the caller, e.g. one
+	 * loaded by "--import".
+	 */
+	void Push(const ScrobblerList &targets,
+		  const SharedRecord &record) noexcept;
 
 	void SubmitNow() noexcept;
+
+	/**
+	 * Returns the length of the longest queue.
+	 */
+	[[gnu::pure]]
+	std::size_t GetMaxQueueLength() const noexcept;
+
+	struct Statistics {
+		unsigned n_scrobblers = 0;
+
+		/**
+		 * The number of distinct "tenant" settings.
+		 */
+		unsigned n_tenants = 0;
+
+		std::size_t max_queue_length = 0;
+
+		/**
+		 * The estimated memory usage of all queues [bytes].
+		 */
+		std::size_t memory = 0;
+
+		uint_least64_t songs_submitted = 0;
+
+		Histogram submit_latency{LATENCY_BUCKETS};
+	};
+
+	/**
+	 * Sum up the counters of all scrobblers (e.g. for
+	 * "--simulate").
+	 */
+	[[gnu::pure]]
+	Statistics GetStatistics() const noexcept;
+
+	/**
+	 * Log the queue length, memory usage and request count of
+	 * each tenant.
+	 */
+	void LogStatistics() const noexcept;
+
+	/**
+	 * Write the metrics of all scrobblers.  Throws
+	 * std::bad_alloc.
+	 */
+	void WriteMetrics(MetricsWriter &w) const;
 };
 
 #endif
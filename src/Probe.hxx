@@ -0,0 +1,60 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef PROBE_HXX
+#define PROBE_HXX
+
+/*
+ * Static tracepoints (USDT) in the provider "mpdscribble", which
+ * can be attached with bpftrace, perf or SystemTap, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/bin/mpdscribble:mpdscribble:submit
+ *                { printf("%s %d\n", str(arg0), arg1); }'
+ *
+ * A tracepoint is a single "nop" instruction until a tracer is
+ * attached.  Without the build option "usdt", the macros expand to
+ * nothing and their arguments are not evaluated.
+ *
+ * The list of tracepoints is documented in doc/mpdscribble.1.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_USDT
+
+#include <sys/sdt.h>
+
+#define MPDSCRIBBLE_PROBE(name) DTRACE_PROBE(mpdscribble, name)
+#define MPDSCRIBBLE_PROBE1(name, a) DTRACE_PROBE1(mpdscribble, name, a)
+#define MPDSCRIBBLE_PROBE2(name, a, b) DTRACE_PROBE2(mpdscribble, name, a, b)
+#define MPDSCRIBBLE_PROBE3(name, a, b, c) DTRACE_PROBE3(mpdscribble, name, a, b, c)
+#define MPDSCRIBBLE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(mpdscribble, name, a, b, c, d)
+
+#else
+
+#define MPDSCRIBBLE_PROBE(name) do {} while (false)
+#define MPDSCRIBBLE_PROBE1(name, a) do {} while (false)
+#define MPDSCRIBBLE_PROBE2(name, a, b) do {} while (false)
+#define MPDSCRIBBLE_PROBE3(name, a, b, c) do {} while (false)
+#define MPDSCRIBBLE_PROBE4(name, a, b, c, d) do {} while (false)
+
+#endif
+
+#endif
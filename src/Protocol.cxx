@@ -19,7 +19,13 @@
 */
 
 #include "Protocol.hxx"
+#include "Form.hxx"
+#include "Record.hxx"
+#include "lib/gcrypt/MD5.hxx"
+#include "util/HexFormat.hxx"
+#include "util/SpanCast.hxx"
 
+#include <stdio.h>
 #include <time.h>
 
 std::string
@@ -29,3 +35,73 @@ as_timestamp() noexcept
 	snprintf(buffer, sizeof(buffer), "%ld", (long)time(nullptr));
 	return buffer;
 }
+
+std::array<char, MD5_HEX_SIZE>
+md5_hex(std::string_view s) noexcept
+{
+	const auto binary = Gcrypt::MD5(AsBytes(s));
+	return HexFormat(std::span{binary});
+}
+
+std::array<char, MD5_HEX_SIZE>
+as_md5(std::string_view password, std::string_view timestamp)
+{
+	std::array<char, MD5_HEX_SIZE> buffer;
+
+	auto password_md5 = password;
+	if (password.length() != MD5_HEX_SIZE) {
+		/* assume it's not hashed yet */
+		buffer = md5_hex(password);
+		password_md5 = std::string_view(buffer.data(), MD5_HEX_SIZE);
+	}
+
+	std::string md5_with_timestamp;
+	md5_with_timestamp.reserve(password_md5.size() + timestamp.size());
+	md5_with_timestamp.append(password_md5);
+	md5_with_timestamp.append(timestamp);
+	return md5_hex(md5_with_timestamp);
+}
+
+std::size_t
+EstimateSubmitSize(const RecordQueue &queue, std::size_t offset,
+		   std::size_t count) noexcept
+{
+	/* the keys, separators and short values of one song, e.g.
+	   "&a[49]=&t[49]=&l[49]=300&..." */
+	static constexpr std::size_t PER_SONG = 128;
+
+	std::size_t size = 16;
+	for (std::size_t i = offset; i < offset + count; ++i) {
+		const Record &song = *queue[i];
+		/* allow a few escaped characters */
+		size += PER_SONG +
+			(song.artist.size() + song.track.size() +
+			 song.album.size() + song.number.size() +
+			 song.mbid.size()) * 5 / 4;
+	}
+
+	return size;
+}
+
+void
+AppendSubmitRecords(FormDataBuilder &form, const RecordQueue &queue,
+		    std::size_t offset, std::size_t count) noexcept
+{
+	for (unsigned i = 0; i < count; ++i) {
+		const Record *song = queue[offset + i].get();
+
+		form.AppendIndexed("a", i, song->artist);
+		form.AppendIndexed("t", i, song->track);
+		form.AppendIndexed("l", i,
+				   std::chrono::duration_cast<std::chrono::seconds>(song->length).count());
+		form.AppendIndexed("i", i, song->FormatTime().c_str());
+		form.AppendIndexed("o", i, song->source);
+		form.AppendIndexed("r", i, "");
+		form.AppendIndexed("b", i, song->album);
+		form.AppendIndexed("n", i, song->number);
+		form.AppendIndexed("m", i, song->mbid.Format().c_str());
+
+		if (song->love)
+			form.AppendIndexed("r", i, "L");
+	}
+}
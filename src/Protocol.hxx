@@ -22,13 +22,69 @@
 #define PROTOCOL_HXX
 
 #include "config.h"
+#include "RecordQueue.hxx"
 
+#include <array>
+#include <cstddef>
 #include <string>
+#include <string_view>
 
 #define AS_CLIENT_ID "mdc"
 #define AS_CLIENT_VERSION VERSION
 
+class FormDataBuilder;
+
+static constexpr std::size_t MD5_SIZE = 16;
+static constexpr std::size_t MD5_HEX_SIZE = MD5_SIZE * 2;
+
 std::string
 as_timestamp() noexcept;
 
+/**
+ * Calculate the MD5 checksum of the specified string and format it
+ * as a hexadecimal string.
+ */
+std::array<char, MD5_HEX_SIZE>
+md5_hex(std::string_view s) noexcept;
+
+/**
+ * Calculate the authentication token for the handshake.  The
+ * password may be plain text or already its MD5 checksum.
+ */
+std::array<char, MD5_HEX_SIZE>
+as_md5(std::string_view password, std::string_view timestamp);
+
+/**
+ * Split the first line off the given input.  Returns an empty
+ * string if there is no complete line.
+ */
+static constexpr std::string_view
+next_line(std::string_view &input) noexcept
+{
+	const auto newline = input.find('\n');
+	if (newline == input.npos)
+		return {};
+
+	const auto line = input.substr(0, newline);
+	input.remove_prefix(newline + 1);
+	return line;
+}
+
+/**
+ * Estimate the size of the POST request body for submitting the
+ * given range of the queue, for FormDataBuilder::Reserve().
+ */
+[[gnu::pure]]
+std::size_t
+EstimateSubmitSize(const RecordQueue &queue, std::size_t offset,
+		   std::size_t count) noexcept;
+
+/**
+ * Append the submission parameters of the given range of the queue
+ * to the POST request body.
+ */
+void
+AppendSubmitRecords(FormDataBuilder &form, const RecordQueue &queue,
+		    std::size_t offset, std::size_t count) noexcept;
+
 #endif
@@ -22,7 +22,9 @@
 #include "util/Compiler.h"
 #include "util/RuntimeError.hxx"
 #include "util/ScopeExit.hxx"
+#include "util/StringSplit.hxx"
 #include "util/StringStrip.hxx"
+#include "system/Error.hxx"
 #include "Config.hxx"
 #include "IniFile.hxx"
 #include "SdDaemon.hxx"
@@ -33,11 +35,17 @@
 #endif
 
 #include <cassert>
+#include <climits>
+#include <set>
 
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
 /*
   default locations for files.
 
@@ -52,6 +60,7 @@
 #endif
 
 #define AS_HOST "https://post.audioscrobbler.com/"
+#define LISTENBRAINZ_HOST "https://api.listenbrainz.org/"
 
 [[gnu::pure]]
 static bool
@@ -188,6 +197,109 @@ GetStdString(const IniSection &section, const std::string &key) noexcept
 	return i->second;
 }
 
+static bool
+GetBool(const IniSection &section, const std::string &key,
+	bool default_value)
+{
+	const char *s = GetString(section, key);
+	if (s == nullptr)
+		return default_value;
+
+	if (strcmp(s, "yes") == 0 || strcmp(s, "true") == 0 ||
+	    strcmp(s, "1") == 0)
+		return true;
+
+	if (strcmp(s, "no") == 0 || strcmp(s, "false") == 0 ||
+	    strcmp(s, "0") == 0)
+		return false;
+
+	throw FormatRuntimeError("Not a boolean value for '%s': '%s'",
+				 key.c_str(), s);
+}
+
+static JournalFormat
+GetJournalFormat(const IniSection &section)
+{
+	const char *s = GetString(section, "journal_format");
+	if (s == nullptr || strcmp(s, "text") == 0)
+		return JournalFormat::TEXT;
+
+	if (strcmp(s, "binary") == 0)
+		return JournalFormat::BINARY;
+
+	throw FormatRuntimeError("Unknown journal format: '%s'", s);
+}
+
+static FileFormat
+GetFileFormat(const IniSection &section)
+{
+	const char *s = GetString(section, "file_format");
+	if (s == nullptr || strcmp(s, "text") == 0)
+		return FileFormat::TEXT;
+
+	if (strcmp(s, "tsv") == 0)
+		return FileFormat::TSV;
+
+	if (strcmp(s, "jsonl") == 0)
+		return FileFormat::JSONL;
+
+	throw FormatRuntimeError("Unknown file format: '%s'", s);
+}
+
+static RequestCompression
+GetRequestCompression(const IniSection &section)
+{
+	const char *s = GetString(section, "compress");
+	if (s == nullptr || strcmp(s, "no") == 0)
+		return RequestCompression::NONE;
+
+#ifdef HAVE_ZLIB
+	if (strcmp(s, "gzip") == 0)
+		return RequestCompression::GZIP;
+
+	if (strcmp(s, "deflate") == 0)
+		return RequestCompression::DEFLATE;
+#else
+	if (strcmp(s, "gzip") == 0 || strcmp(s, "deflate") == 0)
+		throw std::runtime_error("mpdscribble was built without zlib");
+#endif
+
+	throw FormatRuntimeError("Unknown compression: '%s'", s);
+}
+
+static ScrobblerProtocol
+GetProtocol(const IniSection &section)
+{
+	const char *s = GetString(section, "protocol");
+	if (s == nullptr || strcmp(s, "audioscrobbler") == 0)
+		return ScrobblerProtocol::AUDIOSCROBBLER;
+
+	if (strcmp(s, "listenbrainz") == 0)
+		return ScrobblerProtocol::LISTENBRAINZ;
+
+	throw FormatRuntimeError("Unknown protocol: '%s'", s);
+}
+
+static unsigned
+GetUnsigned(const IniSection &section, const std::string &key,
+	    unsigned default_value, unsigned min_value, unsigned max_value)
+{
+	const char *s = GetString(section, key);
+	if (s == nullptr)
+		return default_value;
+
+	char *endptr;
+	auto value = strtoul(s, &endptr, 10);
+	if (endptr == s || *endptr != 0)
+		throw FormatRuntimeError("Not a number: '%s'", s);
+
+	if (value < min_value || value > max_value)
+		throw FormatRuntimeError("Setting '%s' must be between %u and %u",
+					 key.c_str(), min_value, max_value);
+
+	return (unsigned)value;
+}
+
 static bool
 load_string(const IniFile &file, const char *name, std::string &value) noexcept
 {
@@ -255,15 +367,26 @@ load_scrobbler_config(const Config &config,
 		scrobbler.url = AS_HOST;
 	} else {
 		scrobbler.name = section_name;
+		scrobbler.protocol = GetProtocol(section);
 		scrobbler.file = GetStdString(section, "file");
 		if (scrobbler.file.empty()) {
 			scrobbler.url = GetStdString(section, "url");
+			if (scrobbler.url.empty() &&
+			    scrobbler.protocol == ScrobblerProtocol::LISTENBRAINZ)
+				scrobbler.url = LISTENBRAINZ_HOST;
+
 			if (scrobbler.url.empty())
 				throw FormatRuntimeError("Section '%s' has neither 'file' nor 'url'", section_name.c_str());
 		}
 	}
 
-	if (scrobbler.file.empty()) {
+	if (!scrobbler.file.empty()) {
+		/* no credentials needed */
+	} else if (scrobbler.protocol == ScrobblerProtocol::LISTENBRAINZ) {
+		scrobbler.token = GetStdString(section, "token");
+		if (scrobbler.token.empty())
+			throw std::runtime_error("No 'token'");
+	} else {
 		scrobbler.username = GetStdString(section, "username");
 		if (scrobbler.username.empty())
 			throw std::runtime_error("No 'username'");
@@ -277,13 +400,259 @@ load_scrobbler_config(const Config &config,
 	if (scrobbler.journal.empty() && section_name.empty()) {
 		/* mpdscribble <= 0.17 compatibility */
 		scrobbler.journal = GetStdString(section, "cache");
-		if (scrobbler.journal.empty())
+		if (scrobbler.journal.empty() &&
+		    config.shared_journal.empty())
 			scrobbler.journal = get_default_cache_path(config);
 	}
 
+	scrobbler.journal_append = GetBool(section, "journal_append", false);
+	scrobbler.journal_format = GetJournalFormat(section);
+	const unsigned max_submit_count =
+		scrobbler.protocol == ScrobblerProtocol::LISTENBRAINZ
+		? ScrobblerConfig::LISTENBRAINZ_MAX_SUBMIT_COUNT
+		: ScrobblerConfig::MAX_SUBMIT_COUNT;
+	scrobbler.max_submit_count =
+		GetUnsigned(section, "max_submit_count",
+			    max_submit_count, 1, max_submit_count);
+	scrobbler.max_queue = GetUnsigned(section, "max_queue", 0,
+					  0, UINT_MAX);
+	scrobbler.max_memory_queue = GetUnsigned(section, "max_memory_queue",
+						 0, 0, UINT_MAX);
+#ifdef _WIN32
+	if (scrobbler.max_memory_queue > 0)
+		throw std::runtime_error("max_memory_queue is not supported on this platform");
+#endif
+
+	scrobbler.submit_window =
+		std::chrono::milliseconds(GetUnsigned(section,
+						      "submit_window",
+						      0, 0, UINT_MAX / 5));
+	scrobbler.submit_max_delay =
+		std::chrono::milliseconds(GetUnsigned(section,
+						      "submit_max_delay",
+						      scrobbler.submit_window.count() * 5,
+						      0, UINT_MAX));
+	if (scrobbler.submit_max_delay < scrobbler.submit_window)
+		throw std::runtime_error("'submit_max_delay' must not be smaller than 'submit_window'");
+
+	scrobbler.submit_with_now_playing =
+		GetBool(section, "submit_with_now_playing", false);
+	scrobbler.prewarm = GetBool(section, "prewarm", false);
+	scrobbler.compress = GetRequestCompression(section);
+
+	if (!scrobbler.file.empty()) {
+		scrobbler.file_format = GetFileFormat(section);
+		scrobbler.file_flush_interval =
+			std::chrono::milliseconds(GetUnsigned(section,
+							      "file_flush_interval",
+							      0, 0, UINT_MAX));
+		scrobbler.file_flush_count =
+			GetUnsigned(section, "file_flush_count",
+				    scrobbler.file_flush_interval.count() > 0 ? 0 : 1,
+				    0, UINT_MAX);
+		if (scrobbler.file_flush_count == 0 &&
+		    scrobbler.file_flush_interval.count() == 0)
+			throw std::runtime_error("'file_flush_count = 0' requires 'file_flush_interval'");
+
+		scrobbler.file_sync = GetBool(section, "file_sync", false);
+	}
+
 	return scrobbler;
 }
 
+/**
+ * The prefix of section names which configure MPD servers.
+ */
+static constexpr std::string_view MPD_SECTION_PREFIX = "mpd:";
+
+static MpdConfig
+load_mpd_config(const std::string &section_name, const IniSection &section)
+{
+	MpdConfig mpd;
+	mpd.name = section_name.substr(MPD_SECTION_PREFIX.size());
+	if (mpd.name.empty())
+		throw std::runtime_error("MPD section without a name");
+
+	mpd.host = GetStdString(section, "host");
+	mpd.port = GetUnsigned(section, "port", 0, 0, 65535);
+
+	/* a comma-separated list of scrobbler section names */
+	const auto scrobblers = GetStdString(section, "scrobblers");
+	std::string_view names = scrobblers;
+	while (!names.empty()) {
+		const auto [name, rest] = Split(names, ',');
+		const auto stripped = Strip(name);
+		if (!stripped.empty())
+			mpd.scrobblers.emplace_front(stripped);
+		names = rest;
+	}
+
+	return mpd;
+}
+
+/**
+ * Load the "[mpd:NAME]" and the scrobbler sections of a
+ * configuration file.
+ *
+ * @param tenant the name of the tenant whose file this is, or empty
+ * for the main configuration file; it is prepended to all section
+ * names
+ * @param host the default MPD host for this file
+ * @param port the default MPD port for this file
+ */
+static void
+load_sections(Config &config, const IniFile &file,
+	      const std::string &tenant,
+	      const std::string &host, unsigned port)
+{
+	const std::string prefix = tenant.empty() ? std::string{} : tenant + "/";
+
+	std::forward_list<std::string> scrobbler_names;
+	std::forward_list<MpdConfig> mpd;
+
+	for (const auto &section : file) {
+		if (section.first.starts_with(MPD_SECTION_PREFIX)) {
+			auto &m = mpd.emplace_front(load_mpd_config(section.first,
+								    section.second));
+			m.name.insert(0, prefix);
+			m.tenant = tenant;
+
+			for (auto &i : m.scrobblers)
+				i.insert(0, prefix);
+			continue;
+		}
+
+		if (section.first.empty() &&
+		    (!tenant.empty() ||
+		     section.second.find("username") == section.second.end()))
+			/* the default section does not contain a
+			   username: don't set up the last.fm default
+			   scrobbler */
+			continue;
+
+		auto scrobbler = load_scrobbler_config(config,
+						       section.first,
+						       section.second);
+		if (!tenant.empty()) {
+			scrobbler.name.insert(0, prefix);
+			scrobbler.tenant = tenant;
+
+			if (scrobbler.max_queue == 0)
+				scrobbler.max_queue = config.tenant_max_queue;
+
+			if (scrobbler.journal.empty() &&
+			    !config.tenant_journal_dir.empty())
+				scrobbler.journal = config.tenant_journal_dir +
+					"/" + tenant + "." + section.first +
+					".journal";
+		}
+
+		if (!config.shared_journal.empty() &&
+		    scrobbler.journal.empty() && scrobbler.file.empty())
+			scrobbler.shared_journal = config.shared_journal;
+
+		if (scrobbler.max_memory_queue > 0 &&
+		    scrobbler.file.empty() && scrobbler.journal.empty())
+			throw FormatRuntimeError("Section '%s': max_memory_queue requires a journal",
+						 scrobbler.name.c_str());
+
+		scrobbler_names.emplace_front(scrobbler.name);
+		config.scrobblers.emplace_front(std::move(scrobbler));
+	}
+
+	if (scrobbler_names.empty()) {
+		if (!tenant.empty())
+			throw FormatRuntimeError("Tenant '%s' has no scrobblers",
+						 tenant.c_str());
+
+		/* no scrobblers in the main file; all of them are
+		   configured by tenants */
+		return;
+	}
+
+	if (mpd.empty()) {
+		/* no "[mpd:NAME]" sections: observe only the server
+		   configured in the global section */
+		auto &m = mpd.emplace_front();
+		m.name = tenant;
+		m.tenant = tenant;
+		m.host = host;
+		m.port = port;
+	}
+
+	/* an empty "scrobblers" list selects all scrobblers of this
+	   file, but not those of other tenants */
+	for (auto &m : mpd) {
+		if (m.scrobblers.empty())
+			m.scrobblers = scrobbler_names;
+
+		config.mpd.emplace_front(std::move(m));
+	}
+}
+
+/**
+ * Load one tenant configuration file.  The tenant name is the file
+ * name without the ".conf" suffix.
+ */
+static void
+load_tenant_file(Config &config, const std::string &tenant,
+		 const char *path)
+{
+	const auto file = ReadIniFile(path);
+
+	std::string host;
+	unsigned port = 0;
+
+	if (auto i = file.find(std::string()); i != file.end()) {
+		host = GetStdString(i->second, "host");
+		port = GetUnsigned(i->second, "port", 0, 0, 65535);
+	}
+
+	load_sections(config, file, tenant, host, port);
+}
+
+static void
+load_tenant_dir(Config &config, const char *path)
+{
+#ifndef _WIN32
+	DIR *dir = opendir(path);
+	if (dir == nullptr)
+		throw FormatErrno("Failed to open tenant directory '%s'",
+				  path);
+
+	AtScopeExit(dir) { closedir(dir); };
+
+	static constexpr std::string_view suffix = ".conf";
+
+	/* sort the names so the configuration is loaded in a
+	   stable order */
+	std::set<std::string> names;
+
+	while (const auto *e = readdir(dir)) {
+		const std::string_view name = e->d_name;
+		if (name.front() != '.' && name.size() > suffix.size() &&
+		    name.ends_with(suffix))
+			names.emplace(name.substr(0, name.size() - suffix.size()));
+	}
+
+	for (const auto &tenant : names) {
+		const auto tenant_path = std::string{path} + "/" + tenant +
+			std::string{suffix};
+
+		try {
+			load_tenant_file(config, tenant, tenant_path.c_str());
+		} catch (...) {
+			std::throw_with_nested(FormatRuntimeError("Failed to load tenant '%s'",
+								  tenant.c_str()));
+		}
+	}
+#else
+	(void)config;
+	throw FormatRuntimeError("Tenant directory '%s' not supported on this platform",
+				 path);
+#endif
+}
+
 static void
 load_config_file(Config &config, const char *path)
 {
@@ -300,19 +669,32 @@ load_config_file(Config &config, const char *path)
 		load_unsigned(file, "cache_interval",
 			      &config.journal_interval);
 	load_integer(file, "verbose", &config.verbose);
+	load_string(file, "tenant_dir", config.tenant_dir);
+	load_string(file, "tenant_journal_dir", config.tenant_journal_dir);
+	load_unsigned(file, "tenant_max_queue", &config.tenant_max_queue);
+	load_string(file, "metrics_listen", config.metrics_listen);
+	load_string(file, "shared_journal", config.shared_journal);
+	load_unsigned(file, "loop_slow_threshold",
+		      &config.loop_slow_threshold);
+	load_unsigned(file, "host_max_in_flight",
+		      &config.host_max_in_flight);
+	load_unsigned(file, "host_rate_limit", &config.host_rate_limit);
+	load_unsigned(file, "worker_threads", &config.worker_threads);
+
+#ifdef _WIN32
+	if (!config.metrics_listen.empty())
+		throw std::runtime_error("metrics_listen is not supported on this platform");
+#endif
 
-	for (const auto &section : file) {
-		if (section.first.empty() &&
-		    section.second.find("username") == section.second.end())
-			/* the default section does not contain a
-			   username: don't set up the last.fm default
-			   scrobbler */
-			continue;
+#ifndef ENABLE_LOOP_STATS
+	if (config.loop_slow_threshold > 0)
+		throw std::runtime_error("loop_slow_threshold is not supported by this build");
+#endif
 
-		config.scrobblers.emplace_front(load_scrobbler_config(config,
-								      section.first,
-								      section.second));
-	}
+	load_sections(config, file, {}, config.host, config.port);
+
+	if (!config.tenant_dir.empty())
+		load_tenant_dir(config, config.tenant_dir.c_str());
 }
 
 void
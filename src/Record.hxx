@@ -21,21 +21,202 @@
 #ifndef RECORD_HXX
 #define RECORD_HXX
 
+#include "StringPool.hxx"
+#include "util/StringBuffer.hxx"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
+
+/**
+ * The track number tag.  Values are usually short ("3", "03/12",
+ * "A1") and are stored inline; longer ones are interned in the
+ * #InternedString pool, because cutting them could split a UTF-8
+ * sequence.
+ */
+class TrackNumber {
+	static constexpr std::size_t CAPACITY = 8;
+
+	/* not null-terminated if all bytes are used */
+	std::array<char, CAPACITY> value{};
+
+	/**
+	 * The value if it is longer than #CAPACITY.
+	 */
+	InternedString pooled;
+
+public:
+	TrackNumber() noexcept = default;
+
+	/**
+	 * Throws std::bad_alloc.
+	 */
+	explicit TrackNumber(std::string_view s) {
+		if (s.size() > CAPACITY)
+			pooled = InternedString{s};
+		else
+			std::copy(s.begin(), s.end(), value.begin());
+	}
+
+	bool empty() const noexcept {
+		return value.front() == 0 && pooled.empty();
+	}
+
+	std::size_t size() const noexcept {
+		return std::string_view{*this}.size();
+	}
+
+	/**
+	 * The number of bytes allocated outside of this object
+	 * (shared by all references to the same value).
+	 */
+	std::size_t GetAllocatedSize() const noexcept {
+		return pooled.GetAllocatedSize() / pooled.GetUseCount();
+	}
+
+	operator std::string_view() const noexcept {
+		if (!pooled.empty())
+			return pooled;
+
+		std::size_t length = 0;
+		while (length < CAPACITY && value[length] != 0)
+			++length;
+		return {value.data(), length};
+	}
+};
+
+/**
+ * A MusicBrainz id (a UUID) in its binary form.  The nil UUID means
+ * "none"; strings which are not a UUID are discarded, because no
+ * server would accept them anyway.
+ */
+class Mbid {
+	std::array<uint8_t, 16> value{};
+
+public:
+	/**
+	 * The length of a formatted UUID, without the null
+	 * terminator.
+	 */
+	static constexpr std::size_t STRING_LENGTH = 36;
+
+	Mbid() noexcept = default;
+
+	explicit Mbid(std::string_view s) noexcept {
+		if (s.size() != STRING_LENGTH)
+			return;
 
+		std::array<uint8_t, 16> result;
+		auto *out = result.begin();
+		for (std::size_t i = 0; i < s.size();) {
+			if (i == 8 || i == 13 || i == 18 || i == 23) {
+				if (s[i++] != '-')
+					return;
+				continue;
+			}
+
+			const int hi = ParseHexDigit(s[i++]);
+			const int lo = ParseHexDigit(s[i++]);
+			if (hi < 0 || lo < 0)
+				return;
+
+			*out++ = uint8_t((hi << 4) | lo);
+		}
+
+		value = result;
+	}
+
+	bool empty() const noexcept {
+		return value == std::array<uint8_t, 16>{};
+	}
+
+	std::size_t size() const noexcept {
+		return empty() ? 0 : STRING_LENGTH;
+	}
+
+	/**
+	 * Format as a lower-case UUID string, or an empty string if
+	 * there is no id.
+	 */
+	StringBuffer<STRING_LENGTH + 1> Format() const noexcept {
+		StringBuffer<STRING_LENGTH + 1> buffer;
+		if (empty()) {
+			buffer.clear();
+			return buffer;
+		}
+
+		constexpr char digits[] = "0123456789abcdef";
+		char *p = buffer.data();
+		for (std::size_t i = 0; i < value.size(); ++i) {
+			if (i == 4 || i == 6 || i == 8 || i == 10)
+				*p++ = '-';
+			*p++ = digits[value[i] >> 4];
+			*p++ = digits[value[i] & 0xf];
+		}
+
+		*p = 0;
+		return buffer;
+	}
+
+private:
+	static constexpr int ParseHexDigit(char ch) noexcept {
+		if (ch >= '0' && ch <= '9')
+			return ch - '0';
+		if (ch >= 'a' && ch <= 'f')
+			return ch - 'a' + 10;
+		if (ch >= 'A' && ch <= 'F')
+			return ch - 'A' + 10;
+		return -1;
+	}
+};
+
+/**
+ * One song play.  Strings which repeat in a typical backlog are
+ * interned in the #InternedString pool, and the numeric fields are
+ * kept in binary form; they are formatted only when a request or a
+ * journal is written.
+ */
 struct Record {
-	std::string artist;
+	InternedString artist;
 	std::string track;
-	std::string album;
-	std::string number;
-	std::string mbid;
-	std::string time;
+	InternedString album;
+	TrackNumber number;
+	Mbid mbid;
+
+	/**
+	 * The UNIX time stamp when playback started; 0 if unknown
+	 * (e.g. in "now playing" records).
+	 */
+	int_least64_t time = 0;
+
 	std::chrono::steady_clock::duration length{};
 	bool love = false;
 	const char *source = "P";
+
+	/**
+	 * Format the #time attribute as a decimal string.
+	 */
+	StringBuffer<24> FormatTime() const noexcept {
+		StringBuffer<24> buffer;
+		auto *end = std::to_chars(buffer.data(),
+					  buffer.data() + buffer.capacity() - 1,
+					  time).ptr;
+		*end = 0;
+		return buffer;
+	}
 };
 
+/**
+ * A reference-counted immutable #Record.  One instance is shared by
+ * all scrobblers which have queued it.
+ */
+using SharedRecord = std::shared_ptr<const Record>;
+
 /**
  * Does this record object have a defined and usable value?
  */
@@ -19,371 +19,619 @@
 */
 
 #include "Scrobbler.hxx"
-#include "Protocol.hxx"
 #include "ScrobblerConfig.hxx"
 #include "Journal.hxx"
+#include "AsyncWriter.hxx"
+#include "FileSink.hxx"
+#include "SpillQueue.hxx"
+#include "SessionCache.hxx"
+#include "lib/curl/Global.hxx"
 #include "lib/curl/Request.hxx"
-#include "lib/gcrypt/MD5.hxx"
-#include "Form.hxx"
-#include "Log.hxx" /* for log_date() */
+#include "lib/curl/HttpStatusError.hxx"
+#include "event/Loop.hxx"
+#include "Log.hxx"
+#include "Probe.hxx"
 #include "system/Error.hxx"
 #include "util/Exception.hxx"
-#include "util/HexFormat.hxx"
-#include "util/SpanCast.hxx"
+#include "config.h"
 
-#include <array>
+#ifdef HAVE_ZLIB
+#include "lib/zlib/Compress.hxx"
+#endif
+
+#include <algorithm>
 #include <cassert>
+#include <vector>
 
 #include <errno.h>
 #include <string.h>
 
-/* don't submit more than this amount of songs in a batch. */
-#define MAX_SUBMIT_COUNT 10
-
-namespace ResponseStrings {
-static constexpr char OK[] = "OK";
-static constexpr char BADSESSION[] = "BADSESSION";
-static constexpr char FAILED[] = "FAILED";
-static constexpr char BANNED[] = "BANNED";
-static constexpr char BADAUTH[] = "BADAUTH";
-static constexpr char BADTIME[] = "BADTIME";
-}
+/**
+ * After a spilled segment failed to load (e.g. because there were no
+ * file descriptors left), wait this long before trying again.
+ */
+static constexpr Event::Duration SPILL_RETRY_DELAY = std::chrono::seconds{30};
 
 Scrobbler::Scrobbler(const ScrobblerConfig &_config,
 		     EventLoop &event_loop,
-		     CurlGlobal &_curl_global)
-	:config(_config), curl_global(_curl_global),
+		     CurlGlobal &_curl_global,
+		     AsyncWriter &_writer)
+	:config(_config),
+	 backend(CreateScrobblerBackend(config)),
+	 compress(config.compress),
+	 curl_global(_curl_global), writer(_writer),
+	 handshake_request(curl_global,
+			   BIND_THIS_METHOD(OnHandshakeResponse),
+			   BIND_THIS_METHOD(OnHandshakeError),
+			   this),
+	 /* "now playing" is latency-sensitive: let it overtake
+	    the submissions waiting for the CurlThrottle */
+	 now_playing_request(curl_global,
+			     BIND_THIS_METHOD(OnNowPlayingResponse),
+			     BIND_THIS_METHOD(OnNowPlayingError),
+			     this, true),
 	 handshake_timer(event_loop, BIND_THIS_METHOD(OnHandshakeTimer)),
-	 submit_timer(event_loop, BIND_THIS_METHOD(OnSubmitTimer))
+	 submit_timer(event_loop, BIND_THIS_METHOD(OnSubmitTimer)),
+	 now_playing_timer(event_loop, BIND_THIS_METHOD(OnNowPlayingTimer)),
+	 spill_retry_timer(event_loop, BIND_THIS_METHOD(RefillQueue)),
+	 batch_sizer(config.max_submit_count)
 {
+	if (compress != RequestCompression::NONE) {
+		for (auto *i = backend->GetRequestHeaders(); i != nullptr;
+		     i = i->next)
+			compressed_headers.Append(i->data);
+
+		compressed_headers.Append(compress == RequestCompression::GZIP
+					  ? "Content-Encoding: gzip"
+					  : "Content-Encoding: deflate");
+	}
+
+	if (config.prewarm && config.file.empty())
+		/* resolve the host name and connect while the journal
+		   is being loaded */
+		curl_global.Prewarm(config.url.c_str());
+
 	if (!config.journal.empty()) {
-		queue = journal_read(config.journal.c_str());
+#ifndef _WIN32
+		if (config.file.empty())
+			/* this finds the segments spilled by the
+			   previous run */
+			spill = std::make_unique<SpillQueue>(writer,
+							     config.journal,
+							     GetMemoryLimit());
+#endif
+
+		/* load only the head of a long journal and import
+		   the rest in the background, so startup doesn't
+		   take longer with a large backlog; if there are
+		   spilled segments, the journal contains only what
+		   fit into memory */
+		const std::size_t max_records = spill && spill->empty()
+			? GetMemoryLimit()
+			: 0;
+
+		JournalReadInfo info;
+		queue = journal_read(config.journal.c_str(), &info,
+				     max_records);
 
 		const unsigned queue_length = queue.size();
 		FormatInfo("loaded %u song%s from %s",
 			   queue_length, queue_length == 1 ? "" : "s",
 			   config.journal.c_str());
+
+		if (info.tail_offset > 0) {
+			FormatInfo("[%s] loading the rest of %s in the background",
+				   config.name.c_str(),
+				   config.journal.c_str());
+
+			spill->Import(config.journal, info.format,
+				      info.tail_offset,
+				      info.n_head_records, info.n_acked,
+				      [this](unsigned n_acked, std::size_t n){
+					      OnJournalImported(n_acked, n);
+				      });
+		}
+
+		if (info.n_duplicates > 0)
+			FormatInfo("[%s] dropped %u duplicate%s from %s",
+				   config.name.c_str(), info.n_duplicates,
+				   info.n_duplicates == 1 ? "" : "s",
+				   config.journal.c_str());
+
+		for (const auto &i : queue)
+			dedup.Add(record_dedup_key(*i));
+
+		/* the file is only rewritten if it contains more than
+		   the queue, or if it must be converted */
+		if (info.n_acked > 0 || info.n_duplicates > 0 ||
+		    info.damaged || info.tail_offset > 0 ||
+		    (queue_length > 0 && info.format != config.journal_format))
+			++queue_generation;
+
+		if (config.journal_append && config.file.empty()) {
+			journal_appender =
+				std::make_unique<JournalAppender>(writer,
+								  config.journal.c_str(),
+								  config.journal_format,
+								  queue_length,
+								  info);
+
+			/* convert the file now if it is in the wrong
+			   format, or else nothing could be appended
+			   until the next journal_interval; after an
+			   import, the imported part must be removed
+			   (this job runs after the import job) */
+			if (journal_appender->NeedsCompaction() ||
+			    info.tail_offset > 0)
+				journal_appender->Compact(queue, [this](bool success,
+									const JournalWriteInfo &i){
+					if (success)
+						OnJournalWritten(i);
+				});
+		} else if (info.tail_offset > 0 && config.file.empty())
+			/* remove the imported part from the journal,
+			   or it would be imported again after a
+			   restart */
+			WriteJournal();
 	}
 
+	RefillQueue();
+
 	if (!config.file.empty()) {
-		file = fopen(config.file.c_str(), "a");
-		if (file == nullptr)
-			throw FormatErrno("Failed to open file '%s' of scrobbler '%s'",
-					  config.file.c_str(),
-					  config.name.c_str());
-	} else
-		ScheduleHandshake();
+		file = std::make_unique<FileSink>(config, event_loop, writer);
+	} else if (!backend->HasHandshake()) {
+		backend->InitSession(session);
+		state = State::READY;
+
+		if (!queue.empty())
+			ScheduleSubmit();
+
+		if (config.prewarm)
+			PrewarmSession();
+	} else {
+		if (!config.journal.empty())
+			session_path = config.journal + ".session";
+		else if (!config.shared_journal.empty())
+			session_path = config.shared_journal + "." +
+				config.name + ".session";
+
+		if (!session_path.empty() &&
+		    session_cache_read(session_path.c_str(),
+				       config.url, config.username,
+				       session)) {
+			/* try the saved session; if the server
+			   rejects it, InvalidateSession() will do a
+			   new handshake */
+			FormatInfo("[%s] reusing saved session",
+				   config.name.c_str());
+			state = State::READY;
+
+			if (!queue.empty())
+				ScheduleSubmit();
+
+			if (config.prewarm)
+				PrewarmSession();
+		} else
+			ScheduleHandshake();
+	}
 }
 
 Scrobbler::~Scrobbler() noexcept
 {
-	if (file != nullptr)
-		fclose(file);
+	writer.Cancel(this);
 }
 
 void
-Scrobbler::IncreaseInterval() noexcept
+Scrobbler::IncreaseInterval(Backoff &backoff) noexcept
 {
-	if (interval < MIN_INTERVAL)
-		interval = MIN_INTERVAL;
-	else
-		interval *= 2;
-
-	if (interval > MAX_INTERVAL)
-		interval = MAX_INTERVAL;
+	backoff.Increase();
 
 	FormatWarning("[%s] waiting %u seconds before trying again",
 		      config.name.c_str(),
-		      std::chrono::duration_cast<std::chrono::duration<unsigned>>(interval).count());
+		      std::chrono::duration_cast<std::chrono::duration<unsigned>>(backoff.Get()).count());
 }
 
-enum class SubmitResponseType {
-	OK,
-	FAILED,
-	HANDSHAKE,
-};
-
-static SubmitResponseType
-scrobbler_parse_submit_response(const char *scrobbler_name,
-				const char *line, size_t length)
+inline void
+Scrobbler::OnHandshakeResponse(std::string_view body) noexcept
 {
-	using namespace ResponseStrings;
-
-	if (length == sizeof(OK) - 1 && memcmp(line, OK, length) == 0) {
-		FormatInfo("[%s] OK", scrobbler_name);
+	assert(config.file.empty());
+	assert(state == State::HANDSHAKE);
 
-		return SubmitResponseType::OK;
-	} else if (length == sizeof(BADSESSION) - 1 &&
-		   memcmp(line, BADSESSION, length) == 0) {
-		FormatWarning("[%s] invalid session", scrobbler_name);
+	state = State::NOTHING;
 
-		return SubmitResponseType::HANDSHAKE;
-	} else if (length == sizeof(FAILED) - 1 &&
-		   memcmp(line, FAILED, length) == 0) {
-		if (length > strlen(FAILED))
-			FormatError("[%s] submission rejected: %.*s",
-				    scrobbler_name,
-				    (int)(length - strlen(FAILED)),
-				    line + strlen(FAILED));
-		else
-			FormatError("[%s] submission rejected",
-				    scrobbler_name);
-	} else {
-		FormatError("[%s] unknown response: %.*s",
-			    scrobbler_name, (int)length, line);
+	if (!backend->ParseHandshakeResponse(body, session)) {
+		++metrics.handshake_failure;
+		IncreaseInterval(handshake_backoff);
+		ScheduleHandshake();
+		return;
 	}
 
-	return SubmitResponseType::FAILED;
+	state = State::READY;
+	handshake_backoff.Reset();
+	++metrics.handshake_success;
+
+	if (!session_path.empty())
+		/* in the writer thread, like all other file I/O */
+		writer.Push(nullptr, [path = session_path, url = config.url,
+				      username = config.username,
+				      session = session](){
+			return session_cache_write(path.c_str(),
+						   url, username, session);
+		});
+
+	/* handshake was successful: send the "now playing"
+	   notification first, because it is the only request which
+	   gets obsolete; then see if we have songs to submit */
+	if (now_playing && !ExpireNowPlaying())
+		SendNowPlaying();
+
+	Submit();
+
+	if (config.prewarm)
+		PrewarmSession();
 }
 
-bool
-Scrobbler::ParseHandshakeResponse(const char *line) noexcept
+/**
+ * Returns the "scheme://host:port" part of the given URL.
+ */
+static constexpr std::string_view
+GetOrigin(std::string_view url) noexcept
 {
-	using namespace ResponseStrings;
-
-	/* FIXME: some code duplication between this
-	   and as_parse_submit_response. */
-	if (!strncmp(line, OK, strlen(OK))) {
-		FormatInfo("[%s] handshake successful",
-			   config.name.c_str());
-		return true;
-	} else if (!strncmp(line, BANNED, strlen(BANNED))) {
-		FormatError("[%s] handshake failed, we're banned (%s)",
-			    config.name.c_str(), line);
-	} else if (!strncmp(line, BADAUTH, strlen(BADAUTH))) {
-		FormatError("[%s] handshake failed, "
-			    "username or password incorrect (%s)",
-			    config.name.c_str(), line);
-	} else if (!strncmp(line, BADTIME, strlen(BADTIME))) {
-		FormatError("[%s] handshake failed, clock not synchronized (%s)",
-			    config.name.c_str(), line);
-	} else if (!strncmp(line, FAILED, strlen(FAILED))) {
-		FormatError("[%s] handshake failed (%s)",
-			    config.name.c_str(), line);
-	} else {
-		FormatError("[%s] error parsing handshake response (%s)",
-			    config.name.c_str(), line);
-	}
+	const auto i = url.find("://");
+	if (i == url.npos)
+		return url;
 
-	return false;
+	return url.substr(0, url.find('/', i + 3));
 }
 
-static std::string
-next_line(const char **input_r, const char *end)
+void
+Scrobbler::PrewarmSession() noexcept
 {
-	const char *input = *input_r;
-	const char *newline = (const char *)memchr(input, '\n', end - input);
-
-	if (newline == nullptr)
-		return {};
+	/* requests which are being sent right now open their own
+	   connections */
 
-	std::string line(input, newline);
-	*input_r = newline + 1;
+	if (batches.empty())
+		curl_global.Prewarm(session.submit_url.c_str());
 
-	return line;
+	if (!now_playing_request.IsBusy() &&
+	    GetOrigin(session.nowplay_url) != GetOrigin(session.submit_url))
+		curl_global.Prewarm(session.nowplay_url.c_str());
 }
 
 inline void
-Scrobbler::OnHandshakeResponse(std::string body) noexcept
+Scrobbler::OnHandshakeError(std::exception_ptr e) noexcept
 {
-	const char *response = body.data();
-	const char *end = response + body.length();
-	bool ret;
-
 	assert(config.file.empty());
 	assert(state == State::HANDSHAKE);
 
-	http_request.reset();
 	state = State::NOTHING;
 
-	auto line = next_line(&response, end);
-	ret = ParseHandshakeResponse(line.c_str());
-	if (!ret) {
-		IncreaseInterval();
-		ScheduleHandshake();
-		return;
-	}
-
-	session = next_line(&response, end);
-	FormatDebug("[%s] session: %s",
-		    config.name.c_str(),
-		    session.c_str());
-
-	nowplay_url = next_line(&response, end);
-	FormatDebug("[%s] now playing url: %s",
+	FormatError("[%s] handshake error: %s",
 		    config.name.c_str(),
-		    nowplay_url.c_str());
+		    GetFullMessage(e).c_str());
 
-	submit_url = next_line(&response, end);
-	FormatDebug("[%s] submit url: %s",
-		    config.name.c_str(),
-		    submit_url.c_str());
+	++metrics.handshake_failure;
+	IncreaseInterval(handshake_backoff);
+	ScheduleHandshake();
+}
 
-	if (nowplay_url.empty() || submit_url.empty()) {
-		session.clear();
-		nowplay_url.clear();
-		submit_url.clear();
+void
+Scrobbler::InvalidateSession() noexcept
+{
+	assert(state == State::READY);
 
-		IncreaseInterval();
-		ScheduleHandshake();
-		return;
+	state = State::NOTHING;
+	session.Clear();
+
+	if (!session_path.empty())
+		/* after a pending session_cache_write() */
+		writer.Push(nullptr, [path = session_path](){
+			session_cache_delete(path.c_str());
+			return true;
+		});
+
+	/* all other requests will fail with this session, too;
+	   batches which were already accepted remain done */
+	for (auto &batch : batches)
+		batch.slot.Cancel();
+
+	if (now_playing_request.IsBusy()) {
+		now_playing_request.Cancel();
+		RestoreNowPlaying();
 	}
 
-	state = State::READY;
-	interval = std::chrono::seconds{1};
+	submit_timer.Cancel();
+	submit_coalescing = false;
+	now_playing_timer.Cancel();
 
-	/* handshake was successful: see if we have songs to submit */
-	Submit();
+	ScheduleHandshake();
 }
 
-inline void
-Scrobbler::OnHandshakeError(std::exception_ptr e) noexcept
+void
+Scrobbler::AcknowledgeBatches() noexcept
 {
-	assert(config.file.empty());
-	assert(state == State::HANDSHAKE);
+	while (!batches.empty() && batches.front().done) {
+		const unsigned count = batches.front().count;
+		batches.pop_front();
 
-	http_request.reset();
-	state = State::NOTHING;
+		for (unsigned i = 0; i < count; ++i)
+			dedup.Acknowledge(record_dedup_key(*queue[i]));
 
-	FormatError("[%s] handshake error: %s",
-		    config.name.c_str(),
-		    GetFullMessage(e).c_str());
+		queue.pop_front(count);
+		++queue_generation;
 
-	IncreaseInterval();
-	ScheduleHandshake();
+		if (journal_appender)
+			journal_appender->Acknowledge(count);
+	}
+
+	RefillQueue();
+}
+
+unsigned
+Scrobbler::GetMemoryLimit() const noexcept
+{
+	return config.max_memory_queue > 0
+		? config.max_memory_queue
+		: JOURNAL_HEAD_SIZE;
 }
 
-static void
-scrobbler_queue_remove_oldest(std::list<Record> &queue, unsigned count)
+void
+Scrobbler::RefillQueue() noexcept
 {
-	assert(count > 0);
+	if (!spill || spill->empty() || spill->IsBusy() ||
+	    spill_retry_timer.IsPending())
+		return;
 
-	while (count--)
-		queue.pop_front();
+	/* a segment which is larger than the limit (because the
+	   setting was changed) is loaded when the queue is empty */
+	if (!queue.empty() &&
+	    queue.size() + spill->GetFrontSize() > GetMemoryLimit())
+		return;
+
+	spill->Load([this](bool success, RecordQueue &&records){
+		if (success)
+			OnSpillLoaded(std::move(records));
+		else
+			spill_retry_timer.Schedule(SPILL_RETRY_DELAY);
+	});
 }
 
-inline void
-Scrobbler::OnSubmitResponse(std::string body) noexcept
+void
+Scrobbler::OnSpillLoaded(RecordQueue &&records) noexcept
 {
-	assert(config.file.empty());
-	assert(state == State::SUBMITTING);
+	const std::size_t old_size = queue.size();
+
+	/* even if all records were duplicates, the next snapshot
+	   must be written to delete the segment files */
+	++queue_generation;
+
+	for (auto &i : records) {
+		/* duplicates were not detected while the records
+		   were spilled */
+		if (!dedup.Add(record_dedup_key(*i))) {
+			++metrics.duplicates;
+			continue;
+		}
 
-	http_request.reset();
-	state = State::READY;
+		queue.push_back(std::move(i));
 
-	auto newline = body.find('\n');
-	if (newline != body.npos)
-		body.resize(newline);
+		if (journal_appender)
+			journal_appender->Append(queue.back());
+	}
 
-	switch (scrobbler_parse_submit_response(config.name.c_str(),
-						body.data(), body.length())) {
-	case SubmitResponseType::OK:
-		interval = std::chrono::seconds{1};
+	/* in "append" mode, the records are now in the journal;
+	   else the segment files are deleted after the next
+	   snapshot */
+	if (journal_appender)
+		spill->DeleteLoaded();
 
-		/* submission was accepted, so clean up the cache. */
-		if (pending > 0) {
-			scrobbler_queue_remove_oldest(queue, pending);
-			pending = 0;
-		} else {
-			assert(record_is_defined(&now_playing));
+	const std::size_t n = queue.size() - old_size;
+	FormatDebug("[%s] loaded %zu spilled song%s",
+		    config.name.c_str(), n, n == 1 ? "" : "s");
 
-			now_playing = {};
-		}
+	/* these songs have been waiting long enough: submit them
+	   right away, unless we're waiting for a retry */
+	if (n > 0 && state == State::READY && !submit_timer.IsPending())
+		Submit();
 
+	RefillQueue();
+}
 
-		/* submit the next chunk (if there is some left) */
+void
+Scrobbler::OnJournalImported(unsigned n_acked,
+			     std::size_t n_imported) noexcept
+{
+	/* nothing was submitted during the import, so #queue still
+	   contains the head of the journal */
+	n_acked = std::min<std::size_t>(n_acked, queue.size());
+	if (n_acked > 0) {
+		for (unsigned i = 0; i < n_acked; ++i)
+			dedup.Acknowledge(record_dedup_key(*queue[i]));
+
+		queue.pop_front(n_acked);
+		++queue_generation;
+
+		if (journal_appender)
+			journal_appender->Acknowledge(n_acked);
+		else
+			WriteJournal();
+	}
+
+	FormatInfo("[%s] imported %zu song%s from %s",
+		   config.name.c_str(),
+		   n_imported, n_imported == 1 ? "" : "s",
+		   config.journal.c_str());
+
+	if (state == State::READY && !submit_timer.IsPending())
 		Submit();
+
+	RefillQueue();
+}
+
+inline void
+Scrobbler::OnSubmitResponse(SubmitBatch &batch, std::string_view body) noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::READY);
+	assert(!batch.done);
+
+	const auto duration =
+		submit_timer.GetEventLoop().SteadyNow() - batch.start;
+	metrics.submit_latency.Observe(duration);
+
+	const auto response = backend->ParseResponse(body);
+	MPDSCRIBBLE_PROBE4(submit_response, config.name.c_str(),
+			   int(response), batch.count,
+			   std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+
+	switch (response) {
+	case SubmitResponseType::OK: {
+		submit_backoff.Reset();
+		++metrics.submit_success;
+		metrics.songs_submitted += batch.count;
+
+		const unsigned old_size = batch_sizer.Get();
+
+		if (batch_sizer.OnSuccess(batch.count, duration))
+			FormatInfo("[%s] batch size settled at %u",
+				   config.name.c_str(),
+				   batch_sizer.Get());
+		else if (batch_sizer.Get() != old_size)
+			FormatDebug("[%s] increasing batch size to %u",
+				    config.name.c_str(),
+				    batch_sizer.Get());
+
+		/* submission was accepted, so clean up the cache;
+		   this may destroy the batch */
+		batch.done = true;
+		AcknowledgeBatches();
+
+		/* submit the next chunk (if there is some left),
+		   unless we're waiting for a retry */
+		if (!submit_timer.IsPending())
+			Submit();
 		break;
+	}
 
 	case SubmitResponseType::FAILED:
-		IncreaseInterval();
-		ScheduleSubmit();
+		OnSubmitFailed();
 		break;
 
 	case SubmitResponseType::HANDSHAKE:
-		state = State::NOTHING;
-		ScheduleHandshake();
+		InvalidateSession();
 		break;
 	}
 }
 
 inline void
-Scrobbler::OnSubmitError(std::exception_ptr e) noexcept
+Scrobbler::OnSubmitError(SubmitBatch &batch, std::exception_ptr e) noexcept
 {
 	assert(config.file.empty());
-	assert(state == State::SUBMITTING);
+	assert(state == State::READY);
+	assert(batch.IsFailed());
 
-	http_request.reset();
-	state = State::READY;
+	metrics.submit_latency.Observe(submit_timer.GetEventLoop().SteadyNow()
+				       - batch.start);
 
 	FormatError("[%s] submit error: %s",
 		    config.name.c_str(),
 		    GetFullMessage(e).c_str());
 
-	IncreaseInterval();
-	ScheduleSubmit();
-}
+	if (OnCompressionRejected(std::move(e))) {
+		if (submit_coalescing) {
+			submit_timer.Cancel();
+			submit_coalescing = false;
+		}
 
-static constexpr size_t MD5_SIZE = 16;
-static constexpr size_t MD5_HEX_SIZE = MD5_SIZE * 2;
+		ScheduleSubmit();
+		return;
+	}
 
-/**
- * Calculate the MD5 checksum of the specified string.  The return
- * value is a newly allocated string containing the hexadecimal
- * checksum.
- */
-static auto
-md5_hex(std::string_view s)
+	OnSubmitFailed();
+}
+
+void
+Scrobbler::OnSubmitFailed() noexcept
 {
-	const auto binary = Gcrypt::MD5(AsBytes(s));
-	return HexFormat(std::span{binary});
+	++metrics.submit_failure;
+
+	if (batch_sizer.OnFailure())
+		FormatDebug("[%s] decreasing batch size to %u",
+			    config.name.c_str(), batch_sizer.Get());
+
+	if (submit_coalescing) {
+		/* the retry replaces the coalesced submission */
+		submit_timer.Cancel();
+		submit_coalescing = false;
+	} else if (submit_timer.IsPending())
+		/* another batch has failed already and the retry is
+		   scheduled */
+		return;
+
+	IncreaseInterval(submit_backoff);
+	ScheduleSubmit();
 }
 
-static auto
-as_md5(const std::string &password, const std::string &timestamp)
+inline void
+Scrobbler::OnNowPlayingResponse(std::string_view body) noexcept
 {
-	std::array<char, MD5_HEX_SIZE> buffer;
+	assert(config.file.empty());
+	assert(state == State::READY);
+	assert(now_playing_sending);
+
+	switch (backend->ParseResponse(body)) {
+	case SubmitResponseType::OK:
+		now_playing_backoff.Reset();
+		now_playing_sending.reset();
+
+		/* has the song changed meanwhile? */
+		if (now_playing)
+			ScheduleNowPlaying();
+		break;
+
+	case SubmitResponseType::FAILED:
+		RestoreNowPlaying();
+		IncreaseInterval(now_playing_backoff);
+		ScheduleNowPlaying();
+		break;
 
-	auto password_md5 = std::string_view(password);
-	if (password.length() != 32) {
-		/* assume it's not hashed yet */
-		buffer = md5_hex(password);
-		password_md5 = std::string_view(buffer.data(), MD5_HEX_SIZE);
+	case SubmitResponseType::HANDSHAKE:
+		RestoreNowPlaying();
+		InvalidateSession();
+		break;
 	}
+}
+
+inline void
+Scrobbler::OnNowPlayingError(std::exception_ptr e) noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::READY);
+	assert(now_playing_sending);
 
-	std::string md5_with_timestamp;
-	md5_with_timestamp.reserve(password_md5.size() + timestamp.size());
-	md5_with_timestamp.append(password_md5);
-	md5_with_timestamp.append(timestamp);
-	return md5_hex(md5_with_timestamp);
+	FormatError("[%s] 'now playing' error: %s",
+		    config.name.c_str(),
+		    GetFullMessage(e).c_str());
+
+	RestoreNowPlaying();
+
+	if (!OnCompressionRejected(std::move(e)))
+		IncreaseInterval(now_playing_backoff);
+
+	ScheduleNowPlaying();
 }
 
 void
 Scrobbler::Handshake() noexcept
 {
 	assert(config.file.empty());
+	assert(!handshake_request.IsBusy());
 
 	state = State::HANDSHAKE;
 
-	const auto timestr = as_timestamp();
-	const auto md5 = as_md5(config.password, timestr);
-
-	/* construct the handshake url. */
-	FormDataBuilder url(config.url);
-	url.Append("hs", "true");
-	url.Append("p", "1.2");
-	url.Append("c", AS_CLIENT_ID);
-	url.Append("v", AS_CLIENT_VERSION);
-	url.Append("u", config.username);
-	url.Append("t", timestr);
-	url.Append("a", ToStringView(md5));
-
-	//  notice ("handshake url:\n%s", url);
-
-	HttpResponseHandler &handler = *this;
-	http_request = std::make_unique<CurlRequest>(curl_global,
-						     url.c_str(), std::string(),
-						     handler);
+	const auto url = backend->MakeHandshakeURL();
+	handshake_request.Start(url.c_str(), std::string());
+	++n_requests;
 }
 
 void
@@ -402,106 +650,213 @@ Scrobbler::ScheduleHandshake() noexcept
 	assert(state == State::NOTHING);
 	assert(!handshake_timer.IsPending());
 
-	handshake_timer.Schedule(interval);
+	handshake_timer.Schedule(handshake_backoff.Get());
 }
 
 void
-Scrobbler::SendNowPlaying(const char *artist,
-			  const char *track, const char *album,
-			  const char *number,
-			  const char *mbid,
-			  std::chrono::steady_clock::duration length) noexcept
+Scrobbler::StartRequest(HttpRequestSlot &slot, const char *url,
+			std::string &&body)
+{
+#ifdef HAVE_ZLIB
+	if (compress != RequestCompression::NONE &&
+	    body.size() >= MIN_COMPRESS_SIZE) {
+		try {
+			const std::size_t old_size = body.size();
+			body = Zlib::Compress(body,
+					      compress == RequestCompression::GZIP
+					      ? Zlib::Format::GZIP
+					      : Zlib::Format::ZLIB);
+			FormatDebug("[%s] compressed %zu bytes to %zu",
+				    config.name.c_str(),
+				    old_size, body.size());
+
+			slot.Start(url, std::move(body),
+				   compressed_headers.Get());
+			return;
+		} catch (...) {
+			/* send it uncompressed */
+			FormatError("[%s] compression failed: %s",
+				    config.name.c_str(),
+				    GetFullMessage(std::current_exception()).c_str());
+		}
+	}
+#endif
+
+	slot.Start(url, std::move(body), backend->GetRequestHeaders());
+}
+
+bool
+Scrobbler::OnCompressionRejected(std::exception_ptr e) noexcept
+{
+	if (compress == RequestCompression::NONE)
+		return false;
+
+	try {
+		std::rethrow_exception(e);
+	} catch (const HttpStatusError &error) {
+		/* 415 Unsupported Media Type */
+		if (error.GetStatus() != 415)
+			return false;
+	} catch (...) {
+		return false;
+	}
+
+	FormatWarning("[%s] server refuses compressed requests, disabling compression",
+		      config.name.c_str());
+	compress = RequestCompression::NONE;
+	return true;
+}
+
+void
+Scrobbler::SendNowPlaying() noexcept
 {
 	assert(config.file.empty());
 	assert(state == State::READY);
+	assert(now_playing);
+	assert(!now_playing_request.IsBusy());
 
-	state = State::SUBMITTING;
-
-	FormDataBuilder post_data;
-	post_data.Append("s", session);
-	post_data.Append("a", artist);
-	post_data.Append("t", track);
-	post_data.Append("b", album);
-	post_data.Append("l",
-			 std::chrono::duration_cast<std::chrono::seconds>(length).count());
-	post_data.Append("n", number);
-	post_data.Append("m", mbid);
+	now_playing_sending = std::move(now_playing);
+	auto post_data = backend->MakeNowPlaying(session,
+						 *now_playing_sending.song);
 
 	FormatInfo("[%s] sending 'now playing' notification",
 		   config.name.c_str());
 
-	HttpResponseHandler &handler = *this;
-	http_request = std::make_unique<CurlRequest>(curl_global,
-						     nowplay_url.c_str(),
-						     std::move(post_data),
-						     handler);
+	StartRequest(now_playing_request, session.nowplay_url.c_str(),
+		     std::move(post_data));
+	++n_requests;
+
+	if (submit_coalescing && config.submit_with_now_playing) {
+		/* we're sending a request anyway: don't wait for the
+		   end of the window */
+		submit_timer.Cancel();
+		submit_coalescing = false;
+		Submit();
+	}
+}
+
+void
+Scrobbler::RestoreNowPlaying() noexcept
+{
+	assert(now_playing_sending);
+
+	if (!now_playing)
+		now_playing = std::move(now_playing_sending);
+	else
+		now_playing_sending.reset();
+}
+
+bool
+Scrobbler::ExpireNowPlaying(Event::Duration delay) noexcept
+{
+	assert(now_playing);
+
+	const auto now = now_playing_timer.GetEventLoop().SteadyNow();
+	if (now + delay < now_playing.deadline)
+		return false;
+
+	FormatDebug("[%s] discarding obsolete 'now playing' notification",
+		    config.name.c_str());
+	now_playing.reset();
+	++metrics.now_playing_expired;
+	return true;
+}
+
+void
+Scrobbler::OnNowPlayingTimer() noexcept
+{
+	assert(state == State::READY);
+
+	if (now_playing && !now_playing_request.IsBusy() &&
+	    !ExpireNowPlaying())
+		SendNowPlaying();
 }
 
 void
-Scrobbler::ScheduleNowPlaying(const Record &song) noexcept
+Scrobbler::ScheduleNowPlaying() noexcept
 {
-	if (file != nullptr)
+	assert(now_playing);
+
+	if (now_playing_timer.IsPending())
+		return;
+
+	/* don't wait for a retry which would be too late anyway */
+	const auto delay = now_playing_backoff.Get();
+	if (!ExpireNowPlaying(delay))
+		now_playing_timer.Schedule(delay);
+}
+
+void
+Scrobbler::ScheduleNowPlaying(const SharedRecord &song) noexcept
+{
+	if (file)
 		/* there's no "now playing" support for files */
 		return;
 
-	now_playing = song;
+	if (!record_is_defined(song.get())) {
+		/* not enough tags for a "now playing" notification */
+		now_playing.reset();
+		return;
+	}
 
-	if (state == State::READY && !submit_timer.IsPending())
-		ScheduleSubmit();
+	/* this supersedes the previous one, even if that one has
+	   not been sent yet */
+	now_playing.song = song;
+	now_playing.deadline = now_playing_timer.GetEventLoop().SteadyNow() +
+		(song->length > std::chrono::steady_clock::duration::zero()
+		 ? song->length
+		 : DEFAULT_NOW_PLAYING_DEADLINE);
+
+	/* if a notification is being sent right now, this one will
+	   be sent as soon as it is finished */
+	if (state == State::READY && !now_playing_request.IsBusy())
+		ScheduleNowPlaying();
 }
 
 void
 Scrobbler::Submit() noexcept
 {
-	//MAX_SUBMIT_COUNT
-	unsigned count = 0;
-
 	assert(config.file.empty());
 	assert(state == State::READY);
 	assert(!submit_timer.IsPending());
 
-	if (queue.empty()) {
-		/* the submission queue is empty.  See if a "now playing" song is
-		   scheduled - these should be sent after song submissions */
-		if (record_is_defined(&now_playing))
-			SendNowPlaying(now_playing.artist.c_str(),
-				       now_playing.track.c_str(),
-				       now_playing.album.c_str(),
-				       now_playing.number.c_str(),
-				       now_playing.mbid.c_str(),
-				       now_playing.length);
-
+	if (spill && spill->IsImporting())
+		/* wait for OnJournalImported(), which may remove some
+		   records from the front of the queue */
 		return;
-	}
 
-	state = State::SUBMITTING;
+	std::size_t offset = 0;
 
-	/* construct the handshake url. */
-	FormDataBuilder post_data;
-	post_data.Append("s", session);
+	/* first retry the batches which have failed */
+	for (auto &batch : batches) {
+		if (batch.IsFailed())
+			SendBatch(batch, offset);
 
-	for (const auto &i : queue) {
-		if (count >= MAX_SUBMIT_COUNT)
-			break;
-
-		const auto *song = &i;
-
-		post_data.AppendIndexed("a", count, song->artist);
-		post_data.AppendIndexed("t", count, song->track);
-		post_data.AppendIndexed("l", count,
-					std::chrono::duration_cast<std::chrono::seconds>(song->length).count());
-		post_data.AppendIndexed("i", count, song->time);
-		post_data.AppendIndexed("o", count, song->source);
-		post_data.AppendIndexed("r", count, "");
-		post_data.AppendIndexed("b", count, song->album);
-		post_data.AppendIndexed("n", count, song->number);
-		post_data.AppendIndexed("m", count, song->mbid);
-
-		if (song->love)
-			post_data.AppendIndexed("r", count, "L");
-
-		count++;
+		offset += batch.count;
+	}
+
+	/* then start new batches for the rest of the queue */
+	while (batches.size() < MAX_SUBMIT_PIPELINE &&
+	       offset < queue.size()) {
+		const unsigned count =
+			std::min<std::size_t>(queue.size() - offset,
+					      batch_sizer.Get());
+		auto &batch = batches.emplace_back(*this, curl_global, count);
+		SendBatch(batch, offset);
+		offset += count;
 	}
+}
+
+void
+Scrobbler::SendBatch(SubmitBatch &batch, std::size_t offset) noexcept
+{
+	assert(batch.IsFailed());
+	assert(offset + batch.count <= queue.size());
+
+	auto post_data = backend->MakeSubmit(session, queue,
+					     offset, batch.count);
+
+	const unsigned count = batch.count;
 
 	FormatInfo("[%s] submitting %i song%s",
 		   config.name.c_str(), count, count == 1 ? "" : "s");
@@ -509,32 +864,74 @@ Scrobbler::Submit() noexcept
 		    config.name.c_str(), post_data.c_str());
 	FormatDebug("[%s] url: %s",
 		    config.name.c_str(),
-		    submit_url.c_str());
+		    session.submit_url.c_str());
 
-	pending = count;
+	MPDSCRIBBLE_PROBE3(submit, config.name.c_str(),
+			   count, post_data.size());
 
-	HttpResponseHandler &handler = *this;
-	http_request = std::make_unique<CurlRequest>(curl_global,
-						     submit_url.c_str(),
-						     std::move(post_data),
-						     handler);
+	batch.start = submit_timer.GetEventLoop().SteadyNow();
+	StartRequest(batch.slot, session.submit_url.c_str(),
+		     std::move(post_data));
+	++n_requests;
+}
+
+bool
+Scrobbler::Push(const SharedRecord &song) noexcept
+{
+	if (file) {
+		file->Push(*song);
+		++metrics.songs_submitted;
+		return false;
+	}
+
+	const auto key = record_dedup_key(*song);
+	if (dedup.Contains(key)) {
+		FormatDebug("[%s] discarding duplicate song",
+			    config.name.c_str());
+		++metrics.duplicates;
+		return false;
+	}
+
+	if (config.max_queue > 0 && GetQueueLength() >= config.max_queue) {
+		FormatWarning("[%s] queue is full, discarding song",
+			      config.name.c_str());
+		return false;
+	}
+
+	if (spill && (!spill->empty() || spill->IsBusy() ||
+		      (config.max_memory_queue > 0 &&
+		       queue.size() >= config.max_memory_queue))) {
+		/* older records are still on disk (or there's no
+		   room in memory): append to the spill segments to
+		   keep the order; the key is added to #dedup when the
+		   record is loaded */
+		spill->Push(song);
+		return true;
+	}
+
+	dedup.Add(key);
+	queue.emplace_back(song);
+	++queue_generation;
+
+	if (journal_appender)
+		journal_appender->Append(song);
+
+	ScheduleCoalescedSubmit();
+	return true;
 }
 
 void
-Scrobbler::Push(const Record &song) noexcept
+Scrobbler::Restore(const SharedRecord &song) noexcept
 {
-	if (file != nullptr) {
-		fprintf(file, "%s %s - %s\n",
-			log_date(),
-			song.artist.c_str(), song.track.c_str());
-		fflush(file);
+	if (!dedup.Add(record_dedup_key(*song))) {
+		++metrics.duplicates;
 		return;
 	}
 
 	queue.emplace_back(song);
+	++queue_generation;
 
-	if (state == State::READY && !submit_timer.IsPending())
-		ScheduleSubmit();
+	ScheduleCoalescedSubmit();
 }
 
 void
@@ -542,37 +939,184 @@ Scrobbler::OnSubmitTimer() noexcept
 {
 	assert(state == State::READY);
 
+	submit_coalescing = false;
 	Submit();
 }
 
 void
 Scrobbler::ScheduleSubmit() noexcept
 {
-	assert(!submit_timer.IsPending());
-	assert(!queue.empty() || record_is_defined(&now_playing));
+	if (!submit_timer.IsPending())
+		submit_timer.Schedule(submit_backoff.Get());
+}
 
-	submit_timer.Schedule(interval);
+void
+Scrobbler::ScheduleCoalescedSubmit() noexcept
+{
+	if (state != State::READY)
+		/* the handshake will schedule the submission */
+		return;
+
+	if (config.submit_window.count() == 0) {
+		if (!submit_timer.IsPending())
+			ScheduleSubmit();
+		return;
+	}
+
+	const auto now = submit_timer.GetEventLoop().SteadyNow();
+
+	if (!submit_coalescing) {
+		if (submit_timer.IsPending())
+			/* waiting for a retry; the song will be
+			   submitted then */
+			return;
+
+		submit_coalescing = true;
+		submit_deadline = now + config.submit_max_delay;
+	}
+
+	/* restart the window, but don't let the first song wait
+	   longer than "submit_max_delay" */
+	submit_timer.Schedule(std::min<Event::Duration>(config.submit_window,
+							submit_deadline - now));
+}
+
+std::size_t
+Scrobbler::GetQueueLength() const noexcept
+{
+	return queue.size() + GetSpilledCount();
+}
+
+std::size_t
+Scrobbler::GetSpilledCount() const noexcept
+{
+	return spill ? spill->size() : 0;
+}
+
+std::size_t
+Scrobbler::GetPendingCount() const noexcept
+{
+	std::size_t n = 0;
+	for (const auto &i : batches)
+		if (i.slot.IsBusy())
+			n += i.count;
+	return n;
+}
+
+std::size_t
+Scrobbler::GetMemoryUsage() const noexcept
+{
+	std::size_t size = sizeof(*this) +
+		queue.size() * sizeof(SharedRecord) +
+		dedup.GetMemoryUsage() +
+		batches.size() * (sizeof(SubmitBatch) + 2 * sizeof(void *));
+
+	for (const auto &i : queue) {
+		/* records are shared by all scrobblers which got
+		   them; account only this scrobbler's share */
+		const std::size_t record_size = sizeof(*i) +
+			i->track.capacity() +
+			/* interned strings are shared by all
+			   records with the same value */
+			i->artist.GetAllocatedSize() / i->artist.GetUseCount() +
+			i->album.GetAllocatedSize() / i->album.GetUseCount() +
+			i->number.GetAllocatedSize();
+		size += record_size / std::max<long>(i.use_count(), 1);
+	}
+
+	return size;
 }
 
 void
-Scrobbler::WriteJournal() const noexcept
+Scrobbler::WriteJournal() noexcept
 {
-	if (file != nullptr || config.journal.empty())
+	if (file || config.journal.empty())
+		return;
+
+	if (journal_appender) {
+		/* the journal file is already up to date; rewrite it
+		   only if it contains too many acknowledged
+		   records */
+		if (!journal_appender->NeedsCompaction())
+			return;
+
+		journal_appender->Compact(queue, [this](bool success,
+							const JournalWriteInfo &info){
+			if (!success)
+				return;
+
+			OnJournalWritten(info);
+			FormatInfo("[%s] compacted %s",
+				   config.name.c_str(),
+				   config.journal.c_str());
+		});
 		return;
+	}
+
+	if (!IsJournalDirty())
+		/* the journal file is up to date */
+		return;
+
+	SetJournalSaved();
+	const auto generation = journal_generation;
+	const unsigned queue_length = queue.size();
+
+	/* filled by the writer thread, read by the completion */
+	auto info = std::make_shared<JournalWriteInfo>();
+
+	/* spilled segments which were loaded into #queue can be
+	   deleted as soon as the new journal contains their
+	   records */
+	auto loaded = spill ? spill->TakeLoaded() : std::vector<std::string>{};
+
+	/* the file is synced and renamed together with the other
+	   scrobblers' journals written in the same batch */
+	writer.Push(this, [&writer = writer, path = config.journal,
+			   snapshot = queue,
+			   format = config.journal_format, info,
+			   loaded = std::move(loaded)]() mutable {
+		return journal_write(path.c_str(), snapshot, format,
+				     info.get(), &writer,
+				     [loaded = std::move(loaded)](bool success){
+					     if (success)
+						     SpillQueue::DeleteFiles(loaded);
+				     });
+	}, [this, generation, queue_length, info](bool success){
+		if (!success) {
+			/* try again at the next journal_interval,
+			   unless a newer save (which contains
+			   everything) has started meanwhile */
+			if (journal_generation == generation)
+				journal_save_failed = true;
+			return;
+		}
 
-	if (journal_write(config.journal.c_str(), queue)) {
-		unsigned queue_length = queue.size();
-		FormatInfo("[%s] saved %i song%s to %s",
+		OnJournalWritten(*info);
+		FormatInfo("[%s] saved %u song%s to %s",
 			   config.name.c_str(),
 			   queue_length, queue_length == 1 ? "" : "s",
 			   config.journal.c_str());
-	}
+	});
+}
+
+void
+Scrobbler::OnJournalWritten(const JournalWriteInfo &info) noexcept
+{
+	metrics.journal_write_duration.Observe(info.duration);
+	metrics.journal_write_bytes += info.size;
 }
 
 void
 Scrobbler::SubmitNow() noexcept
 {
-	interval = std::chrono::seconds{1};
+	if (file) {
+		file->Flush();
+		return;
+	}
+
+	handshake_backoff.Reset();
+	submit_backoff.Reset();
+	now_playing_backoff.Reset();
 
 	if (handshake_timer.IsPending()) {
 		handshake_timer.Cancel();
@@ -581,44 +1125,12 @@ Scrobbler::SubmitNow() noexcept
 
 	if (submit_timer.IsPending()) {
 		submit_timer.Cancel();
+		submit_coalescing = false;
 		ScheduleSubmit();
 	}
-}
-
-void
-Scrobbler::OnHttpResponse(std::string body) noexcept
-{
-	switch (state) {
-	case State::NOTHING:
-	case State::READY:
-		assert(false);
-		break;
-
-	case State::HANDSHAKE:
-		OnHandshakeResponse(std::move(body));
-		break;
-
-	case State::SUBMITTING:
-		OnSubmitResponse(std::move(body));
-		break;
-	}
-}
 
-void
-Scrobbler::OnHttpError(std::exception_ptr e) noexcept
-{
-	switch (state) {
-	case State::NOTHING:
-	case State::READY:
-		assert(false);
-		break;
-
-	case State::HANDSHAKE:
-		OnHandshakeError(std::move(e));
-		break;
-
-	case State::SUBMITTING:
-		OnSubmitError(std::move(e));
-		break;
+	if (now_playing_timer.IsPending()) {
+		now_playing_timer.Cancel();
+		ScheduleNowPlaying();
 	}
 }
@@ -21,24 +21,123 @@
 #ifndef SCROBBLER_HXX
 #define SCROBBLER_HXX
 
-#include "lib/curl/Handler.hxx"
+#include "HttpRequestSlot.hxx"
+#include "ScrobblerBackend.hxx"
+#include "ScrobblerConfig.hxx"
+#include "RequestCompression.hxx"
+#include "lib/curl/Slist.hxx"
 #include "event/CoarseTimerEvent.hxx"
-#include "Record.hxx"
+#include "RecordQueue.hxx"
+#include "BatchSizer.hxx"
+#include "SessionCache.hxx"
+#include "Metrics.hxx"
+#include "DedupIndex.hxx"
 
 #include <list>
 #include <memory>
 #include <string>
+#include <string_view>
 
 #include <stdio.h>
 
-struct ScrobblerConfig;
+class JournalAppender;
+class SpillQueue;
+class FileSink;
 class CurlGlobal;
-class CurlRequest;
+class AsyncWriter;
+struct JournalWriteInfo;
+
+/**
+ * Submits songs to one server (or writes them to a file); the
+ * protocol is implemented by a #ScrobblerBackend.  The handshake, the
+ * submissions and the "now playing" notifications are independent
+ * request channels, each with its own in-flight requests and its own
+ * retry timer and backoff.
+ */
+class Scrobbler final {
+public:
+	/**
+	 * Counters and histograms for the metrics endpoint.  They
+	 * are only accessed in the #EventLoop thread, so updating
+	 * them is as cheap as incrementing an integer.
+	 */
+	struct Metrics {
+		uint_least64_t handshake_success = 0, handshake_failure = 0;
+		uint_least64_t submit_success = 0, submit_failure = 0;
+
+		/**
+		 * Songs which were accepted by the server (or written
+		 * to the file).
+		 */
+		uint_least64_t songs_submitted = 0;
+
+		/**
+		 * Songs which were not queued because they were
+		 * already queued or submitted recently.
+		 */
+		uint_least64_t duplicates = 0;
+
+		/**
+		 * "Now playing" notifications which were discarded
+		 * because the song had ended before they could be
+		 * sent.
+		 */
+		uint_least64_t now_playing_expired = 0;
+
+		/**
+		 * Round trip of submit requests, from sending the
+		 * request until the response (or the error) was
+		 * received.
+		 */
+		Histogram submit_latency{LATENCY_BUCKETS};
+
+		/**
+		 * How long it took to rewrite the journal file (in
+		 * the writer thread).
+		 */
+		Histogram journal_write_duration{WRITE_DURATION_BUCKETS};
+
+		uint_least64_t journal_write_bytes = 0;
+	};
+
+private:
+	/**
+	 * A copy of the settings, so this object doesn't depend on
+	 * the lifetime of the #Config it was created from (which
+	 * is replaced by a configuration reload).
+	 */
+	const ScrobblerConfig config;
+
+	/**
+	 * Set if this scrobbler writes to a file instead of
+	 * submitting to a server.
+	 */
+	std::unique_ptr<FileSink> file;
 
-class Scrobbler final : HttpResponseHandler {
-	const ScrobblerConfig &config;
+	/**
+	 * Generates the requests and parses the responses.  It is
+	 * declared before the request slots, because it owns the
+	 * request headers.
+	 */
+	const std::unique_ptr<ScrobblerBackend> backend;
 
-	FILE *file = nullptr;
+	/**
+	 * Request bodies smaller than this are never compressed.
+	 */
+	static constexpr std::size_t MIN_COMPRESS_SIZE = 1024;
+
+	/**
+	 * How request bodies are compressed.  This starts with the
+	 * "compress" setting and is reset to NONE when the server
+	 * rejects a compressed request.
+	 */
+	RequestCompression compress;
+
+	/**
+	 * The #backend request headers plus "Content-Encoding", for
+	 * compressed requests.
+	 */
+	CurlSlist compressed_headers;
 
 	enum class State {
 		/**
@@ -57,84 +156,488 @@ class Scrobbler final : HttpResponseHandler {
 		 * We have a session, and we're ready to submit.
 		 */
 		READY,
+	} state = State::NOTHING;
+
+	/**
+	 * Exponential backoff state of one request channel.
+	 */
+	class Backoff {
+		static constexpr Event::Duration INITIAL_INTERVAL = std::chrono::seconds{1};
+
+		static constexpr Event::Duration MIN_INTERVAL = std::chrono::minutes{1};
 
 		/**
-		 * Submission in progress, waiting for the server's response.
+		 * Maximum exponential backoff delay.
 		 */
-		SUBMITTING,
-	} state = State::NOTHING;
+		static constexpr Event::Duration MAX_INTERVAL = std::chrono::minutes{8};
+
+		Event::Duration interval = INITIAL_INTERVAL;
+
+	public:
+		constexpr Event::Duration Get() const noexcept {
+			return interval;
+		}
+
+		constexpr void Reset() noexcept {
+			interval = INITIAL_INTERVAL;
+		}
+
+		constexpr void Increase() noexcept {
+			if (interval < MIN_INTERVAL)
+				interval = MIN_INTERVAL;
+			else
+				interval *= 2;
 
-	static constexpr Event::Duration MIN_INTERVAL = std::chrono::minutes{1};
+			if (interval > MAX_INTERVAL)
+				interval = MAX_INTERVAL;
+		}
+	};
 
 	/**
-	 * Maximum exponential backoff delay.
+	 * One batch of songs being submitted.  It refers to a range
+	 * of #queue; the ranges of all batches are contiguous,
+	 * starting at the front of #queue.
 	 */
-	static constexpr Event::Duration MAX_INTERVAL = std::chrono::minutes{8};
+	struct SubmitBatch {
+		Scrobbler &scrobbler;
 
-	Event::Duration interval = std::chrono::seconds{1};
+		HttpRequestSlot slot;
+
+		/**
+		 * The number of songs in this batch.
+		 */
+		const unsigned count;
+
+		/**
+		 * When was the request sent?  Used to feed
+		 * #batch_sizer.
+		 */
+		Event::TimePoint start;
+
+		/**
+		 * Has the server accepted this batch?  It is removed
+		 * from #queue as soon as all batches before it are
+		 * done, too.
+		 */
+		bool done = false;
+
+		SubmitBatch(Scrobbler &_scrobbler, CurlGlobal &curl_global,
+			    unsigned _count) noexcept
+			:scrobbler(_scrobbler),
+			 slot(curl_global,
+			      BIND_THIS_METHOD(OnResponse),
+			      BIND_THIS_METHOD(OnError),
+			      &_scrobbler),
+			 count(_count) {}
+
+		/**
+		 * Did the last attempt to submit this batch fail?
+		 * Then it needs to be sent again.
+		 */
+		bool IsFailed() const noexcept {
+			return !done && !slot.IsBusy();
+		}
+
+	private:
+		void OnResponse(std::string_view body) noexcept {
+			scrobbler.OnSubmitResponse(*this, body);
+		}
+
+		void OnError(std::exception_ptr e) noexcept {
+			scrobbler.OnSubmitError(*this, std::move(e));
+		}
+	};
+
+	/**
+	 * Submit no more than this number of batches concurrently.
+	 */
+	static constexpr std::size_t MAX_SUBMIT_PIPELINE = 4;
+
+	/**
+	 * Load no more than this number of records from the journal
+	 * at startup (unless "max_memory_queue" is configured); the
+	 * rest is imported into #spill in the background.
+	 */
+	static constexpr unsigned JOURNAL_HEAD_SIZE = 1024;
 
 	CurlGlobal &curl_global;
 
-	std::unique_ptr<CurlRequest> http_request;
+	/**
+	 * Performs all file I/O: the journal and #file.
+	 */
+	AsyncWriter &writer;
 
-	CoarseTimerEvent handshake_timer, submit_timer;
+	HttpRequestSlot handshake_request, now_playing_request;
 
-	std::string session;
-	std::string nowplay_url;
-	std::string submit_url;
+	CoarseTimerEvent handshake_timer, submit_timer, now_playing_timer;
+
+	/**
+	 * Calls RefillQueue() after a spilled segment failed to
+	 * load.
+	 */
+	CoarseTimerEvent spill_retry_timer;
 
-	Record now_playing;
+	Backoff handshake_backoff, submit_backoff, now_playing_backoff;
+
+	/**
+	 * Is #submit_timer waiting for the end of the
+	 * "submit_window" (and not for a retry)?
+	 */
+	bool submit_coalescing = false;
+
+	/**
+	 * The latest time at which the coalesced submission will be
+	 * sent; only valid if #submit_coalescing is set.
+	 */
+	Event::TimePoint submit_deadline;
+
+	ScrobblerSession session;
+
+	/**
+	 * The path of the file where #session is saved, so it can
+	 * be reused after a restart.  Empty if there is neither a
+	 * journal nor a shared journal.
+	 */
+	std::string session_path;
+
+	/**
+	 * A "now playing" notification.  Unlike submissions, it is
+	 * only useful while the song is playing: it is sent ahead of
+	 * the backlog, it is replaced by a newer one, and it is
+	 * discarded when its deadline has passed.
+	 */
+	struct NowPlayingJob {
+		SharedRecord song;
+
+		/**
+		 * When the song will have ended; sending it after
+		 * this point is pointless.
+		 */
+		Event::TimePoint deadline;
+
+		explicit operator bool() const noexcept {
+			return song != nullptr;
+		}
+
+		void reset() noexcept {
+			song.reset();
+		}
+	};
+
+	/**
+	 * Used as #NowPlayingJob::deadline if the song length is
+	 * unknown.
+	 */
+	static constexpr Event::Duration DEFAULT_NOW_PLAYING_DEADLINE =
+		std::chrono::minutes{5};
+
+	/**
+	 * The song to be sent as "now playing" notification, or
+	 * nullptr.
+	 */
+	NowPlayingJob now_playing;
+
+	/**
+	 * The "now playing" song which is currently being sent, or
+	 * nullptr.  It is moved back to #now_playing if sending
+	 * fails (unless there is a newer one).
+	 */
+	NowPlayingJob now_playing_sending;
 
 	/**
 	 * A queue of #record objects.
 	 */
-	std::list<Record> queue;
+	RecordQueue queue;
+
+	/**
+	 * Incremented each time #queue is modified.
+	 */
+	uint_least64_t queue_generation = 0;
 
 	/**
-	 * How many songs are we trying to submit right now?  This
-	 * many will be shifted from #queue if the submit succeeds.
+	 * The #queue_generation which has been saved to the journal
+	 * file (or is being saved right now).  WriteJournal() does
+	 * nothing if it is current.
 	 */
-	unsigned pending = 0;
+	uint_least64_t journal_generation = 0;
+
+	/**
+	 * Has the most recent attempt to save the journal failed?
+	 * Then the next WriteJournal() tries again even if
+	 * #queue_generation has not changed.
+	 */
+	bool journal_save_failed = false;
+
+	/**
+	 * The part of the queue which exceeds "max_memory_queue" or
+	 * which has not been loaded from the journal yet; null if
+	 * there is no journal.  All of its records are newer than
+	 * the ones in #queue.
+	 */
+	std::unique_ptr<SpillQueue> spill;
+
+	/**
+	 * The keys of all records in #queue and of the most recently
+	 * submitted ones, to drop duplicates.
+	 */
+	DedupIndex dedup;
+
+	/**
+	 * If the journal is in "append" mode, then this object
+	 * writes to it.
+	 */
+	std::unique_ptr<JournalAppender> journal_appender;
+
+	/**
+	 * The batches being submitted right now, in #queue order.
+	 * Each batch is shifted from #queue when it and all
+	 * batches before it have been accepted.
+	 */
+	std::list<SubmitBatch> batches;
+
+	/**
+	 * Decides how many songs shall be submitted in the next
+	 * request.
+	 */
+	BatchSizer batch_sizer;
+
+	/**
+	 * The number of HTTP requests sent so far (for statistics).
+	 */
+	unsigned long n_requests = 0;
+
+	Metrics metrics;
 
 public:
 	Scrobbler(const ScrobblerConfig &_config,
 		  EventLoop &event_loop,
-		  CurlGlobal &_curl_global);
+		  CurlGlobal &_curl_global,
+		  AsyncWriter &_writer);
 	~Scrobbler() noexcept;
 
-	void Push(const Record &song) noexcept;
-	void ScheduleNowPlaying(const Record &song) noexcept;
+	const ScrobblerConfig &GetConfig() const noexcept {
+		return config;
+	}
+
+	/**
+	 * The #EventLoop this scrobbler runs in (which may be the
+	 * one of a worker thread).
+	 */
+	EventLoop &GetEventLoop() const noexcept {
+		return submit_timer.GetEventLoop();
+	}
+
+	/**
+	 * Returns the number of songs waiting to be submitted,
+	 * including the spilled ones.
+	 */
+	[[gnu::pure]]
+	std::size_t GetQueueLength() const noexcept;
+
+	/**
+	 * Returns the number of songs which were spilled to disk
+	 * because of "max_memory_queue".
+	 */
+	[[gnu::pure]]
+	std::size_t GetSpilledCount() const noexcept;
+
+	unsigned long GetRequestCount() const noexcept {
+		return n_requests;
+	}
+
+	const Metrics &GetMetrics() const noexcept {
+		return metrics;
+	}
+
+	/**
+	 * Returns the number of songs which are being submitted
+	 * right now.
+	 */
+	[[gnu::pure]]
+	std::size_t GetPendingCount() const noexcept;
+
+	Event::Duration GetHandshakeInterval() const noexcept {
+		return handshake_backoff.Get();
+	}
+
+	Event::Duration GetSubmitInterval() const noexcept {
+		return submit_backoff.Get();
+	}
+
+	/**
+	 * Estimate how much memory this object occupies, including
+	 * its share of the queued records.
+	 */
+	[[gnu::pure]]
+	std::size_t GetMemoryUsage() const noexcept;
+
+	const RecordQueue &GetQueue() const noexcept {
+		return queue;
+	}
+
+	/**
+	 * Has #queue been modified since it was saved last?
+	 */
+	bool IsJournalDirty() const noexcept {
+		return queue_generation != journal_generation ||
+			journal_save_failed;
+	}
+
+	/**
+	 * The caller is saving #queue (e.g. to the shared journal);
+	 * it is clean until it is modified again.
+	 */
+	void SetJournalSaved() noexcept {
+		journal_generation = queue_generation;
+		journal_save_failed = false;
+	}
+
+	/**
+	 * Queue a song for submission.
+	 *
+	 * @return true if the song was queued, false if it was
+	 * discarded (or written to the file)
+	 */
+	bool Push(const SharedRecord &song) noexcept;
+
+	/**
+	 * Queue a song loaded from the shared journal.  Unlike
+	 * Push(), it is not written to this scrobbler's journal,
+	 * because it has none.
+	 */
+	void Restore(const SharedRecord &song) noexcept;
+
+	void ScheduleNowPlaying(const SharedRecord &song) noexcept;
 	void SubmitNow() noexcept;
 
-	void WriteJournal() const noexcept;
+	/**
+	 * Save the queue to the journal.  This only pushes a job to
+	 * the #AsyncWriter, and does nothing if the queue has not
+	 * been modified since it was saved last.
+	 */
+	void WriteJournal() noexcept;
 
 private:
 	void ScheduleHandshake() noexcept;
 	void Handshake() noexcept;
-	bool ParseHandshakeResponse(const char *line) noexcept;
 
-	void SendNowPlaying(const char *artist,
-			    const char *track, const char *album,
-			    const char *number,
-			    const char *mbid,
-			    std::chrono::steady_clock::duration length) noexcept;
+	/**
+	 * The server has rejected our session.  Cancel all requests
+	 * and start a new handshake.
+	 */
+	void InvalidateSession() noexcept;
+
+	/**
+	 * Open connections to the submit and "now playing" URLs of
+	 * the new #session, so the first request doesn't have to
+	 * wait for them.
+	 */
+	void PrewarmSession() noexcept;
+
+	/**
+	 * Start a submission or "now playing" request with the
+	 * #backend headers, compressing the body if enabled.
+	 */
+	void StartRequest(HttpRequestSlot &slot, const char *url,
+			  std::string &&body);
+
+	/**
+	 * Check whether the server has refused a compressed request
+	 * body, and if so, disable compression.
+	 *
+	 * @return true if the request should be sent again without
+	 * compression right away
+	 */
+	bool OnCompressionRejected(std::exception_ptr e) noexcept;
+
+	/**
+	 * Discard #now_playing if its deadline has passed.
+	 *
+	 * @param delay the time until it would be sent
+	 * @return true if it was discarded
+	 */
+	bool ExpireNowPlaying(Event::Duration delay={}) noexcept;
+
+	void SendNowPlaying() noexcept;
+	void ScheduleNowPlaying() noexcept;
+
+	/**
+	 * Put the "now playing" song which was being sent back
+	 * into #now_playing for a retry.
+	 */
+	void RestoreNowPlaying() noexcept;
 
 	void ScheduleSubmit() noexcept;
+
+	/**
+	 * A song has been queued: schedule its submission, waiting
+	 * for more songs if "submit_window" is configured.
+	 */
+	void ScheduleCoalescedSubmit() noexcept;
+
 	void Submit() noexcept;
-	void IncreaseInterval() noexcept;
+	void SendBatch(SubmitBatch &batch, std::size_t offset) noexcept;
+
+	/**
+	 * Remove all leading batches which were accepted by the
+	 * server from #queue.
+	 */
+	void AcknowledgeBatches() noexcept;
+
+	void IncreaseInterval(Backoff &backoff) noexcept;
+
+	/**
+	 * The number of records to be kept in memory before the rest
+	 * is left in #spill.
+	 */
+	unsigned GetMemoryLimit() const noexcept;
+
+	/**
+	 * Load the next spilled segment if there is enough room in
+	 * #queue.
+	 */
+	void RefillQueue() noexcept;
+
+	/**
+	 * A spilled segment has been loaded (called in the
+	 * #EventLoop thread).
+	 */
+	void OnSpillLoaded(RecordQueue &&records) noexcept;
+
+	/**
+	 * The rest of the journal has been imported into #spill
+	 * (called in the #EventLoop thread).
+	 *
+	 * @param n_acked the number of records at the front of
+	 * #queue which turned out to be acknowledged already
+	 * @param n_imported the number of records which were
+	 * imported
+	 */
+	void OnJournalImported(unsigned n_acked,
+			       std::size_t n_imported) noexcept;
+
+	/**
+	 * The journal file has been rewritten (called in the main
+	 * thread).
+	 */
+	void OnJournalWritten(const JournalWriteInfo &info) noexcept;
+
+	/**
+	 * Submitting a batch has failed: shrink the batch size and
+	 * schedule a retry.
+	 */
+	void OnSubmitFailed() noexcept;
 
 	void OnHandshakeTimer() noexcept;
 	void OnSubmitTimer() noexcept;
+	void OnNowPlayingTimer() noexcept;
 
-public:
-	void OnHandshakeResponse(std::string body) noexcept;
+	void OnHandshakeResponse(std::string_view body) noexcept;
 	void OnHandshakeError(std::exception_ptr e) noexcept;
-	void OnSubmitResponse(std::string body) noexcept;
-	void OnSubmitError(std::exception_ptr e) noexcept;
-
-	/* virtual methods from class HttpResponseHandler */
-	void OnHttpResponse(std::string body) noexcept override;
-	void OnHttpError(std::exception_ptr e) noexcept override;
+	void OnSubmitResponse(SubmitBatch &batch, std::string_view body) noexcept;
+	void OnSubmitError(SubmitBatch &batch, std::exception_ptr e) noexcept;
+	void OnNowPlayingResponse(std::string_view body) noexcept;
+	void OnNowPlayingError(std::exception_ptr e) noexcept;
 };
 
 #endif /* SCROBBLER_H */
@@ -0,0 +1,132 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SCROBBLER_BACKEND_HXX
+#define SCROBBLER_BACKEND_HXX
+
+#include "RecordQueue.hxx"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct curl_slist;
+struct Record;
+struct ScrobblerConfig;
+struct ScrobblerSession;
+
+/**
+ * The meaning of a server response to a submission or a "now
+ * playing" notification.
+ */
+enum class SubmitResponseType {
+	OK,
+	FAILED,
+
+	/**
+	 * The session is not valid (anymore); a new handshake is
+	 * needed.
+	 */
+	HANDSHAKE,
+};
+
+/**
+ * The protocol specific part of a #Scrobbler: it generates the
+ * request bodies and interprets the responses, while the #Scrobbler
+ * manages the queue, the request channels and their retries.
+ */
+class ScrobblerBackend {
+public:
+	virtual ~ScrobblerBackend() noexcept = default;
+
+	/**
+	 * Does this protocol obtain its session with a handshake
+	 * request?  If not, then InitSession() is called instead.
+	 */
+	virtual bool HasHandshake() const noexcept = 0;
+
+	/**
+	 * Set up the #ScrobblerSession of a protocol without a
+	 * handshake.  Protocols with a handshake don't need to
+	 * implement this.
+	 */
+	virtual void InitSession(ScrobblerSession &) const {
+	}
+
+	/**
+	 * Returns the URL of the handshake (GET) request.
+	 * Protocols without a handshake don't need to implement
+	 * this (and the following method).
+	 */
+	virtual std::string MakeHandshakeURL() const {
+		return {};
+	}
+
+	/**
+	 * Parse the handshake response and fill the session.
+	 * Errors are logged.
+	 *
+	 * @return true on success
+	 */
+	virtual bool ParseHandshakeResponse(std::string_view,
+					    ScrobblerSession &) const noexcept {
+		return false;
+	}
+
+	/**
+	 * Returns additional HTTP request headers for submissions
+	 * and "now playing" notifications, or nullptr.  The list
+	 * is owned by this object.
+	 */
+	virtual struct curl_slist *GetRequestHeaders() const noexcept {
+		return nullptr;
+	}
+
+	/**
+	 * Generate the POST request body of a "now playing"
+	 * notification.
+	 */
+	virtual std::string MakeNowPlaying(const ScrobblerSession &session,
+					   const Record &song) const = 0;
+
+	/**
+	 * Generate the POST request body which submits the given
+	 * range of the queue.
+	 */
+	virtual std::string MakeSubmit(const ScrobblerSession &session,
+				       const RecordQueue &queue,
+				       std::size_t offset,
+				       std::size_t count) const = 0;
+
+	/**
+	 * Interpret the response to MakeNowPlaying() or
+	 * MakeSubmit().  Errors are logged.
+	 */
+	virtual SubmitResponseType ParseResponse(std::string_view body) const noexcept = 0;
+};
+
+/**
+ * Create the #ScrobblerBackend for the configured protocol.
+ */
+std::unique_ptr<ScrobblerBackend>
+CreateScrobblerBackend(const ScrobblerConfig &config);
+
+#endif
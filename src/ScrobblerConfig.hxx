@@ -21,31 +21,155 @@
 #ifndef SCROBBLER_CONFIG_HXX
 #define SCROBBLER_CONFIG_HXX
 
+#include "JournalFormat.hxx"
+#include "FileFormat.hxx"
+#include "ScrobblerProtocol.hxx"
+#include "RequestCompression.hxx"
+
+#include <chrono>
+
 #include <string>
 
 struct ScrobblerConfig {
+	/**
+	 * The AudioScrobbler 1.2 protocol allows no more than this
+	 * number of songs per submission.
+	 */
+	static constexpr unsigned MAX_SUBMIT_COUNT = 50;
+
+	/**
+	 * The limit of the ListenBrainz "submit-listens" endpoint.
+	 */
+	static constexpr unsigned LISTENBRAINZ_MAX_SUBMIT_COUNT = 1000;
+
 	/**
 	 * The name of the mpdscribble.conf section.  It is used in
 	 * log messages.
 	 */
 	std::string name;
 
+	/**
+	 * The name of the tenant this scrobbler belongs to; empty if
+	 * it was configured in the main configuration file.
+	 */
+	std::string tenant;
+
+	ScrobblerProtocol protocol = ScrobblerProtocol::AUDIOSCROBBLER;
+
 	std::string url;
 	std::string username;
 	std::string password;
 
+	/**
+	 * The user token for #ScrobblerProtocol::LISTENBRAINZ.
+	 */
+	std::string token;
+
 	/**
 	 * The path of the journal file.  It contains records which
 	 * have not been submitted yet.
 	 */
 	std::string journal;
 
+	/**
+	 * The path of the shared journal (see
+	 * Config::shared_journal) if this scrobbler stores its
+	 * queue there instead of in #journal.
+	 */
+	std::string shared_journal;
+
+	/**
+	 * Append new records and acknowledgements to the journal
+	 * file instead of rewriting it periodically?
+	 */
+	bool journal_append = false;
+
+	/**
+	 * The format in which the journal is written.  Both formats
+	 * can always be read.
+	 */
+	JournalFormat journal_format = JournalFormat::TEXT;
+
+	/**
+	 * Submit no more than this number of songs in one request.
+	 * The actual batch size is adjusted at runtime depending on
+	 * the server's responses.
+	 */
+	unsigned max_submit_count = MAX_SUBMIT_COUNT;
+
+	/**
+	 * The maximum number of songs waiting to be submitted; new
+	 * songs are discarded while the queue is full.  0 means
+	 * unlimited.
+	 */
+	unsigned max_queue = 0;
+
+	/**
+	 * Keep no more than this number of songs in memory; the
+	 * rest of the queue is spilled to segment files next to
+	 * #journal.  0 means everything is kept in memory.
+	 */
+	unsigned max_memory_queue = 0;
+
+	/**
+	 * After a song has been queued, wait this long for more
+	 * songs before submitting, so they are sent in one request.
+	 * Each new song restarts the window, but none waits longer
+	 * than #submit_max_delay.  Zero disables coalescing.
+	 */
+	std::chrono::milliseconds submit_window{};
+
+	std::chrono::milliseconds submit_max_delay{};
+
+	/**
+	 * Submit the songs waiting in the #submit_window together
+	 * with the next "now playing" notification?
+	 */
+	bool submit_with_now_playing = false;
+
+	/**
+	 * Connect to the server in the background at startup and
+	 * after each handshake?
+	 */
+	bool prewarm = false;
+
+	/**
+	 * Compress the bodies of large requests?  This is disabled
+	 * at runtime if the server rejects them.
+	 */
+	RequestCompression compress = RequestCompression::NONE;
+
 	/**
 	 * The path of the log file.  This is set when logging to a
 	 * file is configured instead of submission to an
 	 * AudioScrobbler server.
 	 */
 	std::string file;
+
+	FileFormat file_format = FileFormat::TEXT;
+
+	/**
+	 * Write the buffered lines to #file after this number of
+	 * songs.  0 means only #file_flush_interval applies.
+	 */
+	unsigned file_flush_count = 1;
+
+	/**
+	 * Write the buffered lines to #file at most this long after
+	 * the first one was buffered.  Zero disables the timer.
+	 */
+	std::chrono::milliseconds file_flush_interval{};
+
+	/**
+	 * Call fdatasync() after writing to #file?
+	 */
+	bool file_sync = false;
+
+	/**
+	 * Compare all settings; used by the configuration reload to
+	 * find the scrobblers which can be kept.
+	 */
+	bool operator==(const ScrobblerConfig &) const noexcept = default;
 };
 
 #endif
@@ -0,0 +1,41 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SCROBBLER_PROTOCOL_HXX
+#define SCROBBLER_PROTOCOL_HXX
+
+/**
+ * The protocol spoken by a scrobbler (the "protocol" setting).
+ */
+enum class ScrobblerProtocol {
+	/**
+	 * The AudioScrobbler 1.2 protocol with a handshake and form
+	 * posts (Last.fm, Libre.fm).
+	 */
+	AUDIOSCROBBLER,
+
+	/**
+	 * The ListenBrainz API: JSON documents with token
+	 * authentication.
+	 */
+	LISTENBRAINZ,
+};
+
+#endif
@@ -0,0 +1,176 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "ScrobblerWorker.hxx"
+
+#include <cassert>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <time.h>
+#endif
+
+ScrobblerWorker::ScrobblerWorker(const char *proxy,
+				 std::shared_ptr<CurlThrottleBudget> throttle_budget)
+	:curl_global(event_loop, proxy, std::move(throttle_budget)),
+	 writer(event_loop),
+	 inject_event(event_loop, BIND_THIS_METHOD(OnInject)),
+	 thread(&ScrobblerWorker::Run, this)
+{
+}
+
+ScrobblerWorker::~ScrobblerWorker() noexcept
+{
+	assert(!pause_requested);
+
+	/* EventLoop::Break() does not wake up a loop which is built
+	   without HAVE_THREADED_EVENT_LOOP, so it is called from
+	   inside */
+	Inject([this]{ event_loop.Break(); });
+	thread.join();
+
+	assert(jobs.load() == nullptr);
+}
+
+std::chrono::nanoseconds
+ScrobblerWorker::GetCpuTime() noexcept
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+	clockid_t clock;
+	struct timespec ts;
+	if (pthread_getcpuclockid(thread.native_handle(), &clock) == 0 &&
+	    clock_gettime(clock, &ts) == 0)
+		return std::chrono::seconds{ts.tv_sec} +
+			std::chrono::nanoseconds{ts.tv_nsec};
+#endif
+
+	return {};
+}
+
+void
+ScrobblerWorker::Inject(std::function<void()> function) noexcept
+{
+	auto *job = new Job{nullptr, std::move(function)};
+
+	Job *head = jobs.load(std::memory_order_relaxed);
+	do {
+		job->next = head;
+	} while (!jobs.compare_exchange_weak(head, job,
+					     std::memory_order_release,
+					     std::memory_order_relaxed));
+
+	/* if the stack was not empty, the worker thread has not
+	   taken it yet, and a wakeup is already pending; "job"
+	   must not be dereferenced here, because the worker thread
+	   may have executed it already */
+	if (head == nullptr)
+		inject_event.Schedule();
+}
+
+void
+ScrobblerWorker::RequestPause() noexcept
+{
+	{
+		const std::scoped_lock lock{mutex};
+		assert(!pause_requested);
+		pause_requested = true;
+	}
+
+	inject_event.Schedule();
+}
+
+void
+ScrobblerWorker::WaitPaused() noexcept
+{
+	std::unique_lock lock{mutex};
+	cond.wait(lock, [this]{ return paused; });
+}
+
+void
+ScrobblerWorker::Resume() noexcept
+{
+	std::unique_lock lock{mutex};
+	assert(paused);
+	pause_requested = false;
+	cond.notify_all();
+
+	/* wait for the worker thread to pick this up, or else a
+	   following RequestPause() could keep it paused without
+	   running the functions injected meanwhile */
+	cond.wait(lock, [this]{ return !paused; });
+}
+
+void
+ScrobblerWorker::Run() noexcept
+{
+#ifndef _WIN32
+	/* signals are handled by the SignalMonitor in the main
+	   thread */
+	sigset_t mask;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+#endif
+
+	event_loop.Run();
+}
+
+void
+ScrobblerWorker::RunJobs() noexcept
+{
+	Job *job = jobs.exchange(nullptr, std::memory_order_acquire);
+
+	/* reverse the stack to restore the injection order */
+	Job *head = nullptr;
+	while (job != nullptr) {
+		Job *next = job->next;
+		job->next = head;
+		head = job;
+		job = next;
+	}
+
+	while (head != nullptr) {
+		Job *next = head->next;
+		head->function();
+		delete head;
+		head = next;
+	}
+}
+
+void
+ScrobblerWorker::OnInject() noexcept
+{
+	RunJobs();
+
+	std::unique_lock lock{mutex};
+	if (!pause_requested)
+		return;
+
+	/* the functions injected before RequestPause() may have
+	   been missed by the RunJobs() call above */
+	lock.unlock();
+	RunJobs();
+	lock.lock();
+
+	paused = true;
+	cond.notify_all();
+	cond.wait(lock, [this]{ return !pause_requested; });
+	paused = false;
+	cond.notify_all();
+}
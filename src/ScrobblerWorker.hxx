@@ -0,0 +1,184 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SCROBBLER_WORKER_HXX
+#define SCROBBLER_WORKER_HXX
+
+#include "event/Loop.hxx"
+#include "event/InjectEvent.hxx"
+#include "lib/curl/Global.hxx"
+#include "AsyncWriter.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * A thread with its own #EventLoop, #CurlGlobal and #AsyncWriter
+ * which runs a subset of the scrobblers, so their network I/O does
+ * not compete with the main thread.
+ *
+ * The main thread talks to it in two ways: Inject() hands over a
+ * function through a lock-free queue (e.g. a new song), and pausing
+ * stops the thread, so its objects may be accessed directly by the
+ * main thread until Resume() is called (e.g. to collect metrics or
+ * to create and destroy scrobblers).
+ */
+class ScrobblerWorker final {
+	EventLoop event_loop;
+
+	CurlGlobal curl_global;
+
+	AsyncWriter writer;
+
+	struct Job {
+		Job *next;
+
+		std::function<void()> function;
+	};
+
+	/**
+	 * A stack of jobs pushed by Inject(), most recent first.
+	 * It is taken as a whole by the worker thread, so pushing
+	 * needs no lock.
+	 */
+	std::atomic<Job *> jobs{nullptr};
+
+	InjectEvent inject_event;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	/**
+	 * Has RequestPause() been called?  Protected by #mutex.
+	 */
+	bool pause_requested = false;
+
+	/**
+	 * Is the worker thread waiting for Resume()?  Protected by
+	 * #mutex.
+	 */
+	bool paused = false;
+
+	std::thread thread;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param throttle_budget the per-host request limits, shared
+	 * with the main thread and the other workers
+	 */
+	ScrobblerWorker(const char *proxy,
+			std::shared_ptr<CurlThrottleBudget> throttle_budget);
+
+	/**
+	 * Stops the thread; must not be paused.  The scrobblers
+	 * running in this worker must have been destroyed already.
+	 */
+	~ScrobblerWorker() noexcept;
+
+	ScrobblerWorker(const ScrobblerWorker &) = delete;
+	ScrobblerWorker &operator=(const ScrobblerWorker &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return event_loop;
+	}
+
+	CurlGlobal &GetCurl() noexcept {
+		return curl_global;
+	}
+
+	AsyncWriter &GetWriter() noexcept {
+		return writer;
+	}
+
+	/**
+	 * The CPU time consumed by the worker thread so far; zero if
+	 * the platform doesn't provide it.  This method is
+	 * thread-safe.
+	 */
+	std::chrono::nanoseconds GetCpuTime() noexcept;
+
+	/**
+	 * Call the function in the worker thread.  Functions are
+	 * called in the order they were injected.  This method is
+	 * thread-safe.
+	 */
+	void Inject(std::function<void()> function) noexcept;
+
+	/**
+	 * Ask the worker thread to execute all injected functions
+	 * and then to stop until Resume() is called.  Call
+	 * WaitPaused() before accessing its objects.
+	 */
+	void RequestPause() noexcept;
+
+	/**
+	 * Wait until the worker thread has stopped after
+	 * RequestPause().
+	 */
+	void WaitPaused() noexcept;
+
+	void Resume() noexcept;
+
+private:
+	void Run() noexcept;
+
+	/**
+	 * Execute all injected functions.
+	 */
+	void RunJobs() noexcept;
+
+	void OnInject() noexcept;
+};
+
+/**
+ * Pauses all workers of a list during its lifetime.
+ */
+template<typename L>
+class ScopePauseWorkers {
+	L &workers;
+
+public:
+	explicit ScopePauseWorkers(L &_workers) noexcept
+		:workers(_workers) {
+		/* request all pauses first, so the workers stop
+		   concurrently */
+		for (auto &i : workers)
+			i->RequestPause();
+		for (auto &i : workers)
+			i->WaitPaused();
+	}
+
+	~ScopePauseWorkers() noexcept {
+		for (auto &i : workers)
+			i->Resume();
+	}
+
+	ScopePauseWorkers(const ScopePauseWorkers &) = delete;
+	ScopePauseWorkers &operator=(const ScopePauseWorkers &) = delete;
+};
+
+#endif
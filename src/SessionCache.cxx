@@ -0,0 +1,180 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "SessionCache.hxx"
+#include "util/StringStrip.hxx"
+#include "Log.hxx"
+
+#include <chrono>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Ignore saved sessions older than this.  The protocol doesn't
+ * specify an expiry, but compared to a handshake, a rejected
+ * submission with a stale session costs just as much.
+ */
+static constexpr std::chrono::system_clock::duration SESSION_MAX_AGE =
+	std::chrono::hours{24 * 7};
+
+/**
+ * Create (or truncate) a file which only the owner may read,
+ * because it contains a credential.
+ */
+static FILE *
+OpenPrivateFile(const char *path) noexcept
+{
+#ifdef _WIN32
+	return fopen(path, "w");
+#else
+	const int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (fd < 0)
+		return nullptr;
+
+	/* the mode passed to open() does not apply to a stale file
+	   which already exists */
+	if (fchmod(fd, 0600) < 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	FILE *file = fdopen(fd, "w");
+	if (file == nullptr)
+		close(fd);
+
+	return file;
+#endif
+}
+
+bool
+session_cache_write(const char *path, const std::string &url,
+		    const std::string &username,
+		    const ScrobblerSession &session) noexcept
+{
+	const std::string tmp_path = std::string{path} + ".tmp";
+
+	FILE *file = OpenPrivateFile(tmp_path.c_str());
+	if (file == nullptr) {
+		FormatError("Failed to save %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	const auto now = std::chrono::system_clock::now().time_since_epoch();
+
+	fprintf(file,
+		"url = %s\n"
+		"username = %s\n"
+		"session = %s\n"
+		"nowplay_url = %s\n"
+		"submit_url = %s\n"
+		"time = %lld\n",
+		url.c_str(), username.c_str(), session.id.c_str(),
+		session.nowplay_url.c_str(), session.submit_url.c_str(),
+		(long long)std::chrono::duration_cast<std::chrono::seconds>(now).count());
+
+	bool success = fflush(file) == 0 && ferror(file) == 0;
+#ifndef _WIN32
+	if (success)
+		success = fsync(fileno(file)) == 0;
+#endif
+
+	if (fclose(file) != 0 || !success ||
+	    rename(tmp_path.c_str(), path) != 0) {
+		FormatError("Failed to save %s: %s", path, strerror(errno));
+		remove(tmp_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool
+session_cache_read(const char *path, const std::string &url,
+		   const std::string &username,
+		   ScrobblerSession &session_r) noexcept
+{
+	FILE *file = fopen(path, "r");
+	if (file == nullptr) {
+		if (errno != ENOENT)
+			FormatWarning("Failed to load %s: %s",
+				      path, strerror(errno));
+		return false;
+	}
+
+	ScrobblerSession session;
+	bool url_matches = false, username_matches = false;
+	std::chrono::system_clock::time_point time{};
+
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		char *key = StripLeft(line);
+		char *value = strchr(key, '=');
+		if (value == nullptr || value == key)
+			continue;
+
+		*value++ = 0;
+
+		StripRight(key);
+		value = Strip(value);
+
+		if (strcmp(key, "url") == 0)
+			url_matches = url == value;
+		else if (strcmp(key, "username") == 0)
+			username_matches = username == value;
+		else if (strcmp(key, "session") == 0)
+			session.id = value;
+		else if (strcmp(key, "nowplay_url") == 0)
+			session.nowplay_url = value;
+		else if (strcmp(key, "submit_url") == 0)
+			session.submit_url = value;
+		else if (strcmp(key, "time") == 0)
+			time = std::chrono::system_clock::time_point{std::chrono::seconds{strtoll(value, nullptr, 10)}};
+	}
+
+	fclose(file);
+
+	if (!url_matches || !username_matches || !session.IsDefined())
+		return false;
+
+	const auto age = std::chrono::system_clock::now() - time;
+	if (age < std::chrono::system_clock::duration::zero() ||
+	    age > SESSION_MAX_AGE)
+		return false;
+
+	session_r = std::move(session);
+	return true;
+}
+
+void
+session_cache_delete(const char *path) noexcept
+{
+	if (remove(path) != 0 && errno != ENOENT)
+		FormatWarning("Failed to delete %s: %s",
+			      path, strerror(errno));
+}
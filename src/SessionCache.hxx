@@ -0,0 +1,77 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SESSION_CACHE_HXX
+#define SESSION_CACHE_HXX
+
+#include <string>
+
+/**
+ * The result of a successful AudioScrobbler handshake.
+ */
+struct ScrobblerSession {
+	std::string id;
+	std::string nowplay_url;
+	std::string submit_url;
+
+	bool IsDefined() const noexcept {
+		return !id.empty() && !nowplay_url.empty() &&
+			!submit_url.empty();
+	}
+
+	void Clear() noexcept {
+		id.clear();
+		nowplay_url.clear();
+		submit_url.clear();
+	}
+};
+
+/**
+ * Save the session in a file, so it can be reused after a restart.
+ * The server URL and the user name are stored, too, because a
+ * session is only valid for this combination.  Errors are logged.
+ *
+ * @return true on success
+ */
+bool
+session_cache_write(const char *path, const std::string &url,
+		    const std::string &username,
+		    const ScrobblerSession &session) noexcept;
+
+/**
+ * Load a session saved by session_cache_write().  Sessions for a
+ * different server or user and sessions which are too old are
+ * ignored.
+ *
+ * @return true if a usable session was found
+ */
+bool
+session_cache_read(const char *path, const std::string &url,
+		   const std::string &username,
+		   ScrobblerSession &session_r) noexcept;
+
+/**
+ * Delete the session file because the server has rejected the
+ * session.
+ */
+void
+session_cache_delete(const char *path) noexcept;
+
+#endif
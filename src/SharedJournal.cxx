@@ -0,0 +1,328 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "SharedJournal.hxx"
+#include "Journal.hxx"
+#include "AsyncWriter.hxx"
+#include "DedupIndex.hxx"
+#include "Log.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/StringSplit.hxx"
+#include "util/StringStrip.hxx"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+SharedJournal::SharedJournal(AsyncWriter &_writer,
+			     std::string_view _path) noexcept
+	:writer(_writer), path(_path), cursors_path(path + ".cursors") {}
+
+SharedJournal::~SharedJournal() noexcept
+{
+	writer.Cancel(this);
+}
+
+/**
+ * Format a sorted list of indices as comma-separated ranges, e.g.
+ * "0-15,18".
+ */
+static std::string
+FormatRanges(const std::vector<std::size_t> &indices) noexcept
+{
+	std::string result;
+
+	for (std::size_t i = 0; i < indices.size();) {
+		std::size_t j = i + 1;
+		while (j < indices.size() && indices[j] == indices[j - 1] + 1)
+			++j;
+
+		if (!result.empty())
+			result.push_back(',');
+
+		result += std::to_string(indices[i]);
+		if (j - i > 1) {
+			result.push_back('-');
+			result += std::to_string(indices[j - 1]);
+		}
+
+		i = j;
+	}
+
+	return result;
+}
+
+/**
+ * The opposite of FormatRanges().
+ *
+ * @return false if the list is malformed or if an index is out of
+ * range
+ */
+static bool
+ParseRanges(std::string_view s, std::size_t n,
+	    std::vector<std::size_t> &dest) noexcept
+{
+	while (!s.empty()) {
+		const auto [range, rest] = Split(s, ',');
+		s = rest;
+
+		const std::string token{Strip(range)};
+		if (token.empty())
+			continue;
+
+		char *endptr;
+		const std::size_t first = strtoul(token.c_str(), &endptr, 10);
+		std::size_t last = first;
+		if (*endptr == '-')
+			last = strtoul(endptr + 1, &endptr, 10);
+
+		if (endptr == token.c_str() || *endptr != 0 ||
+		    last < first || last >= n)
+			return false;
+
+		for (std::size_t i = first; i <= last; ++i)
+			dest.push_back(i);
+	}
+
+	return true;
+}
+
+/**
+ * Calculate a checksum of the records identifying the journal
+ * contents, stored in the cursors file to detect a cursors file
+ * which belongs to a different version of the journal.
+ */
+[[gnu::pure]]
+static uint_least64_t
+JournalChecksum(const RecordQueue &records) noexcept
+{
+	/* FNV-1a over the keys; the order matters, because the
+	   cursors refer to indices */
+	uint_least64_t result = 14695981039346656037ULL;
+	for (const auto &i : records) {
+		result ^= record_dedup_key(*i);
+		result *= 1099511628211ULL;
+	}
+
+	return result;
+}
+
+SharedJournal::LoadResult
+SharedJournal::Load() noexcept
+{
+	LoadResult result;
+	result.records = journal_read(path.c_str());
+
+	const std::size_t n = result.records.size();
+
+	/* everything which is loaded is queued by somebody, and the
+	   next Write() drops what no scrobbler takes */
+	records = result.records;
+
+	if (n == 0)
+		return result;
+
+	FILE *file = fopen(cursors_path.c_str(), "r");
+	if (file == nullptr) {
+		FormatWarning("Failed to load %s: %s",
+			      cursors_path.c_str(), strerror(errno));
+		result.consistent = false;
+		return result;
+	}
+
+	AtScopeExit(file) { fclose(file); };
+
+	std::size_t n_expected = 0;
+	uint_least64_t checksum = 0;
+	bool have_checksum = false;
+	std::vector<std::size_t> *current = nullptr;
+
+	/* the lines may be long; they are read in pieces by
+	   getline() */
+	char *line = nullptr;
+	size_t line_size = 0;
+	AtScopeExit(&line) { free(line); };
+
+	while (getline(&line, &line_size, file) > 0) {
+		const std::string_view stripped = Strip(std::string_view{line});
+		if (stripped.empty() || stripped.front() == '#')
+			continue;
+
+		const auto [key, value] = Split(stripped, '=');
+		const auto k = Strip(key), v = Strip(value);
+
+		if (k == "records")
+			n_expected = strtoul(std::string{v}.c_str(),
+					     nullptr, 10);
+		else if (k == "checksum") {
+			checksum = strtoull(std::string{v}.c_str(),
+					    nullptr, 16);
+			have_checksum = true;
+		} else if (k == "scrobbler")
+			current = &result.pending[std::string{v}];
+		else if (k == "pending" && current != nullptr &&
+			 !ParseRanges(v, n, *current))
+			result.consistent = false;
+	}
+
+	if (n_expected != n || !have_checksum ||
+	    checksum != JournalChecksum(result.records))
+		result.consistent = false;
+
+	if (!result.consistent)
+		FormatWarning("%s does not match %s",
+			      cursors_path.c_str(), path.c_str());
+
+	return result;
+}
+
+/**
+ * Write the file to "PATH.tmp"; it is synced and renamed to @path
+ * at the end of the batch (see AsyncWriter::CommitFile()).
+ */
+static bool
+WriteTextFile(const char *path, std::string_view text,
+	      AsyncWriter &batch) noexcept
+{
+	const std::string tmp_path = std::string{path} + ".tmp";
+
+	FILE *file = fopen(tmp_path.c_str(), "w");
+	if (file == nullptr) {
+		FormatError("Failed to save %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	fwrite(text.data(), 1, text.size(), file);
+
+	bool success = fflush(file) == 0 && !ferror(file);
+	if (fclose(file) != 0)
+		success = false;
+
+	if (!success) {
+		FormatError("Failed to write %s: %s", path, strerror(errno));
+		remove(tmp_path.c_str());
+		return false;
+	}
+
+	batch.CommitFile(tmp_path, path);
+	return true;
+}
+
+void
+SharedJournal::Write(std::span<const Participant> participants,
+		     WriteCallback callback) noexcept
+{
+	std::unordered_map<const Record *, std::size_t> index;
+	index.reserve(records.size());
+	for (std::size_t i = 0; i < records.size(); ++i)
+		index.emplace(records[i].get(), i);
+
+	/* find each scrobbler's records */
+	std::vector<bool> used(records.size());
+	std::vector<std::vector<std::size_t>> marks(participants.size());
+
+	for (std::size_t p = 0; p < participants.size(); ++p) {
+		auto &m = marks[p];
+		m.reserve(participants[p].queue.size());
+
+		for (const auto &i : participants[p].queue) {
+			auto j = index.find(i.get());
+			if (j == index.end()) {
+				/* not added by Add() (this should not
+				   happen); append it */
+				j = index.emplace(i.get(), records.size()).first;
+				records.push_back(i);
+				used.push_back(false);
+			}
+
+			used[j->second] = true;
+			m.push_back(j->second);
+		}
+	}
+
+	/* drop the records which nobody needs anymore */
+	std::vector<std::size_t> new_index(records.size());
+	RecordQueue compacted;
+	compacted.reserve(records.size());
+	for (std::size_t i = 0; i < records.size(); ++i) {
+		if (used[i]) {
+			new_index[i] = compacted.size();
+			compacted.push_back(std::move(records[i]));
+		}
+	}
+
+	records = std::move(compacted);
+
+	char checksum[24];
+	snprintf(checksum, sizeof(checksum), "%016llx",
+		 (unsigned long long)JournalChecksum(records));
+
+	std::string cursors = "# mpdscribble shared journal cursors\n"
+		"records = " + std::to_string(records.size()) + "\n"
+		"checksum = " + checksum + "\n";
+
+	for (std::size_t p = 0; p < participants.size(); ++p) {
+		auto &m = marks[p];
+		for (auto &i : m)
+			i = new_index[i];
+		std::sort(m.begin(), m.end());
+
+		cursors += "scrobbler = ";
+		cursors += participants[p].name;
+		cursors += "\npending = ";
+		cursors += FormatRanges(m);
+		cursors += "\n";
+	}
+
+	const std::size_t n = records.size();
+
+	writer.Push(this, [&writer = writer,
+			   path = path, cursors_path = cursors_path,
+			   snapshot = records,
+			   cursors = std::move(cursors)](){
+		if (snapshot.empty()) {
+			/* everything has been submitted */
+			remove(path.c_str());
+			remove(cursors_path.c_str());
+			return true;
+		}
+
+		/* both files are replaced at the end of the batch,
+		   the journal first; if the cursors file is not
+		   replaced because of a crash, its checksum doesn't
+		   match, and all records will be submitted again by
+		   all scrobblers, but nothing is lost */
+		return journal_write(path.c_str(), snapshot,
+				     JournalFormat::BINARY,
+				     nullptr, &writer) &&
+			WriteTextFile(cursors_path.c_str(), cursors, writer);
+	}, [n, path = path, callback = std::move(callback)](bool success){
+		if (success)
+			FormatInfo("saved %zu song%s to %s",
+				   n, n == 1 ? "" : "s", path.c_str());
+
+		if (callback)
+			callback(success);
+	});
+}
@@ -0,0 +1,122 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SHARED_JOURNAL_HXX
+#define SHARED_JOURNAL_HXX
+
+#include "RecordQueue.hxx"
+
+#include <functional>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class AsyncWriter;
+
+/**
+ * A journal which is shared by several scrobblers.  Each record is
+ * stored only once; a small "cursors" file next to it ("PATH.cursors")
+ * lists, for each scrobbler, the records which it has not submitted
+ * yet, and a checksum of the journal it belongs to.  Records which
+ * all scrobblers have submitted are dropped on the next Write().
+ *
+ * The journal is always written in the binary format.
+ */
+class SharedJournal final {
+	AsyncWriter &writer;
+
+	const std::string path, cursors_path;
+
+	/**
+	 * All records which were queued by at least one scrobbler
+	 * since the last Write(), in the order they were added.
+	 */
+	RecordQueue records;
+
+public:
+	/**
+	 * The queue of one scrobbler which uses this journal.
+	 */
+	struct Participant {
+		std::string_view name;
+
+		const RecordQueue &queue;
+	};
+
+	struct LoadResult {
+		RecordQueue records;
+
+		/**
+		 * For each scrobbler name: the indices of the
+		 * records it has not submitted yet.  A scrobbler
+		 * which is missing here should get all records.
+		 */
+		std::map<std::string, std::vector<std::size_t>,
+			 std::less<>> pending;
+
+		/**
+		 * False if the cursors file was missing or did not
+		 * match the journal.  Then all records should be
+		 * given to all scrobblers, because it is unknown
+		 * which of them were submitted.
+		 */
+		bool consistent = true;
+	};
+
+	SharedJournal(AsyncWriter &_writer, std::string_view _path) noexcept;
+	~SharedJournal() noexcept;
+
+	SharedJournal(const SharedJournal &) = delete;
+	SharedJournal &operator=(const SharedJournal &) = delete;
+
+	const std::string &GetPath() const noexcept {
+		return path;
+	}
+
+	/**
+	 * Load the journal file.  This is a blocking operation,
+	 * called once at startup.
+	 */
+	LoadResult Load() noexcept;
+
+	/**
+	 * A record has been queued by at least one scrobbler.
+	 */
+	void Add(const SharedRecord &record) noexcept {
+		records.push_back(record);
+	}
+
+	/**
+	 * Invoked in the thread which called Write() when the files
+	 * have been replaced (or when that has failed).
+	 */
+	using WriteCallback = std::function<void(bool success)>;
+
+	/**
+	 * Save the given queues.  This only pushes a job to the
+	 * #AsyncWriter.
+	 */
+	void Write(std::span<const Participant> participants,
+		   WriteCallback callback={}) noexcept;
+};
+
+#endif
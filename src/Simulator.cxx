@@ -0,0 +1,359 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "Simulator.hxx"
+#include "Instance.hxx"
+#include "Config.hxx"
+#include "JsonWriter.hxx"
+#include "Log.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <algorithm>
+#include <forward_list>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#endif
+
+/**
+ * Does this URL point to the local host, e.g. to
+ * test/RunLoadReplay's mock server?  Only "localhost", "[::1]" and
+ * 127.0.0.0/8 addresses are accepted; user information is ignored.
+ */
+[[gnu::pure]]
+static bool
+IsLocalUrl(std::string_view url) noexcept
+{
+	if (const auto i = url.find("://"); i != url.npos)
+		url = url.substr(i + 3);
+
+	/* the authority ends at the path, query or fragment */
+	url = url.substr(0, url.find_first_of("/?#"));
+
+	/* skip user information, e.g. "localhost@remote.example" */
+	if (const auto i = url.rfind('@'); i != url.npos)
+		url = url.substr(i + 1);
+
+	std::string_view host;
+	if (url.starts_with('[')) {
+		const auto i = url.find(']');
+		if (i == url.npos)
+			return false;
+
+		host = url.substr(0, i + 1);
+		url = url.substr(i + 1);
+	} else {
+		const auto i = url.find(':');
+		host = url.substr(0, i);
+		url = i == url.npos ? std::string_view{} : url.substr(i);
+	}
+
+	/* only a port may follow the host */
+	if (!url.empty() && url.front() != ':')
+		return false;
+
+	if (host == "localhost" || host == "[::1]")
+		return true;
+
+	const std::string s(host);
+	struct in_addr addr;
+	return inet_pton(AF_INET, s.c_str(), &addr) == 1 &&
+		reinterpret_cast<const unsigned char *>(&addr)[0] == 127;
+}
+
+void
+PrepareSimulation(Config &config)
+{
+	/* the synthetic tenants replace MPD, and the journals and
+	   the pid file and the metrics socket of a running daemon
+	   must not be touched */
+	config.mpd.clear();
+	config.pidfile.clear();
+	config.shared_journal.clear();
+	config.metrics_listen.clear();
+
+	if (config.scrobblers.empty())
+		throw std::runtime_error("--simulate requires at least one scrobbler section");
+
+	for (const auto &i : config.scrobblers)
+		if (i.file.empty() && !IsLocalUrl(i.url))
+			throw FormatRuntimeError("Scrobbler '%s' submits to %s; "
+						 "--simulate requires a local url or a file",
+						 i.name.c_str(), i.url.c_str());
+
+	const auto templates = std::move(config.scrobblers);
+	config.scrobblers.clear();
+
+	for (unsigned i = 0; i < config.simulate_tenants; ++i) {
+		const std::string tenant = "sim" + std::to_string(i);
+
+		for (const auto &t : templates) {
+			auto &s = config.scrobblers.emplace_front(t);
+			s.name = tenant + "/" + t.name;
+			s.tenant = tenant;
+			s.journal.clear();
+			s.shared_journal.clear();
+
+			/* each tenant gets its own file, or else
+			   the copies would interleave their
+			   writes */
+			if (!s.file.empty() && s.file != "/dev/null")
+				s.file += "." + tenant;
+		}
+	}
+}
+
+/**
+ * The CPU time consumed by the calling thread so far; zero if the
+ * platform doesn't provide it.
+ */
+static std::chrono::nanoseconds
+GetThreadCpuTime() noexcept
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		return std::chrono::seconds{ts.tv_sec} +
+			std::chrono::nanoseconds{ts.tv_nsec};
+#endif
+
+	return {};
+}
+
+/**
+ * The peak resident set size of this process [kB]; 0 if unknown.
+ */
+static uint_least64_t
+GetPeakRSS() noexcept
+{
+#ifndef _WIN32
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		/* kilobytes on Linux */
+		return usage.ru_maxrss;
+#endif
+
+	return 0;
+}
+
+static double
+ToSeconds(Event::Duration d) noexcept
+{
+	return std::chrono::duration<double>(d).count();
+}
+
+Simulator::Simulator(Instance &_instance, const Config &config)
+	:instance(_instance), scrobblers(instance.scrobblers),
+	 rate(config.simulate_rate),
+	 duration(std::chrono::seconds{config.simulate_duration}),
+	 tick_timer(instance.event_loop, BIND_THIS_METHOD(OnTick)),
+	 check_timer(instance.event_loop, BIND_THIS_METHOD(OnCheckTimer))
+{
+	std::map<std::string, std::forward_list<std::string>,
+		 std::less<>> names;
+	for (const auto &i : config.scrobblers)
+		names[i.tenant].push_front(i.name);
+
+	tenants.reserve(names.size());
+	for (const auto &[tenant, list] : names)
+		tenants.push_back({scrobblers.Select(list), {}});
+}
+
+void
+Simulator::Start() noexcept
+{
+	FormatInfo("simulate: %zu tenants, %g songs/s for %u s",
+		   tenants.size(), rate,
+		   (unsigned)std::chrono::duration_cast<std::chrono::seconds>(duration).count());
+
+	start_time = instance.event_loop.SteadyNow();
+	start_cpu_time = GetThreadCpuTime();
+	for (const auto &i : instance.workers)
+		start_worker_cpu_time.push_back(i->GetCpuTime());
+	start_submitted = scrobblers.GetStatistics().songs_submitted;
+
+	tick_timer.Schedule(TICK);
+}
+
+inline void
+Simulator::EndSong(Tenant &tenant) noexcept
+{
+	if (!tenant.playing)
+		return;
+
+	scrobblers.SongChange(tenant.targets, "simulate",
+			      std::move(*tenant.playing));
+	tenant.playing.reset();
+}
+
+inline void
+Simulator::StartSong(Tenant &tenant) noexcept
+{
+	EndSong(tenant);
+
+	/* a small set of artists and albums, like a real library,
+	   so the string pool sees repeated strings */
+	const unsigned artist = n_songs % 97;
+
+	Record record;
+	record.artist = "Artist " + std::to_string(artist);
+	record.track = "Track " + std::to_string(n_songs);
+	record.album = "Album " + std::to_string(artist) + "." +
+		std::to_string(n_songs % 11);
+	record.length = std::chrono::seconds{200};
+
+	scrobblers.NowPlaying(tenant.targets, Record{record});
+	tenant.playing = std::move(record);
+
+	++n_songs;
+}
+
+void
+Simulator::EndFeed(Event::TimePoint now) noexcept
+{
+	for (auto &i : tenants)
+		EndSong(i);
+
+	feed_end_time = now;
+
+	const auto statistics = scrobblers.GetStatistics();
+	feed_end_backlog = statistics.max_queue_length;
+	feed_end_memory = statistics.memory;
+
+	FormatInfo("simulate: started %llu songs, waiting for the queues to drain",
+		   (unsigned long long)n_songs);
+
+	/* don't wait for partial batches */
+	scrobblers.SubmitNow();
+
+	check_timer.Schedule({});
+}
+
+void
+Simulator::Report(Event::TimePoint now, bool drained) noexcept
+{
+	const auto statistics = scrobblers.GetStatistics();
+	const auto elapsed = now - start_time;
+	const double elapsed_s = ToSeconds(elapsed);
+	const uint_least64_t submitted =
+		statistics.songs_submitted - start_submitted;
+
+	std::string json;
+	JsonWriter w(json);
+	w.BeginObject();
+
+	w.Key("tenants");
+	w.Unsigned(tenants.size());
+	w.Key("scrobblers");
+	w.Unsigned(statistics.n_scrobblers);
+	w.Key("workers");
+	w.Unsigned(instance.workers.size());
+	w.Key("rate");
+	w.Number(rate);
+	w.Key("duration_s");
+	w.Number(ToSeconds(duration));
+	w.Key("drained");
+	w.Boolean(drained);
+	w.Key("drain_s");
+	w.Number(ToSeconds(now - feed_end_time));
+
+	w.Key("songs");
+	w.Unsigned(n_songs);
+	w.Key("submitted");
+	w.Unsigned(submitted);
+	w.Key("scrobbles_per_second");
+	w.Number(submitted / elapsed_s);
+	w.Key("backlog_at_feed_end");
+	w.Unsigned(feed_end_backlog);
+
+	/* the fraction of the wall time the threads were busy; the
+	   main thread runs the scrobblers unless there are
+	   workers */
+	w.Key("loop_utilization");
+	w.Number(ToSeconds(GetThreadCpuTime() - start_cpu_time) / elapsed_s);
+
+	w.Key("worker_utilization");
+	w.BeginArray();
+	for (std::size_t i = 0; i < instance.workers.size(); ++i)
+		w.Number(ToSeconds(instance.workers[i]->GetCpuTime() -
+				   start_worker_cpu_time[i]) / elapsed_s);
+	w.EndArray();
+
+	/* estimated from the histogram buckets */
+	w.Key("submit_latency_p99_ms");
+	w.Number(statistics.submit_latency.GetQuantile(0.99) * 1000);
+
+	w.Key("memory_per_tenant_bytes");
+	w.Unsigned(feed_end_memory / tenants.size());
+	w.Key("peak_rss_kb");
+	w.Unsigned(GetPeakRSS());
+
+	w.EndObject();
+
+	json += '\n';
+	fputs(json.c_str(), stdout);
+	fflush(stdout);
+}
+
+void
+Simulator::OnTick() noexcept
+{
+	const auto now = instance.event_loop.SteadyNow();
+	const auto elapsed = std::min(now - start_time, duration);
+
+	const auto due = (uint_least64_t)(ToSeconds(elapsed) * rate);
+	while (n_songs < due)
+		StartSong(tenants[n_songs % tenants.size()]);
+
+	if (elapsed >= duration) {
+		EndFeed(now);
+		return;
+	}
+
+	tick_timer.Schedule(TICK);
+}
+
+void
+Simulator::OnCheckTimer() noexcept
+{
+	const auto now = instance.event_loop.SteadyNow();
+	const bool drained = scrobblers.GetMaxQueueLength() == 0;
+
+	if (drained || now - feed_end_time >= DRAIN_TIMEOUT) {
+		if (!drained)
+			FormatWarning("simulate: the queues did not drain within %u s",
+				      (unsigned)std::chrono::duration_cast<std::chrono::seconds>(DRAIN_TIMEOUT).count());
+
+		Report(now, drained);
+		instance.event_loop.Break();
+		return;
+	}
+
+	check_timer.Schedule(CHECK_INTERVAL);
+}
@@ -0,0 +1,137 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SIMULATOR_HXX
+#define SIMULATOR_HXX
+
+#include "MultiScrobbler.hxx"
+#include "Record.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/Chrono.hxx"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+struct Config;
+struct Instance;
+
+/**
+ * Prepare the configuration for "--simulate": MPD is not observed,
+ * and each scrobbler section is copied once per simulated tenant
+ * (named "simN/SECTION"), without journals.
+ *
+ * Throws if a scrobbler would submit to a remote server; the
+ * simulation must not flood a real service.
+ */
+void
+PrepareSimulation(Config &config);
+
+/**
+ * Replaces the MPD observers in "--simulate" mode: starts and ends
+ * synthetic songs on all simulated tenants at a fixed rate.  After
+ * the configured duration, it waits for the queues to drain, prints
+ * a report as one JSON object on stdout and stops the #EventLoop.
+ */
+class Simulator {
+	/**
+	 * Start the due songs this often.
+	 */
+	static constexpr Event::Duration TICK = std::chrono::milliseconds{10};
+
+	/**
+	 * Give up waiting for the queues to drain after this
+	 * duration.
+	 */
+	static constexpr Event::Duration DRAIN_TIMEOUT = std::chrono::minutes{1};
+
+	static constexpr Event::Duration CHECK_INTERVAL = std::chrono::milliseconds{100};
+
+	Instance &instance;
+
+	MultiScrobbler &scrobblers;
+
+	struct Tenant {
+		ScrobblerList targets;
+
+		/**
+		 * The song which is currently "playing" on this
+		 * tenant.
+		 */
+		std::optional<Record> playing;
+	};
+
+	std::vector<Tenant> tenants;
+
+	/**
+	 * Songs per second, over all tenants.
+	 */
+	const double rate;
+
+	const Event::Duration duration;
+
+	FineTimerEvent tick_timer;
+	CoarseTimerEvent check_timer;
+
+	Event::TimePoint start_time, feed_end_time;
+
+	/**
+	 * The CPU time of the main thread and of all workers when
+	 * the simulation started.
+	 */
+	std::chrono::nanoseconds start_cpu_time;
+	std::vector<std::chrono::nanoseconds> start_worker_cpu_time;
+
+	uint_least64_t start_submitted;
+
+	/**
+	 * The number of songs which have been started.
+	 */
+	uint_least64_t n_songs = 0;
+
+	/**
+	 * Snapshot of the queues at the end of the feed phase.
+	 */
+	std::size_t feed_end_backlog = 0;
+	std::size_t feed_end_memory = 0;
+
+public:
+	Simulator(Instance &_instance, const Config &config);
+
+	void Start() noexcept;
+
+private:
+	void StartSong(Tenant &tenant) noexcept;
+	void EndSong(Tenant &tenant) noexcept;
+
+	/**
+	 * Stop playing, and start waiting for the queues to drain.
+	 */
+	void EndFeed(Event::TimePoint now) noexcept;
+
+	void Report(Event::TimePoint now, bool drained) noexcept;
+
+	void OnTick() noexcept;
+	void OnCheckTimer() noexcept;
+};
+
+#endif
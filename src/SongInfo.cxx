@@ -0,0 +1,72 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "SongInfo.hxx"
+
+#include <mpd/client.h>
+
+#include <string.h>
+
+static std::chrono::steady_clock::duration
+GetSongDuration(const struct mpd_song &song) noexcept
+{
+#if LIBMPDCLIENT_CHECK_VERSION(2,10,0)
+	return std::chrono::milliseconds(mpd_song_get_duration_ms(&song));
+#else
+	return std::chrono::seconds(mpd_song_get_duration(&song));
+#endif
+}
+
+static std::string_view
+GetTag(const struct mpd_song &song, enum mpd_tag_type type) noexcept
+{
+	const char *value = mpd_song_get_tag(&song, type, 0);
+	return value != nullptr ? std::string_view{value} : std::string_view{};
+}
+
+SongInfo::SongInfo(const struct mpd_song &song) noexcept
+	:uri(mpd_song_get_uri(&song)),
+	 id(mpd_song_get_id(&song)), pos(mpd_song_get_pos(&song)),
+	 title(GetTag(song, MPD_TAG_TITLE)),
+	 album(GetTag(song, MPD_TAG_ALBUM)),
+	 number(GetTag(song, MPD_TAG_TRACK)),
+	 mbid(GetTag(song, MPD_TAG_MUSICBRAINZ_TRACKID)),
+	 duration(GetSongDuration(song)),
+	 remote(strstr(uri.c_str(), "://") != nullptr)
+{
+	auto a = GetTag(song, MPD_TAG_ARTIST);
+	if (a.empty())
+		a = GetTag(song, MPD_TAG_ALBUM_ARTIST);
+	artist = a;
+}
+
+Record
+SongInfo::ToRecord() const noexcept
+{
+	Record record;
+	record.artist = artist;
+	record.track = title;
+	record.album = album;
+	record.number = number;
+	record.mbid = mbid;
+	record.length = duration;
+	record.source = remote ? "R" : "P";
+	return record;
+}
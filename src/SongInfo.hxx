@@ -0,0 +1,78 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SONG_INFO_HXX
+#define SONG_INFO_HXX
+
+#include "Record.hxx"
+
+#include <chrono>
+#include <string>
+
+struct mpd_song;
+
+/**
+ * The metadata of a song reported by MPD, parsed once when the song
+ * is received, so the listeners don't need to look up the tags
+ * again and again.
+ */
+struct SongInfo {
+	std::string uri;
+
+	unsigned id, pos;
+
+	/**
+	 * The "Artist" tag, or "AlbumArtist" if there is none.
+	 */
+	InternedString artist;
+
+	std::string title;
+
+	InternedString album;
+
+	TrackNumber number;
+
+	Mbid mbid;
+
+	std::chrono::steady_clock::duration duration;
+
+	/**
+	 * Is this a remote stream (as opposed to a local file)?
+	 */
+	bool remote;
+
+	explicit SongInfo(const struct mpd_song &song) noexcept;
+
+	/**
+	 * Does this song have all the tags needed for a
+	 * submission?
+	 */
+	bool IsComplete() const noexcept {
+		return !artist.empty() && !title.empty();
+	}
+
+	/**
+	 * Create a #Record for the scrobblers; the "time" and "love"
+	 * attributes are left for the caller to fill in.
+	 */
+	Record ToRecord() const noexcept;
+};
+
+#endif
@@ -0,0 +1,504 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "SpillQueue.hxx"
+#include "AsyncWriter.hxx"
+#include "BinaryJournal.hxx"
+#include "Record.hxx"
+#include "Journal.hxx"
+#include "Log.hxx"
+#include "util/Exception.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/SpanCast.hxx"
+
+#include <algorithm>
+#include <cassert>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+/**
+ * Don't put more than this number of records into one segment.
+ */
+static constexpr unsigned MAX_SEGMENT_SIZE = 1024;
+
+/**
+ * No journal record is smaller than this number of bytes (in either
+ * format).  This is used to estimate how many segments an import
+ * may need.
+ */
+static constexpr std::size_t MIN_RECORD_SIZE = 12;
+
+/**
+ * The last segment, which is being appended to by the writer
+ * thread.
+ */
+struct SpillQueue::TailFile {
+	const std::string path;
+
+	FILE *file = nullptr;
+
+	/**
+	 * The number of records written to #file.  It is stored in
+	 * the header when the file is closed.
+	 */
+	unsigned n_records = 0;
+
+	/**
+	 * Set after an I/O error; all further records are
+	 * discarded.
+	 */
+	bool failed = false;
+
+	explicit TailFile(std::string &&_path) noexcept
+		:path(std::move(_path)) {}
+
+	~TailFile() noexcept {
+		Close();
+	}
+
+	TailFile(const TailFile &) = delete;
+	TailFile &operator=(const TailFile &) = delete;
+
+	bool Append(const Record &record) noexcept {
+		if (failed)
+			return false;
+
+		if (file == nullptr) {
+			file = fopen(path.c_str(), "wb");
+			if (file == nullptr) {
+				FormatError("Failed to create %s: %s",
+					    path.c_str(), strerror(errno));
+				failed = true;
+				return false;
+			}
+
+			/* the number of records is not known yet;
+			   the reader doesn't rely on it */
+			binary_journal_write_header(file, 0);
+		}
+
+		binary_journal_write_record(file, record);
+
+		if (fflush(file) != 0 || ferror(file)) {
+			FormatError("Failed to write %s: %s",
+				    path.c_str(), strerror(errno));
+			Close();
+			failed = true;
+			return false;
+		}
+
+		++n_records;
+		return true;
+	}
+
+	void Close() noexcept {
+		if (file != nullptr) {
+			/* now the number of records is known; this
+			   saves reading the whole segment at
+			   startup */
+			if (!failed && fseek(file, 0, SEEK_SET) == 0)
+				binary_journal_write_header(file, n_records);
+
+			fclose(file);
+			file = nullptr;
+		}
+	}
+};
+
+/**
+ * Write a complete segment file.
+ */
+static bool
+WriteSegment(const char *path, const RecordQueue &records) noexcept
+{
+	FILE *file = fopen(path, "wb");
+	if (file == nullptr) {
+		FormatError("Failed to create %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	binary_journal_write_header(file, records.size());
+
+	for (const auto &i : records)
+		binary_journal_write_record(file, *i);
+
+	const bool success = fflush(file) == 0 && !ferror(file);
+	if (!success)
+		FormatError("Failed to write %s: %s", path, strerror(errno));
+
+	fclose(file);
+	return success;
+}
+
+/**
+ * Read all records from a segment file and append them to @p queue.
+ *
+ * @return false on error (the records parsed so far have been
+ * appended)
+ */
+static bool
+ReadSegment(const char *path, RecordQueue &queue) noexcept
+{
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr) {
+		FormatError("Failed to load %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	AtScopeExit(file) { fclose(file); };
+
+	/* segments are small, so they are simply read into a
+	   buffer */
+	std::string buffer;
+	char chunk[16384];
+	std::size_t nbytes;
+	while ((nbytes = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		buffer.append(chunk, nbytes);
+
+	if (ferror(file)) {
+		FormatError("Failed to read %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	try {
+		BinaryJournalReader reader(AsBytes(buffer));
+
+		while (true) {
+			Record record;
+			unsigned n_acked;
+
+			switch (reader.Next(record, n_acked)) {
+			case BinaryJournalReader::EntryType::END:
+				return true;
+
+			case BinaryJournalReader::EntryType::RECORD:
+				queue.emplace_back(std::make_shared<Record>(std::move(record)));
+				break;
+
+			case BinaryJournalReader::EntryType::ACK:
+				/* segments don't contain "ack"
+				   markers */
+				break;
+			}
+		}
+	} catch (...) {
+		FormatWarning("Failed to load %s: %s",
+			      path, GetFullMessage(std::current_exception()).c_str());
+	}
+
+	return false;
+}
+
+/**
+ * Determine the number of records in a segment file, preferably
+ * from its header.
+ */
+static unsigned
+CountSegment(const char *path) noexcept
+{
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr)
+		return 0;
+
+	std::byte header[BINARY_JOURNAL_HEADER_SIZE];
+	const std::size_t nbytes = fread(header, 1, sizeof(header), file);
+	fclose(file);
+
+	unsigned n = 0;
+
+	try {
+		n = BinaryJournalReader({header, nbytes}).GetRecordCount();
+	} catch (...) {
+	}
+
+	if (n == 0) {
+		/* the segment was not closed properly (or it is
+		   really empty): count the records */
+		RecordQueue queue;
+		ReadSegment(path, queue);
+		n = queue.size();
+	}
+
+	return n;
+}
+
+SpillQueue::SpillQueue(AsyncWriter &_writer, std::string_view journal_path,
+		       unsigned max_memory) noexcept
+	:writer(_writer),
+	 prefix(std::string{journal_path} + ".spill."),
+	 segment_size(std::clamp(max_memory / 4, 1U, MAX_SEGMENT_SIZE))
+{
+#ifndef _WIN32
+	const auto slash = prefix.rfind('/');
+	const std::string directory = slash == std::string::npos
+		? std::string{"."}
+		: prefix.substr(0, std::max<std::size_t>(slash, 1));
+	const std::string_view name_prefix = slash == std::string::npos
+		? std::string_view{prefix}
+		: std::string_view{prefix}.substr(slash + 1);
+
+	DIR *dir = opendir(directory.c_str());
+	if (dir == nullptr)
+		return;
+
+	AtScopeExit(dir) { closedir(dir); };
+
+	std::vector<uint_least64_t> ids;
+
+	while (const auto *e = readdir(dir)) {
+		const std::string_view name = e->d_name;
+		if (!name.starts_with(name_prefix) ||
+		    name.size() == name_prefix.size())
+			continue;
+
+		const char *s = e->d_name + name_prefix.size();
+		char *endptr;
+		const auto id = strtoull(s, &endptr, 10);
+		if (*endptr == 0 && *s >= '0' && *s <= '9')
+			ids.push_back(id);
+	}
+
+	std::sort(ids.begin(), ids.end());
+
+	for (const auto id : ids) {
+		/* empty segments are left over by a crash and can be
+		   deleted right away */
+		const auto path = MakePath(id);
+		const unsigned n = CountSegment(path.c_str());
+		if (n == 0) {
+			remove(path.c_str());
+			continue;
+		}
+
+		segments.push_back({id, n});
+		n_records += n;
+	}
+
+	if (!ids.empty())
+		next_id = ids.back() + 1;
+
+	if (n_records > 0)
+		FormatInfo("found %zu spilled song%s in %zu segment%s",
+			   n_records, n_records == 1 ? "" : "s",
+			   segments.size(), segments.size() == 1 ? "" : "s");
+#endif
+}
+
+SpillQueue::~SpillQueue() noexcept
+{
+	writer.Cancel(this);
+
+	if (tail)
+		CloseTail();
+}
+
+void
+SpillQueue::CloseTail() noexcept
+{
+	assert(tail);
+
+	/* close the file in the writer thread, after all pending
+	   jobs */
+	writer.Push(nullptr, [t = std::move(tail)](){
+		t->Close();
+		return true;
+	});
+}
+
+void
+SpillQueue::Push(const SharedRecord &record) noexcept
+{
+	if (!tail) {
+		const auto id = next_id++;
+		segments.push_back({id, 0});
+		tail = std::make_shared<TailFile>(MakePath(id));
+	}
+
+	++segments.back().n_records;
+	++n_records;
+
+	writer.Push(this, [t = tail, record](){
+		return t->Append(*record);
+	});
+
+	if (segments.back().n_records >= segment_size)
+		CloseTail();
+}
+
+void
+SpillQueue::Load(LoadCallback callback) noexcept
+{
+	assert(!segments.empty());
+	assert(!loading);
+
+	const auto segment = segments.front();
+	if (segments.size() == 1 && tail)
+		/* this is the segment being appended to: finish it
+		   before it gets read */
+		CloseTail();
+
+	segments.pop_front();
+	n_records -= segment.n_records;
+
+	loading = true;
+
+	/* filled by the writer thread, read by the completion */
+	auto records = std::make_shared<RecordQueue>();
+
+	writer.Push(this, [path = MakePath(segment.id), records](){
+		return ReadSegment(path.c_str(), *records);
+	}, [this, segment, records,
+	    callback = std::move(callback)](bool success){
+		loading = false;
+
+		if (!success) {
+			/* keep the file and try again later; the
+			   records parsed so far are discarded, or
+			   they would be submitted twice */
+			segments.push_front(segment);
+			n_records += segment.n_records;
+			callback(false, {});
+			return;
+		}
+
+		loaded.push_back(MakePath(segment.id));
+		callback(true, std::move(*records));
+	});
+}
+
+void
+SpillQueue::Import(std::string_view journal_path, JournalFormat format,
+		   std::size_t offset,
+		   unsigned n_head, unsigned n_head_acked,
+		   ImportCallback callback) noexcept
+{
+	assert(segments.empty());
+	assert(!tail);
+	assert(!importing);
+
+	importing = true;
+
+	/* reserve segment numbers for the imported records, so they
+	   sort before the segments of records which are pushed
+	   meanwhile */
+	std::string path{journal_path};
+	std::size_t size = offset;
+	if (struct stat st; stat(path.c_str(), &st) == 0 &&
+	    std::size_t(st.st_size) > offset)
+		size = st.st_size;
+
+	const auto first_id = next_id;
+	next_id += (size - offset) / MIN_RECORD_SIZE / segment_size + 1;
+
+	struct Result {
+		std::vector<Segment> segments;
+		unsigned n_acked = 0;
+	};
+
+	/* filled by the writer thread, read by the completion */
+	auto result = std::make_shared<Result>();
+
+	writer.Push(this, [path = std::move(path), format, offset,
+			   n_head, n_head_acked, first_id,
+			   prefix = prefix, segment_size = segment_size,
+			   result](){
+		/* the "ack" markers may come long after the records
+		   they refer to, so the last one needs to be known
+		   before anything is written */
+		unsigned n_acked = n_head_acked;
+		journal_read_tail(path.c_str(), format, offset,
+				  [](Record &&){},
+				  [&n_acked](unsigned n){
+					  n_acked = std::max(n_acked, n);
+				  });
+
+		unsigned i = n_head;
+		auto id = first_id;
+		RecordQueue records;
+
+		const auto flush = [&](){
+			const auto segment_path = prefix + std::to_string(id);
+			if (WriteSegment(segment_path.c_str(), records))
+				result->segments.push_back({id, unsigned(records.size())});
+			++id;
+			records.clear();
+		};
+
+		journal_read_tail(path.c_str(), format, offset,
+				  [&](Record &&record){
+					  if (i++ < n_acked)
+						  return;
+
+					  records.emplace_back(std::make_shared<Record>(std::move(record)));
+					  if (records.size() >= segment_size)
+						  flush();
+				  },
+				  [](unsigned){});
+
+		if (!records.empty())
+			flush();
+
+		result->n_acked = std::min(n_acked, n_head) - n_head_acked;
+		return true;
+	}, [this, result, callback = std::move(callback)](bool){
+		importing = false;
+
+		std::size_t n = 0;
+		for (const auto &i : result->segments)
+			n += i.n_records;
+
+		n_records += n;
+		segments.insert(segments.begin(),
+				result->segments.begin(),
+				result->segments.end());
+
+		callback(result->n_acked, n);
+	});
+}
+
+void
+SpillQueue::DeleteFiles(const std::vector<std::string> &paths) noexcept
+{
+	for (const auto &i : paths)
+		if (remove(i.c_str()) < 0 && errno != ENOENT)
+			FormatError("Failed to delete %s: %s",
+				    i.c_str(), strerror(errno));
+}
+
+void
+SpillQueue::DeleteLoaded() noexcept
+{
+	if (loaded.empty())
+		return;
+
+	writer.Push(nullptr, [paths = TakeLoaded()](){
+		DeleteFiles(paths);
+		return true;
+	});
+}
@@ -0,0 +1,228 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SPILL_QUEUE_HXX
+#define SPILL_QUEUE_HXX
+
+#include "RecordQueue.hxx"
+#include "JournalFormat.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class AsyncWriter;
+
+/**
+ * The part of a scrobbler's queue which did not fit into memory.
+ * The records are stored in binary journal segment files next to
+ * the journal ("JOURNAL.spill.N"), oldest first; they are all newer
+ * than the records in memory.  New records are appended to the last
+ * segment, and Load() reads back the first one.
+ *
+ * Import() converts the rest of a journal which was loaded only
+ * partially at startup into segments.
+ *
+ * All file I/O is done by the #AsyncWriter.
+ */
+class SpillQueue final {
+	AsyncWriter &writer;
+
+	/**
+	 * All segment file names begin with this prefix, followed by
+	 * the segment number.
+	 */
+	const std::string prefix;
+
+	/**
+	 * Start a new segment after this number of records.
+	 */
+	const unsigned segment_size;
+
+	struct Segment {
+		uint_least64_t id;
+
+		unsigned n_records;
+	};
+
+	/**
+	 * The segments which have not been loaded yet, oldest
+	 * first.
+	 */
+	std::deque<Segment> segments;
+
+	/**
+	 * The file which new records are appended to; it belongs to
+	 * the last element of #segments.  This is only accessed by
+	 * the writer thread.  Null if the last segment is complete
+	 * (or if there are no segments).
+	 */
+	struct TailFile;
+	std::shared_ptr<TailFile> tail;
+
+	uint_least64_t next_id = 0;
+
+	/**
+	 * The total number of records in #segments.
+	 */
+	std::size_t n_records = 0;
+
+	/**
+	 * The paths of segment files which have been loaded into
+	 * memory but not deleted yet.  They are deleted as soon as
+	 * their records are safe in the journal.
+	 */
+	std::vector<std::string> loaded;
+
+	/**
+	 * Is a Load() in progress?
+	 */
+	bool loading = false;
+
+	/**
+	 * Is an Import() in progress?  Its segments will be inserted
+	 * at the front of #segments.
+	 */
+	bool importing = false;
+
+public:
+	/**
+	 * Look for segment files left over from the previous run.
+	 *
+	 * @param journal_path the path of the scrobbler's journal
+	 * @param max_memory the scrobbler's "max_memory_queue"
+	 * setting, which determines the segment size
+	 */
+	SpillQueue(AsyncWriter &_writer, std::string_view journal_path,
+		   unsigned max_memory) noexcept;
+
+	~SpillQueue() noexcept;
+
+	SpillQueue(const SpillQueue &) = delete;
+	SpillQueue &operator=(const SpillQueue &) = delete;
+
+	bool empty() const noexcept {
+		return segments.empty() && !importing;
+	}
+
+	std::size_t size() const noexcept {
+		return n_records;
+	}
+
+	/**
+	 * Is a Load() or an Import() in progress?  Nothing must be
+	 * loaded meanwhile, or the records would be out of order.
+	 */
+	bool IsBusy() const noexcept {
+		return loading || importing;
+	}
+
+	bool IsImporting() const noexcept {
+		return importing;
+	}
+
+	/**
+	 * The number of records which the next Load() call will
+	 * deliver.
+	 */
+	unsigned GetFrontSize() const noexcept {
+		return segments.front().n_records;
+	}
+
+	void Push(const SharedRecord &record) noexcept;
+
+	using LoadCallback = std::function<void(bool success,
+						RecordQueue &&records)>;
+
+	/**
+	 * Read the oldest segment in the writer thread and pass its
+	 * records to the callback (in the #EventLoop thread).  The
+	 * file is not deleted until DeleteLoaded() or TakeLoaded()
+	 * is called.
+	 *
+	 * If the segment cannot be read, the callback gets false and
+	 * no records, and the segment remains the first one, to be
+	 * loaded again by the next call.
+	 */
+	void Load(LoadCallback callback) noexcept;
+
+	/**
+	 * Invoked in the #EventLoop thread when Import() is finished.
+	 * Parameters are the number of records at the beginning of
+	 * the journal (counting from JournalReadInfo::n_acked) which
+	 * were acknowledged by "ack" markers in the imported part,
+	 * and the number of records which were imported.
+	 */
+	using ImportCallback = std::function<void(unsigned n_acked,
+						  std::size_t n_imported)>;
+
+	/**
+	 * Convert the part of the journal after
+	 * JournalReadInfo::tail_offset into segments (in the writer
+	 * thread).  The caller must rewrite the journal after this.
+	 *
+	 * @param n_head the number of records before @p offset
+	 * (JournalReadInfo::n_head_records)
+	 * @param n_head_acked the number of records before @p
+	 * offset which were acknowledged (JournalReadInfo::n_acked)
+	 */
+	void Import(std::string_view journal_path, JournalFormat format,
+		    std::size_t offset,
+		    unsigned n_head, unsigned n_head_acked,
+		    ImportCallback callback) noexcept;
+
+	/**
+	 * Delete the files of all segments which were loaded, after
+	 * all pending #AsyncWriter jobs.
+	 */
+	void DeleteLoaded() noexcept;
+
+	/**
+	 * Return the paths of all segments which were loaded, to be
+	 * deleted by the caller.
+	 */
+	std::vector<std::string> TakeLoaded() noexcept {
+		return std::exchange(loaded, {});
+	}
+
+	/**
+	 * Delete the given segment files.  This is a blocking
+	 * operation for the writer thread.
+	 */
+	static void DeleteFiles(const std::vector<std::string> &paths) noexcept;
+
+private:
+	std::string MakePath(uint_least64_t id) const noexcept {
+		return prefix + std::to_string(id);
+	}
+
+	/**
+	 * Close the last segment; new records will go to a new one.
+	 */
+	void CloseTail() noexcept;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "StringPool.hxx"
+
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+namespace {
+
+class StringPool {
+	std::mutex mutex;
+
+	/**
+	 * The keys point into the #Item they map to.
+	 */
+	std::unordered_map<std::string_view, InternedString::Item *> items;
+
+public:
+	/**
+	 * Throws std::bad_alloc.
+	 */
+	InternedString::Item *Get(std::string_view s);
+	void Release(InternedString::Item *item) noexcept;
+
+	std::size_t size() noexcept {
+		const std::scoped_lock lock{mutex};
+		return items.size();
+	}
+};
+
+InternedString::Item *
+StringPool::Get(std::string_view s)
+{
+	const std::scoped_lock lock{mutex};
+
+	if (auto i = items.find(s); i != items.end()) {
+		i->second->refs.fetch_add(1, std::memory_order_relaxed);
+		return i->second;
+	}
+
+	using Item = InternedString::Item;
+	void *p = ::operator new(sizeof(Item) + s.size() + 1);
+	auto *item = new(p) Item(s.size());
+	char *data = item->GetData();
+	std::memcpy(data, s.data(), s.size());
+	data[s.size()] = 0;
+
+	items.emplace(*item, item);
+	return item;
+}
+
+void
+StringPool::Release(InternedString::Item *item) noexcept
+{
+	/* fast path: drop a reference which is not the last one
+	   without locking; the last one is dropped only with the
+	   mutex held, so Get() cannot resurrect an item which is
+	   being freed */
+	std::size_t refs = item->refs.load(std::memory_order_relaxed);
+	while (refs > 1)
+		if (item->refs.compare_exchange_weak(refs, refs - 1,
+						     std::memory_order_release,
+						     std::memory_order_relaxed))
+			return;
+
+	const std::scoped_lock lock{mutex};
+	if (item->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+
+	items.erase(std::string_view{*item});
+	item->~Item();
+	::operator delete(item);
+}
+
+/* constructed during static initialization, before any thread is
+   started (a function-local static would not be guarded with
+   -fno-threadsafe-statics), and never destroyed because records may
+   outlive static destructors */
+StringPool &pool = *new StringPool();
+
+} // anonymous namespace
+
+InternedString::InternedString(std::string_view s)
+	:item(s.empty() ? nullptr : pool.Get(s)) {}
+
+void
+InternedString::Release(Item *_item) noexcept
+{
+	pool.Release(_item);
+}
+
+std::size_t
+string_pool_size() noexcept
+{
+	return pool.size();
+}
@@ -0,0 +1,144 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef STRING_POOL_HXX
+#define STRING_POOL_HXX
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+/**
+ * A reference to an immutable string in a process-wide pool.  Equal
+ * strings share one allocation, which is freed when the last
+ * reference goes away.  This is meant for tags which repeat a lot in
+ * the queue, like artist and album names.
+ *
+ * Copying and destroying references is thread-safe.
+ */
+class InternedString {
+public:
+	struct Item {
+		std::atomic_size_t refs{1};
+		std::size_t length;
+
+		/* the string follows this struct, null-terminated */
+
+		explicit Item(std::size_t _length) noexcept
+			:length(_length) {}
+
+		const char *GetData() const noexcept {
+			return reinterpret_cast<const char *>(this + 1);
+		}
+
+		char *GetData() noexcept {
+			return reinterpret_cast<char *>(this + 1);
+		}
+
+		operator std::string_view() const noexcept {
+			return {GetData(), length};
+		}
+	};
+
+private:
+	Item *item = nullptr;
+
+public:
+	InternedString() noexcept = default;
+
+	/**
+	 * Look up the string in the pool, adding it if it is not
+	 * there yet.  Empty strings are never pooled.
+	 *
+	 * Throws std::bad_alloc.
+	 */
+	explicit InternedString(std::string_view s);
+
+	InternedString(const InternedString &src) noexcept
+		:item(src.item) {
+		if (item != nullptr)
+			item->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	InternedString(InternedString &&src) noexcept
+		:item(std::exchange(src.item, nullptr)) {}
+
+	~InternedString() noexcept {
+		if (item != nullptr)
+			Release(item);
+	}
+
+	InternedString &operator=(InternedString src) noexcept {
+		std::swap(item, src.item);
+		return *this;
+	}
+
+	InternedString &operator=(std::string_view s) {
+		return *this = InternedString{s};
+	}
+
+	bool empty() const noexcept {
+		return item == nullptr;
+	}
+
+	std::size_t size() const noexcept {
+		return item != nullptr ? item->length : 0;
+	}
+
+	const char *c_str() const noexcept {
+		return item != nullptr ? item->GetData() : "";
+	}
+
+	operator std::string_view() const noexcept {
+		return item != nullptr
+			? std::string_view{*item}
+			: std::string_view{};
+	}
+
+	/**
+	 * The number of references to this string, including this
+	 * one.  Used for memory accounting.
+	 */
+	std::size_t GetUseCount() const noexcept {
+		return item != nullptr
+			? item->refs.load(std::memory_order_relaxed)
+			: 1;
+	}
+
+	/**
+	 * The number of bytes allocated for this string (shared by
+	 * all references).
+	 */
+	std::size_t GetAllocatedSize() const noexcept {
+		return item != nullptr ? sizeof(*item) + item->length + 1 : 0;
+	}
+
+private:
+	static void Release(Item *_item) noexcept;
+};
+
+/**
+ * The number of distinct strings in the pool.
+ */
+std::size_t
+string_pool_size() noexcept;
+
+#endif
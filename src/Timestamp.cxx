@@ -0,0 +1,104 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "Timestamp.hxx"
+#include "util/CharUtil.hxx"
+
+#include <algorithm>
+#include <charconv>
+
+#include <time.h>
+
+static constexpr bool
+IsNumber(std::string_view s) noexcept
+{
+	return !s.empty() && std::all_of(s.begin(), s.end(), IsDigitASCII);
+}
+
+/**
+ * Parse a number with exactly the given number of digits.
+ */
+static constexpr bool
+ParseDigits(std::string_view &s, std::size_t n, int &value_r) noexcept
+{
+	if (s.size() < n)
+		return false;
+
+	int value = 0;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!IsDigitASCII(s[i]))
+			return false;
+		value = value * 10 + (s[i] - '0');
+	}
+
+	s.remove_prefix(n);
+	value_r = value;
+	return true;
+}
+
+static constexpr bool
+SkipChar(std::string_view &s, char ch) noexcept
+{
+	if (s.empty() || s.front() != ch)
+		return false;
+
+	s.remove_prefix(1);
+	return true;
+}
+
+int_least64_t
+ParseTimestamp(std::string_view s) noexcept
+{
+	if (IsNumber(s)) {
+		int_least64_t value;
+		if (std::from_chars(s.data(), s.data() + s.size(),
+				    value).ec != std::errc{})
+			return 0;
+		return value;
+	}
+
+	struct tm tm{};
+	if (!ParseDigits(s, 4, tm.tm_year) || !SkipChar(s, '-') ||
+	    !ParseDigits(s, 2, tm.tm_mon) || !SkipChar(s, '-') ||
+	    !ParseDigits(s, 2, tm.tm_mday) ||
+	    !(SkipChar(s, 'T') || SkipChar(s, ' ')) ||
+	    !ParseDigits(s, 2, tm.tm_hour) || !SkipChar(s, ':') ||
+	    !ParseDigits(s, 2, tm.tm_min) || !SkipChar(s, ':') ||
+	    !ParseDigits(s, 2, tm.tm_sec))
+		return 0;
+
+	SkipChar(s, 'Z');
+	if (!s.empty())
+		return 0;
+
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+
+#ifdef _WIN32
+	const time_t t = _mkgmtime(&tm);
+#else
+	const time_t t = timegm(&tm);
+#endif
+	if (t == (time_t)-1)
+		return 0;
+
+	return t;
+}
+
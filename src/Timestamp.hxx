@@ -0,0 +1,37 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef TIMESTAMP_HXX
+#define TIMESTAMP_HXX
+
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Parse a time stamp into the UNIX time stamp expected by the
+ * AudioScrobbler protocol.  Accepts a UNIX time stamp or "YYYY-MM-DD
+ * HH:MM:SS" / "YYYY-MM-DDTHH:MM:SS[Z]" in UTC.
+ *
+ * @return the UNIX time stamp or 0 on error
+ */
+int_least64_t
+ParseTimestamp(std::string_view s) noexcept;
+
+#endif
@@ -27,6 +27,11 @@
 #include "WinSelectBackend.hxx"
 using EventPollBackend = WinSelectBackend;
 
+#elif defined(USE_URING)
+
+#include "UringBackend.hxx"
+using EventPollBackend = UringBackend;
+
 #elif defined(USE_EPOLL)
 
 #include "EpollBackend.hxx"
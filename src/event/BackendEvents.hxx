@@ -27,7 +27,7 @@
 #include "WinSelectEvents.hxx"
 using EventPollBackendEvents = WinSelectEvents;
 
-#elif defined(USE_EPOLL)
+#elif defined(USE_EPOLL) || defined(USE_URING)
 
 #include "EpollEvents.hxx"
 using EventPollBackendEvents = EpollEvents;
@@ -57,3 +57,9 @@ CoarseTimerEvent::ScheduleEarlier(Event::Duration d) noexcept
 	due = new_due;
 	loop.Insert(*this);
 }
+
+void
+CoarseTimerEvent::Run() noexcept
+{
+	loop.InvokeTimer(EventLoop::CallbackType::COARSE_TIMER, due, callback);
+}
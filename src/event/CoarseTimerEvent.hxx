@@ -97,7 +97,5 @@ public:
 	}
 
 private:
-	void Run() noexcept {
-		callback();
-	}
+	void Run() noexcept;
 };
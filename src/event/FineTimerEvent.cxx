@@ -57,3 +57,9 @@ FineTimerEvent::ScheduleEarlier(Event::Duration d) noexcept
 	due = new_due;
 	loop.Insert(*this);
 }
+
+void
+FineTimerEvent::Run() noexcept
+{
+	loop.InvokeTimer(EventLoop::CallbackType::FINE_TIMER, due, callback);
+}
@@ -110,7 +110,5 @@ public:
 	}
 
 private:
-	void Run() noexcept {
-		callback();
-	}
+	void Run() noexcept;
 };
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2003-2021 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_INJECT_EVENT_HXX
+#define MPD_INJECT_EVENT_HXX
+
+#include "SocketEvent.hxx"
+#include "WakeFD.hxx"
+#include "util/BindMethod.hxx"
+
+/**
+ * Invoke a method call in the #EventLoop.  Unlike #DeferEvent,
+ * Schedule() may be called from any thread.
+ *
+ * This implementation does not need the #EventLoop to be built
+ * with HAVE_THREADED_EVENT_LOOP: each instance owns a #WakeFD
+ * which is registered with the #EventLoop.
+ */
+class InjectEvent final {
+	WakeFD wake_fd;
+	SocketEvent socket_event;
+
+	using Callback = BoundMethod<void() noexcept>;
+	const Callback callback;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	InjectEvent(EventLoop &loop, Callback _callback);
+
+	~InjectEvent() noexcept {
+		/* the file descriptor is owned by #wake_fd */
+		socket_event.ReleaseSocket();
+	}
+
+	InjectEvent(const InjectEvent &) = delete;
+	InjectEvent &operator=(const InjectEvent &) = delete;
+
+	auto &GetEventLoop() const noexcept {
+		return socket_event.GetEventLoop();
+	}
+
+	/**
+	 * Schedule a call to the callback.  Multiple calls before
+	 * the #EventLoop gets to it are combined.
+	 *
+	 * This method is thread-safe.
+	 */
+	void Schedule() noexcept {
+		wake_fd.Write();
+	}
+
+	/**
+	 * Cancel a pending call.  Must be called from the #EventLoop
+	 * thread.
+	 */
+	void Cancel() noexcept {
+		wake_fd.Read();
+	}
+
+private:
+	void OnSocketReady(unsigned flags) noexcept;
+};
+
+#endif
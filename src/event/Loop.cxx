@@ -33,6 +33,10 @@
 #include <stdio.h>
 #endif
 
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#endif
+
 EventLoop::EventLoop(
 #ifdef HAVE_THREADED_EVENT_LOOP
 		     ThreadId _thread
@@ -190,8 +194,8 @@ void
 EventLoop::RunDeferred() noexcept
 {
 	while (!defer.empty() && !quit) {
-		defer.pop_front_and_dispose([](DeferEvent *e){
-			e->Run();
+		defer.pop_front_and_dispose([this](DeferEvent *e){
+			Invoke(CallbackType::DEFER, [e]{ e->Run(); });
 		});
 	}
 }
@@ -202,8 +206,8 @@ EventLoop::RunOneIdle() noexcept
 	if (idle.empty())
 		return false;
 
-	idle.pop_front_and_dispose([](DeferEvent *e){
-		e->Run();
+	idle.pop_front_and_dispose([this](DeferEvent *e){
+		Invoke(CallbackType::IDLE, [e]{ e->Run(); });
 	});
 
 	return true;
@@ -237,8 +241,13 @@ ExportTimeoutMS(Event::Duration timeout) noexcept
 inline bool
 EventLoop::Wait(Event::Duration timeout) noexcept
 {
-	const auto poll_result =
-		poll_backend.ReadEvents(ExportTimeoutMS(timeout));
+	const int timeout_ms = ExportTimeoutMS(timeout);
+	const auto poll_result = poll_backend.ReadEvents(timeout_ms);
+
+#ifdef HAVE_USDT
+	DTRACE_PROBE2(mpdscribble, loop_wakeup,
+		      poll_result.GetSize(), timeout_ms);
+#endif
 
 	for (size_t i = 0; i < poll_result.GetSize(); ++i) {
 		auto &socket_event = *(SocketEvent *)poll_result.GetObject(i);
@@ -348,7 +357,9 @@ EventLoop::Run() noexcept
 			socket_event.unlink();
 			sockets.push_back(socket_event);
 
-			socket_event.Dispatch();
+			Invoke(CallbackType::SOCKET, [&socket_event]{
+				socket_event.Dispatch();
+			});
 		}
 	} while (!quit);
 
@@ -402,7 +413,7 @@ EventLoop::HandleInject() noexcept
 		inject.pop_front();
 
 		const ScopeUnlock unlock(mutex);
-		m.Run();
+		Invoke(CallbackType::INJECT, [&m]{ m.Run(); });
 	}
 }
 
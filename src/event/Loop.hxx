@@ -37,6 +37,14 @@
 #include <boost/intrusive/list.hpp>
 #endif
 
+#include "LoopObserver.hxx"
+
+#ifdef ENABLE_LOOP_STATS
+#include "util/BindMethod.hxx"
+
+#include <utility>
+#endif
+
 #include <atomic>
 #include <cassert>
 
@@ -146,6 +154,10 @@ class EventLoop final
 
 	ClockCache<std::chrono::steady_clock> steady_clock_cache;
 
+#ifdef ENABLE_LOOP_STATS
+	EventLoopObserver *observer = nullptr;
+#endif
+
 public:
 	/**
 	 * Throws on error.
@@ -187,6 +199,55 @@ public:
 	Uring::Queue *GetUring() noexcept;
 #endif
 
+#ifdef ENABLE_LOOP_STATS
+	/**
+	 * Measure all callbacks and pass the results to the given
+	 * observer (or stop measuring if nullptr).
+	 */
+	void SetObserver(EventLoopObserver *_observer) noexcept {
+		observer = _observer;
+	}
+#endif
+
+	using CallbackType = EventLoopObserver::CallbackType;
+
+	/**
+	 * Invoke an event callback (used by the event classes).  If
+	 * there is an #EventLoopObserver, its duration is measured.
+	 */
+	template<typename F>
+	void Invoke([[maybe_unused]] CallbackType type, F &&f) noexcept {
+#ifdef ENABLE_LOOP_STATS
+		if (observer != nullptr) {
+			InvokeObserved(type, std::forward<F>(f));
+			return;
+		}
+#endif
+
+		f();
+	}
+
+	/**
+	 * Invoke a timer callback; like Invoke(), but also reports
+	 * how late the timer is.
+	 */
+	template<typename F>
+	void InvokeTimer([[maybe_unused]] CallbackType type,
+			 [[maybe_unused]] Event::TimePoint due,
+			 F &&f) noexcept {
+#ifdef ENABLE_LOOP_STATS
+		if (observer != nullptr) {
+			/* not SteadyNow(), because the cached time
+			   may be outdated after a slow callback */
+			observer->OnTimerLateness(type, Event::Clock::now() - due);
+			InvokeObserved(type, std::forward<F>(f));
+			return;
+		}
+#endif
+
+		f();
+	}
+
 	/**
 	 * Stop execution of this #EventLoop at the next chance.  This
 	 * method is thread-safe and non-blocking: after returning, it
@@ -238,6 +299,23 @@ public:
 	void Run() noexcept;
 
 private:
+#ifdef ENABLE_LOOP_STATS
+	template<typename F>
+	void InvokeObserved(CallbackType type, F &&f) noexcept {
+		BindMethodDetail::current_name = nullptr;
+		const auto start = Event::Clock::now();
+		f();
+		const auto duration = Event::Clock::now() - start;
+
+		const char *name = std::exchange(BindMethodDetail::current_name,
+						 nullptr);
+
+		/* the callback may have removed the observer */
+		if (observer != nullptr)
+			observer->OnCallback(type, duration, name);
+	}
+#endif
+
 	void RunDeferred() noexcept;
 
 	/**
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2022 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Chrono.hxx"
+
+/**
+ * Receives measurements of the callbacks invoked by an #EventLoop;
+ * see EventLoop::SetObserver().  All methods are called in the
+ * #EventLoop thread, right after the callback has returned, so they
+ * should be fast.
+ *
+ * Only available if ENABLE_LOOP_STATS is defined.
+ */
+class EventLoopObserver {
+public:
+	enum class CallbackType : unsigned {
+		SOCKET,
+		COARSE_TIMER,
+		FINE_TIMER,
+		DEFER,
+		IDLE,
+		INJECT,
+	};
+
+	static constexpr unsigned N_CALLBACK_TYPES = 6;
+
+	/**
+	 * A callback has returned.
+	 *
+	 * @param duration the wall-clock time the callback took
+	 * @param name the name of the bound method which was invoked
+	 * (in the form generated by the compiler's
+	 * __PRETTY_FUNCTION__); nullptr if it is not known
+	 */
+	virtual void OnCallback(CallbackType type, Event::Duration duration,
+				const char *name) noexcept = 0;
+
+	/**
+	 * A timer is about to be invoked.
+	 *
+	 * @param type #COARSE_TIMER or #FINE_TIMER
+	 * @param lateness how long after its due time it is invoked
+	 */
+	virtual void OnTimerLateness(CallbackType type,
+				     Event::Duration lateness) noexcept = 0;
+};
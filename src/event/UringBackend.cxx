@@ -0,0 +1,223 @@
+/*
+ * Copyright 2003-2021 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "UringBackend.hxx"
+
+#include <errno.h>
+
+UringBackend::UringBackend()
+{
+	if (io_uring_queue_init(256, &ring, 0) < 0)
+		epoll.emplace();
+}
+
+UringBackend::~UringBackend() noexcept
+{
+	if (!epoll)
+		io_uring_queue_exit(&ring);
+}
+
+inline uint64_t
+UringBackend::MakeUserData(int fd) noexcept
+{
+	const uint32_t generation = next_generation++;
+	if (next_generation == 0)
+		next_generation = 1;
+
+	return (uint64_t(uint32_t(fd)) << 32) | generation;
+}
+
+struct io_uring_sqe *
+UringBackend::GetSqe() noexcept
+{
+	auto *sqe = io_uring_get_sqe(&ring);
+	if (sqe == nullptr) {
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	return sqe;
+}
+
+void
+UringBackend::Schedule(int fd, Registration &r) noexcept
+{
+	r.user_data = MakeUserData(fd);
+	rearm.push_back(fd);
+}
+
+void
+UringBackend::Cancel(Registration &r) noexcept
+{
+	if (!r.armed)
+		return;
+
+	r.armed = false;
+
+	auto *sqe = GetSqe();
+	if (sqe == nullptr)
+		/* the stale completion will be ignored because its
+		   user_data doesn't match anymore */
+		return;
+
+	io_uring_prep_poll_remove(sqe, r.user_data);
+	io_uring_sqe_set_data64(sqe, IGNORE_USER_DATA);
+}
+
+bool
+UringBackend::Add(int fd, unsigned events, void *obj) noexcept
+{
+	if (epoll)
+		return epoll->Add(fd, events, obj);
+
+	auto [i, inserted] = registrations.try_emplace(fd);
+	if (!inserted) {
+		errno = EEXIST;
+		return false;
+	}
+
+	i->second.object = obj;
+	i->second.events = events;
+	Schedule(fd, i->second);
+	return true;
+}
+
+bool
+UringBackend::Modify(int fd, unsigned events, void *obj) noexcept
+{
+	if (epoll)
+		return epoll->Modify(fd, events, obj);
+
+	auto i = registrations.find(fd);
+	if (i == registrations.end()) {
+		errno = ENOENT;
+		return false;
+	}
+
+	auto &r = i->second;
+	r.object = obj;
+
+	if (events != r.events || !r.armed) {
+		Cancel(r);
+		r.events = events;
+		Schedule(fd, r);
+	}
+
+	return true;
+}
+
+bool
+UringBackend::Remove(int fd) noexcept
+{
+	if (epoll)
+		return epoll->Remove(fd);
+
+	auto i = registrations.find(fd);
+	if (i == registrations.end()) {
+		errno = ENOENT;
+		return false;
+	}
+
+	Cancel(i->second);
+	registrations.erase(i);
+	return true;
+}
+
+inline void
+UringBackend::Arm() noexcept
+{
+	for (int fd : rearm) {
+		auto i = registrations.find(fd);
+		if (i == registrations.end() || i->second.armed)
+			continue;
+
+		auto *sqe = GetSqe();
+		if (sqe == nullptr)
+			/* can't happen after io_uring_submit(); try
+			   again next time */
+			return;
+
+		auto &r = i->second;
+		io_uring_prep_poll_add(sqe, fd, r.events);
+		io_uring_sqe_set_data64(sqe, r.user_data);
+		r.armed = true;
+	}
+
+	rearm.clear();
+}
+
+UringBackendResult
+UringBackend::ReadEvents(int timeout_ms) noexcept
+{
+	UringBackendResult result;
+
+	if (epoll) {
+		const auto e = epoll->ReadEvents(timeout_ms);
+		for (size_t i = 0; i < e.GetSize(); ++i)
+			result.items[i] = {e.GetEvents(i), e.GetObject(i)};
+		result.n_items = e.GetSize();
+		return result;
+	}
+
+	Arm();
+
+	struct io_uring_cqe *cqe;
+	if (timeout_ms < 0) {
+		io_uring_submit_and_wait(&ring, 1);
+	} else {
+		struct __kernel_timespec ts;
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &ts, nullptr);
+	}
+
+	while (result.n_items < result.items.size() &&
+	       io_uring_peek_cqe(&ring, &cqe) == 0) {
+		const uint64_t user_data = io_uring_cqe_get_data64(cqe);
+		const int res = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+
+		if (user_data == IGNORE_USER_DATA)
+			continue;
+
+		const int fd = int(user_data >> 32);
+		auto i = registrations.find(fd);
+		if (i == registrations.end() ||
+		    i->second.user_data != user_data)
+			/* completion of a cancelled request */
+			continue;
+
+		auto &r = i->second;
+		r.armed = false;
+
+		if (res == -ECANCELED)
+			continue;
+
+		/* a one-shot poll: re-arm it before the next wait,
+		   unless the SocketEvent modifies it meanwhile */
+		Schedule(fd, r);
+
+		result.items[result.n_items++] = {
+			res < 0 ? unsigned(EPOLLERR) : unsigned(res),
+			r.object,
+		};
+	}
+
+	return result;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2003-2021 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EVENT_URING_BACKEND_HXX
+#define EVENT_URING_BACKEND_HXX
+
+#include "EpollBackend.hxx"
+
+#include <liburing.h>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+class UringBackendResult
+{
+	friend class UringBackend;
+
+	struct Item {
+		unsigned events;
+		void *object;
+	};
+
+	std::array<Item, 16> items;
+	size_t n_items = 0;
+
+public:
+	size_t GetSize() const noexcept {
+		return n_items;
+	}
+
+	unsigned GetEvents(size_t i) const noexcept {
+		return items[i].events;
+	}
+
+	void *GetObject(size_t i) const noexcept {
+		return items[i].object;
+	}
+};
+
+/**
+ * An #EventLoop backend which uses one-shot IORING_OP_POLL_ADD
+ * requests instead of epoll_ctl().  A poll which has completed is
+ * re-armed (to emulate level-triggered epoll) in the same
+ * io_uring_enter() call which waits for the next events, so all
+ * registration changes of one loop iteration cost no extra system
+ * call.
+ *
+ * If io_uring is not available at runtime (old kernel, seccomp
+ * filter), it falls back to #EpollBackend.
+ */
+class UringBackend
+{
+	struct io_uring ring;
+
+	/**
+	 * Only initialized if io_uring is not available.
+	 */
+	std::optional<EpollBackend> epoll;
+
+	struct Registration {
+		void *object;
+
+		unsigned events;
+
+		/**
+		 * The user_data of the current poll request.  It is
+		 * unique, so completions of cancelled requests can
+		 * be recognized even if the file descriptor number
+		 * has been reused meanwhile.
+		 */
+		uint64_t user_data;
+
+		/**
+		 * Is a poll request with #user_data in flight?
+		 */
+		bool armed = false;
+	};
+
+	std::unordered_map<int, Registration> registrations;
+
+	/**
+	 * File descriptors which need a new poll request before
+	 * the next wait.
+	 */
+	std::vector<int> rearm;
+
+	uint32_t next_generation = 1;
+
+	/**
+	 * The user_data of requests whose completions are ignored.
+	 */
+	static constexpr uint64_t IGNORE_USER_DATA = ~uint64_t{};
+
+	UringBackend(UringBackend &) = delete;
+	UringBackend &operator=(UringBackend &) = delete;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	UringBackend();
+	~UringBackend() noexcept;
+
+	UringBackendResult ReadEvents(int timeout_ms) noexcept;
+
+	bool Add(int fd, unsigned events, void *obj) noexcept;
+	bool Modify(int fd, unsigned events, void *obj) noexcept;
+	bool Remove(int fd) noexcept;
+
+	bool Abandon(int fd) noexcept {
+		if (epoll)
+			return epoll->Abandon(fd);
+
+		/* unlike epoll, a pending poll request holds a
+		   reference on the file, so it needs to be removed
+		   explicitly */
+		return Remove(fd);
+	}
+
+private:
+	uint64_t MakeUserData(int fd) noexcept;
+
+	/**
+	 * Obtain a submission queue entry, flushing the queue if it
+	 * is full.
+	 */
+	struct io_uring_sqe *GetSqe() noexcept;
+
+	void Schedule(int fd, Registration &r) noexcept;
+	void Cancel(Registration &r) noexcept;
+	void Arm() noexcept;
+};
+
+#endif
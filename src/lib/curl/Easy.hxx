@@ -88,6 +88,14 @@ public:
 		return handle;
 	}
 
+	/**
+	 * Reset all options to their defaults, but keep live
+	 * connections, the DNS cache and the TLS session cache.
+	 */
+	void Reset() noexcept {
+		curl_easy_reset(handle);
+	}
+
 	template<typename T>
 	void SetOption(CURLoption option, T value) {
 		CURLcode code = curl_easy_setopt(handle, option, value);
@@ -32,6 +32,7 @@
 #include "event/Loop.hxx"
 #include "event/SocketEvent.hxx"
 #include "util/Compiler.h"
+#include "config.h"
 
 #include <cassert>
 
@@ -107,25 +108,92 @@ private:
 };
 
 CurlGlobal::CurlGlobal(EventLoop &_loop,
-		       const char *_proxy)
+		       const char *_proxy,
+		       CurlThrottleLimits limits)
+	:CurlGlobal(_loop, _proxy,
+		    std::make_shared<CurlThrottleBudget>(limits))
+{
+}
+
+CurlGlobal::CurlGlobal(EventLoop &_loop, const char *_proxy,
+		       std::shared_ptr<CurlThrottleBudget> throttle_budget)
 	:proxy(_proxy),
 	 defer_read_info(_loop, BIND_THIS_METHOD(ReadInfo)),
-	 timeout_event(_loop, BIND_THIS_METHOD(OnTimeout))
+	 timeout_event(_loop, BIND_THIS_METHOD(OnTimeout)),
+	 throttle(_loop, std::move(throttle_budget))
 {
 	multi.SetOption(CURLMOPT_SOCKETFUNCTION, CurlSocket::SocketFunction);
 	multi.SetOption(CURLMOPT_SOCKETDATA, this);
 
 	multi.SetOption(CURLMOPT_TIMERFUNCTION, TimerFunction);
 	multi.SetOption(CURLMOPT_TIMERDATA, this);
+
+#if LIBCURL_VERSION_NUM >= 0x072b00 /* 7.43.0 */
+	/* allow multiple requests to the same HTTP/2 server to share
+	   one connection */
+	multi.SetOption(CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+	share.Share(CURL_LOCK_DATA_DNS);
+	share.Share(CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900 /* 7.57.0 */
+	share.Share(CURL_LOCK_DATA_CONNECT);
+#endif
+
+	easy_pool.reserve(MAX_EASY_POOL);
+}
+
+CurlGlobal::~CurlGlobal() noexcept
+{
+	for (auto &i : prewarms)
+		multi.Remove(i.Get());
 }
 
 void
 CurlGlobal::Configure(CurlEasy &easy)
 {
+	easy.SetOption(CURLOPT_SHARE, share.Get());
+
+#if LIBCURL_VERSION_NUM >= 0x072b00 /* 7.43.0 */
+	/* prefer waiting for an existing HTTP/2 connection over
+	   opening a new one */
+	easy.SetOption(CURLOPT_PIPEWAIT, 1L);
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x071506 /* 7.21.6 */
+	/* advertise and decode all encodings supported by
+	   libcurl */
+	easy.SetOption(CURLOPT_ACCEPT_ENCODING, "");
+#endif
+
 	if (proxy != nullptr)
 		easy.SetOption(CURLOPT_PROXY, proxy);
 }
 
+CurlEasy
+CurlGlobal::AcquireEasy(const char *url)
+{
+	if (easy_pool.empty())
+		return CurlEasy{url};
+
+	CurlEasy easy = std::move(easy_pool.back());
+	easy_pool.pop_back();
+	easy.SetURL(url);
+	return easy;
+}
+
+void
+CurlGlobal::ReleaseEasy(CurlEasy &&easy) noexcept
+{
+	if (easy_pool.size() >= MAX_EASY_POOL)
+		/* the pool is full; let the destructor free it */
+		return;
+
+	/* clear all pointers to the old request */
+	easy.Reset();
+	easy_pool.emplace_back(std::move(easy));
+}
+
 int
 CurlSocket::SocketFunction([[maybe_unused]] CURL *easy,
 			   curl_socket_t s, int action,
@@ -161,6 +229,45 @@ CurlSocket::OnSocketReady(unsigned flags) noexcept
 	global.SocketAction(GetSocket().Get(), FlagsToCurlCSelect(flags));
 }
 
+void
+CurlGlobal::Prewarm(const char *url) noexcept
+{
+	assert(GetEventLoop().IsInside());
+
+	try {
+		CurlEasy easy = AcquireEasy(url);
+		easy.SetUserAgent(PACKAGE "/" VERSION);
+		easy.SetNoBody();
+		Configure(easy);
+
+		multi.Add(easy.Get());
+		prewarms.emplace_front(std::move(easy));
+	} catch (...) {
+		/* never mind, the real request will connect */
+		return;
+	}
+
+	/* this starts the (threaded) resolver right away, even if
+	   the caller blocks the EventLoop for a while */
+	InvalidateSockets();
+}
+
+inline bool
+CurlGlobal::FinishPrewarm(CURL *easy) noexcept
+{
+	for (auto prev = prewarms.before_begin(), i = std::next(prev);
+	     i != prewarms.end(); prev = i++) {
+		if (i->Get() == easy) {
+			multi.Remove(easy);
+			ReleaseEasy(std::move(*i));
+			prewarms.erase_after(prev);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void
 CurlGlobal::Add(CurlRequest &r)
 {
@@ -203,7 +310,11 @@ CurlGlobal::ReadInfo() noexcept
 
 	while ((msg = multi.InfoRead()) != nullptr) {
 		if (msg->msg == CURLMSG_DONE) {
-			auto *request = ToRequest(msg->easy_handle);
+			CURL *easy = msg->easy_handle;
+			if (FinishPrewarm(easy))
+				continue;
+
+			auto *request = ToRequest(easy);
 			if (request != nullptr)
 				request->Done(msg->data.result);
 		}
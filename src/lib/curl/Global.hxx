@@ -32,37 +32,109 @@
 
 #include "Init.hxx"
 #include "Multi.hxx"
+#include "Share.hxx"
+#include "Easy.hxx"
+#include "Throttle.hxx"
 #include "event/CoarseTimerEvent.hxx"
 #include "event/DeferEvent.hxx"
 
+#include <forward_list>
+#include <vector>
+
 class CurlSocket;
 class CurlRequest;
-class CurlEasy;
 
 /**
  * Manager for the global CURLM object.
  */
 class CurlGlobal final {
+	/**
+	 * Keep no more than this number of idle easy handles in
+	 * #easy_pool.
+	 */
+	static constexpr std::size_t MAX_EASY_POOL = 8;
+
 	const char *const proxy;
 
 	const ScopeCurlInit init;
 
 	CurlMulti multi;
 
+	/**
+	 * Shares the DNS cache, the TLS session cache and the
+	 * connection cache between all easy handles.
+	 */
+	CurlShare share;
+
+	/**
+	 * Idle easy handles which can be reused by new requests.
+	 * Reusing them avoids the setup cost of new handles.
+	 */
+	std::vector<CurlEasy> easy_pool;
+
+	/**
+	 * The easy handles of the running Prewarm() requests.
+	 */
+	std::forward_list<CurlEasy> prewarms;
+
 	DeferEvent defer_read_info;
 
 	CoarseTimerEvent timeout_event;
 
+	/**
+	 * Enforces the per-host limits on requests created with
+	 * HttpRequestSlot.  Prewarm() requests are not counted.
+	 */
+	CurlThrottle throttle;
+
 public:
 	explicit CurlGlobal(EventLoop &_loop,
-			    const char *_proxy);
+			    const char *_proxy,
+			    CurlThrottleLimits limits={});
+
+	/**
+	 * Share the #CurlThrottleBudget with other #CurlGlobal
+	 * instances (in other threads), so the limits apply to all
+	 * of them together.
+	 */
+	CurlGlobal(EventLoop &_loop, const char *_proxy,
+		   std::shared_ptr<CurlThrottleBudget> throttle_budget);
+	~CurlGlobal() noexcept;
 
 	auto &GetEventLoop() const noexcept {
 		return timeout_event.GetEventLoop();
 	}
 
+	CurlThrottle &GetThrottle() noexcept {
+		return throttle;
+	}
+
 	void Configure(CurlEasy &easy);
 
+	/**
+	 * Obtain an easy handle for a new request, either from the
+	 * pool or a newly allocated one.
+	 *
+	 * Throws on error.
+	 */
+	CurlEasy AcquireEasy(const char *url);
+
+	/**
+	 * Return an easy handle which is no longer used to the pool.
+	 * Its options are reset.
+	 */
+	void ReleaseEasy(CurlEasy &&easy) noexcept;
+
+	/**
+	 * Open a connection to the server of the given URL in the
+	 * background (with a "HEAD" request whose response is
+	 * ignored) and leave it idle in the connection cache, so
+	 * the next request to this server finds the host name
+	 * resolved and the connection (or at least the TLS session)
+	 * established.  Errors are ignored.
+	 */
+	void Prewarm(const char *url) noexcept;
+
 	void Add(CurlRequest &r);
 	void Remove(CurlRequest &r) noexcept;
 
@@ -84,6 +156,14 @@ private:
 	 */
 	void ReadInfo() noexcept;
 
+	/**
+	 * A Prewarm() request has finished; free its easy handle.
+	 *
+	 * @return false if the handle does not belong to a Prewarm()
+	 * request
+	 */
+	bool FinishPrewarm(CURL *easy) noexcept;
+
 	void UpdateTimeout(long timeout_ms) noexcept;
 	static int TimerFunction(CURLM *multi, long timeout_ms,
 				 void *userp) noexcept;
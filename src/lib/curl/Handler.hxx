@@ -22,11 +22,15 @@
 #define CURL_HANDLER_HXX
 
 #include <exception>
-#include <string>
+#include <string_view>
 
 class HttpResponseHandler {
 public:
-	virtual void OnHttpResponse(std::string body) noexcept = 0;
+	/**
+	 * The response body was received.  The #body buffer is only
+	 * valid during this call.
+	 */
+	virtual void OnHttpResponse(std::string_view body) noexcept = 0;
 	virtual void OnHttpError(std::exception_ptr e) noexcept = 0;
 };
 
@@ -20,24 +20,26 @@
 #include "Request.hxx"
 #include "Handler.hxx"
 #include "Global.hxx"
+#include "HttpStatusError.hxx"
 #include "util/RuntimeError.hxx"
 #include "config.h"
 
 #include <curl/curl.h>
 
+#include <algorithm>
 #include <stdexcept>
 
-enum {
-	/** maximum length of a response body */
-	MAX_RESPONSE_BODY = 8192,
-};
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#endif
 
 CurlRequest::CurlRequest(CurlGlobal &_global,
 			 const char *url, std::string &&_request_body,
-			 HttpResponseHandler &_handler)
+			 HttpResponseHandler &_handler,
+			 struct curl_slist *headers)
 	:global(_global),
 	 handler(_handler),
-	 curl(url),
+	 curl(global.AcquireEasy(url)),
 	 request_body(std::move(_request_body))
 {
 	curl.SetPrivate(this);
@@ -48,6 +50,9 @@ CurlRequest::CurlRequest(CurlGlobal &_global,
 	curl.SetOption(CURLOPT_BUFFERSIZE, (long)2048);
 	curl.SetFailOnError();
 
+	if (headers != nullptr)
+		curl.SetRequestHeaders(headers);
+
 	if (!request_body.empty()) {
 		curl.SetOption(CURLOPT_POST, true);
 		curl.SetRequestBody(request_body.data(),
@@ -60,8 +65,10 @@ CurlRequest::CurlRequest(CurlGlobal &_global,
 
 CurlRequest::~CurlRequest() noexcept
 {
-	if (curl)
+	if (curl) {
 		global.Remove(*this);
+		global.ReleaseEasy(std::move(curl));
+	}
 }
 
 inline void
@@ -70,9 +77,13 @@ CurlRequest::CheckResponse(CURLcode result)
 	if (result == CURLE_WRITE_ERROR &&
 	    /* handle the postponed error that was caught in
 	       WriteFunction() */
-	    response_body.length() > MAX_RESPONSE_BODY)
+	    response_too_large)
 		throw std::runtime_error("response body is too large");
-	else if (result != CURLE_OK)
+	else if (result == CURLE_HTTP_RETURNED_ERROR) {
+		long status = 0;
+		curl.GetInfo(CURLINFO_RESPONSE_CODE, &status);
+		throw HttpStatusError(status, error);
+	} else if (result != CURLE_OK)
 		throw FormatRuntimeError("CURL failed: %s",
 					 error);
 }
@@ -80,11 +91,20 @@ CurlRequest::CheckResponse(CURLcode result)
 void
 CurlRequest::Done(CURLcode result) noexcept
 {
+#ifdef HAVE_USDT
+	long status = 0;
+	curl.GetInfo(CURLINFO_RESPONSE_CODE, &status);
+	double total_time = 0;
+	curl.GetInfo(CURLINFO_TOTAL_TIME, &total_time);
+	DTRACE_PROBE4(mpdscribble, http_done, int(result), status,
+		      long(total_time * 1e6), response_length);
+#endif
+
 	/* invoke the handler method */
 
 	try {
 		CheckResponse(result);
-		handler.OnHttpResponse(std::move(response_body));
+		handler.OnHttpResponse({response_body.data(), response_length});
 	} catch (...) {
 		handler.OnHttpError(std::current_exception());
 	}
@@ -99,11 +119,15 @@ CurlRequest::WriteFunction(char *ptr, size_t size, size_t nmemb,
 {
 	auto *request = (CurlRequest *)stream;
 
-	request->response_body.append((const char *)ptr, size * nmemb);
-
-	if (request->response_body.length() > MAX_RESPONSE_BODY)
+	const std::size_t length = size * nmemb;
+	if (length > request->response_body.size() - request->response_length) {
 		/* response body too large */
+		request->response_too_large = true;
 		return 0;
+	}
 
-	return size * nmemb;
+	std::copy_n(ptr, length,
+		    request->response_body.data() + request->response_length);
+	request->response_length += length;
+	return length;
 }
@@ -23,6 +23,8 @@
 
 #include "Easy.hxx"
 
+#include <array>
+#include <cstddef>
 #include <string>
 
 class CurlGlobal;
@@ -34,6 +36,9 @@ class HttpResponseHandler;
  */
 class CurlRequest final
 {
+	/** maximum length of a response body */
+	static constexpr std::size_t MAX_RESPONSE_BODY = 8192;
+
 	CurlGlobal &global;
 
 	HttpResponseHandler &handler;
@@ -44,16 +49,32 @@ class CurlRequest final
 	/** the POST request body */
 	std::string request_body;
 
-	/** the response body */
-	std::string response_body;
+	/**
+	 * The response body.  It is stored inline, so receiving it
+	 * does not allocate memory.
+	 */
+	std::array<char, MAX_RESPONSE_BODY> response_body;
+
+	/** the number of bytes in #response_body */
+	std::size_t response_length = 0;
+
+	/**
+	 * Was the response body larger than #MAX_RESPONSE_BODY?
+	 */
+	bool response_too_large = false;
 
 	/** error message provided by libcurl */
 	char error[CURL_ERROR_SIZE];
 
 public:
+	/**
+	 * @param headers additional request headers (or nullptr);
+	 * the list must remain valid until this object is destroyed
+	 */
 	CurlRequest(CurlGlobal &global,
 		    const char *url, std::string &&_request_body,
-		    HttpResponseHandler &_handler);
+		    HttpResponseHandler &_handler,
+		    struct curl_slist *headers=nullptr);
 	~CurlRequest() noexcept;
 
 	CURL *Get() noexcept {
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2008-2020 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Throttle.hxx"
+#include "event/Loop.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <tuple>
+
+/**
+ * Returns the "scheme://host:port" part of the given URL.
+ */
+static constexpr std::string_view
+GetOrigin(std::string_view url) noexcept
+{
+	const auto i = url.find("://");
+	if (i == url.npos)
+		return url;
+
+	return url.substr(0, url.find('/', i + 3));
+}
+
+bool
+CurlThrottleHost::HasWaiting() noexcept
+{
+	flows.remove_if([](const Flow &f){
+		return f.clients.empty();
+	});
+
+	return !urgent.empty() || !flows.empty();
+}
+
+CurlThrottleClient *
+CurlThrottleHost::PopNext() noexcept
+{
+	if (!urgent.empty()) {
+		auto &client = urgent.front();
+		urgent.pop_front();
+		return &client;
+	}
+
+	while (!flows.empty()) {
+		auto &flow = flows.front();
+		if (flow.clients.empty()) {
+			flows.pop_front();
+			continue;
+		}
+
+		auto &client = flow.clients.front();
+		flow.clients.pop_front();
+
+		if (flow.clients.empty())
+			flows.pop_front();
+		else
+			/* it's the next owner's turn */
+			flows.splice(flows.end(), flows, flows.begin());
+
+		return &client;
+	}
+
+	return nullptr;
+}
+
+void
+CurlThrottleBudget::AddThrottle(CurlThrottle &throttle)
+{
+	const std::scoped_lock lock{mutex};
+	throttles.push_back(&throttle);
+}
+
+void
+CurlThrottleBudget::RemoveThrottle(CurlThrottle &throttle) noexcept
+{
+	const std::scoped_lock lock{mutex};
+	throttles.erase(std::find(throttles.begin(), throttles.end(),
+				  &throttle));
+}
+
+CurlThrottleBudget::Host &
+CurlThrottleBudget::MakeHost(std::string_view origin)
+{
+	const std::scoped_lock lock{mutex};
+
+	auto i = hosts.find(origin);
+	if (i == hosts.end())
+		/* start with a full bucket */
+		i = hosts.emplace(std::piecewise_construct,
+				  std::forward_as_tuple(origin),
+				  std::forward_as_tuple(double(limits.rate),
+							Event::Clock::now())).first;
+
+	return i->second;
+}
+
+void
+CurlThrottleBudget::Refill(Host &host, Event::TimePoint now) const noexcept
+{
+	if (limits.rate == 0)
+		return;
+
+	const double elapsed =
+		std::chrono::duration<double>(now - host.refilled).count();
+	host.tokens = std::min<double>(limits.rate,
+				       host.tokens + elapsed * limits.rate);
+	host.refilled = now;
+}
+
+bool
+CurlThrottleBudget::TryTake(Host &host) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	Refill(host, Event::Clock::now());
+
+	if ((limits.max_in_flight > 0 &&
+	     host.in_flight >= limits.max_in_flight) ||
+	    (limits.rate > 0 && host.tokens < 1))
+		return false;
+
+	++host.in_flight;
+
+	if (limits.rate > 0)
+		host.tokens -= 1;
+
+	return true;
+}
+
+void
+CurlThrottleBudget::Release(Host &host) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	assert(host.in_flight > 0);
+	--host.in_flight;
+
+	/* admit the next one later, not from inside the caller's
+	   response handler */
+	for (auto *i : throttles)
+		i->admit_event.Schedule();
+}
+
+Event::Duration
+CurlThrottleBudget::GetRefillDelay(Host &host) noexcept
+{
+	if (limits.rate == 0)
+		return {};
+
+	const std::scoped_lock lock{mutex};
+
+	Refill(host, Event::Clock::now());
+
+	if (host.tokens >= 1)
+		return {};
+
+	const std::chrono::duration<double> delay{(1 - host.tokens) / limits.rate};
+	return std::chrono::ceil<Event::Duration>(delay);
+}
+
+CurlThrottle::CurlThrottle(EventLoop &event_loop,
+			   std::shared_ptr<CurlThrottleBudget> _budget)
+	:budget(std::move(_budget)),
+	 admit_event(event_loop, BIND_THIS_METHOD(OnAdmit)),
+	 timer(event_loop, BIND_THIS_METHOD(OnAdmit))
+{
+	budget->AddThrottle(*this);
+}
+
+CurlThrottle::~CurlThrottle() noexcept
+{
+	budget->RemoveThrottle(*this);
+}
+
+CurlThrottleHost &
+CurlThrottle::MakeHost(std::string_view url)
+{
+	const auto origin = GetOrigin(url);
+
+	auto i = hosts.find(origin);
+	if (i == hosts.end())
+		i = hosts.emplace(std::piecewise_construct,
+				  std::forward_as_tuple(origin),
+				  std::forward_as_tuple(budget->MakeHost(origin))).first;
+
+	return i->second;
+}
+
+void
+CurlThrottle::ScheduleRefill(CurlThrottleHost &host) noexcept
+{
+	/* if the concurrency limit is in the way, Release() will
+	   wake us up */
+	const auto delay = budget->GetRefillDelay(host.budget);
+	if (delay > Event::Duration::zero())
+		timer.ScheduleEarlier(delay);
+}
+
+bool
+CurlThrottle::Enqueue(CurlThrottleClient &client, std::string_view url)
+{
+	assert(client.host == nullptr);
+	assert(!client.admitted);
+	assert(!client.IsWaiting());
+
+	if (budget->GetLimits().IsUnlimited())
+		return true;
+
+	auto &host = MakeHost(url);
+	client.host = &host;
+
+	/* don't overtake the clients which are already waiting */
+	if (!host.HasWaiting() && budget->TryTake(host.budget)) {
+		client.admitted = true;
+		return true;
+	}
+
+	if (client.urgent) {
+		host.urgent.push_back(client);
+	} else {
+		auto flow = std::find_if(host.flows.begin(), host.flows.end(),
+					 [owner = client.owner](const auto &f){
+						 return f.owner == owner;
+					 });
+		if (flow == host.flows.end())
+			flow = host.flows.emplace(host.flows.end(),
+						  client.owner);
+
+		flow->clients.push_back(client);
+	}
+
+	ScheduleRefill(host);
+	return false;
+}
+
+void
+CurlThrottle::Remove(CurlThrottleClient &client) noexcept
+{
+	if (client.IsWaiting()) {
+		client.unlink();
+	} else if (client.admitted) {
+		assert(client.host != nullptr);
+
+		client.admitted = false;
+		budget->Release(client.host->budget);
+	}
+
+	client.host = nullptr;
+}
+
+void
+CurlThrottle::Admit(CurlThrottleHost &host) noexcept
+{
+	while (host.HasWaiting()) {
+		if (!budget->TryTake(host.budget)) {
+			ScheduleRefill(host);
+			return;
+		}
+
+		auto *client = host.PopNext();
+		assert(client != nullptr);
+
+		client->admitted = true;
+
+		/* this may start or cancel other requests */
+		client->callback();
+	}
+}
+
+void
+CurlThrottle::OnAdmit() noexcept
+{
+	for (auto &[origin, host] : hosts)
+		Admit(host);
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright 2008-2020 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CURL_THROTTLE_HXX
+#define CURL_THROTTLE_HXX
+
+#include "event/FineTimerEvent.hxx"
+#include "event/InjectEvent.hxx"
+#include "event/Chrono.hxx"
+#include "util/IntrusiveList.hxx"
+#include "util/BindMethod.hxx"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CurlThrottle;
+struct CurlThrottleHost;
+
+/**
+ * Per-host request limits.  Zero means unlimited.
+ */
+struct CurlThrottleLimits {
+	/**
+	 * The maximum number of concurrent requests to one host.
+	 */
+	unsigned max_in_flight = 0;
+
+	/**
+	 * The maximum number of requests per second to one host.
+	 * Up to one second worth of requests may be sent in a
+	 * burst.
+	 */
+	unsigned rate = 0;
+
+	bool IsUnlimited() const noexcept {
+		return max_in_flight == 0 && rate == 0;
+	}
+};
+
+/**
+ * The requests which may be sent to each host according to the
+ * #CurlThrottleLimits.  One instance is shared by the #CurlThrottle
+ * objects of all threads, so the limits apply to the whole process;
+ * each #CurlThrottle keeps its own queue of waiting clients.
+ *
+ * This class is thread-safe.
+ */
+class CurlThrottleBudget final {
+	friend class CurlThrottle;
+	friend struct CurlThrottleHost;
+
+	const CurlThrottleLimits limits;
+
+	/**
+	 * The counters of one host.
+	 */
+	struct Host {
+		/**
+		 * The number of requests in flight (in all
+		 * threads).
+		 */
+		unsigned in_flight = 0;
+
+		/**
+		 * The number of requests which may be sent right
+		 * now according to CurlThrottleLimits::rate.
+		 */
+		double tokens;
+
+		/**
+		 * When were #tokens last updated?
+		 */
+		Event::TimePoint refilled;
+
+		Host(double _tokens, Event::TimePoint now) noexcept
+			:tokens(_tokens), refilled(now) {}
+	};
+
+	std::mutex mutex;
+
+	/**
+	 * The hosts by their "scheme://host:port" origin.  Entries
+	 * are never removed; there are only a few of them.
+	 */
+	std::map<std::string, Host, std::less<>> hosts;
+
+	/**
+	 * All #CurlThrottle objects using this budget; they are
+	 * woken up when a request finishes.
+	 */
+	std::vector<CurlThrottle *> throttles;
+
+public:
+	explicit CurlThrottleBudget(CurlThrottleLimits _limits) noexcept
+		:limits(_limits) {}
+
+	CurlThrottleBudget(const CurlThrottleBudget &) = delete;
+	CurlThrottleBudget &operator=(const CurlThrottleBudget &) = delete;
+
+	const CurlThrottleLimits &GetLimits() const noexcept {
+		return limits;
+	}
+
+private:
+	void AddThrottle(CurlThrottle &throttle);
+	void RemoveThrottle(CurlThrottle &throttle) noexcept;
+
+	Host &MakeHost(std::string_view origin);
+
+	/**
+	 * Count one more request to this host if the limits allow
+	 * it.
+	 */
+	bool TryTake(Host &host) noexcept;
+
+	/**
+	 * A request to this host has finished; wake up all
+	 * #CurlThrottle objects, because one of them may have a
+	 * client waiting for it.
+	 */
+	void Release(Host &host) noexcept;
+
+	/**
+	 * How long until the next rate limit token for this host
+	 * becomes available?  Zero if only the concurrency limit
+	 * is in the way.
+	 */
+	Event::Duration GetRefillDelay(Host &host) noexcept;
+
+	/**
+	 * Add the tokens which have accumulated since the last
+	 * call.  The caller must hold the mutex.
+	 */
+	void Refill(Host &host, Event::TimePoint now) const noexcept;
+};
+
+/**
+ * Something which wants to send a request and may have to wait for
+ * the #CurlThrottle.  The owner of this object stores only what it
+ * needs to create the request later.
+ */
+class CurlThrottleClient final : public AutoUnlinkIntrusiveListHook {
+	friend class CurlThrottle;
+
+public:
+	/**
+	 * The request may be sent now.  This is invoked from inside
+	 * the #EventLoop (never from within CurlThrottle::Enqueue()),
+	 * so it may start other requests.
+	 */
+	using Callback = BoundMethod<void() noexcept>;
+
+private:
+	const Callback callback;
+
+	CurlThrottleHost *host = nullptr;
+
+	/**
+	 * An opaque pointer identifying the client's owner (e.g. one
+	 * scrobbler).  Waiting clients with different owners are
+	 * admitted in round-robin order.
+	 */
+	const void *const owner;
+
+	/**
+	 * Shall this client be admitted before all non-urgent
+	 * ones, because its request is latency-sensitive?
+	 */
+	const bool urgent;
+
+	/**
+	 * Has this client been admitted, i.e. is its request
+	 * counted as "in flight"?
+	 */
+	bool admitted = false;
+
+public:
+	CurlThrottleClient(Callback _callback, const void *_owner,
+			   bool _urgent=false) noexcept
+		:callback(_callback), owner(_owner), urgent(_urgent) {}
+
+	CurlThrottleClient(const CurlThrottleClient &) = delete;
+	CurlThrottleClient &operator=(const CurlThrottleClient &) = delete;
+
+	/**
+	 * Is this client waiting for admission?
+	 */
+	bool IsWaiting() const noexcept {
+		return is_linked();
+	}
+};
+
+/**
+ * The state of one host; used internally by #CurlThrottle.
+ */
+struct CurlThrottleHost {
+	using ClientList = IntrusiveList<CurlThrottleClient>;
+
+	/**
+	 * The waiting clients of one owner.
+	 */
+	struct Flow {
+		const void *const owner;
+
+		ClientList clients;
+
+		explicit Flow(const void *_owner) noexcept
+			:owner(_owner) {}
+	};
+
+	/**
+	 * Waiting urgent clients (of all owners).
+	 */
+	ClientList urgent;
+
+	/**
+	 * The waiting non-urgent clients, one #Flow per owner in
+	 * round-robin order.  Flows which became empty because their
+	 * clients were destroyed are removed lazily.
+	 */
+	std::list<Flow> flows;
+
+	/**
+	 * The counters in the #CurlThrottleBudget.
+	 */
+	CurlThrottleBudget::Host &budget;
+
+	explicit CurlThrottleHost(CurlThrottleBudget::Host &_budget) noexcept
+		:budget(_budget) {}
+
+	CurlThrottleHost(const CurlThrottleHost &) = delete;
+	CurlThrottleHost &operator=(const CurlThrottleHost &) = delete;
+
+	/**
+	 * Is at least one client waiting?  This removes empty
+	 * flows.
+	 */
+	bool HasWaiting() noexcept;
+
+	/**
+	 * Remove and return the next client to be admitted, or
+	 * nullptr if none is waiting.
+	 */
+	CurlThrottleClient *PopNext() noexcept;
+};
+
+/**
+ * Limits the rate and the concurrency of requests to each host
+ * (see #CurlThrottleLimits) for the clients of one #EventLoop.
+ * Requests which exceed the limits wait in a queue; the clients of
+ * different owners take turns, and urgent requests go first.  The
+ * threads which share a #CurlThrottleBudget compete for it.
+ */
+class CurlThrottle final {
+	friend class CurlThrottleBudget;
+
+	const std::shared_ptr<CurlThrottleBudget> budget;
+
+	/**
+	 * The hosts by their "scheme://host:port" origin.  Entries
+	 * are never removed; there are only a few of them.
+	 */
+	std::map<std::string, CurlThrottleHost, std::less<>> hosts;
+
+	/**
+	 * Admits waiting clients after a request has finished (in
+	 * any thread).
+	 */
+	InjectEvent admit_event;
+
+	/**
+	 * Admits waiting clients when the next rate limit token
+	 * becomes available.
+	 */
+	FineTimerEvent timer;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	CurlThrottle(EventLoop &event_loop,
+		     std::shared_ptr<CurlThrottleBudget> _budget);
+	~CurlThrottle() noexcept;
+
+	CurlThrottle(const CurlThrottle &) = delete;
+	CurlThrottle &operator=(const CurlThrottle &) = delete;
+
+	const std::shared_ptr<CurlThrottleBudget> &GetBudget() const noexcept {
+		return budget;
+	}
+
+	/**
+	 * Ask for permission to send a request to the given URL.
+	 *
+	 * @return true if the request may be sent right away;
+	 * false if the client has to wait for
+	 * the client's callback
+	 */
+	bool Enqueue(CurlThrottleClient &client, std::string_view url);
+
+	/**
+	 * The client's request has finished (or it has given up
+	 * waiting).  It may call Enqueue() again afterwards.
+	 */
+	void Remove(CurlThrottleClient &client) noexcept;
+
+private:
+	CurlThrottleHost &MakeHost(std::string_view url);
+
+	/**
+	 * Schedule #timer for the next token of this host (if the
+	 * rate limit is what clients are waiting for).
+	 */
+	void ScheduleRefill(CurlThrottleHost &host) noexcept;
+
+	/**
+	 * Admit as many waiting clients as the limits allow.
+	 */
+	void Admit(CurlThrottleHost &host) noexcept;
+
+	void OnAdmit() noexcept;
+};
+
+#endif
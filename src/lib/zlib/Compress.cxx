@@ -0,0 +1,71 @@
+/*
+ * Copyright 2022 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Compress.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <zlib.h>
+
+namespace Zlib {
+
+std::string
+Compress(std::string_view src, Format format)
+{
+	z_stream z{};
+
+	/* 16 added to the window size selects the gzip header */
+	const int window_bits = format == Format::GZIP ? 15 + 16 : 15;
+
+	int result = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				  window_bits, 8, Z_DEFAULT_STRATEGY);
+	if (result != Z_OK)
+		throw FormatRuntimeError("deflateInit2() failed: %d", result);
+
+	/* with this buffer size, a single deflate(Z_FINISH) call
+	   is guaranteed to finish the stream */
+	std::string dest;
+	dest.resize(deflateBound(&z, src.size()));
+
+	z.next_in = (Bytef *)const_cast<char *>(src.data());
+	z.avail_in = src.size();
+	z.next_out = (Bytef *)dest.data();
+	z.avail_out = dest.size();
+
+	result = deflate(&z, Z_FINISH);
+	const std::size_t size = dest.size() - z.avail_out;
+	deflateEnd(&z);
+
+	if (result != Z_STREAM_END)
+		throw FormatRuntimeError("deflate() failed: %d", result);
+
+	dest.resize(size);
+	return dest;
+}
+
+} // namespace Zlib
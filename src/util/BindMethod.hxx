@@ -81,6 +81,36 @@ public:
 
 namespace BindMethodDetail {
 
+#ifdef ENABLE_LOOP_STATS
+
+/**
+ * The name of the outermost bound method which is currently being
+ * invoked in this thread, or nullptr.  The #EventLoop clears it
+ * before each callback, so it can tell which method was slow.
+ */
+inline thread_local const char *current_name = nullptr;
+
+/**
+ * Returns a string which contains the name of the given
+ * method/function, e.g. "... [with auto method = &Foo::Bar]".
+ */
+template<auto method>
+constexpr const char *
+MethodName() noexcept
+{
+	return __PRETTY_FUNCTION__;
+}
+
+template<auto method>
+inline void
+SetCurrentName() noexcept
+{
+	if (current_name == nullptr)
+		current_name = MethodName<method>();
+}
+
+#endif
+
 /**
  * Helper class which introspects a method/function pointer type.
  *
@@ -126,6 +156,9 @@ template<typename T, bool NoExcept,
 	 auto method, typename R, typename... Args>
 struct WrapperGenerator<R (T::*)(Args...) noexcept(NoExcept), method> {
 	static R Invoke(void *_instance, Args... args) noexcept(NoExcept) {
+#ifdef ENABLE_LOOP_STATS
+		SetCurrentName<method>();
+#endif
 		auto &t = *(T *)_instance;
 		return (t.*method)(std::forward<Args>(args)...);
 	}
@@ -134,6 +167,9 @@ struct WrapperGenerator<R (T::*)(Args...) noexcept(NoExcept), method> {
 template<auto function, bool NoExcept, typename R, typename... Args>
 struct WrapperGenerator<R (*)(Args...) noexcept(NoExcept), function> {
 	static R Invoke(void *, Args... args) noexcept(NoExcept) {
+#ifdef ENABLE_LOOP_STATS
+		SetCurrentName<function>();
+#endif
 		return function(std::forward<Args>(args)...);
 	}
 };
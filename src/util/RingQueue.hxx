@@ -0,0 +1,341 @@
+/* mpdscribble (MPD Client)
+ * Copyright (C) 2008-2022 The Music Player Daemon Project
+ * Project homepage: http://musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+/**
+ * A FIFO queue stored in one contiguous growable ring buffer.
+ * Unlike std::list, it does not allocate memory for each element,
+ * and removing an arbitrary number of elements from the front does
+ * not touch any other memory than the removed elements.
+ *
+ * The capacity is always a power of two, so indexing is done with a
+ * bit mask.
+ */
+template<typename T>
+class RingQueue {
+	using Allocator = std::allocator<T>;
+	using AllocatorTraits = std::allocator_traits<Allocator>;
+
+	T *buffer = nullptr;
+
+	/**
+	 * The capacity of #buffer; either zero or a power of two.
+	 */
+	std::size_t capacity = 0;
+
+	/**
+	 * The position of the first element within #buffer.
+	 */
+	std::size_t head = 0;
+
+	/**
+	 * The number of elements.
+	 */
+	std::size_t n = 0;
+
+	template<typename Q, typename V>
+	class Iterator {
+		friend class RingQueue;
+
+		Q *queue;
+		std::size_t i;
+
+		constexpr Iterator(Q &_queue, std::size_t _i) noexcept
+			:queue(&_queue), i(_i) {}
+
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = V *;
+		using reference = V &;
+
+		Iterator() = default;
+
+		/* allow converting iterator to const_iterator */
+		template<typename Q2, typename V2>
+		constexpr Iterator(const Iterator<Q2, V2> &src) noexcept
+			:queue(src.queue), i(src.i) {}
+
+		constexpr reference operator*() const noexcept {
+			return (*queue)[i];
+		}
+
+		constexpr pointer operator->() const noexcept {
+			return &(*queue)[i];
+		}
+
+		constexpr reference operator[](difference_type d) const noexcept {
+			return (*queue)[i + d];
+		}
+
+		constexpr auto &operator++() noexcept {
+			++i;
+			return *this;
+		}
+
+		constexpr auto operator++(int) noexcept {
+			auto old = *this;
+			++i;
+			return old;
+		}
+
+		constexpr auto &operator--() noexcept {
+			--i;
+			return *this;
+		}
+
+		constexpr auto operator--(int) noexcept {
+			auto old = *this;
+			--i;
+			return old;
+		}
+
+		constexpr auto &operator+=(difference_type d) noexcept {
+			i += d;
+			return *this;
+		}
+
+		constexpr auto &operator-=(difference_type d) noexcept {
+			i -= d;
+			return *this;
+		}
+
+		constexpr auto operator+(difference_type d) const noexcept {
+			return Iterator{*queue, i + d};
+		}
+
+		friend constexpr auto operator+(difference_type d,
+						const Iterator &it) noexcept {
+			return it + d;
+		}
+
+		constexpr auto operator-(difference_type d) const noexcept {
+			return Iterator{*queue, i - d};
+		}
+
+		constexpr difference_type operator-(const Iterator &other) const noexcept {
+			return difference_type(i) - difference_type(other.i);
+		}
+
+		constexpr bool operator==(const Iterator &other) const noexcept {
+			assert(queue == other.queue);
+			return i == other.i;
+		}
+
+		constexpr auto operator<=>(const Iterator &other) const noexcept {
+			assert(queue == other.queue);
+			return i <=> other.i;
+		}
+
+		template<typename Q2, typename V2> friend class Iterator;
+	};
+
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = T &;
+	using const_reference = const T &;
+	using iterator = Iterator<RingQueue, T>;
+	using const_iterator = Iterator<const RingQueue, const T>;
+
+	RingQueue() noexcept = default;
+
+	RingQueue(RingQueue &&src) noexcept
+		:buffer(std::exchange(src.buffer, nullptr)),
+		 capacity(std::exchange(src.capacity, 0)),
+		 head(std::exchange(src.head, 0)),
+		 n(std::exchange(src.n, 0)) {}
+
+	RingQueue(const RingQueue &src) {
+		reserve(src.size());
+		for (const auto &i : src)
+			push_back(i);
+	}
+
+	~RingQueue() noexcept {
+		clear();
+		Deallocate(buffer, capacity);
+	}
+
+	RingQueue &operator=(RingQueue &&src) noexcept {
+		using std::swap;
+		swap(buffer, src.buffer);
+		swap(capacity, src.capacity);
+		swap(head, src.head);
+		swap(n, src.n);
+		return *this;
+	}
+
+	RingQueue &operator=(const RingQueue &src) {
+		if (this != &src) {
+			RingQueue tmp(src);
+			*this = std::move(tmp);
+		}
+
+		return *this;
+	}
+
+	constexpr bool empty() const noexcept {
+		return n == 0;
+	}
+
+	constexpr size_type size() const noexcept {
+		return n;
+	}
+
+	reference operator[](size_type i) noexcept {
+		assert(i < n);
+		return buffer[(head + i) & (capacity - 1)];
+	}
+
+	const_reference operator[](size_type i) const noexcept {
+		assert(i < n);
+		return buffer[(head + i) & (capacity - 1)];
+	}
+
+	reference front() noexcept {
+		return (*this)[0];
+	}
+
+	const_reference front() const noexcept {
+		return (*this)[0];
+	}
+
+	reference back() noexcept {
+		return (*this)[n - 1];
+	}
+
+	const_reference back() const noexcept {
+		return (*this)[n - 1];
+	}
+
+	iterator begin() noexcept {
+		return {*this, 0};
+	}
+
+	iterator end() noexcept {
+		return {*this, n};
+	}
+
+	const_iterator begin() const noexcept {
+		return {*this, 0};
+	}
+
+	const_iterator end() const noexcept {
+		return {*this, n};
+	}
+
+	/**
+	 * Make sure there is room for at least the given number of
+	 * elements without reallocation.
+	 */
+	void reserve(size_type min_capacity) {
+		if (min_capacity > capacity)
+			Reallocate(RoundUpCapacity(min_capacity));
+	}
+
+	template<typename... Args>
+	reference emplace_back(Args&&... args) {
+		if (n == capacity)
+			Reallocate(capacity > 0 ? capacity * 2 : 16);
+
+		T *p = buffer + ((head + n) & (capacity - 1));
+		std::construct_at(p, std::forward<Args>(args)...);
+		++n;
+		return *p;
+	}
+
+	void push_back(const T &value) {
+		emplace_back(value);
+	}
+
+	void push_back(T &&value) {
+		emplace_back(std::move(value));
+	}
+
+	void pop_front() noexcept {
+		pop_front(1);
+	}
+
+	/**
+	 * Remove the given number of elements from the front.  This
+	 * only destroys those elements and moves the head index; no
+	 * other element is touched.
+	 */
+	void pop_front(size_type count) noexcept {
+		assert(count <= n);
+
+		for (size_type i = 0; i < count; ++i)
+			std::destroy_at(buffer + ((head + i) & (capacity - 1)));
+
+		n -= count;
+		head = n > 0 ? (head + count) & (capacity - 1) : 0;
+	}
+
+	void clear() noexcept {
+		pop_front(n);
+	}
+
+private:
+	static constexpr size_type RoundUpCapacity(size_type c) noexcept {
+		size_type result = 16;
+		while (result < c)
+			result *= 2;
+		return result;
+	}
+
+	static void Deallocate(T *p, size_type c) noexcept {
+		if (p != nullptr) {
+			Allocator allocator;
+			AllocatorTraits::deallocate(allocator, p, c);
+		}
+	}
+
+	/**
+	 * Move all elements to a new buffer, starting at index 0.
+	 */
+	void Reallocate(size_type new_capacity) {
+		assert(new_capacity >= n);
+
+		Allocator allocator;
+		T *new_buffer = AllocatorTraits::allocate(allocator,
+							  new_capacity);
+
+		for (size_type i = 0; i < n; ++i) {
+			T &src = (*this)[i];
+			std::construct_at(new_buffer + i, std::move(src));
+			std::destroy_at(&src);
+		}
+
+		Deallocate(buffer, capacity);
+
+		buffer = new_buffer;
+		capacity = new_capacity;
+		head = 0;
+	}
+};
@@ -0,0 +1,78 @@
+/*
+ * A minimal benchmark harness.  Each result is printed as one JSON
+ * object per line on stdout, so the results of different releases
+ * can be compared by scripts.
+ */
+
+#ifndef BENCH_HXX
+#define BENCH_HXX
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <type_traits>
+
+#include <stdio.h>
+
+/**
+ * Run the given function repeatedly for at least this duration.
+ */
+static constexpr std::chrono::milliseconds BENCH_MIN_DURATION{500};
+
+static constexpr unsigned BENCH_MIN_ITERATIONS = 3;
+
+/**
+ * Measure the given function and print the result.
+ *
+ * @param name the name of the benchmark
+ * @param n the number of items processed by one call, used to
+ * calculate the time per item
+ * @param f the function to be measured; if it returns a
+ * std::chrono::steady_clock::duration, then this is used instead of
+ * the duration of the whole call, which allows excluding setup code
+ */
+template<typename F>
+static void
+RunBenchmark(const char *name, std::size_t n, F &&f)
+{
+	using Clock = std::chrono::steady_clock;
+
+	unsigned iterations = 0;
+	Clock::duration total{}, best = Clock::duration::max();
+
+	do {
+		Clock::duration duration;
+		if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+			const auto start = Clock::now();
+			f();
+			duration = Clock::now() - start;
+		} else
+			duration = f();
+
+		total += duration;
+		best = std::min(best, duration);
+		++iterations;
+	} while (iterations < BENCH_MIN_ITERATIONS || total < BENCH_MIN_DURATION);
+
+	using NS = std::chrono::duration<double, std::nano>;
+	const double mean_ns = NS(total).count() / iterations;
+	const double best_ns = NS(best).count();
+
+	printf("{\"name\":\"%s\",\"n\":%zu,\"iterations\":%u,"
+	       "\"mean_ns\":%.0f,\"best_ns\":%.0f,\"ns_per_item\":%.2f}\n",
+	       name, n, iterations, mean_ns, best_ns,
+	       best_ns / std::max<std::size_t>(n, 1));
+	fflush(stdout);
+}
+
+/**
+ * Prevent the compiler from optimizing away a computed value.
+ */
+template<typename T>
+static inline void
+DoNotOptimize(const T &value) noexcept
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "Bench.hxx"
+#include "Journal.hxx"
+#include "Record.hxx"
+
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static RecordQueue
+MakeQueue(std::size_t n)
+{
+	RecordQueue queue;
+	queue.reserve(n);
+
+	for (std::size_t i = 0; i < n; ++i) {
+		Record record;
+		record.artist = "Artist " + std::to_string(i % 1000);
+		record.track = "Track " + std::to_string(i);
+		record.album = "Album " + std::to_string(i % 5000);
+		record.number = TrackNumber{std::to_string(i % 20 + 1)};
+		record.mbid = Mbid{"0f0e0d0c-0b0a-0908-0706-" + std::to_string(100000000000 + i)};
+		record.time = 1704067200 + i;
+		record.length = std::chrono::seconds{180 + i % 120};
+		record.love = i % 17 == 0;
+		queue.emplace_back(std::make_shared<const Record>(std::move(record)));
+	}
+
+	return queue;
+}
+
+static void
+BenchJournal(const std::string &path, JournalFormat format,
+	     const char *format_name, std::size_t n)
+{
+	const auto queue = MakeQueue(n);
+
+	char name[64];
+	snprintf(name, sizeof(name), "journal_write_%s", format_name);
+	RunBenchmark(name, n, [&](){
+		if (!journal_write(path.c_str(), queue, format))
+			exit(EXIT_FAILURE);
+	});
+
+	snprintf(name, sizeof(name), "journal_read_%s", format_name);
+	RunBenchmark(name, n, [&](){
+		const auto result = journal_read(path.c_str());
+		if (result.size() != n)
+			exit(EXIT_FAILURE);
+	});
+
+	unlink(path.c_str());
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 3) {
+		fprintf(stderr, "Usage: BenchJournal [DIRECTORY [MAX_RECORDS]]\n");
+		return EXIT_FAILURE;
+	}
+
+	const char *directory = argc > 1 ? argv[1] : getenv("TMPDIR");
+	if (directory == nullptr)
+		directory = "/tmp";
+
+	const std::size_t max_records = argc > 2
+		? strtoul(argv[2], nullptr, 10)
+		: 1000000;
+
+	const std::string path = std::string{directory} +
+		"/mpdscribble-bench-journal." + std::to_string(getpid());
+
+	for (const std::size_t n : {1000, 100000, 1000000}) {
+		if (n > max_records)
+			break;
+
+		BenchJournal(path, JournalFormat::TEXT, "text", n);
+		BenchJournal(path, JournalFormat::BINARY, "binary", n);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#include "Bench.hxx"
+#include "Protocol.hxx"
+#include "Form.hxx"
+#include "Record.hxx"
+
+#include <string>
+
+#include <stdlib.h>
+
+static RecordQueue
+MakeQueue(std::size_t n)
+{
+	RecordQueue queue;
+
+	for (std::size_t i = 0; i < n; ++i) {
+		Record record;
+		record.artist = "Artist & Friends " + std::to_string(i % 100);
+		record.track = "Track #" + std::to_string(i) + " (Live)";
+		record.album = "Album " + std::to_string(i % 500);
+		record.number = TrackNumber{std::to_string(i % 20 + 1)};
+		record.time = 1700000000;
+		record.length = std::chrono::seconds{180 + i % 120};
+		queue.emplace_back(std::make_shared<const Record>(std::move(record)));
+	}
+
+	return queue;
+}
+
+static void
+BenchSubmitForm(std::size_t batch_size)
+{
+	const auto queue = MakeQueue(batch_size);
+
+	RunBenchmark(("submit_form_" + std::to_string(batch_size)).c_str(),
+		     100 * batch_size, [&](){
+		for (unsigned i = 0; i < 100; ++i) {
+			FormDataBuilder form;
+			form.Reserve(EstimateSubmitSize(queue, 0, batch_size) + 32);
+			form.Append("s", "0123456789abcdef0123456789abcdef");
+			AppendSubmitRecords(form, queue, 0, batch_size);
+			DoNotOptimize(form.c_str());
+		}
+	});
+}
+
+static void
+BenchNextLine()
+{
+	std::string body;
+	for (unsigned i = 0; i < 1000; ++i)
+		body.append("http://post.audioscrobbler.com:80/np_1.2\n");
+
+	RunBenchmark("next_line", 1000, [&](){
+		std::string_view input = body;
+		std::size_t n = 0;
+		while (!next_line(input).empty())
+			++n;
+		if (n != 1000)
+			exit(EXIT_FAILURE);
+	});
+}
+
+int
+main()
+{
+	RunBenchmark("md5_hex", 1000, [](){
+		for (unsigned i = 0; i < 1000; ++i)
+			DoNotOptimize(md5_hex("secret password"));
+	});
+
+	RunBenchmark("as_md5_plain", 1000, [](){
+		for (unsigned i = 0; i < 1000; ++i)
+			DoNotOptimize(as_md5("secret password", "1700000000"));
+	});
+
+	RunBenchmark("as_md5_hashed", 1000, [](){
+		for (unsigned i = 0; i < 1000; ++i)
+			DoNotOptimize(as_md5("5ebe2294ecd0e0f08eab7690d2a6ee69",
+					     "1700000000"));
+	});
+
+	for (const std::size_t n : {1, 10, 50})
+		BenchSubmitForm(n);
+
+	BenchNextLine();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#include "Bench.hxx"
+#include "event/Loop.hxx"
+#include "event/CoarseTimerEvent.hxx"
+
+#include <list>
+
+#include <stdlib.h>
+
+struct BenchTimerContext {
+	EventLoop &event_loop;
+	std::size_t remaining = 0;
+};
+
+class BenchTimer {
+	BenchTimerContext &context;
+
+public:
+	CoarseTimerEvent event;
+
+	explicit BenchTimer(BenchTimerContext &_context) noexcept
+		:context(_context),
+		 event(context.event_loop, BIND_THIS_METHOD(OnTimer)) {}
+
+private:
+	void OnTimer() noexcept {
+		if (--context.remaining == 0)
+			context.event_loop.Break();
+	}
+};
+
+/**
+ * A cheap deterministic pseudo random number generator.
+ */
+static unsigned
+NextRandom(unsigned &state) noexcept
+{
+	state = state * 1103515245 + 12345;
+	return state >> 16;
+}
+
+/**
+ * Schedule, reschedule and cancel many timers, similar to what
+ * many scrobblers with retry and "now playing" timers do.
+ */
+static void
+BenchChurn(std::size_t n)
+{
+	EventLoop event_loop;
+	BenchTimerContext context{event_loop};
+
+	std::list<BenchTimer> timers;
+	for (std::size_t i = 0; i < n; ++i)
+		timers.emplace_back(context);
+
+	unsigned random = 42;
+
+	RunBenchmark(("timer_churn_" + std::to_string(n)).c_str(),
+		     3 * n, [&](){
+		for (auto &i : timers)
+			i.event.Schedule(std::chrono::seconds{1 + NextRandom(random) % 600});
+
+		for (auto &i : timers)
+			i.event.Schedule(std::chrono::milliseconds{NextRandom(random) % 3600000});
+
+		for (auto &i : timers)
+			i.event.Cancel();
+	});
+}
+
+/**
+ * Schedule many timers which expire immediately and let the
+ * #EventLoop invoke them all.
+ */
+static void
+BenchExpire(std::size_t n)
+{
+	RunBenchmark(("timer_expire_" + std::to_string(n)).c_str(),
+		     n, [n](){
+		/* an EventLoop cannot be run again after it was
+		   stopped, so create a new one each time, but don't
+		   measure that */
+		EventLoop event_loop;
+		BenchTimerContext context{event_loop, n};
+
+		std::list<BenchTimer> timers;
+		for (std::size_t i = 0; i < n; ++i)
+			timers.emplace_back(context);
+
+		const auto start = std::chrono::steady_clock::now();
+
+		for (auto &i : timers)
+			i.event.Schedule(Event::Duration{});
+
+		event_loop.Run();
+
+		const auto duration = std::chrono::steady_clock::now() - start;
+		if (context.remaining != 0)
+			exit(EXIT_FAILURE);
+
+		return duration;
+	});
+}
+
+int
+main()
+{
+	for (const std::size_t n : {1000, 100000}) {
+		BenchChurn(n);
+		BenchExpire(n);
+	}
+
+	return EXIT_SUCCESS;
+}
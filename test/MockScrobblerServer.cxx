@@ -0,0 +1,435 @@
+#include "MockScrobblerServer.hxx"
+#include "event/Loop.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm>
+#include <string_view>
+
+#include <ctype.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+class MockScrobblerServer::Connection final
+	: public AutoUnlinkIntrusiveListHook
+{
+	MockScrobblerServer &server;
+
+	SocketEvent socket;
+
+	/**
+	 * Delays the response by MockScrobblerServerConfig::latency.
+	 */
+	FineTimerEvent delay_timer;
+
+	std::string input, output;
+
+	/**
+	 * The response which waits for #delay_timer.
+	 */
+	std::string delayed;
+
+	/**
+	 * Is a request being handled?  The next request is only
+	 * parsed after the response has been queued.
+	 */
+	bool busy = false;
+
+	/**
+	 * Has "100 Continue" been sent for the current request?
+	 */
+	bool continue_sent = false;
+
+public:
+	Connection(MockScrobblerServer &_server, EventLoop &event_loop,
+		   SocketDescriptor fd) noexcept
+		:server(_server),
+		 socket(event_loop, BIND_THIS_METHOD(OnSocketReady), fd),
+		 delay_timer(event_loop, BIND_THIS_METHOD(OnDelayTimer))
+	{
+		socket.ScheduleRead();
+	}
+
+	~Connection() noexcept {
+		socket.Close();
+	}
+
+	void Destroy() noexcept {
+		delete this;
+	}
+
+private:
+	/**
+	 * @return false if the connection has been destroyed
+	 */
+	bool Send(std::string_view data) noexcept;
+
+	/**
+	 * @return false on error
+	 */
+	bool Flush() noexcept;
+
+	/**
+	 * Parse and handle as many complete requests from #input as
+	 * possible.
+	 *
+	 * @return false if the connection has been destroyed
+	 */
+	bool ParseRequests() noexcept;
+
+	void OnDelayTimer() noexcept;
+	void OnSocketReady(unsigned events) noexcept;
+};
+
+static std::string
+ToLower(std::string_view s) noexcept
+{
+	std::string result{s};
+	std::transform(result.begin(), result.end(), result.begin(),
+		       [](unsigned char ch){ return tolower(ch); });
+	return result;
+}
+
+/**
+ * Find the value of a header in the lower-case request header
+ * block.
+ */
+static std::string_view
+FindHeader(std::string_view headers, std::string_view name) noexcept
+{
+	std::size_t i = 0;
+	while ((i = headers.find(name, i)) != headers.npos) {
+		if (i >= 2 && headers[i - 1] == '\n' &&
+		    headers.substr(i + name.size()).starts_with(':')) {
+			auto value = headers.substr(i + name.size() + 1);
+			value = value.substr(0, value.find('\r'));
+			while (value.starts_with(' '))
+				value.remove_prefix(1);
+			return value;
+		}
+
+		i += name.size();
+	}
+
+	return {};
+}
+
+bool
+MockScrobblerServer::Connection::Flush() noexcept
+{
+	while (!output.empty()) {
+		ssize_t nbytes = send(socket.GetSocket().Get(), output.data(),
+				      output.size(), MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (nbytes < 0) {
+			if (errno == EAGAIN) {
+				socket.ScheduleWrite();
+				return true;
+			}
+
+			return false;
+		}
+
+		server.stats.bytes_sent += nbytes;
+		output.erase(0, nbytes);
+	}
+
+	socket.CancelWrite();
+	return true;
+}
+
+bool
+MockScrobblerServer::Connection::Send(std::string_view data) noexcept
+{
+	output.append(data);
+	if (!Flush()) {
+		Destroy();
+		return false;
+	}
+
+	return true;
+}
+
+bool
+MockScrobblerServer::Connection::ParseRequests() noexcept
+{
+	while (!busy) {
+		const auto header_end = input.find("\r\n\r\n");
+		if (header_end == input.npos)
+			return true;
+
+		const std::string_view request_line =
+			std::string_view{input}.substr(0, input.find("\r\n"));
+		const auto headers =
+			ToLower(std::string_view{input}.substr(0, header_end + 2));
+
+		std::size_t content_length = 0;
+		if (const auto value = FindHeader(headers, "content-length");
+		    !value.empty())
+			content_length = strtoul(std::string{value}.c_str(),
+						 nullptr, 10);
+
+		const std::size_t request_size =
+			header_end + 4 + content_length;
+		if (input.size() < request_size) {
+			if (!continue_sent &&
+			    FindHeader(headers, "expect") == "100-continue") {
+				continue_sent = true;
+				return Send("HTTP/1.1 100 Continue\r\n\r\n");
+			}
+
+			return true;
+		}
+
+		const auto space1 = request_line.find(' ');
+		const auto space2 = request_line.find(' ', space1 + 1);
+		if (space1 == request_line.npos ||
+		    space2 == request_line.npos) {
+			Destroy();
+			return false;
+		}
+
+		const auto body =
+			server.HandleRequest(request_line.substr(0, space1),
+					     request_line.substr(space1 + 1,
+								 space2 - space1 - 1),
+					     std::string_view{input}.substr(header_end + 4,
+									    content_length));
+
+		std::string response = "HTTP/1.1 200 OK\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: ";
+		response.append(std::to_string(body.size()));
+		response.append("\r\n\r\n");
+		response.append(body);
+
+		input.erase(0, request_size);
+		continue_sent = false;
+
+		if (server.config.latency.count() > 0) {
+			busy = true;
+			delayed = std::move(response);
+			delay_timer.Schedule(server.config.latency);
+			return true;
+		}
+
+		if (!Send(response))
+			return false;
+	}
+
+	return true;
+}
+
+void
+MockScrobblerServer::Connection::OnDelayTimer() noexcept
+{
+	busy = false;
+
+	if (Send(delayed))
+		ParseRequests();
+}
+
+void
+MockScrobblerServer::Connection::OnSocketReady(unsigned events) noexcept
+{
+	if (events & (SocketEvent::ERROR|SocketEvent::HANGUP)) {
+		Destroy();
+		return;
+	}
+
+	if ((events & SocketEvent::WRITE) && !Flush()) {
+		Destroy();
+		return;
+	}
+
+	if (!(events & SocketEvent::READ))
+		return;
+
+	char buffer[16384];
+	ssize_t nbytes = recv(socket.GetSocket().Get(), buffer,
+			      sizeof(buffer), MSG_DONTWAIT);
+	if (nbytes < 0) {
+		if (errno != EAGAIN)
+			Destroy();
+		return;
+	}
+
+	if (nbytes == 0) {
+		Destroy();
+		return;
+	}
+
+	server.stats.bytes_received += nbytes;
+	input.append(buffer, nbytes);
+
+	ParseRequests();
+}
+
+MockScrobblerServer::MockScrobblerServer(EventLoop &event_loop,
+					 const MockScrobblerServerConfig &_config)
+	:config(_config),
+	 listener(event_loop, BIND_THIS_METHOD(OnListenerReady))
+{
+	int fd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		throw MakeErrno("Failed to create socket");
+
+	struct sockaddr_in sin{};
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	socklen_t length = sizeof(sin);
+	if (bind(fd, (const struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(fd, 256) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&sin, &length) < 0) {
+		const int e = errno;
+		close(fd);
+		throw MakeErrno(e, "Failed to listen");
+	}
+
+	port = ntohs(sin.sin_port);
+
+	listener.Open(SocketDescriptor{fd});
+	listener.ScheduleRead();
+
+	rate_window_start = event_loop.SteadyNow();
+}
+
+MockScrobblerServer::~MockScrobblerServer() noexcept
+{
+	connections.clear_and_dispose([](Connection *c){
+		c->Destroy();
+	});
+
+	listener.Close();
+}
+
+std::string
+MockScrobblerServer::GetURL() const noexcept
+{
+	return "http://127.0.0.1:" + std::to_string(port) + "/";
+}
+
+std::string
+MockScrobblerServer::GetSessionId() const noexcept
+{
+	return "mocksession" + std::to_string(session_generation);
+}
+
+unsigned
+MockScrobblerServer::NextRandom() noexcept
+{
+	random_state = random_state * 1103515245 + 12345;
+	return random_state >> 16;
+}
+
+bool
+MockScrobblerServer::CheckRateLimit() noexcept
+{
+	if (config.rate_limit == 0)
+		return true;
+
+	const auto now = listener.GetEventLoop().SteadyNow();
+	if (now - rate_window_start >= std::chrono::seconds{1}) {
+		rate_window_start = now;
+		rate_window_count = 0;
+	}
+
+	return ++rate_window_count <= config.rate_limit;
+}
+
+/**
+ * Extract the "s" (session id) parameter from a POST body.
+ */
+static std::string_view
+GetSessionParameter(std::string_view body) noexcept
+{
+	if (!body.starts_with("s="))
+		return {};
+
+	body.remove_prefix(2);
+	return body.substr(0, body.find('&'));
+}
+
+static unsigned
+CountSongs(std::string_view body) noexcept
+{
+	unsigned n = 0;
+	for (std::size_t i = 0; (i = body.find("&a[", i)) != body.npos; i += 3)
+		++n;
+	return n;
+}
+
+std::string
+MockScrobblerServer::HandleRequest(std::string_view method,
+				   std::string_view uri,
+				   std::string_view body) noexcept
+{
+	++stats.requests;
+
+	if (method == "GET" && uri.find("hs=true") != uri.npos) {
+		++stats.handshakes;
+
+		const auto url = GetURL();
+		return "OK\n" + GetSessionId() + "\n" +
+			url + "np\n" + url + "submit\n";
+	}
+
+	const bool now_playing = uri == "/np";
+	if (method != "POST" || (!now_playing && uri != "/submit"))
+		return "FAILED unknown request\n";
+
+	if (!CheckRateLimit()) {
+		++stats.rate_limited;
+		return "FAILED rate limit exceeded\n";
+	}
+
+	if (GetSessionParameter(body) != GetSessionId()) {
+		++stats.badsession;
+		return "BADSESSION\n";
+	}
+
+	const unsigned r = NextRandom() % 100;
+	if (r < config.failed_percent) {
+		++stats.failed;
+		return "FAILED injected failure\n";
+	}
+
+	if (r < config.failed_percent + config.badsession_percent) {
+		/* invalidate the session; all other requests with
+		   this session will fail, too */
+		++session_generation;
+		++stats.badsession;
+		return "BADSESSION\n";
+	}
+
+	if (now_playing)
+		++stats.now_playing;
+	else {
+		++stats.submissions;
+		stats.songs += CountSongs(body);
+	}
+
+	return "OK\n";
+}
+
+void
+MockScrobblerServer::OnListenerReady(unsigned) noexcept
+{
+	while (true) {
+		const int fd = accept4(listener.GetSocket().Get(),
+				       nullptr, nullptr,
+				       SOCK_NONBLOCK|SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		++stats.connections;
+
+		auto *c = new Connection(*this, listener.GetEventLoop(),
+					 SocketDescriptor{fd});
+		connections.push_back(*c);
+	}
+}
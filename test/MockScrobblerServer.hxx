@@ -0,0 +1,111 @@
+/*
+ * A mock AudioScrobbler 1.2 server for load tests.  It implements
+ * the handshake, "now playing" and submissions, and it can inject
+ * latency, "FAILED" and "BADSESSION" responses and a rate limit.
+ */
+
+#ifndef MOCK_SCROBBLER_SERVER_HXX
+#define MOCK_SCROBBLER_SERVER_HXX
+
+#include "event/SocketEvent.hxx"
+#include "event/Chrono.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+struct MockScrobblerServerConfig {
+	/**
+	 * Delay each response by this duration.
+	 */
+	std::chrono::milliseconds latency{};
+
+	/**
+	 * Respond to this percentage of "now playing" and submit
+	 * requests with "FAILED".
+	 */
+	unsigned failed_percent = 0;
+
+	/**
+	 * Respond to this percentage of "now playing" and submit
+	 * requests with "BADSESSION" (and invalidate the session).
+	 */
+	unsigned badsession_percent = 0;
+
+	/**
+	 * Accept no more than this number of requests per second;
+	 * excess requests get a "FAILED" response.  0 means
+	 * unlimited.
+	 */
+	unsigned rate_limit = 0;
+};
+
+/**
+ * Counters which may be read from any thread.
+ */
+struct MockScrobblerServerStats {
+	std::atomic<uint_least64_t> connections{0}, requests{0};
+	std::atomic<uint_least64_t> handshakes{0}, now_playing{0};
+	std::atomic<uint_least64_t> submissions{0}, songs{0};
+	std::atomic<uint_least64_t> failed{0}, badsession{0}, rate_limited{0};
+	std::atomic<uint_least64_t> bytes_received{0}, bytes_sent{0};
+};
+
+class MockScrobblerServer final {
+	class Connection;
+
+	const MockScrobblerServerConfig config;
+
+	SocketEvent listener;
+
+	unsigned port;
+
+	IntrusiveList<Connection> connections;
+
+	/**
+	 * Incremented each time a session is invalidated.
+	 */
+	unsigned session_generation = 0;
+
+	unsigned random_state = 1;
+
+	Event::TimePoint rate_window_start;
+	unsigned rate_window_count = 0;
+
+public:
+	MockScrobblerServerStats stats;
+
+	/**
+	 * Listen on a random port on the loopback interface.  Throws
+	 * on error.
+	 */
+	MockScrobblerServer(EventLoop &event_loop,
+			    const MockScrobblerServerConfig &_config);
+	~MockScrobblerServer() noexcept;
+
+	MockScrobblerServer(const MockScrobblerServer &) = delete;
+	MockScrobblerServer &operator=(const MockScrobblerServer &) = delete;
+
+	/**
+	 * The URL to be used in the scrobbler configuration.
+	 */
+	std::string GetURL() const noexcept;
+
+private:
+	std::string GetSessionId() const noexcept;
+	unsigned NextRandom() noexcept;
+	bool CheckRateLimit() noexcept;
+
+	/**
+	 * Generate the response body for one request.
+	 */
+	std::string HandleRequest(std::string_view method,
+				  std::string_view uri,
+				  std::string_view body) noexcept;
+
+	void OnListenerReady(unsigned events) noexcept;
+};
+
+#endif
@@ -17,12 +17,12 @@ static bool quit;
 class MyResponseHandler final : public HttpResponseHandler {
 public:
 	/* virtual methods from class HttpResponseHandler */
-	void OnHttpResponse(std::string body) noexcept override;
+	void OnHttpResponse(std::string_view body) noexcept override;
 	void OnHttpError(std::exception_ptr e) noexcept override;
 };
 
 void
-MyResponseHandler::OnHttpResponse(std::string body) noexcept
+MyResponseHandler::OnHttpResponse(std::string_view body) noexcept
 {
 	write(STDOUT_FILENO, body.data(), body.size());
 	event_loop.Break();
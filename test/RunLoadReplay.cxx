@@ -0,0 +1,444 @@
+/*
+ * Replay a synthetic load against many #Scrobbler instances which
+ * submit to an embedded mock AudioScrobbler server, and report how
+ * long it took to drain all queues, how many requests and bytes were
+ * needed and the peak memory usage.
+ *
+ * The results are printed as one JSON object on stdout.
+ */
+
+#include "MockScrobblerServer.hxx"
+#include "MultiScrobbler.hxx"
+#include "Scrobbler.hxx"
+#include "ScrobblerConfig.hxx"
+#include "ScrobblerWorker.hxx"
+#include "AsyncWriter.hxx"
+#include "Log.hxx"
+#include "lib/curl/Global.hxx"
+#include "event/Loop.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "event/InjectEvent.hxx"
+#include "util/PrintException.hxx"
+
+#include <algorithm>
+#include <forward_list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+struct Options {
+	MockScrobblerServerConfig server;
+
+	/**
+	 * The client-side limits, see "host_max_in_flight" and
+	 * "host_rate_limit".
+	 */
+	CurlThrottleLimits throttle;
+
+	unsigned n_scrobblers = 10;
+
+	/**
+	 * See "worker_threads".
+	 */
+	unsigned n_workers = 0;
+
+	/**
+	 * The number of songs to be played; each one is submitted
+	 * to all scrobblers.
+	 */
+	unsigned n_songs = 1000;
+
+	/**
+	 * Songs per second.
+	 */
+	unsigned rate = 100;
+
+	bool now_playing = true;
+
+	/**
+	 * Only run the server until killed, e.g. as the target of
+	 * "mpdscribble --simulate".
+	 */
+	bool serve = false;
+
+	std::chrono::seconds timeout{300};
+
+	int verbose = 0;
+};
+
+static void
+Usage()
+{
+	fprintf(stderr,
+		"Usage: RunLoadReplay [OPTIONS]\n"
+		"\n"
+		"  --scrobblers=N     number of scrobblers (10)\n"
+		"  --workers=N        worker threads running the scrobblers (0)\n"
+		"  --songs=N          number of songs played (1000)\n"
+		"  --rate=N           songs per second (100)\n"
+		"  --no-now-playing   don't send \"now playing\" notifications\n"
+		"  --serve            only run the server, print its URL\n"
+		"  --latency=MS       server response latency (0)\n"
+		"  --failed=PERCENT   inject \"FAILED\" responses (0)\n"
+		"  --badsession=PERCENT inject \"BADSESSION\" responses (0)\n"
+		"  --rate-limit=N     server requests per second (unlimited)\n"
+		"  --max-in-flight=N  client-side limit of concurrent requests (unlimited)\n"
+		"  --client-rate=N    client-side limit of requests per second (unlimited)\n"
+		"  --timeout=S        give up after this duration (300)\n"
+		"  --verbose=N        log level (0)\n");
+	exit(EXIT_FAILURE);
+}
+
+static unsigned
+ParseUnsigned(const char *value)
+{
+	char *endptr;
+	const unsigned long result = strtoul(value, &endptr, 10);
+	if (endptr == value || *endptr != 0)
+		Usage();
+
+	return result;
+}
+
+static Options
+ParseCommandLine(int argc, char **argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *eq = strchr(arg, '=');
+		const std::string_view name = eq != nullptr
+			? std::string_view(arg, eq - arg)
+			: std::string_view(arg);
+		const char *value = eq != nullptr ? eq + 1 : nullptr;
+
+		if (name == "--no-now-playing") {
+			options.now_playing = false;
+			continue;
+		}
+
+		if (name == "--serve") {
+			options.serve = true;
+			continue;
+		}
+
+		if (value == nullptr)
+			Usage();
+
+		if (name == "--scrobblers")
+			options.n_scrobblers = ParseUnsigned(value);
+		else if (name == "--workers")
+			options.n_workers = ParseUnsigned(value);
+		else if (name == "--songs")
+			options.n_songs = ParseUnsigned(value);
+		else if (name == "--rate")
+			options.rate = std::max(ParseUnsigned(value), 1U);
+		else if (name == "--latency")
+			options.server.latency = std::chrono::milliseconds(ParseUnsigned(value));
+		else if (name == "--failed")
+			options.server.failed_percent = ParseUnsigned(value);
+		else if (name == "--badsession")
+			options.server.badsession_percent = ParseUnsigned(value);
+		else if (name == "--rate-limit")
+			options.server.rate_limit = ParseUnsigned(value);
+		else if (name == "--max-in-flight")
+			options.throttle.max_in_flight = ParseUnsigned(value);
+		else if (name == "--client-rate")
+			options.throttle.rate = ParseUnsigned(value);
+		else if (name == "--timeout")
+			options.timeout = std::chrono::seconds(ParseUnsigned(value));
+		else if (name == "--verbose")
+			options.verbose = ParseUnsigned(value);
+		else
+			Usage();
+	}
+
+	if (options.n_scrobblers == 0 ||
+	    options.server.failed_percent + options.server.badsession_percent > 100)
+		Usage();
+
+	return options;
+}
+
+/**
+ * Runs the #MockScrobblerServer in its own thread, so its CPU
+ * usage does not delay the scrobblers.
+ */
+class MockServerThread {
+	EventLoop event_loop;
+	MockScrobblerServer server;
+	InjectEvent stop_event;
+	std::thread thread;
+
+public:
+	explicit MockServerThread(const MockScrobblerServerConfig &config)
+		:server(event_loop, config),
+		 stop_event(event_loop, BIND_THIS_METHOD(OnStop)),
+		 thread([this]{ event_loop.Run(); }) {}
+
+	~MockServerThread() noexcept {
+		Stop();
+	}
+
+	const MockScrobblerServer &GetServer() const noexcept {
+		return server;
+	}
+
+	void Stop() noexcept {
+		if (thread.joinable()) {
+			stop_event.Schedule();
+			thread.join();
+		}
+	}
+
+private:
+	void OnStop() noexcept {
+		event_loop.Break();
+	}
+};
+
+class LoadReplay {
+	EventLoop &event_loop;
+	MultiScrobbler &scrobblers;
+	const ScrobblerList targets;
+	const Options &options;
+
+	FineTimerEvent feed_timer, check_timer, timeout_timer;
+
+	Event::TimePoint start, fed, drained;
+
+	unsigned n_fed = 0;
+
+	bool is_drained = false;
+
+	static constexpr Event::Duration FEED_INTERVAL = std::chrono::milliseconds{10};
+	static constexpr Event::Duration CHECK_INTERVAL = std::chrono::milliseconds{20};
+
+public:
+	LoadReplay(EventLoop &_event_loop, MultiScrobbler &_scrobblers,
+		   const Options &_options)
+		:event_loop(_event_loop), scrobblers(_scrobblers),
+		 targets(scrobblers.Select({})),
+		 options(_options),
+		 feed_timer(event_loop, BIND_THIS_METHOD(OnFeedTimer)),
+		 check_timer(event_loop, BIND_THIS_METHOD(OnCheckTimer)),
+		 timeout_timer(event_loop, BIND_THIS_METHOD(OnTimeout)) {}
+
+	void Start() noexcept {
+		start = fed = drained = event_loop.SteadyNow();
+		feed_timer.Schedule(Event::Duration{});
+		check_timer.Schedule(CHECK_INTERVAL);
+		timeout_timer.Schedule(options.timeout);
+	}
+
+	bool IsDrained() const noexcept {
+		return is_drained;
+	}
+
+	Event::Duration GetFeedDuration() const noexcept {
+		return fed - start;
+	}
+
+	/**
+	 * How long did it take to submit everything after the last
+	 * song was played?
+	 */
+	Event::Duration GetDrainDuration() const noexcept {
+		return drained - fed;
+	}
+
+	Event::Duration GetTotalDuration() const noexcept {
+		return drained - start;
+	}
+
+	unsigned long GetRequestCount() const noexcept {
+		unsigned long n = 0;
+		for (const auto *i : targets)
+			n += i->GetRequestCount();
+		return n;
+	}
+
+private:
+	void Feed(unsigned i) noexcept;
+
+	void OnFeedTimer() noexcept;
+	void OnCheckTimer() noexcept;
+
+	void OnTimeout() noexcept {
+		drained = event_loop.SteadyNow();
+		event_loop.Break();
+	}
+};
+
+inline void
+LoadReplay::Feed(unsigned i) noexcept
+{
+	const auto file = "song" + std::to_string(i) + ".flac";
+
+	Record record;
+	record.artist = "Artist " + std::to_string(i % 50);
+	record.track = "Track " + std::to_string(i);
+	record.album = "Album " + std::to_string(i % 200);
+	record.number = TrackNumber{std::to_string(i % 12 + 1)};
+	record.length = std::chrono::seconds{200};
+
+	if (options.now_playing)
+		scrobblers.NowPlaying(targets, Record{record});
+
+	scrobblers.SongChange(targets, file.c_str(), std::move(record));
+}
+
+void
+LoadReplay::OnFeedTimer() noexcept
+{
+	const auto now = event_loop.SteadyNow();
+	const double elapsed = std::chrono::duration<double>(now - start).count();
+	const unsigned due = std::min<double>(options.n_songs,
+					      elapsed * options.rate + 1);
+
+	while (n_fed < due)
+		Feed(n_fed++);
+
+	if (n_fed < options.n_songs)
+		feed_timer.Schedule(FEED_INTERVAL);
+	else
+		fed = now;
+}
+
+void
+LoadReplay::OnCheckTimer() noexcept
+{
+	if (n_fed == options.n_songs && scrobblers.GetMaxQueueLength() == 0) {
+		is_drained = true;
+		drained = event_loop.SteadyNow();
+		event_loop.Break();
+		return;
+	}
+
+	check_timer.Schedule(CHECK_INTERVAL);
+}
+
+static long
+GetPeakRSS() noexcept
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return -1;
+
+	/* kilobytes on Linux */
+	return usage.ru_maxrss;
+}
+
+static double
+ToMilliseconds(Event::Duration d) noexcept
+{
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int
+main(int argc, char **argv)
+try {
+	const auto options = ParseCommandLine(argc, argv);
+
+	log_init("-", options.verbose);
+
+	if (options.serve) {
+		EventLoop event_loop;
+		MockScrobblerServer server(event_loop, options.server);
+		printf("%s\n", server.GetURL().c_str());
+		fflush(stdout);
+		event_loop.Run();
+		return EXIT_SUCCESS;
+	}
+
+	MockServerThread server_thread(options.server);
+	const auto &server = server_thread.GetServer();
+	const auto url = server.GetURL();
+
+	std::forward_list<ScrobblerConfig> configs;
+	for (unsigned i = 0; i < options.n_scrobblers; ++i) {
+		auto &config = configs.emplace_front();
+		config.name = "mock" + std::to_string(i);
+		config.url = url;
+		config.username = "user" + std::to_string(i);
+		config.password = "secret";
+	}
+
+	bool drained;
+
+	{
+		EventLoop event_loop;
+		CurlGlobal curl_global(event_loop, nullptr, options.throttle);
+		AsyncWriter writer(event_loop);
+
+		std::vector<std::unique_ptr<ScrobblerWorker>> workers;
+		std::vector<ScrobblerWorker *> worker_pointers;
+		for (unsigned i = 0; i < options.n_workers; ++i) {
+			workers.emplace_back(std::make_unique<ScrobblerWorker>(nullptr,
+									       curl_global.GetThrottle().GetBudget()));
+			worker_pointers.push_back(workers.back().get());
+		}
+
+		MultiScrobbler scrobblers(configs, event_loop,
+					  curl_global, writer, nullptr,
+					  std::move(worker_pointers));
+
+		LoadReplay replay(event_loop, scrobblers, options);
+		replay.Start();
+		event_loop.Run();
+
+		/* the scrobblers in the workers must not be accessed
+		   while they run */
+		const ScopePauseWorkers pause{workers};
+
+		server_thread.Stop();
+
+		drained = replay.IsDrained();
+
+		const auto &stats = server.stats;
+		printf("{\"scrobblers\":%u,\"workers\":%u,\"songs\":%u,\"rate\":%u,"
+		       "\"latency_ms\":%u,\"drained\":%s,"
+		       "\"feed_ms\":%.1f,\"drain_ms\":%.1f,\"total_ms\":%.1f,"
+		       "\"requests\":%lu,\"server_requests\":%lu,"
+		       "\"connections\":%lu,\"handshakes\":%lu,"
+		       "\"now_playing\":%lu,\"submissions\":%lu,"
+		       "\"songs_accepted\":%lu,"
+		       "\"failed\":%lu,\"badsession\":%lu,\"rate_limited\":%lu,"
+		       "\"bytes_received\":%lu,\"bytes_sent\":%lu,"
+		       "\"peak_rss_kb\":%ld}\n",
+		       options.n_scrobblers, options.n_workers,
+		       options.n_songs, options.rate,
+		       unsigned(options.server.latency.count()),
+		       drained ? "true" : "false",
+		       ToMilliseconds(replay.GetFeedDuration()),
+		       ToMilliseconds(replay.GetDrainDuration()),
+		       ToMilliseconds(replay.GetTotalDuration()),
+		       replay.GetRequestCount(),
+		       (unsigned long)stats.requests,
+		       (unsigned long)stats.connections,
+		       (unsigned long)stats.handshakes,
+		       (unsigned long)stats.now_playing,
+		       (unsigned long)stats.submissions,
+		       (unsigned long)stats.songs,
+		       (unsigned long)stats.failed,
+		       (unsigned long)stats.badsession,
+		       (unsigned long)stats.rate_limited,
+		       (unsigned long)stats.bytes_received,
+		       (unsigned long)stats.bytes_sent,
+		       GetPeakRSS());
+	}
+
+	log_deinit();
+
+	return drained ? EXIT_SUCCESS : EXIT_FAILURE;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}